@@ -0,0 +1,89 @@
+/*
+ * array.c
+ *
+ * Reference-counted, copy-on-write arrays of doubles
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "array.h"
+
+struct _array
+{
+  int refs;         // accessed atomically
+  size_t n;
+  double data[];
+};
+
+// Documented in .h file
+Array AR_new(size_t n)
+{
+  Array a = malloc(sizeof(struct _array) + n * sizeof(double));
+  assert(a);
+  a->refs = 1;
+  a->n = n;
+  return a;
+}
+
+// Documented in .h file
+Array AR_from(const double *data, size_t n)
+{
+  Array a = AR_new(n);
+  if (n > 0)
+    memcpy(a->data, data, n * sizeof(double));
+  return a;
+}
+
+// Documented in .h file
+Array AR_retain(Array a)
+{
+  if (a)
+    __atomic_add_fetch(&a->refs, 1, __ATOMIC_RELAXED);
+  return a;
+}
+
+// Documented in .h file
+void AR_release(Array a)
+{
+  if (a && __atomic_sub_fetch(&a->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(a);
+}
+
+// Documented in .h file
+size_t AR_length(Array a)
+{
+  assert(a);
+  return a->n;
+}
+
+// Documented in .h file
+int AR_refs(Array a)
+{
+  assert(a);
+  return __atomic_load_n(&a->refs, __ATOMIC_ACQUIRE);
+}
+
+// Documented in .h file
+const double *AR_data(Array a)
+{
+  assert(a);
+  return a->data;
+}
+
+// Documented in .h file
+double *AR_mutable(Array *a)
+{
+  assert(a && *a);
+
+  if (AR_refs(*a) > 1)
+  {
+    Array copy = AR_from((*a)->data, (*a)->n);
+    AR_release(*a);
+    *a = copy;
+  }
+  return (*a)->data;
+}
@@ -0,0 +1,115 @@
+/*
+ * array.h
+ *
+ * Reference-counted arrays of doubles, the values of array variables
+ * such as v in
+ *
+ *   v = [1, 2, 3]
+ *   w = v * 2
+ *
+ * An array is shared, not copied, when it is assigned to another
+ * variable or passed to a function: each holder owns one reference.
+ * A holder that wants to modify an array calls AR_mutable, which
+ * copies it first if anyone else holds a reference (copy-on-write),
+ * so no holder sees another's changes. The element-wise operators use
+ * this to compute into the buffer of an operand that nothing else
+ * holds, such as the intermediate result of a larger expression.
+ *
+ * Reference counts are updated atomically, so arrays may be shared
+ * between threads; their elements may be written only through
+ * AR_mutable.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _ARRAY_H_
+#define _ARRAY_H_
+
+#include <stddef.h>
+
+typedef struct _array *Array;
+
+
+/*
+ * Create an array of n elements, holding one reference to it. The
+ * elements are not initialized.
+ *
+ * Parameters:
+ *   n        The number of elements; may be 0
+ *
+ * Returns: The new array. It is up to the caller to call AR_release.
+ */
+Array AR_new(size_t n);
+
+
+/*
+ * Create an array holding a copy of n doubles
+ *
+ * Parameters:
+ *   data     The elements
+ *   n        The number of elements
+ *
+ * Returns: The new array. It is up to the caller to call AR_release.
+ */
+Array AR_from(const double *data, size_t n);
+
+
+/*
+ * Take another reference to an array
+ *
+ * Parameters:
+ *   a        The array; may be NULL
+ *
+ * Returns: a
+ */
+Array AR_retain(Array a);
+
+
+/*
+ * Give up a reference to an array, freeing it if it was the last
+ *
+ * Parameters:
+ *   a        The array; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void AR_release(Array a);
+
+
+/*
+ * Return the number of elements of an array
+ */
+size_t AR_length(Array a);
+
+
+/*
+ * Return the number of references held to an array
+ */
+int AR_refs(Array a);
+
+
+/*
+ * Return the elements of an array, for reading
+ *
+ * Parameters:
+ *   a        The array
+ *
+ * Returns: The elements, valid while the caller holds its reference
+ */
+const double *AR_data(Array a);
+
+
+/*
+ * Return the elements of an array for writing. If other references
+ * are held to *a, the caller's reference is exchanged for one to a
+ * private copy, which replaces *a.
+ *
+ * Parameters:
+ *   a        Points to the array, to which the caller holds a reference
+ *
+ * Returns: The elements of *a
+ */
+double *AR_mutable(Array *a);
+
+
+#endif /* _ARRAY_H_ */
@@ -0,0 +1,309 @@
+/*
+ * array_ops.c
+ *
+ * Element-wise operators on arrays, with broadcasting
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "array_ops.h"
+#include "fastmath.h"
+
+// The most elements handed to a builtin's batch implementation at once
+#define AO_CHUNK (1 << 20)
+
+static ETNumber _AO_nan(void)
+{
+  return (ETNumber){.is_int = false, .d = NAN};
+}
+
+static ETNumber _AO_array(Array a)
+{
+  return (ETNumber){.is_int = false, .d = NAN, .array = a};
+}
+
+/*
+ * The value of a number, or of an array of one element, that is
+ * broadcast over the other operands
+ */
+static double _AO_scalar(ETNumber num)
+{
+  if (num.array)
+    return AR_data(num.array)[0];
+  return num.is_int ? (double)num.i : num.d;
+}
+
+// Is num an array that is not broadcast?
+static bool _AO_full(ETNumber num)
+{
+  return num.array && AR_length(num.array) != 1;
+}
+
+static void _AO_release(ETNumber *nums, int count)
+{
+  for (int i = 0; i < count; i++)
+    AR_release(nums[i].array);
+}
+
+/*
+ * Find the length of the result of an operation on nums, at least one
+ * of which is an array
+ *
+ * Returns: true, with the length in *n, unless two arrays that are
+ *   not broadcast differ in length
+ */
+static bool _AO_length(const ETNumber *nums, int count, size_t *n, char *errmsg, size_t errmsg_sz)
+{
+  bool found = false;
+  *n = 1;
+
+  for (int i = 0; i < count; i++)
+  {
+    if (!_AO_full(nums[i]))
+      continue;
+    size_t len = AR_length(nums[i].array);
+    if (found && len != *n)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: Array lengths differ: %zu and %zu", *n, len);
+      return false;
+    }
+    *n = len;
+    found = true;
+  }
+  return true;
+}
+
+/*
+ * Turn num into an array of n elements, consuming its reference. An
+ * array of that length is kept (made private to the caller if
+ * writable); a number or one-element array is broadcast into a new one.
+ */
+static Array _AO_broadcast(ETNumber num, size_t n, bool writable)
+{
+  if (num.array && AR_length(num.array) == n)
+  {
+    if (writable)
+      AR_mutable(&num.array);
+    return num.array;
+  }
+
+  double k = _AO_scalar(num);
+  AR_release(num.array);
+  Array a = AR_new(n);
+  double *restrict data = AR_mutable(&a);
+  for (size_t i = 0; i < n; i++)
+    data[i] = k;
+  return a;
+}
+
+/*
+ * The kernel _AO_<name> of one binary operator, computing d[i] from
+ * a and b with expr. An operand is either the array x (or y) or, if
+ * that is NULL, the number xk (or yk). d may be x or y.
+ */
+#define AO_KERNEL(name, expr)                                           \
+  FM_CLONES static size_t _AO_##name(double *d, const double *x, double xk, \
+                                     const double *y, double yk, size_t n) \
+  {                                                                     \
+    size_t zeros = 0;                                                   \
+    if (x && y)                                                         \
+      for (size_t i = 0; i < n; i++)                                    \
+      {                                                                 \
+        double a = x[i], b = y[i];                                      \
+        d[i] = (expr);                                                  \
+      }                                                                 \
+    else if (x)                                                         \
+      for (size_t i = 0; i < n; i++)                                    \
+      {                                                                 \
+        double a = x[i], b = yk;                                        \
+        d[i] = (expr);                                                  \
+      }                                                                 \
+    else                                                                \
+      for (size_t i = 0; i < n; i++)                                    \
+      {                                                                 \
+        double a = xk, b = y[i];                                        \
+        d[i] = (expr);                                                  \
+      }                                                                 \
+    return zeros;                                                       \
+  }
+
+AO_KERNEL(add, a + b)
+AO_KERNEL(sub, a - b)
+AO_KERNEL(mul, a * b)
+AO_KERNEL(div, (zeros += (b == 0), b == 0 ? NAN : a / b))
+AO_KERNEL(power, pow(a, b))
+AO_KERNEL(negate, ((void)b, -a))
+// NaN has no truth value, so comparisons and logic on it give NaN; &&
+// and || look at b only where a does not decide
+AO_KERNEL(lt, (a != a) | (b != b) ? NAN : a < b)
+AO_KERNEL(le, (a != a) | (b != b) ? NAN : a <= b)
+AO_KERNEL(gt, (a != a) | (b != b) ? NAN : a > b)
+AO_KERNEL(ge, (a != a) | (b != b) ? NAN : a >= b)
+AO_KERNEL(eq, (a != a) | (b != b) ? NAN : a == b)
+AO_KERNEL(ne, (a != a) | (b != b) ? NAN : a != b)
+AO_KERNEL(and, a != a ? a : a == 0 ? 0 : b != b ? b : b != 0)
+AO_KERNEL(or, a != a ? a : a != 0 ? 1 : b != b ? b : b != 0)
+
+typedef size_t (*AOKernel)(double *d, const double *x, double xk, const double *y, double yk,
+                           size_t n);
+
+static AOKernel _AO_kernel(ExprNodeType op)
+{
+  switch (op)
+  {
+  case OP_ADD:
+    return _AO_add;
+  case OP_SUB:
+    return _AO_sub;
+  case OP_MUL:
+    return _AO_mul;
+  case OP_DIV:
+    return _AO_div;
+  case OP_POWER:
+    return _AO_power;
+  case UNARY_NEGATE:
+    return _AO_negate;
+  case OP_LT:
+    return _AO_lt;
+  case OP_LE:
+    return _AO_le;
+  case OP_GT:
+    return _AO_gt;
+  case OP_GE:
+    return _AO_ge;
+  case OP_EQ:
+    return _AO_eq;
+  case OP_NE:
+    return _AO_ne;
+  case OP_AND:
+    return _AO_and;
+  case OP_OR:
+    return _AO_or;
+  default:
+    return NULL;
+  }
+}
+
+// Documented in .h file
+ETNumber AO_apply(ExprNodeType op, ETNumber left, ETNumber right, char *errmsg, size_t errmsg_sz)
+{
+  ETNumber operand[2] = {left, right};
+  int count = op == UNARY_NEGATE ? 1 : 2;
+  AOKernel kernel = _AO_kernel(op);
+  size_t n;
+
+  if (kernel == NULL)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Invalid operator");
+    _AO_release(operand, 2);
+    return _AO_nan();
+  }
+  if (!_AO_length(operand, count, &n, errmsg, errmsg_sz))
+  {
+    _AO_release(operand, 2);
+    return _AO_nan();
+  }
+
+  // The operands that are arrays of the result's length; the others
+  // are broadcast
+  bool full[2];
+  for (int i = 0; i < 2; i++)
+    full[i] = i < count && operand[i].array && AR_length(operand[i].array) == n;
+
+  // Compute into an operand that only we hold, if there is one; it is
+  // then read from the result itself
+  Array result = NULL;
+  int taken = -1;
+  for (int i = 0; i < count && result == NULL; i++)
+    if (full[i] && AR_refs(operand[i].array) == 1)
+    {
+      result = operand[i].array;
+      operand[i].array = NULL;
+      taken = i;
+    }
+  if (result == NULL)
+    result = AR_new(n);
+
+  double *d = AR_mutable(&result);
+  const double *x = full[0] ? (taken == 0 ? d : AR_data(operand[0].array)) : NULL;
+  const double *y = full[1] ? (taken == 1 ? d : AR_data(operand[1].array)) : NULL;
+  size_t zeros = kernel(d, x, x ? 0 : _AO_scalar(operand[0]), y,
+                        y ? 0 : _AO_scalar(operand[1]), n);
+
+  if (zeros > 0)
+    snprintf(errmsg, errmsg_sz, "Error: Division by zero");
+
+  _AO_release(operand, 2);
+  return _AO_array(result);
+}
+
+// Documented in .h file
+ETNumber AO_select(ETNumber cond, ETNumber a, ETNumber b, char *errmsg, size_t errmsg_sz)
+{
+  ETNumber operand[3] = {cond, a, b};
+  size_t n;
+
+  if (!_AO_length(operand, 3, &n, errmsg, errmsg_sz))
+  {
+    _AO_release(operand, 3);
+    return _AO_nan();
+  }
+
+  Array result = _AO_broadcast(a, n, true);
+  Array c = _AO_broadcast(cond, n, false);
+  Array other = _AO_broadcast(b, n, false);
+
+  double *restrict d = AR_mutable(&result);
+  const double *restrict cd = AR_data(c);
+  const double *restrict od = AR_data(other);
+  for (size_t i = 0; i < n; i++)
+    d[i] = cd[i] != cd[i] ? cd[i] : cd[i] != 0 ? d[i] : od[i];
+
+  AR_release(c);
+  AR_release(other);
+  return _AO_array(result);
+}
+
+// Documented in .h file
+ETNumber AO_call(const Builtin *fn, ETNumber *args, char *errmsg, size_t errmsg_sz)
+{
+  size_t n;
+
+  if (fn->reduce)
+  {
+    double value = args[0].array ? fn->reduce(AR_data(args[0].array), AR_length(args[0].array))
+                                 : fn->scalar((double[]){_AO_scalar(args[0])});
+    AR_release(args[0].array);
+    return (ETNumber){.is_int = false, .d = value};
+  }
+
+  if (!_AO_length(args, fn->num_args, &n, errmsg, errmsg_sz))
+  {
+    _AO_release(args, fn->num_args);
+    return _AO_nan();
+  }
+
+  // The batch implementation overwrites its first argument column
+  Array col[BI_MAX_ARGS];
+  double *data[BI_MAX_ARGS];
+  for (int i = 0; i < fn->num_args; i++)
+  {
+    col[i] = _AO_broadcast(args[i], n, i == 0);
+    data[i] = i == 0 ? AR_mutable(&col[i]) : (double *)AR_data(col[i]);
+  }
+
+  for (size_t start = 0; start < n; start += AO_CHUNK)
+  {
+    double *chunk[BI_MAX_ARGS];
+    for (int i = 0; i < fn->num_args; i++)
+      chunk[i] = data[i] + start;
+    fn->batch(chunk, n - start < AO_CHUNK ? (int)(n - start) : AO_CHUNK, false);
+  }
+
+  for (int i = 1; i < fn->num_args; i++)
+    AR_release(col[i]);
+  return _AO_array(col[0]);
+}
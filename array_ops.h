@@ -0,0 +1,71 @@
+/*
+ * array_ops.h
+ *
+ * The element-wise operators on arrays, used by ET_evaluate_number
+ * when an operand is an array.
+ *
+ * Operands broadcast: a number, or an array of one element, is
+ * applied to every element of the other operand, and two longer
+ * arrays must be the same length. Each element is computed exactly as
+ * ET_apply computes a number, except that an element divided by zero
+ * becomes NaN, with the usual error reported once for the array.
+ *
+ * The loops are written to be vectorized. Each function consumes the
+ * references held by its operands, and computes into the buffer of an
+ * operand that nothing else holds a reference to, when there is one
+ * of the right length, rather than allocating another.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _ARRAY_OPS_H_
+#define _ARRAY_OPS_H_
+
+#include "expr_tree.h"
+
+
+/*
+ * Apply an operator element by element
+ *
+ * Parameters:
+ *   op         As for ET_apply; OP_AND and OP_OR take both operands
+ *              as already computed
+ *   left       The left operand
+ *   right      The right operand, ignored for UNARY_NEGATE
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The array result, or NaN with an error message if the
+ *   operands' lengths differ
+ */
+ETNumber AO_apply(ExprNodeType op, ETNumber left, ETNumber right, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Select element by element: where cond is true (nonzero), the
+ * element of a, where it is NaN, NaN, and elsewhere that of b
+ *
+ * Returns: The array result, or NaN with an error message if the
+ *   operands' lengths differ
+ */
+ETNumber AO_select(ETNumber cond, ETNumber a, ETNumber b, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Call a builtin on arguments of which some are arrays. A reduction
+ * combines its array into a number; any other builtin is applied
+ * element by element through its batch implementation.
+ *
+ * Parameters:
+ *   fn         The builtin
+ *   args       Its fn->num_args arguments
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The result, or NaN with an error message if the arguments'
+ *   lengths differ
+ */
+ETNumber AO_call(const Builtin *fn, ETNumber *args, char *errmsg, size_t errmsg_sz);
+
+
+#endif /* _ARRAY_OPS_H_ */
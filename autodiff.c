@@ -0,0 +1,382 @@
+/*
+ * autodiff.c
+ *
+ * Forward- and reverse-mode automatic differentiation of ExprTrees
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "autodiff.h"
+#include "functions.h"
+
+// One operation on the tape: its result depends on the results of up
+// to two earlier entries (or -1), with these partial derivatives
+typedef struct
+{
+  int parent[2];
+  double partial[2];
+} ADEntry;
+
+// A value during evaluation. In reverse mode, node is its entry on
+// the tape, or -1 if it does not depend on any of the variables; in
+// forward mode, dot is its derivative.
+typedef struct
+{
+  double v;
+  double dot;
+  int node;
+} ADValue;
+
+// The indexes of the ranges being evaluated, innermost first
+typedef struct _ad_index
+{
+  double value;
+  const struct _ad_index *outer;
+} ADIndex;
+
+// A variable assigned during evaluation, with its value
+typedef struct
+{
+  const char *name;
+  ADValue value;
+} ADAssigned;
+
+typedef struct
+{
+  CDict vars;
+  const char *const *names;
+  int num_names;
+  const double *direction;  // forward mode; NULL in reverse mode
+  int *leaf;                // reverse mode: each name's entry, once read
+
+  ADEntry *tape;
+  int tape_len;
+  int tape_cap;
+
+  ADAssigned *assigned;
+  int num_assigned;
+  int assigned_cap;
+
+  bool failed;
+  char *errmsg;
+  size_t errmsg_sz;
+} ADContext;
+
+static ADValue _AD_const(double v)
+{
+  return (ADValue){.v = v, .dot = 0, .node = -1};
+}
+
+static ADValue _AD_error(ADContext *ad)
+{
+  ad->failed = true;
+  return _AD_const(NAN);
+}
+
+// Append an entry to the tape, returning its number
+static int _AD_record(ADContext *ad, int parent0, double partial0, int parent1, double partial1)
+{
+  if (ad->tape_len == ad->tape_cap)
+  {
+    ad->tape_cap = ad->tape_cap ? 2 * ad->tape_cap : 64;
+    ad->tape = realloc(ad->tape, ad->tape_cap * sizeof(ADEntry));
+    assert(ad->tape);
+  }
+  ad->tape[ad->tape_len] = (ADEntry){{parent0, parent1}, {partial0, partial1}};
+  return ad->tape_len++;
+}
+
+/*
+ * The value v computed from a and b, whose partial derivatives with
+ * respect to them are pa and pb. A derivative with respect to an
+ * operand that does not vary is not used, so it may be NaN.
+ */
+static ADValue _AD_combine(ADContext *ad, double v, ADValue a, double pa, ADValue b, double pb)
+{
+  if (ad->direction)
+  {
+    double dot = (a.dot != 0 ? pa * a.dot : 0) + (b.dot != 0 ? pb * b.dot : 0);
+    return (ADValue){.v = v, .dot = dot, .node = -1};
+  }
+  if (a.node < 0 && b.node < 0)
+    return _AD_const(v);
+  return (ADValue){.v = v, .dot = 0, .node = _AD_record(ad, a.node, pa, b.node, pb)};
+}
+
+// The value of a variable, not assigned within the expression
+static ADValue _AD_variable(ADContext *ad, const char *name)
+{
+  double v = CD_retrieve(ad->vars, name);
+  if (isnan(v))
+  {
+    if (CD_retrieve_array(ad->vars, name))
+      snprintf(ad->errmsg, ad->errmsg_sz, "Error: Arrays cannot be differentiated");
+    else
+      snprintf(ad->errmsg, ad->errmsg_sz, "Undefined variable: %s", name);
+    return _AD_error(ad);
+  }
+
+  for (int k = 0; k < ad->num_names; k++)
+    if (strcmp(ad->names[k], name) == 0)
+    {
+      if (ad->direction)
+        return (ADValue){.v = v, .dot = ad->direction[k], .node = -1};
+      if (ad->leaf[k] < 0)
+        ad->leaf[k] = _AD_record(ad, -1, 0, -1, 0);
+      return (ADValue){.v = v, .dot = 0, .node = ad->leaf[k]};
+    }
+
+  return _AD_const(v);
+}
+
+static void _AD_assign(ADContext *ad, const char *name, ADValue value)
+{
+  CD_store(ad->vars, name, value.v);
+
+  for (int i = 0; i < ad->num_assigned; i++)
+    if (strcmp(ad->assigned[i].name, name) == 0)
+    {
+      ad->assigned[i].value = value;
+      return;
+    }
+
+  if (ad->num_assigned == ad->assigned_cap)
+  {
+    ad->assigned_cap = ad->assigned_cap ? 2 * ad->assigned_cap : 8;
+    ad->assigned = realloc(ad->assigned, ad->assigned_cap * sizeof(ADAssigned));
+    assert(ad->assigned);
+  }
+  ad->assigned[ad->num_assigned++] = (ADAssigned){name, value};
+}
+
+/*
+ * Evaluate tree, within the body of a user-defined function whose
+ * arguments are frame and of the ranges whose indexes are ranges, at
+ * call depth depth
+ */
+static ADValue _AD_eval(ADContext *ad, ExprTree tree, const ADValue *frame,
+                        const ADIndex *ranges, int depth)
+{
+  if (tree == NULL || ad->failed)
+    return _AD_const(ad->failed ? NAN : 0);
+
+  ExprNodeType type = ET_type(tree);
+
+  switch (type)
+  {
+  case VALUE:
+    return _AD_const(ET_get_value(tree));
+
+  case SYMBOL:
+    for (int i = 0; i < ad->num_assigned; i++)
+      if (strcmp(ad->assigned[i].name, ET_symbol_name(tree)) == 0)
+        return ad->assigned[i].value;
+    return _AD_variable(ad, ET_symbol_name(tree));
+
+  case PARAM:
+    return frame[ET_param_index(tree)];
+
+  case RANGE_INDEX:
+  {
+    const ADIndex *range = ranges;
+    for (int level = 0; level < ET_index_level(tree); level++)
+      range = range->outer;
+    return _AD_const(range->value);
+  }
+
+  case OP_ASSIGN:
+  {
+    ADValue value = _AD_eval(ad, ET_child(tree, 1), frame, ranges, depth);
+    if (!ad->failed)
+      _AD_assign(ad, ET_symbol_name(ET_child(tree, 0)), value);
+    return value;
+  }
+
+  case OP_AND:
+  case OP_OR:
+  {
+    double left = _AD_eval(ad, ET_child(tree, 0), frame, ranges, depth).v;
+    if (isnan(left) || (left != 0) == (type == OP_OR))
+      return _AD_const(isnan(left) ? NAN : left != 0);
+    double right = _AD_eval(ad, ET_child(tree, 1), frame, ranges, depth).v;
+    return _AD_const(isnan(right) ? NAN : right != 0);
+  }
+
+  case OP_COND:
+  {
+    ExprTree branches = ET_child(tree, 1);
+    double cond = _AD_eval(ad, ET_child(tree, 0), frame, ranges, depth).v;
+    if (isnan(cond))
+      return _AD_const(NAN);
+    return _AD_eval(ad, ET_child(branches, cond != 0 ? 0 : 1), frame, ranges, depth);
+  }
+
+  case FUNC_CALL:
+  {
+    const Builtin *fn = ET_call_function(tree);
+    ADValue arg[BI_MAX_ARGS] = {_AD_const(0), _AD_const(0)};
+    double args[BI_MAX_ARGS], d[BI_MAX_ARGS] = {0};
+    for (int i = 0; i < fn->num_args; i++)
+    {
+      arg[i] = _AD_eval(ad, ET_arg(tree, i), frame, ranges, depth);
+      args[i] = arg[i].v;
+    }
+    fn->partials(args, d);
+    return _AD_combine(ad, fn->scalar(args), arg[0], d[0], arg[1], d[1]);
+  }
+
+  case USER_CALL:
+  {
+    const UserFunc *fn = ET_user_function(tree);
+    if (fn == NULL)
+    {
+      snprintf(ad->errmsg, ad->errmsg_sz, "Unknown function: %s", ET_call_name(tree));
+      return _AD_error(ad);
+    }
+    if (depth == ET_MAX_CALL_DEPTH)
+    {
+      snprintf(ad->errmsg, ad->errmsg_sz, "Error: Recursion too deep in %s", fn->name);
+      return _AD_error(ad);
+    }
+
+    ADValue args[ET_MAX_ARGS];
+    for (int i = 0; i < ET_num_args(tree); i++)
+      args[i] = _AD_eval(ad, ET_arg(tree, i), frame, ranges, depth);
+    return _AD_eval(ad, fn->body, args, NULL, depth + 1);
+  }
+
+  case RANGE_SUM:
+  case RANGE_PROD:
+  {
+    double lo = _AD_eval(ad, ET_arg(tree, 0), frame, ranges, depth).v;
+    double hi = _AD_eval(ad, ET_arg(tree, 1), frame, ranges, depth).v;
+    if (ad->failed)
+      return _AD_error(ad);
+    if (lo != trunc(lo) || hi != trunc(hi))
+    {
+      snprintf(ad->errmsg, ad->errmsg_sz, "Error: Bounds of %s must be integers",
+               ET_call_name(tree));
+      return _AD_error(ad);
+    }
+
+    bool product = type == RANGE_PROD;
+    ADValue acc = _AD_const(product ? 1 : 0);
+    for (ADIndex index = {lo, ranges}; index.value <= hi && !ad->failed; index.value++)
+    {
+      ADValue term = _AD_eval(ad, ET_arg(tree, 2), frame, &index, depth);
+      if (product)
+        acc = _AD_combine(ad, acc.v * term.v, acc, term.v, term, acc.v);
+      else
+        acc = _AD_combine(ad, acc.v + term.v, acc, 1, term, 1);
+    }
+    return acc;
+  }
+
+  case ARRAY_LITERAL:
+    snprintf(ad->errmsg, ad->errmsg_sz, "Error: Arrays cannot be differentiated");
+    return _AD_error(ad);
+
+  case FUNC_DEF:
+    snprintf(ad->errmsg, ad->errmsg_sz, "Error: Function definition within an expression");
+    return _AD_error(ad);
+
+  default:
+    break;
+  }
+
+  ADValue a = _AD_eval(ad, ET_child(tree, 0), frame, ranges, depth);
+  ADValue b = _AD_eval(ad, ET_child(tree, 1), frame, ranges, depth);
+  double v = ET_apply(type, a.v, b.v, ad->errmsg, ad->errmsg_sz);
+  if (ad->failed)
+    return _AD_error(ad);
+
+  switch (type)
+  {
+  case OP_ADD:
+    return _AD_combine(ad, v, a, 1, b, 1);
+  case OP_SUB:
+    return _AD_combine(ad, v, a, 1, b, -1);
+  case OP_MUL:
+    return _AD_combine(ad, v, a, b.v, b, a.v);
+  case OP_DIV:
+    if (b.v == 0)
+      return _AD_error(ad); // ET_apply has reported it
+    return _AD_combine(ad, v, a, 1 / b.v, b, -v / b.v);
+  case UNARY_NEGATE:
+    return _AD_combine(ad, v, a, -1, b, 0);
+  case OP_POWER:
+  {
+    // d/da a^b = b a^(b-1); d/db a^b = a^b ln a, needed only if b varies
+    bool b_varies = b.node >= 0 || b.dot != 0;
+    return _AD_combine(ad, v, a, b.v == 0 ? 0 : b.v * pow(a.v, b.v - 1), b,
+                       b_varies ? v * log(a.v) : 0);
+  }
+  default:
+    // comparisons, whose results do not vary
+    return _AD_const(v);
+  }
+}
+
+static void _AD_free(ADContext *ad)
+{
+  free(ad->tape);
+  free(ad->assigned);
+  free(ad->leaf);
+}
+
+// Documented in .h file
+double ET_gradient(ExprTree tree, CDict vars, const char *const *names, int num_names,
+                   double *grad, char *errmsg, size_t errmsg_sz)
+{
+  ADContext ad = {.vars = vars, .names = names, .num_names = num_names,
+                  .errmsg = errmsg, .errmsg_sz = errmsg_sz};
+  ad.leaf = malloc(num_names * sizeof(int) + 1);
+  assert(ad.leaf);
+  for (int k = 0; k < num_names; k++)
+    ad.leaf[k] = -1;
+
+  ADValue result = _AD_eval(&ad, tree, NULL, NULL, 0);
+
+  // the sweep back: each entry's adjoint, the derivative of the result
+  // with respect to it, is complete before it is passed to its parents
+  double *adjoint = calloc(ad.tape_len + 1, sizeof(double));
+  assert(adjoint);
+  if (result.node >= 0)
+    adjoint[result.node] = 1;
+  for (int i = result.node; i >= 0; i--)
+  {
+    if (adjoint[i] == 0)
+      continue;
+    for (int j = 0; j < 2; j++)
+      if (ad.tape[i].parent[j] >= 0)
+        adjoint[ad.tape[i].parent[j]] += ad.tape[i].partial[j] * adjoint[i];
+  }
+
+  for (int k = 0; k < num_names; k++)
+    grad[k] = ad.failed ? NAN : ad.leaf[k] >= 0 ? adjoint[ad.leaf[k]] : 0;
+
+  free(adjoint);
+  _AD_free(&ad);
+  return ad.failed ? NAN : result.v;
+}
+
+// Documented in .h file
+double ET_directional(ExprTree tree, CDict vars, const char *const *names,
+                      const double *direction, int num_names, double *derivative,
+                      char *errmsg, size_t errmsg_sz)
+{
+  ADContext ad = {.vars = vars, .names = names, .num_names = num_names,
+                  .direction = direction, .errmsg = errmsg, .errmsg_sz = errmsg_sz};
+
+  ADValue result = _AD_eval(&ad, tree, NULL, NULL, 0);
+  *derivative = ad.failed ? NAN : result.dot;
+
+  _AD_free(&ad);
+  return ad.failed ? NAN : result.v;
+}
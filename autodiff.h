@@ -0,0 +1,80 @@
+/*
+ * autodiff.h
+ *
+ * Automatic differentiation of expressions: the derivatives of the
+ * value that ET_evaluate computes with respect to chosen variables,
+ * exact to rounding, without the 2N evaluations of finite differences.
+ *
+ * ET_gradient runs in reverse mode. It evaluates the tree once,
+ * recording each operation on a variable-dependent value, with its
+ * partial derivatives, on a tape; one sweep back over the tape then
+ * gives the derivative with respect to every variable at once. Its
+ * cost is a small multiple of one evaluation, whatever the number of
+ * variables. ET_directional runs in forward mode, carrying a dual
+ * number (value and derivative) through a single evaluation, and gives
+ * the derivative in one direction without a tape.
+ *
+ * Both compute in doubles, as EW_execute does, and accept everything
+ * ET_evaluate does except arrays. Assignments are stored in vars, and
+ * a variable assigned within the expression carries the derivative of
+ * its value to where it is read. Comparisons and logical operators
+ * have derivative 0; a conditional has the derivative of the branch
+ * taken, as do abs, min and max where they have none (see builtins.h).
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _AUTODIFF_H_
+#define _AUTODIFF_H_
+
+#include "expr_tree.h"
+
+
+/*
+ * Evaluate an expression and its gradient by reverse-mode automatic
+ * differentiation
+ *
+ * Parameters:
+ *   tree       The expression
+ *   vars       The variables, which may be modified by assignments
+ *   names      The variables to differentiate with respect to
+ *   num_names  The number of names
+ *   grad       Return space for num_names partial derivatives, grad[k]
+ *              being that with respect to names[k]; 0 for a variable
+ *              the value does not depend on
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The value of the expression. If an error is encountered,
+ *   copies an error message into errmsg and returns NaN, with the
+ *   gradient NaN too.
+ */
+double ET_gradient(ExprTree tree, CDict vars, const char *const *names, int num_names,
+                   double *grad, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Evaluate an expression and its derivative in one direction by
+ * forward-mode automatic differentiation
+ *
+ * Parameters:
+ *   tree        The expression
+ *   vars        The variables, which may be modified by assignments
+ *   names       The variables that the direction moves
+ *   direction   The rate of change of each of them
+ *   num_names   The number of names
+ *   derivative  Return space for the directional derivative, the sum
+ *               over k of direction[k] times the partial derivative
+ *               with respect to names[k]
+ *   errmsg      Return space for an error message, filled in in case of error
+ *   errmsg_sz   The size of errmsg
+ *
+ * Returns: The value of the expression, or NaN (with the derivative
+ *   NaN) and an error message on error
+ */
+double ET_directional(ExprTree tree, CDict vars, const char *const *names,
+                      const double *direction, int num_names, double *derivative,
+                      char *errmsg, size_t errmsg_sz);
+
+
+#endif /* _AUTODIFF_H_ */
@@ -0,0 +1,648 @@
+/*
+ * batch.c
+ *
+ * Batch processing of expressions: a pipeline of splitting, parsing
+ * and evaluating threads, connected by bounded queues, with independent
+ * lines computed at once
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "tokenize.h"
+#include "parse.h"
+#include "array.h"
+
+// A variable that a line reads or assigns
+typedef struct
+{
+  const char *name;   // owned by the line's tree
+  bool assigned;
+} BTSymbol;
+
+// What the pipeline keeps of each line besides the BTLine
+typedef struct
+{
+  int first_symbol, num_symbols;
+  int level;          // its depth in the order of its segment, from 1
+} BTDeps;
+
+typedef struct
+{
+  const char *text;   // whole lines of the input
+  size_t len;
+  char *buffer;       // holding text, when read from a stream
+  BTLine *line;       // the lines to evaluate
+  BTDeps *deps;
+  int num_lines, max_lines;
+  BTSymbol *symbol;   // the variables of all the lines
+  int num_symbols, max_symbols;
+  bool parsed;        // under the pipeline's lock
+} BTChunk;
+
+// A bounded queue of chunks; a NULL chunk marks the end of the input
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full;
+  BTChunk *item[BT_QUEUE_CHUNKS];
+  int head, count;
+} BTQueue;
+
+typedef struct
+{
+  FILE *in;
+  const BTConfig *config;
+  int threads;
+  BTQueue to_parse;   // chunks for the parsing threads
+  BTQueue ordered;    // every chunk, in input order, for the evaluator
+  long number;        // the lines split so far
+
+  // a mapped file: the mapping, its size, the start of the next chunk
+  // and the end of the pages released
+  char *map;
+  size_t size, pos, released;
+
+  // a stream: the partial line read after the last chunk
+  char *carry;
+  size_t carry_len;
+
+  // the lines of one level being computed, each with its variables,
+  // and the chunks being parsed
+  pthread_mutex_t lock;
+  pthread_cond_t parsed, work, done;
+  BTLine **job_line;
+  CDict *job_vars;
+  int job_size, job_next, job_done;
+  bool quit;
+} BTPipeline;
+
+static void _BT_queue_init(BTQueue *q)
+{
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+  q->head = q->count = 0;
+}
+
+static void _BT_queue_destroy(BTQueue *q)
+{
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_cond_destroy(&q->not_full);
+}
+
+// Add a chunk, waiting while the queue is full
+static void _BT_push(BTQueue *q, BTChunk *chunk)
+{
+  pthread_mutex_lock(&q->lock);
+  while (q->count == BT_QUEUE_CHUNKS)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  q->item[(q->head + q->count++) % BT_QUEUE_CHUNKS] = chunk;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// Take the oldest chunk, waiting while the queue is empty
+static BTChunk *_BT_pop(BTQueue *q)
+{
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  BTChunk *chunk = q->item[q->head];
+  q->head = (q->head + 1) % BT_QUEUE_CHUNKS;
+  q->count--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return chunk;
+}
+
+// Map the rest of the input if it is a regular file, which is then read
+// front to back; otherwise it is read as a stream
+static void _BT_map(BTPipeline *pl)
+{
+  struct stat st;
+  off_t start = ftello(pl->in);
+  if (start < 0 || fstat(fileno(pl->in), &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size <= start)
+    return;
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(pl->in), 0);
+  if (map == MAP_FAILED)
+    return;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  pl->map = map;
+  pl->size = st.st_size;
+  pl->pos = start;
+}
+
+// Release the mapped pages that lie wholly before end, whose lines have
+// all been evaluated
+static void _BT_release(BTPipeline *pl, const char *end)
+{
+  static long page_size = 0;
+  if (page_size == 0)
+    page_size = sysconf(_SC_PAGESIZE);
+
+  size_t upto = (end - pl->map) / page_size * page_size;
+  if (upto > pl->released)
+  {
+    madvise(pl->map + pl->released, upto - pl->released, MADV_DONTNEED);
+    pl->released = upto;
+  }
+}
+
+static BTChunk *_BT_chunk_new(const char *text, size_t len, char *buffer)
+{
+  BTChunk *chunk = malloc(sizeof(BTChunk));
+  assert(chunk);
+  chunk->text = text;
+  chunk->len = len;
+  chunk->buffer = buffer;
+  chunk->max_lines = len / 16 + 16;
+  chunk->num_lines = 0;
+  chunk->line = malloc(chunk->max_lines * sizeof(BTLine));
+  chunk->deps = malloc(chunk->max_lines * sizeof(BTDeps));
+  chunk->max_symbols = chunk->max_lines * 4;
+  chunk->num_symbols = 0;
+  chunk->symbol = malloc(chunk->max_symbols * sizeof(BTSymbol));
+  assert(chunk->line && chunk->deps && chunk->symbol);
+  chunk->parsed = false;
+  return chunk;
+}
+
+static void _BT_chunk_free(BTChunk *chunk)
+{
+  free(chunk->line);
+  free(chunk->deps);
+  free(chunk->symbol);
+  free(chunk->buffer);
+  free(chunk);
+}
+
+// Read the next chunk of a stream: a buffer's worth, up to its last
+// newline, the partial line after which is carried to the next chunk;
+// returns NULL at the end of the stream
+static BTChunk *_BT_read(BTPipeline *pl)
+{
+  size_t cap = BT_CHUNK_BYTES, len = pl->carry_len, keep;
+  while (cap < 2 * len)
+    cap *= 2;
+  char *buffer = malloc(cap);
+  assert(buffer);
+  memcpy(buffer, pl->carry, len);
+
+  for (;;)
+  {
+    size_t got;
+    while (len < cap && (got = fread(buffer + len, 1, cap - len, pl->in)) > 0)
+      len += got;
+    if (len < cap)
+    {
+      keep = len;   // the end of the stream
+      break;
+    }
+    keep = len;
+    while (keep > 0 && buffer[keep - 1] != '\n')
+      keep--;
+    if (keep > 0)
+      break;
+
+    // a line longer than the buffer
+    cap *= 2;
+    buffer = realloc(buffer, cap);
+    assert(buffer);
+  }
+
+  pl->carry_len = len - keep;
+  pl->carry = realloc(pl->carry, pl->carry_len + 1);
+  assert(pl->carry);
+  memcpy(pl->carry, buffer + keep, pl->carry_len);
+
+  if (keep == 0)
+  {
+    free(buffer);
+    return NULL;
+  }
+  return _BT_chunk_new(buffer, keep, buffer);
+}
+
+// The next chunk of the input, or NULL at its end
+static BTChunk *_BT_next_chunk(BTPipeline *pl)
+{
+  if (pl->map == NULL)
+    return _BT_read(pl);
+  if (pl->pos == pl->size)
+    return NULL;
+
+  size_t end = pl->pos + BT_CHUNK_BYTES;
+  if (end >= pl->size)
+    end = pl->size;
+  else
+  {
+    const char *newline = memchr(pl->map + end, '\n', pl->size - end);
+    end = newline ? newline + 1 - pl->map : pl->size;
+  }
+  BTChunk *chunk = _BT_chunk_new(pl->map + pl->pos, end - pl->pos, NULL);
+  pl->pos = end;
+  return chunk;
+}
+
+// Split a chunk into lines, skipping blank lines and comments
+static void _BT_split(BTPipeline *pl, BTChunk *chunk)
+{
+  const char *p = chunk->text, *end = chunk->text + chunk->len;
+
+  while (p < end)
+  {
+    const char *newline = memchr(p, '\n', end - p);
+    const char *eol = newline ? newline : end;
+    const char *start = p;
+    pl->number++;
+    while (eol > p && eol[-1] == '\r')
+      eol--;
+    while (start < eol && (*start == ' ' || *start == '\t'))
+      start++;
+    if (start == eol || *start == '#')
+    {
+      p = newline ? newline + 1 : end;
+      continue;
+    }
+
+    if (chunk->num_lines == chunk->max_lines)
+    {
+      chunk->max_lines *= 2;
+      chunk->line = realloc(chunk->line, chunk->max_lines * sizeof(BTLine));
+      chunk->deps = realloc(chunk->deps, chunk->max_lines * sizeof(BTDeps));
+      assert(chunk->line && chunk->deps);
+    }
+    chunk->line[chunk->num_lines++] = (BTLine){.number = pl->number, .text = p, .len = eol - p};
+    p = newline ? newline + 1 : end;
+  }
+}
+
+// The first stage: split the input into chunks of lines
+static void *_BT_splitter(void *arg)
+{
+  BTPipeline *pl = arg;
+  BTChunk *chunk;
+
+  while ((chunk = _BT_next_chunk(pl)) != NULL)
+  {
+    _BT_split(pl, chunk);
+    _BT_push(&pl->ordered, chunk);
+    _BT_push(&pl->to_parse, chunk);
+  }
+  _BT_push(&pl->ordered, NULL);
+  for (int t = 0; t < pl->threads; t++)
+    _BT_push(&pl->to_parse, NULL);
+  return NULL;
+}
+
+static void _BT_symbol(const char *symbol, bool assigned, void *cb_data)
+{
+  BTChunk *chunk = cb_data;
+  if (chunk->num_symbols == chunk->max_symbols)
+  {
+    chunk->max_symbols *= 2;
+    chunk->symbol = realloc(chunk->symbol, chunk->max_symbols * sizeof(BTSymbol));
+    assert(chunk->symbol);
+  }
+  chunk->symbol[chunk->num_symbols++] = (BTSymbol){symbol, assigned};
+}
+
+// The second stage, on each of the pool's threads: tokenize and parse
+// chunks, and list the variables of each line
+static void *_BT_parser(void *arg)
+{
+  BTPipeline *pl = arg;
+  BTChunk *chunk;
+
+  while ((chunk = _BT_pop(&pl->to_parse)) != NULL)
+  {
+    for (int i = 0; i < chunk->num_lines; i++)
+    {
+      BTLine *line = &chunk->line[i];
+      BTDeps *deps = &chunk->deps[i];
+      if (pl->config->is_command(line->text, line->len))
+      {
+        line->command = strndup(line->text, line->len);
+        assert(line->command);
+      }
+      else
+      {
+        line->tokens = TOK_tokenize_span(line->text, line->len, line->errmsg,
+                                         sizeof(line->errmsg));
+        if (line->tokens)
+          line->tree = Parse(line->tokens, line->errmsg, sizeof(line->errmsg));
+        CL_free(line->tokens);
+        line->tokens = NULL;
+      }
+      deps->first_symbol = chunk->num_symbols;
+      ET_foreach_symbol(line->tree, _BT_symbol, chunk);
+      deps->num_symbols = chunk->num_symbols - deps->first_symbol;
+    }
+
+    pthread_mutex_lock(&pl->lock);
+    chunk->parsed = true;
+    pthread_cond_broadcast(&pl->parsed);
+    pthread_mutex_unlock(&pl->lock);
+  }
+  return NULL;
+}
+
+// Compute the lines of the current level until none is left
+static void _BT_work(BTPipeline *pl)
+{
+  pthread_mutex_lock(&pl->lock);
+  while (pl->job_next < pl->job_size)
+  {
+    int i = pl->job_next++;
+    pthread_mutex_unlock(&pl->lock);
+    pl->config->compute(pl->job_line[i], pl->job_vars[i], pl->config->cb_data);
+    pthread_mutex_lock(&pl->lock);
+    if (++pl->job_done == pl->job_size)
+      pthread_cond_signal(&pl->done);
+  }
+  pthread_mutex_unlock(&pl->lock);
+}
+
+// A thread of the pool that helps the evaluator compute levels
+static void *_BT_helper(void *arg)
+{
+  BTPipeline *pl = arg;
+
+  pthread_mutex_lock(&pl->lock);
+  while (!pl->quit)
+  {
+    if (pl->job_next < pl->job_size)
+    {
+      pthread_mutex_unlock(&pl->lock);
+      _BT_work(pl);
+      pthread_mutex_lock(&pl->lock);
+    }
+    else
+      pthread_cond_wait(&pl->work, &pl->lock);
+  }
+  pthread_mutex_unlock(&pl->lock);
+  return NULL;
+}
+
+// Can a line be computed, its effects being known from its tree?
+static bool _BT_computable(const BTConfig *config, const BTLine *line)
+{
+  return config->compute && line->tree && ET_type(line->tree) != FUNC_DEF &&
+         !ET_has_unbound_call(line->tree);
+}
+
+// Compute one line against the shared variables
+static void _BT_compute(BTPipeline *pl, BTLine *line)
+{
+  pl->config->compute(line, pl->config->vars, pl->config->cb_data);
+  line->computed = true;
+}
+
+// Copy a variable from one dictionary to another, if it has a value
+static void _BT_copy(CDict from, CDict to, const char *name)
+{
+  Array a = CD_retrieve_array(from, name);
+  if (a)
+    CD_store_array(to, name, a);
+  else if (CD_contains(from, name))
+    CD_store(to, name, CD_retrieve(from, name));
+}
+
+/*
+ * Compute the lines of one level, which are independent of one another,
+ * at once: each against a copy of the variables it reads, whose
+ * assignments are copied back in line order afterward
+ */
+static void _BT_compute_level(BTPipeline *pl, BTChunk *chunk, const int *order, int n)
+{
+  CDict vars = pl->config->vars;
+  if (n == 1)
+  {
+    _BT_compute(pl, &chunk->line[order[0]]);
+    return;
+  }
+
+  BTLine *line[n];
+  CDict private[n];
+  unsigned long clock[n];
+  for (int k = 0; k < n; k++)
+  {
+    BTDeps *deps = &chunk->deps[order[k]];
+    line[k] = &chunk->line[order[k]];
+    private[k] = CD_new();
+    for (int s = deps->first_symbol; s < deps->first_symbol + deps->num_symbols; s++)
+      if (!chunk->symbol[s].assigned)
+        _BT_copy(vars, private[k], chunk->symbol[s].name);
+    clock[k] = CD_clock(private[k]);
+  }
+
+  pthread_mutex_lock(&pl->lock);
+  pl->job_line = line;
+  pl->job_vars = private;
+  pl->job_next = pl->job_done = 0;
+  pl->job_size = n;
+  pthread_cond_broadcast(&pl->work);
+  pthread_mutex_unlock(&pl->lock);
+
+  _BT_work(pl);
+
+  pthread_mutex_lock(&pl->lock);
+  while (pl->job_done < n)
+    pthread_cond_wait(&pl->done, &pl->lock);
+  pl->job_size = pl->job_next = pl->job_done = 0;
+  pthread_mutex_unlock(&pl->lock);
+
+  for (int k = 0; k < n; k++)
+  {
+    BTDeps *deps = &chunk->deps[order[k]];
+    for (int s = deps->first_symbol; s < deps->first_symbol + deps->num_symbols; s++)
+    {
+      const char *name = chunk->symbol[s].name;
+      if (chunk->symbol[s].assigned && CD_version(private[k], name) > clock[k])
+        _BT_copy(private[k], vars, name);
+    }
+    line[k]->computed = true;
+    CD_free(private[k]);
+  }
+}
+
+/*
+ * Compute the computable lines from first up to end, which hold no
+ * barrier, in the order of the variables they read and assign
+ */
+static void _BT_compute_segment(BTPipeline *pl, BTChunk *chunk, int first, int end)
+{
+  if (pl->threads == 1)
+  {
+    for (int i = first; i < end; i++)
+      if (_BT_computable(pl->config, &chunk->line[i]))
+        _BT_compute(pl, &chunk->line[i]);
+    return;
+  }
+
+  // a line's level is one more than that of the last line to assign a
+  // variable it reads or assigns, and than that of every line reading a
+  // variable it assigns
+  CDict written = CD_new(), read = CD_new();
+  int max_level = 0, num_computable = 0;
+  for (int i = first; i < end; i++)
+  {
+    BTDeps *deps = &chunk->deps[i];
+    if (!_BT_computable(pl->config, &chunk->line[i]))
+    {
+      deps->level = 0;
+      continue;
+    }
+    BTSymbol *symbol = &chunk->symbol[deps->first_symbol];
+    int level = 1;
+    for (int s = 0; s < deps->num_symbols; s++)
+    {
+      if (CD_contains(written, symbol[s].name) && CD_retrieve(written, symbol[s].name) >= level)
+        level = CD_retrieve(written, symbol[s].name) + 1;
+      if (symbol[s].assigned && CD_contains(read, symbol[s].name) &&
+          CD_retrieve(read, symbol[s].name) >= level)
+        level = CD_retrieve(read, symbol[s].name) + 1;
+    }
+    for (int s = 0; s < deps->num_symbols; s++)
+    {
+      if (symbol[s].assigned)
+        CD_store(written, symbol[s].name, level);
+      else if (!CD_contains(read, symbol[s].name) || CD_retrieve(read, symbol[s].name) < level)
+        CD_store(read, symbol[s].name, level);
+    }
+    deps->level = level;
+    if (level > max_level)
+      max_level = level;
+    num_computable++;
+  }
+  CD_free(written);
+  CD_free(read);
+
+  // the lines sorted by level, keeping input order within a level
+  int count[max_level + 2], order[num_computable + 1];
+  memset(count, 0, sizeof(count));
+  for (int i = first; i < end; i++)
+    if (chunk->deps[i].level > 0)
+      count[chunk->deps[i].level + 1]++;
+  for (int l = 1; l <= max_level; l++)
+    count[l + 1] += count[l];
+  for (int i = first; i < end; i++)
+    if (chunk->deps[i].level > 0)
+      order[count[chunk->deps[i].level]++] = i;
+
+  // count[l] is now the end of level l in order
+  for (int l = 1, start = 0; l <= max_level; start = count[l++])
+    _BT_compute_level(pl, chunk, order + start, count[l] - start);
+}
+
+// Report a line, and free what it holds
+static void _BT_report(BTPipeline *pl, BTLine *line)
+{
+  pl->config->evaluate(line, pl->config->cb_data);
+  AR_release(line->result.array);
+  ET_free(line->tree);
+  free(line->command);
+}
+
+// The last stage: evaluate a chunk, segment by segment
+static void _BT_evaluate(BTPipeline *pl, BTChunk *chunk)
+{
+  int first = 0;
+  for (int i = 0; i <= chunk->num_lines; i++)
+  {
+    BTLine *line = i < chunk->num_lines ? &chunk->line[i] : NULL;
+    if (line && !line->command && (line->tree == NULL || _BT_computable(pl->config, line)))
+      continue;
+
+    // the lines before the barrier, then the barrier
+    _BT_compute_segment(pl, chunk, first, i);
+    for (int j = first; j < i; j++)
+      _BT_report(pl, &chunk->line[j]);
+    if (line)
+      _BT_report(pl, line);
+    first = i + 1;
+  }
+}
+
+// Documented in .h file
+long BT_run(FILE *in, const BTConfig *config)
+{
+  static long cpus = 0;
+  if (cpus == 0)
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  BTPipeline pl = {.in = in, .config = config, .threads = config->threads};
+  if (pl.threads <= 0)
+    pl.threads = cpus < 1 ? 1 : (int)cpus;
+  if (pl.threads > BT_MAX_THREADS)
+    pl.threads = BT_MAX_THREADS;
+
+  pthread_t splitter, parser[BT_MAX_THREADS], helper[BT_MAX_THREADS];
+  long lines = 0;
+
+  _BT_map(&pl);
+  _BT_queue_init(&pl.to_parse);
+  _BT_queue_init(&pl.ordered);
+  pthread_mutex_init(&pl.lock, NULL);
+  pthread_cond_init(&pl.parsed, NULL);
+  pthread_cond_init(&pl.work, NULL);
+  pthread_cond_init(&pl.done, NULL);
+  bool started = pthread_create(&splitter, NULL, _BT_splitter, &pl) == 0;
+  for (int t = 0; t < pl.threads; t++)
+    started = started && pthread_create(&parser[t], NULL, _BT_parser, &pl) == 0;
+  for (int t = 0; t < pl.threads - 1; t++)
+    started = started && pthread_create(&helper[t], NULL, _BT_helper, &pl) == 0;
+  assert(started);
+
+  BTChunk *chunk;
+  while ((chunk = _BT_pop(&pl.ordered)) != NULL)
+  {
+    pthread_mutex_lock(&pl.lock);
+    while (!chunk->parsed)
+      pthread_cond_wait(&pl.parsed, &pl.lock);
+    pthread_mutex_unlock(&pl.lock);
+
+    _BT_evaluate(&pl, chunk);
+    lines += chunk->num_lines;
+    if (pl.map)
+      _BT_release(&pl, chunk->text + chunk->len);
+    _BT_chunk_free(chunk);
+  }
+
+  pthread_mutex_lock(&pl.lock);
+  pl.quit = true;
+  pthread_cond_broadcast(&pl.work);
+  pthread_mutex_unlock(&pl.lock);
+  pthread_join(splitter, NULL);
+  for (int t = 0; t < pl.threads; t++)
+    pthread_join(parser[t], NULL);
+  for (int t = 0; t < pl.threads - 1; t++)
+    pthread_join(helper[t], NULL);
+
+  _BT_queue_destroy(&pl.to_parse);
+  _BT_queue_destroy(&pl.ordered);
+  pthread_mutex_destroy(&pl.lock);
+  pthread_cond_destroy(&pl.parsed);
+  pthread_cond_destroy(&pl.work);
+  pthread_cond_destroy(&pl.done);
+  if (pl.map)
+  {
+    munmap(pl.map, pl.size);
+    fseeko(in, pl.size, SEEK_SET);
+  }
+  free(pl.carry);
+  return lines;
+}
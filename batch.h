@@ -0,0 +1,108 @@
+/*
+ * batch.h
+ *
+ * Batch processing of a file of expressions, one per line, as a
+ * pipeline: one thread splits the input into chunks of lines, about
+ * BT_CHUNK_BYTES each; a pool of threads tokenizes and parses chunks at
+ * once; and the calling thread evaluates them in input order. The
+ * queues between the stages hold at most BT_QUEUE_CHUNKS chunks, so that
+ * a fast stage waits for a slow one rather than reading the whole file
+ * ahead of it.
+ *
+ * A regular file is mapped into memory rather than read, and its lines
+ * are tokenized where they lie in the mapping: no line is copied, save
+ * the rare command. Pages are released once the lines on them have
+ * been evaluated, so a file of any size is processed in the memory of
+ * a few chunks. Other input, such as a pipe, is read a chunk at a time
+ * into a buffer that the chunk's lines point into.
+ *
+ * Within a chunk, the lines between one barrier and the next (a
+ * command, a function definition, or a line calling a user-defined
+ * function, none of whose effects can be told from its tree) are
+ * ordered by the variables they read and assign: a line comes after
+ * any earlier line that assigns a variable it reads or assigns, or
+ * that reads a variable it assigns. Lines at the same depth of that
+ * order are independent, and are computed at once on the pool's
+ * threads, each against a private copy of the variables it reads,
+ * whose assignments are copied back once they are all done. Results
+ * are therefore those of running the lines one after another, and are
+ * reported in input order.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdio.h>
+
+#include "cdict.h"
+#include "clist.h"
+#include "expr_tree.h"
+
+// The input passed from stage to stage at once, in bytes; a chunk
+// holds whole lines, so it is longer by the rest of its last line
+#define BT_CHUNK_BYTES (16 * 1024)
+
+// The chunks a queue between stages holds before its producer waits
+#define BT_QUEUE_CHUNKS 4
+
+// The most threads parsing or computing lines
+#define BT_MAX_THREADS 8
+
+typedef struct
+{
+  long number;        // its line number in the input, from 1
+  const char *text;   // the line, where it lies in the input; it is not
+  size_t len;         // terminated, and len excludes its newline
+  char *command;      // a terminated copy of a command's text, or NULL
+  CList tokens;       // while it is parsed
+  ExprTree tree;      // the parsed line, or NULL for a command or on error
+  bool computed;      // whether result and errmsg hold its value
+  ETNumber result;    // its value, if computed; the pipeline releases
+                      // its array after reporting it
+  char errmsg[128];   // the error tokenizing, parsing or computing it
+} BTLine;
+
+// Is a line, of len characters and not terminated, a command, to be
+// evaluated from its text? Called on any of the parsing threads.
+typedef bool (*BT_command_fn)(const char *text, size_t len);
+
+// Compute a parsed line's result, or the error in its errmsg, against
+// vars. Called on any of the pool's threads, at once for lines that are
+// independent; the tree has no function definition or unbound call.
+typedef void (*BT_compute_fn)(BTLine *line, CDict vars, void *cb_data);
+
+// Report a line, in input order on the calling thread, first running it
+// if it was not computed; its text and tree remain owned by the pipeline
+typedef void (*BT_evaluate_fn)(const BTLine *line, void *cb_data);
+
+typedef struct
+{
+  BT_command_fn is_command;   // picks out the lines that are commands
+  BT_compute_fn compute;      // NULL to run every line with evaluate
+  BT_evaluate_fn evaluate;    // called on every line
+  CDict vars;                 // the variables that compute reads and assigns
+  int threads;                // 0 for one per CPU, up to BT_MAX_THREADS
+  void *cb_data;              // caller data to pass to the functions
+} BTConfig;
+
+
+/*
+ * Run a file through the pipeline. Blank lines, and lines whose first
+ * character other than blanks is '#', are skipped.
+ *
+ * Each line is passed in order to evaluate: with a command's terminated
+ * text; or, parsed, with its result if it was computed, or to be run
+ * if not; or with the error tokenizing or parsing it in its errmsg.
+ *
+ * Parameters:
+ *   in          The file, from its current position
+ *   config      The functions to call, and their data
+ *
+ * Returns: The number of lines evaluated
+ */
+long BT_run(FILE *in, const BTConfig *config);
+
+
+#endif /* _BATCH_H_ */
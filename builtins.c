@@ -0,0 +1,226 @@
+/*
+ * builtins.c
+ *
+ * The built-in functions, with their scalar and batch implementations
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "builtins.h"
+#include "fastmath.h"
+
+// min and max give NaN if either argument is NaN, so that a row that
+// failed earlier stays failed. Macros, so that the batch loops using
+// them vectorize.
+#define BI_MIN(x, y) ((((x) < (y)) | ((x) != (x))) ? (x) : (y))
+#define BI_MAX(x, y) ((((x) > (y)) | ((x) != (x))) ? (x) : (y))
+
+/*
+ * One builtin of one argument: its scalar function _BI_<name> and
+ * batch kernels _BI_<name>_d and _BI_<name>_f, which compute
+ * expr_d and expr_f respectively from x
+ */
+#define BI_UNARY(name, expr_d, expr_f)                                  \
+  static double _BI_##name(const double *args)                          \
+  {                                                                     \
+    double x = args[0];                                                 \
+    return (expr_d);                                                    \
+  }                                                                     \
+  FM_CLONES static void _BI_##name##_d(double *const *args, int m, bool relaxed) \
+  {                                                                     \
+    double *restrict col = args[0];                                     \
+    for (int i = 0; i < m; i++)                                         \
+    {                                                                   \
+      double x = col[i];                                                \
+      col[i] = (expr_d);                                                \
+    }                                                                   \
+  }                                                                     \
+  FM_CLONES static void _BI_##name##_f(float *const *args, int m, bool relaxed) \
+  {                                                                     \
+    float *restrict col = args[0];                                      \
+    for (int i = 0; i < m; i++)                                         \
+    {                                                                   \
+      float x = col[i];                                                 \
+      col[i] = (expr_f);                                                \
+    }                                                                   \
+  }
+
+// As BI_UNARY, for two arguments x and y
+#define BI_BINARY(name, expr_d, expr_f)                                 \
+  static double _BI_##name(const double *args)                          \
+  {                                                                     \
+    double x = args[0], y = args[1];                                    \
+    return (expr_d);                                                    \
+  }                                                                     \
+  FM_CLONES static void _BI_##name##_d(double *const *args, int m, bool relaxed) \
+  {                                                                     \
+    double *restrict col = args[0];                                     \
+    const double *restrict col_y = args[1];                             \
+    for (int i = 0; i < m; i++)                                         \
+    {                                                                   \
+      double x = col[i], y = col_y[i];                                  \
+      col[i] = (expr_d);                                                \
+    }                                                                   \
+  }                                                                     \
+  FM_CLONES static void _BI_##name##_f(float *const *args, int m, bool relaxed) \
+  {                                                                     \
+    float *restrict col = args[0];                                      \
+    const float *restrict col_y = args[1];                              \
+    for (int i = 0; i < m; i++)                                         \
+    {                                                                   \
+      float x = col[i], y = col_y[i];                                   \
+      col[i] = (expr_f);                                                \
+    }                                                                   \
+  }
+
+BI_UNARY(sqrt, sqrt(x), sqrtf(x))
+BI_UNARY(sin, sin(x), sinf(x))
+BI_UNARY(cos, cos(x), cosf(x))
+BI_UNARY(abs, fabs(x), fabsf(x))
+BI_BINARY(min, BI_MIN(x, y), BI_MIN(x, y))
+BI_BINARY(max, BI_MAX(x, y), BI_MAX(x, y))
+
+/*
+ * log and exp, whose batch kernels use the fastmath.h versions when
+ * relaxed. The relaxed log handles only positive, normal, finite
+ * arguments, so a block with any other falls back on libm.
+ */
+#define BI_LOG_EXP(T, SUFFIX, LOG, EXP, FM_LOG, FM_EXP, FM_LOG_ORDINARY) \
+  FM_CLONES static void _BI_log_##SUFFIX(T *const *args, int m, bool relaxed) \
+  {                                                                     \
+    T *restrict col = args[0];                                          \
+    T outside = 0;                                                      \
+    if (relaxed)                                                        \
+      for (int i = 0; i < m; i++)                                       \
+        outside += FM_LOG_ORDINARY(col[i]) ? 0 : 1;                     \
+                                                                        \
+    if (relaxed && outside == 0)                                        \
+      for (int i = 0; i < m; i++)                                       \
+        col[i] = FM_LOG(col[i]);                                        \
+    else                                                                \
+      for (int i = 0; i < m; i++)                                       \
+        col[i] = LOG(col[i]);                                           \
+  }                                                                     \
+  FM_CLONES static void _BI_exp_##SUFFIX(T *const *args, int m, bool relaxed) \
+  {                                                                     \
+    T *restrict col = args[0];                                          \
+    if (relaxed)                                                        \
+      for (int i = 0; i < m; i++)                                       \
+        col[i] = FM_EXP(col[i]);                                        \
+    else                                                                \
+      for (int i = 0; i < m; i++)                                       \
+        col[i] = EXP(col[i]);                                           \
+  }
+
+BI_LOG_EXP(double, d, log, exp, FM_log, FM_exp, FM_LOG_ORDINARY)
+BI_LOG_EXP(float, f, logf, expf, FM_logf, FM_expf, FM_LOGF_ORDINARY)
+
+static double _BI_log(const double *args) { return log(args[0]); }
+static double _BI_exp(const double *args) { return exp(args[0]); }
+
+// A reduction leaves a number unchanged
+static double _BI_identity(const double *args) { return args[0]; }
+static void _BI_identity_d(double *const *args, int m, bool relaxed) {}
+static void _BI_identity_f(float *const *args, int m, bool relaxed) {}
+
+// Lanes of independent accumulators in the reductions, so that the
+// loops vectorize without reassociating any one sum
+#define BI_LANES 8
+
+/*
+ * One reduction _BI_<name>_reduce, folding the elements into BI_LANES
+ * accumulators that start at identity with combine(acc, x), and then
+ * folding the accumulators together the same way. An empty array
+ * gives empty.
+ */
+#define BI_REDUCE(name, empty, identity, combine)                       \
+  FM_CLONES static double _BI_##name##_reduce(const double *x, size_t n) \
+  {                                                                     \
+    if (n == 0)                                                         \
+      return (empty);                                                   \
+    double acc[BI_LANES];                                               \
+    size_t i;                                                           \
+    for (int j = 0; j < BI_LANES; j++)                                  \
+      acc[j] = (identity);                                              \
+    for (i = 0; i + BI_LANES <= n; i += BI_LANES)                       \
+      for (int j = 0; j < BI_LANES; j++)                                \
+        acc[j] = combine(acc[j], x[i + j]);                             \
+    for (int j = 0; i < n; i++, j++)                                    \
+      acc[j] = combine(acc[j], x[i]);                                   \
+    for (int w = BI_LANES / 2; w > 0; w /= 2)                           \
+      for (int j = 0; j < w; j++)                                       \
+        acc[j] = combine(acc[j], acc[j + w]);                           \
+    return acc[0];                                                      \
+  }
+
+#define BI_ADD(x, y) ((x) + (y))
+
+BI_REDUCE(sum, 0.0, 0.0, BI_ADD)
+BI_REDUCE(min, NAN, INFINITY, BI_MIN)
+BI_REDUCE(max, NAN, -INFINITY, BI_MAX)
+
+static double _BI_mean_reduce(const double *x, size_t n)
+{
+  return n == 0 ? NAN : _BI_sum_reduce(x, n) / n;
+}
+
+// The partial derivatives, for automatic differentiation
+static void _BI_sqrt_partials(const double *args, double *d) { d[0] = 0.5 / sqrt(args[0]); }
+static void _BI_exp_partials(const double *args, double *d) { d[0] = exp(args[0]); }
+static void _BI_log_partials(const double *args, double *d) { d[0] = 1 / args[0]; }
+static void _BI_sin_partials(const double *args, double *d) { d[0] = cos(args[0]); }
+static void _BI_cos_partials(const double *args, double *d) { d[0] = -sin(args[0]); }
+static void _BI_identity_partials(const double *args, double *d) { d[0] = 1; }
+
+static void _BI_abs_partials(const double *args, double *d)
+{
+  d[0] = args[0] > 0 ? 1 : args[0] < 0 ? -1 : 0;
+}
+
+// as BI_MIN and BI_MAX choose
+static void _BI_min_partials(const double *args, double *d)
+{
+  d[0] = (args[0] < args[1]) | isnan(args[0]);
+  d[1] = 1 - d[0];
+}
+
+static void _BI_max_partials(const double *args, double *d)
+{
+  d[0] = (args[0] > args[1]) | isnan(args[0]);
+  d[1] = 1 - d[0];
+}
+
+#define BI_ENTRY(name, num_args) \
+  {#name, num_args, _BI_##name, _BI_##name##_d, _BI_##name##_f, NULL, _BI_##name##_partials}
+#define BI_REDUCTION(name) \
+  {#name, 1, _BI_identity, _BI_identity_d, _BI_identity_f, _BI_##name##_reduce, \
+   _BI_identity_partials}
+
+static const Builtin _BI_table[] = {
+  BI_ENTRY(sqrt, 1),
+  BI_ENTRY(exp, 1),
+  BI_ENTRY(log, 1),
+  BI_ENTRY(sin, 1),
+  BI_ENTRY(cos, 1),
+  BI_ENTRY(abs, 1),
+  BI_ENTRY(min, 2),
+  BI_ENTRY(max, 2),
+  BI_REDUCTION(sum),
+  BI_REDUCTION(mean),
+  BI_REDUCTION(min),
+  BI_REDUCTION(max),
+};
+
+// Documented in .h file
+const Builtin *BI_lookup(const char *name, int num_args)
+{
+  for (int i = 0; i < sizeof(_BI_table) / sizeof(_BI_table[0]); i++)
+    if (strcmp(_BI_table[i].name, name) == 0 &&
+        (num_args < 0 || _BI_table[i].num_args == num_args))
+      return &_BI_table[i];
+
+  return NULL;
+}
@@ -0,0 +1,72 @@
+/*
+ * builtins.h
+ *
+ * The built-in functions that expressions may call, such as sqrt(x)
+ * or max(a, b). The parser resolves each call to its Builtin when the
+ * tree is built, so evaluators call straight through the function
+ * pointers here without looking anything up by name.
+ *
+ * Every builtin has a scalar implementation, used by the tree-walking
+ * and single-row evaluators, and batch implementations for double and
+ * float, used by EW_execute_batch and EW_execute_batch_f32. The batch
+ * implementations are written to be vectorized; unless relaxed, they
+ * give exactly the scalar results.
+ *
+ * The reductions sum, mean, min and max of one argument combine the
+ * elements of an array (see array.h) into a number. Given a number,
+ * they return it unchanged, so the evaluators that know only numbers
+ * treat them as the identity.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _BUILTINS_H_
+#define _BUILTINS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The most arguments any builtin takes
+#define BI_MAX_ARGS 2
+
+typedef struct
+{
+  const char *name;
+  int num_args;
+
+  // Return the result for one set of arguments, args[0..num_args-1]
+  double (*scalar)(const double *args);
+
+  // Compute the result for rows 0..m-1 of the argument columns
+  // args[0..num_args-1], overwriting args[0] with it. If relaxed, the
+  // fastmath.h functions may be used in place of libm.
+  void (*batch)(double *const *args, int m, bool relaxed);
+  void (*batch_f32)(float *const *args, int m, bool relaxed);
+
+  // For a reduction, the result for the array x[0..n-1]; NaN if it is
+  // empty, except that the sum is 0. NULL for other builtins.
+  double (*reduce)(const double *x, size_t n);
+
+  // Set d[i] to the partial derivative of the scalar result with
+  // respect to args[i], at args. Where there is none (abs at 0, min
+  // and max of equal arguments), it is that of the argument chosen.
+  void (*partials)(const double *args, double *d);
+} Builtin;
+
+
+/*
+ * Find a builtin by name and number of arguments. min and max are
+ * each two builtins: the reduction of one argument, and the smaller or
+ * larger of two.
+ *
+ * Parameters:
+ *   name      The function name, as written in the expression
+ *   num_args  The number of arguments, or -1 for any
+ *
+ * Returns: The builtin, or NULL if there is none with that name
+ *   taking num_args arguments
+ */
+const Builtin *BI_lookup(const char *name, int num_args);
+
+
+#endif /* _BUILTINS_H_ */
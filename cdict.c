@@ -32,6 +32,8 @@ struct _hash_slot
   CDictSlotStatus status;
   CDictKeyType key;
   CDictValueType value;
+  Array array;                // the value instead, if not NULL
+  unsigned long version;
 };
 
 struct _dictionary
@@ -39,6 +41,7 @@ struct _dictionary
   unsigned int num_stored;
   unsigned int num_deleted;
   unsigned int capacity;
+  unsigned long clock;        // bumped on every store or delete
   struct _hash_slot *slot;
 };
 
@@ -88,13 +91,17 @@ static void _CD_rehash(CDict dict)
   unsigned int old_capacity = dict->capacity;
   dict->capacity = new_capacity;
 
-  // Reinsert elements from old slots into new slots
+  // Move elements from old slots into new slots. The keys are moved
+  // rather than copied, and each keeps its version.
   for (unsigned int i = 0; i < old_capacity; i++)
   {
     if (old_slots[i].status == SLOT_IN_USE)
     {
-      CD_store(dict, old_slots[i].key, old_slots[i].value);
-      free((void*)old_slots[i].key);
+      unsigned int probe = _CD_hash(old_slots[i].key, new_capacity);
+      while (dict->slot[probe].status != SLOT_UNUSED)
+        probe = (probe + 1) % new_capacity;
+      dict->slot[probe] = old_slots[i];
+      dict->num_stored++;
     }
   }
 
@@ -109,6 +116,7 @@ CDict CD_new()
   dict->num_stored = 0;
   dict->num_deleted = 0;
   dict->capacity = DEFAULT_DICT_CAPACITY;
+  dict->clock = 0;
   dict->slot = malloc(DEFAULT_DICT_CAPACITY * sizeof(struct _hash_slot));
 
   assert(dict->slot);
@@ -118,6 +126,8 @@ CDict CD_new()
     dict->slot[i].status = SLOT_UNUSED;
     dict->slot[i].key = "";
     dict->slot[i].value = 0.0;
+    dict->slot[i].array = NULL;
+    dict->slot[i].version = 0;
   }
 
   return dict;
@@ -131,6 +141,7 @@ void CD_free(CDict dict)
   for(int i = 0; i < dict->capacity; i++) {
     if(dict->slot[i].status == SLOT_IN_USE) {
       free((void*)dict->slot[i].key);
+      AR_release(dict->slot[i].array);
     }
   }
 
@@ -190,14 +201,15 @@ bool CD_contains(CDict dict, CDictKeyType key)
   return false;
 }
 
-void CD_store(CDict dict, CDictKeyType key, CDictValueType value)
+/*
+ * Store value, or array if it is not NULL, in key, taking a reference
+ * to the array
+ */
+static void _CD_store(CDict dict, CDictKeyType key, CDictValueType value, Array array)
 {
   assert(dict);
   assert(key);
-  assert(value);
 
-
-  printf("Storing key: %s with value: %.2f\n", key, value);  // Debug print
   unsigned int index = _CD_hash(key, dict->capacity);
 
   for (unsigned int i = 0; i < dict->capacity; i++)
@@ -208,7 +220,11 @@ void CD_store(CDict dict, CDictKeyType key, CDictValueType value)
     if (dict->slot[probe].status == SLOT_IN_USE &&
         strcmp(dict->slot[probe].key, key) == 0)
     {
+      AR_retain(array);
+      AR_release(dict->slot[probe].array);
       dict->slot[probe].value = value;
+      dict->slot[probe].array = array;
+      dict->slot[probe].version = ++dict->clock;
       return;
     }
     else if (dict->slot[probe].status != SLOT_UNUSED)
@@ -222,6 +238,8 @@ void CD_store(CDict dict, CDictKeyType key, CDictValueType value)
       dict->slot[probe].key = strdup(key);
       dict->num_stored++;
       dict->slot[probe].value = value;
+      dict->slot[probe].array = AR_retain(array);
+      dict->slot[probe].version = ++dict->clock;
 
       if (CD_load_factor(dict) > REHASH_THRESHOLD)
       {
@@ -232,6 +250,17 @@ void CD_store(CDict dict, CDictKeyType key, CDictValueType value)
   }
 }
 
+void CD_store(CDict dict, CDictKeyType key, CDictValueType value)
+{
+  _CD_store(dict, key, value, NULL);
+}
+
+void CD_store_array(CDict dict, CDictKeyType key, Array a)
+{
+  assert(a);
+  _CD_store(dict, key, INVALID_VALUE, a);
+}
+
 CDictValueType CD_retrieve(CDict dict, CDictKeyType key)
 {
   assert(dict);
@@ -254,6 +283,28 @@ CDictValueType CD_retrieve(CDict dict, CDictKeyType key)
   return NAN;
 }
 
+Array CD_retrieve_array(CDict dict, CDictKeyType key)
+{
+  assert(dict);
+  assert(key);
+
+  unsigned int index = _CD_hash(key, dict->capacity);
+  for (unsigned int i = 0; i < dict->capacity; i++)
+  {
+    unsigned int probe = (index + i) % dict->capacity;
+    if (dict->slot[probe].status == SLOT_UNUSED)
+    {
+      return NULL;
+    }
+    if (dict->slot[probe].status == SLOT_IN_USE &&
+        strcmp(dict->slot[probe].key, key) == 0)
+    {
+      return dict->slot[probe].array;
+    }
+  }
+  return NULL;
+}
+
 void CD_delete(CDict dict, CDictKeyType key)
 {
   assert(dict);
@@ -271,13 +322,46 @@ void CD_delete(CDict dict, CDictKeyType key)
         strcmp(dict->slot[probe].key, key) == 0)
     {
       dict->slot[probe].status = SLOT_DELETED;
+      free((void*)dict->slot[probe].key);
+      AR_release(dict->slot[probe].array);
+      dict->slot[probe].key = "";
+      dict->slot[probe].array = NULL;
       dict->num_stored--;
       dict->num_deleted++;
+      dict->clock++;
       return;
     }
   }
 }
 
+unsigned long CD_version(CDict dict, CDictKeyType key)
+{
+  assert(dict);
+  assert(key);
+
+  unsigned int index = _CD_hash(key, dict->capacity);
+  for (unsigned int i = 0; i < dict->capacity; i++)
+  {
+    unsigned int probe = (index + i) % dict->capacity;
+    if (dict->slot[probe].status == SLOT_UNUSED)
+    {
+      return 0;
+    }
+    if (dict->slot[probe].status == SLOT_IN_USE &&
+        strcmp(dict->slot[probe].key, key) == 0)
+    {
+      return dict->slot[probe].version;
+    }
+  }
+  return 0;
+}
+
+unsigned long CD_clock(CDict dict)
+{
+  assert(dict);
+  return dict->clock;
+}
+
 double CD_load_factor(CDict dict)
 {
   assert(dict);
@@ -292,7 +376,12 @@ void CD_print(CDict dict)
          dict->capacity, dict->num_stored, dict->num_deleted, CD_load_factor(dict));
   for (unsigned int i = 0; i < dict->capacity; i++)
   {
-    if (dict->slot[i].status == SLOT_IN_USE)
+    if (dict->slot[i].status == SLOT_IN_USE && dict->slot[i].array)
+    {
+      printf("Slot %u: key='%s', value=array of %zu\n", i + 1, dict->slot[i].key,
+             AR_length(dict->slot[i].array));
+    }
+    else if (dict->slot[i].status == SLOT_IN_USE)
     {
       printf("Slot %u: key='%s', value='%f'\n", i + 1, dict->slot[i].key, dict->slot[i].value);
     }
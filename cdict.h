@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <math.h>
+#include "array.h"
 
 typedef struct _dictionary *CDict;
 
@@ -109,6 +110,36 @@ void CD_store(CDict dict, CDictKeyType key, CDictValueType value);
 CDictValueType CD_retrieve(CDict dict, CDictKeyType key);
 
 
+/*
+ * Store an array as the value of a key, overwriting any value the key
+ * has. The dictionary takes its own reference to the array, so the
+ * array is shared rather than copied. While a key holds an array,
+ * CD_retrieve returns INVALID_VALUE for it; storing a number in the
+ * key releases the array.
+ *
+ * Parameters:
+ *   dict     The dictionary
+ *   key      The key
+ *   a        The array
+ *
+ * Returns: None
+ */
+void CD_store_array(CDict dict, CDictKeyType key, Array a);
+
+
+/*
+ * Find the array held by a key
+ *
+ * Parameters:
+ *   dict     The dictionary
+ *   key      The key
+ *
+ * Returns: The array, which remains owned by the dictionary (call
+ *   AR_retain to keep it), or NULL if key is not found or holds a number
+ */
+Array CD_retrieve_array(CDict dict, CDictKeyType key);
+
+
 /*
  * Delete a key from the dictionary
  *
@@ -121,6 +152,34 @@ CDictValueType CD_retrieve(CDict dict, CDictKeyType key);
 void CD_delete(CDict dict, CDictKeyType key);
 
 
+/*
+ * Return the version of a key. Every store to a key gives it a new
+ * version, greater than any version previously handed out by this
+ * dictionary, so a reader that remembers a key's version can later
+ * tell whether the value has changed.
+ *
+ * Parameters:
+ *   dict     The dictionary
+ *   key      The key
+ * 
+ * Returns: The key's version, or 0 if key is not in dict
+ */
+unsigned long CD_version(CDict dict, CDictKeyType key);
+
+
+/*
+ * Return the dictionary's modification clock, which advances on every
+ * store or delete. If the clock is unchanged, no value in the
+ * dictionary has changed.
+ *
+ * Parameters:
+ *   dict     The dictionary
+ * 
+ * Returns: The current clock value
+ */
+unsigned long CD_clock(CDict dict);
+
+
 /*
  * Return the load factor for the dictionary
  *
@@ -0,0 +1,689 @@
+/*
+ * closure.c
+ *
+ * Compile an ExprTree into a tree of pre-specialized closures
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "closure.h"
+#include "prepared.h"
+#include "functions.h"
+
+typedef struct
+{
+  double *values;
+  char **var_name;
+  char *errmsg;
+  size_t errmsg_sz;
+  const double *frame;       // the arguments of the current call
+  int depth;                 // ...and its depth
+} CCContext;
+
+typedef struct _cnode CNode;
+typedef double (*CCFunc)(const CNode *n, CCContext *ctx);
+
+/*
+ * A compiled node. Which operand fields are meaningful depends on fn:
+ * a node operand is called through a/b, a variable operand is read
+ * from slot sa/sb, and the (at most one) constant operand is k. A
+ * call node calls builtin f on its arguments a and b. A user call node
+ * runs the body b of function u on its sa arguments arg[]. A
+ * conditional node runs b or c according to a.
+ */
+struct _cnode
+{
+  CCFunc fn;
+  const CNode *a;
+  const CNode *b;
+  const CNode *c;
+  int sa;
+  int sb;
+  double k;
+  const Builtin *f;
+  const UserFunc *u;
+  const CNode **arg;
+};
+
+struct _closure
+{
+  CNode *node;               // all nodes, allocated as one block
+  int num_nodes;
+  const CNode **arg;         // the arguments of all user calls, likewise
+  int num_args;
+  const CNode *root;
+  char **var_name;
+  int num_vars;
+  int *check_slot;           // read-only slots, checked before execution
+  int num_check;
+};
+
+// Operand kinds, in table order
+enum { KIND_NODE, KIND_VAR, KIND_CONST };
+
+typedef struct
+{
+  int kind;
+  const CNode *node;
+  int slot;
+  double k;
+} Operand;
+
+/*
+ * The operators. Each is applied to already-computed operands.
+ */
+static inline double _CC_add(double l, double r, CCContext *ctx) { return l + r; }
+static inline double _CC_sub(double l, double r, CCContext *ctx) { return l - r; }
+static inline double _CC_mul(double l, double r, CCContext *ctx) { return l * r; }
+static inline double _CC_pow(double l, double r, CCContext *ctx) { return pow(l, r); }
+// NaN has no truth value, so a comparison with it is NaN
+#define CC_COMPARE(op, test)                                            \
+  static inline double _CC_##op(double l, double r, CCContext *ctx)     \
+  {                                                                     \
+    return isnan(l) || isnan(r) ? NAN : (test);                         \
+  }
+CC_COMPARE(lt, l < r)
+CC_COMPARE(le, l <= r)
+CC_COMPARE(gt, l > r)
+CC_COMPARE(ge, l >= r)
+CC_COMPARE(eq, l == r)
+CC_COMPARE(ne, l != r)
+static inline double _CC_div(double l, double r, CCContext *ctx)
+{
+  if (r == 0)
+  {
+    snprintf(ctx->errmsg, ctx->errmsg_sz, "Error: Division by zero");
+    return NAN;
+  }
+  return l / r;
+}
+
+#define LEFT_NODE   (n->a->fn(n->a, ctx))
+#define LEFT_VAR    (ctx->values[n->sa])
+#define LEFT_CONST  (n->k)
+#define RIGHT_NODE  (n->b->fn(n->b, ctx))
+#define RIGHT_VAR   (ctx->values[n->sb])
+#define RIGHT_CONST (n->k)
+
+// One specialized function for one operator and operand shape
+#define CC_SHAPE(op, L, R)                                              \
+  static double _CC_##op##_##L##_##R(const CNode *n, CCContext *ctx)    \
+  {                                                                     \
+    double l = LEFT_##L;                                                \
+    double r = RIGHT_##R;                                               \
+    return _CC_##op(l, r, ctx);                                         \
+  }
+
+// Every shape of a binary operator, and a table indexed by operand kind.
+// Two constants are always folded, so there is no CONST_CONST shape.
+#define CC_BINARY(op)                                                   \
+  CC_SHAPE(op, NODE, NODE) CC_SHAPE(op, NODE, VAR) CC_SHAPE(op, NODE, CONST) \
+  CC_SHAPE(op, VAR, NODE) CC_SHAPE(op, VAR, VAR) CC_SHAPE(op, VAR, CONST) \
+  CC_SHAPE(op, CONST, NODE) CC_SHAPE(op, CONST, VAR)                    \
+  static const CCFunc _CC_##op##_table[3][3] = {                        \
+    {_CC_##op##_NODE_NODE, _CC_##op##_NODE_VAR, _CC_##op##_NODE_CONST}, \
+    {_CC_##op##_VAR_NODE, _CC_##op##_VAR_VAR, _CC_##op##_VAR_CONST},    \
+    {_CC_##op##_CONST_NODE, _CC_##op##_CONST_VAR, NULL}                 \
+  };
+
+CC_BINARY(add)
+CC_BINARY(sub)
+CC_BINARY(mul)
+CC_BINARY(div)
+CC_BINARY(pow)
+CC_BINARY(lt)
+CC_BINARY(le)
+CC_BINARY(gt)
+CC_BINARY(ge)
+CC_BINARY(eq)
+CC_BINARY(ne)
+
+// The lazy operators, on nodes only: the operands not needed are not run
+// and NaN, having no truth value, is the result of any it is needed by
+static double _CC_and(const CNode *n, CCContext *ctx)
+{
+  double l = LEFT_NODE;
+  if (isnan(l) || l == 0)
+    return isnan(l) ? l : 0;
+  double r = RIGHT_NODE;
+  return isnan(r) ? r : r != 0;
+}
+
+static double _CC_or(const CNode *n, CCContext *ctx)
+{
+  double l = LEFT_NODE;
+  if (isnan(l) || l != 0)
+    return isnan(l) ? l : 1;
+  double r = RIGHT_NODE;
+  return isnan(r) ? r : r != 0;
+}
+
+static double _CC_cond(const CNode *n, CCContext *ctx)
+{
+  double cond = LEFT_NODE;
+  if (isnan(cond))
+    return cond;
+  const CNode *branch = cond != 0 ? n->b : n->c;
+  return branch->fn(branch, ctx);
+}
+
+static double _CC_negate_NODE(const CNode *n, CCContext *ctx) { return -LEFT_NODE; }
+static double _CC_negate_VAR(const CNode *n, CCContext *ctx) { return -LEFT_VAR; }
+
+static double _CC_const(const CNode *n, CCContext *ctx) { return n->k; }
+static double _CC_var(const CNode *n, CCContext *ctx) { return LEFT_VAR; }
+
+// A read of a variable that the expression also assigns, or reads only
+// in a branch that may not run, which can't be checked up front
+static double _CC_checked_var(const CNode *n, CCContext *ctx)
+{
+  double value = LEFT_VAR;
+  if (isnan(value))
+    snprintf(ctx->errmsg, ctx->errmsg_sz, "Undefined variable: %s", ctx->var_name[n->sa]);
+  return value;
+}
+
+static double _CC_call1_NODE(const CNode *n, CCContext *ctx)
+{
+  double x = LEFT_NODE;
+  return n->f->scalar(&x);
+}
+
+static double _CC_call1_VAR(const CNode *n, CCContext *ctx)
+{
+  double x = LEFT_VAR;
+  return n->f->scalar(&x);
+}
+
+static double _CC_call2(const CNode *n, CCContext *ctx)
+{
+  double args[2] = {LEFT_NODE, RIGHT_NODE};
+  return n->f->scalar(args);
+}
+
+static double _CC_param(const CNode *n, CCContext *ctx) { return ctx->frame[n->sa]; }
+
+// The arguments live in this C stack frame for the duration of the call
+static double _CC_ucall(const CNode *n, CCContext *ctx)
+{
+  if (ctx->depth == ET_MAX_CALL_DEPTH)
+  {
+    snprintf(ctx->errmsg, ctx->errmsg_sz, "Error: Recursion too deep in %s", n->u->name);
+    return NAN;
+  }
+
+  double frame[ET_MAX_ARGS + 1];
+  for (int i = 0; i < n->sa; i++)
+    frame[i] = n->arg[i]->fn(n->arg[i], ctx);
+
+  const double *caller = ctx->frame;
+  ctx->frame = frame;
+  ctx->depth++;
+  double value = n->b->fn(n->b, ctx);
+  ctx->frame = caller;
+  ctx->depth--;
+  return value;
+}
+
+static double _CC_store_NODE(const CNode *n, CCContext *ctx) { return ctx->values[n->sb] = LEFT_NODE; }
+static double _CC_store_VAR(const CNode *n, CCContext *ctx) { return ctx->values[n->sb] = LEFT_VAR; }
+static double _CC_store_CONST(const CNode *n, CCContext *ctx) { return ctx->values[n->sb] = LEFT_CONST; }
+
+// Compilation state
+struct _cc_compiler
+{
+  Closure cc;
+  bool *late;                // per slot: is it assigned anywhere, or read
+                             // in a lazy operand? If so, it is checked
+                             // as it is read
+  const UserFunc **user;     // the functions called without inlining
+  CNode **entry;             // ...and the node each one's body runs from
+  int num_funcs;
+};
+
+static CNode *_CC_new_node(struct _cc_compiler *c, CCFunc fn)
+{
+  CNode *n = &c->cc->node[c->cc->num_nodes++];
+  memset(n, 0, sizeof(*n));
+  n->fn = fn;
+  return n;
+}
+
+/*
+ * Turn an operand of any kind into a node
+ */
+static const CNode *_CC_as_node(struct _cc_compiler *c, Operand op)
+{
+  if (op.kind == KIND_NODE)
+    return op.node;
+
+  CNode *n = _CC_new_node(c, op.kind == KIND_VAR ? _CC_var : _CC_const);
+  n->sa = op.slot;
+  n->k = op.k;
+  return n;
+}
+
+static void _CC_mark_late(struct _cc_compiler *c, ExprTree tree, bool lazy)
+{
+  if (tree == NULL || ET_type(tree) == VALUE || ET_type(tree) == PARAM ||
+      ET_type(tree) == RANGE_INDEX)
+    return;
+
+  if (ET_type(tree) == SYMBOL)
+  {
+    if (lazy)
+      c->late[CC_var_slot(c->cc, ET_symbol_name(tree))] = true;
+    return;
+  }
+
+  if (ET_type(tree) == FUNC_CALL || ET_type(tree) == USER_CALL || ET_type(tree) == ARRAY_LITERAL ||
+      ET_type(tree) == RANGE_SUM || ET_type(tree) == RANGE_PROD)
+  {
+    for (int i = 0; i < ET_num_args(tree); i++)
+      _CC_mark_late(c, ET_arg(tree, i), lazy);
+
+    const UserFunc *fn = ET_type(tree) == USER_CALL ? ET_user_function(tree) : NULL;
+    for (int i = 0; fn && i < fn->num_symbols; i++)
+      if (fn->assigned[i])
+        c->late[CC_var_slot(c->cc, fn->symbol[i])] = true;
+    return;
+  }
+
+  if (ET_type(tree) == OP_ASSIGN)
+    c->late[CC_var_slot(c->cc, ET_symbol_name(ET_child(tree, 0)))] = true;
+
+  // the right operand of && and ||, and the branches of ?:, may not run
+  bool lazy_right = lazy || ET_type(tree) == OP_AND || ET_type(tree) == OP_OR ||
+                    ET_type(tree) == OP_COND;
+  _CC_mark_late(c, ET_child(tree, 0), lazy);
+  _CC_mark_late(c, ET_child(tree, 1), lazy_right);
+}
+
+/*
+ * Compile tree into an operand
+ *
+ * Returns: true on success, false (with errmsg filled in) on error
+ */
+static bool _CC_compile(struct _cc_compiler *c, ExprTree tree, Operand *out,
+                        char *errmsg, size_t errmsg_sz)
+{
+  if (tree == NULL)
+  {
+    *out = (Operand){.kind = KIND_CONST, .k = 0};
+    return true;
+  }
+
+  ExprNodeType type = ET_type(tree);
+
+  if (type == VALUE)
+  {
+    *out = (Operand){.kind = KIND_CONST, .k = ET_get_value(tree)};
+    return true;
+  }
+
+  if (type == SYMBOL)
+  {
+    int slot = CC_var_slot(c->cc, ET_symbol_name(tree));
+    if (!c->late[slot])
+    {
+      *out = (Operand){.kind = KIND_VAR, .slot = slot};
+      return true;
+    }
+    CNode *n = _CC_new_node(c, _CC_checked_var);
+    n->sa = slot;
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  if (type == PARAM)
+  {
+    CNode *n = _CC_new_node(c, _CC_param);
+    n->sa = ET_param_index(tree);
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  if (type == ARRAY_LITERAL)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Arrays are not supported in compiled expressions");
+    return false;
+  }
+
+  if (type == RANGE_SUM || type == RANGE_PROD || type == RANGE_INDEX)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: %s over a range is not supported in compiled expressions",
+             type == RANGE_PROD ? "prod" : "sum");
+    return false;
+  }
+
+  if (type == USER_CALL)
+  {
+    const UserFunc *fn = ET_user_function(tree);
+    if (fn == NULL)
+    {
+      snprintf(errmsg, errmsg_sz, "Unknown function: %s", ET_call_name(tree));
+      return false;
+    }
+
+    int func = 0;
+    while (c->user[func] != fn)
+      func++;
+
+    CNode *n = _CC_new_node(c, _CC_ucall);
+    n->u = fn;
+    n->b = c->entry[func];
+    n->sa = ET_num_args(tree);
+    n->arg = &c->cc->arg[c->cc->num_args];
+    c->cc->num_args += n->sa;
+
+    for (int i = 0; i < n->sa; i++)
+    {
+      Operand arg;
+      if (!_CC_compile(c, ET_arg(tree, i), &arg, errmsg, errmsg_sz))
+        return false;
+      n->arg[i] = _CC_as_node(c, arg);
+    }
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  Operand left, right;
+
+  if (type == OP_ASSIGN)
+  {
+    if (ET_type(ET_child(tree, 0)) != SYMBOL)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: Left side of '=' must be a variable");
+      return false;
+    }
+    if (!_CC_compile(c, ET_child(tree, 1), &right, errmsg, errmsg_sz))
+      return false;
+
+    CNode *n = _CC_new_node(c, right.kind == KIND_NODE ? _CC_store_NODE :
+                               right.kind == KIND_VAR ? _CC_store_VAR : _CC_store_CONST);
+    n->a = right.node;
+    n->sa = right.slot;
+    n->k = right.k;
+    n->sb = CC_var_slot(c->cc, ET_symbol_name(ET_child(tree, 0)));
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  if (type == UNARY_NEGATE)
+  {
+    if (!_CC_compile(c, ET_child(tree, 0), &left, errmsg, errmsg_sz))
+      return false;
+
+    if (left.kind == KIND_CONST)
+    {
+      *out = (Operand){.kind = KIND_CONST, .k = -left.k};
+      return true;
+    }
+
+    CNode *n = _CC_new_node(c, left.kind == KIND_NODE ? _CC_negate_NODE : _CC_negate_VAR);
+    n->a = left.node;
+    n->sa = left.slot;
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  if (type == FUNC_CALL)
+  {
+    const Builtin *f = ET_call_function(tree);
+    Operand args[BI_MAX_ARGS];
+    double k[BI_MAX_ARGS];
+    bool all_const = true;
+
+    assert(f->num_args <= 2);
+    for (int i = 0; i < f->num_args; i++)
+    {
+      if (!_CC_compile(c, ET_arg(tree, i), &args[i], errmsg, errmsg_sz))
+        return false;
+      all_const = all_const && args[i].kind == KIND_CONST;
+      k[i] = args[i].k;
+    }
+
+    // builtins have no side effects or errors, so constant calls fold
+    if (all_const)
+    {
+      *out = (Operand){.kind = KIND_CONST, .k = f->scalar(k)};
+      return true;
+    }
+
+    CNode *n;
+    if (f->num_args == 1 && args[0].kind == KIND_VAR)
+    {
+      n = _CC_new_node(c, _CC_call1_VAR);
+      n->sa = args[0].slot;
+    }
+    else
+    {
+      n = _CC_new_node(c, f->num_args == 1 ? _CC_call1_NODE : _CC_call2);
+      n->a = _CC_as_node(c, args[0]);
+      if (f->num_args == 2)
+        n->b = _CC_as_node(c, args[1]);
+    }
+    n->f = f;
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  if (type == OP_COND)
+  {
+    Operand cond, then, otherwise;
+    ExprTree branches = ET_child(tree, 1);
+    if (!_CC_compile(c, ET_child(tree, 0), &cond, errmsg, errmsg_sz))
+      return false;
+
+    // a constant condition compiles to its branch alone
+    if (cond.kind == KIND_CONST && isnan(cond.k))
+    {
+      *out = cond;
+      return true;
+    }
+    if (cond.kind == KIND_CONST)
+      return _CC_compile(c, ET_child(branches, cond.k != 0 ? 0 : 1), out, errmsg, errmsg_sz);
+
+    if (!_CC_compile(c, ET_child(branches, 0), &then, errmsg, errmsg_sz) ||
+        !_CC_compile(c, ET_child(branches, 1), &otherwise, errmsg, errmsg_sz))
+      return false;
+
+    CNode *n = _CC_new_node(c, _CC_cond);
+    n->a = _CC_as_node(c, cond);
+    n->b = _CC_as_node(c, then);
+    n->c = _CC_as_node(c, otherwise);
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  if (type == OP_AND || type == OP_OR)
+  {
+    if (!_CC_compile(c, ET_child(tree, 0), &left, errmsg, errmsg_sz) ||
+        !_CC_compile(c, ET_child(tree, 1), &right, errmsg, errmsg_sz))
+      return false;
+
+    if (left.kind == KIND_CONST && right.kind == KIND_CONST)
+    {
+      *out = (Operand){.kind = KIND_CONST, .k = ET_apply(type, left.k, right.k, errmsg, errmsg_sz)};
+      return true;
+    }
+
+    CNode *n = _CC_new_node(c, type == OP_AND ? _CC_and : _CC_or);
+    n->a = _CC_as_node(c, left);
+    n->b = _CC_as_node(c, right);
+    *out = (Operand){.kind = KIND_NODE, .node = n};
+    return true;
+  }
+
+  const CCFunc (*table)[3];
+  switch (type)
+  {
+  case OP_ADD:   table = _CC_add_table; break;
+  case OP_SUB:   table = _CC_sub_table; break;
+  case OP_MUL:   table = _CC_mul_table; break;
+  case OP_DIV:   table = _CC_div_table; break;
+  case OP_POWER: table = _CC_pow_table; break;
+  case OP_LT:    table = _CC_lt_table; break;
+  case OP_LE:    table = _CC_le_table; break;
+  case OP_GT:    table = _CC_gt_table; break;
+  case OP_GE:    table = _CC_ge_table; break;
+  case OP_EQ:    table = _CC_eq_table; break;
+  case OP_NE:    table = _CC_ne_table; break;
+  default:
+    snprintf(errmsg, errmsg_sz, "Error: Invalid operator");
+    return false;
+  }
+
+  if (!_CC_compile(c, ET_child(tree, 0), &left, errmsg, errmsg_sz) ||
+      !_CC_compile(c, ET_child(tree, 1), &right, errmsg, errmsg_sz))
+    return false;
+
+  if (left.kind == KIND_CONST && right.kind == KIND_CONST)
+  {
+    // Fold, unless doing so would hide a run-time error
+    char fold_err[64] = "";
+    double k = ET_apply(type, left.k, right.k, fold_err, sizeof(fold_err));
+    if (fold_err[0] == '\0')
+    {
+      *out = (Operand){.kind = KIND_CONST, .k = k};
+      return true;
+    }
+    left = (Operand){.kind = KIND_NODE, .node = _CC_as_node(c, left)};
+  }
+
+  CNode *n = _CC_new_node(c, table[left.kind][right.kind]);
+  n->a = left.node;
+  n->b = right.node;
+  n->sa = left.slot;
+  n->sb = right.slot;
+  n->k = (left.kind == KIND_CONST) ? left.k : right.k;
+  *out = (Operand){.kind = KIND_NODE, .node = n};
+  return true;
+}
+
+// Documented in .h file
+Closure CC_compile(ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  Closure cc = calloc(1, sizeof(struct _closure));
+  assert(cc);
+
+  cc->var_name = EW_tree_vars(tree, &cc->num_vars);
+
+  struct _cc_compiler c = {.cc = cc};
+  c.user = FT_called(tree, &c.num_funcs);
+  c.entry = malloc((c.num_funcs + 1) * sizeof(CNode *));
+  assert(c.entry);
+
+  // every tree node yields at most one closure node, plus one for the
+  // root if it is a leaf; each function body is compiled once, with
+  // an entry node besides
+  int max_nodes = ET_count(tree) + 1;
+  for (int f = 0; f < c.num_funcs; f++)
+    max_nodes += ET_count(c.user[f]->body) + 2;
+  cc->node = malloc(max_nodes * sizeof(CNode));
+  cc->arg = malloc(max_nodes * sizeof(CNode *));
+  assert(cc->node && cc->arg);
+
+  // a function body runs only if called, so its reads are all lazy
+  c.late = calloc(cc->num_vars + 1, sizeof(bool));
+  assert(c.late);
+  _CC_mark_late(&c, tree, false);
+  for (int f = 0; f < c.num_funcs; f++)
+  {
+    _CC_mark_late(&c, c.user[f]->body, true);
+    c.entry[f] = _CC_new_node(&c, NULL);
+  }
+
+  // A body's root is copied into its entry node once compiled, since
+  // calls, including recursive ones, refer to the entry
+  bool ok = true;
+  Operand root;
+  for (int f = 0; f < c.num_funcs && ok; f++)
+  {
+    ok = _CC_compile(&c, c.user[f]->body, &root, errmsg, errmsg_sz);
+    if (ok)
+      *c.entry[f] = *_CC_as_node(&c, root);
+  }
+
+  if (!ok || !_CC_compile(&c, tree, &root, errmsg, errmsg_sz))
+  {
+    free(c.late);
+    free(c.user);
+    free(c.entry);
+    CC_free(cc);
+    return NULL;
+  }
+  cc->root = _CC_as_node(&c, root);
+
+  cc->check_slot = malloc((cc->num_vars + 1) * sizeof(int));
+  assert(cc->check_slot);
+  for (int i = 0; i < cc->num_vars; i++)
+    if (!c.late[i])
+      cc->check_slot[cc->num_check++] = i;
+
+  free(c.late);
+  free(c.user);
+  free(c.entry);
+  return cc;
+}
+
+// Documented in .h file
+void CC_free(Closure cc)
+{
+  if (!cc)
+    return;
+
+  for (int i = 0; i < cc->num_vars; i++)
+    free(cc->var_name[i]);
+  free(cc->var_name);
+  free(cc->check_slot);
+  free(cc->node);
+  free(cc->arg);
+  free(cc);
+}
+
+// Documented in .h file
+int CC_num_vars(Closure cc)
+{
+  assert(cc);
+  return cc->num_vars;
+}
+
+// Documented in .h file
+int CC_var_slot(Closure cc, const char *name)
+{
+  assert(cc);
+
+  for (int i = 0; i < cc->num_vars; i++)
+    if (strcmp(cc->var_name[i], name) == 0)
+      return i;
+
+  return -1;
+}
+
+// Documented in .h file
+const char *CC_var_name(Closure cc, int slot)
+{
+  assert(cc);
+  assert(slot >= 0 && slot < cc->num_vars);
+  return cc->var_name[slot];
+}
+
+// Documented in .h file
+double CC_execute(Closure cc, double *values, char *errmsg, size_t errmsg_sz)
+{
+  assert(cc);
+
+  for (int i = 0; i < cc->num_check; i++)
+    if (isnan(values[cc->check_slot[i]]))
+      snprintf(errmsg, errmsg_sz, "Undefined variable: %s", cc->var_name[cc->check_slot[i]]);
+
+  CCContext ctx = {values, cc->var_name, errmsg, errmsg_sz, NULL, 0};
+  return cc->root->fn(cc->root, &ctx);
+}
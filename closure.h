@@ -0,0 +1,78 @@
+/*
+ * closure.h
+ *
+ * Closure-compiled expressions. An ExprTree is compiled into a tree
+ * of nodes, each carrying a function pointer specialized for the exact
+ * shape of its operation -- for instance add(variable, constant) or
+ * mul(variable, variable) -- with its operands pre-bound. Executing a
+ * node is a single indirect call, with no switch on the node type and
+ * no NULL checks. Constant subexpressions are folded at compile time.
+ *
+ * Values are passed exactly as for EW_execute, and slots are numbered
+ * as EW_compile numbers them.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _CLOSURE_H_
+#define _CLOSURE_H_
+
+#include <stddef.h>
+#include "expr_tree.h"
+
+typedef struct _closure *Closure;
+
+
+/*
+ * Compile a tree into a closure
+ *
+ * Parameters:
+ *   tree       The tree; it is not modified, and the caller retains
+ *              ownership of it
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The compiled closure, or NULL (with an error message copied
+ *   into errmsg) on error. It is up to the caller to call CC_free.
+ */
+Closure CC_compile(ExprTree tree, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Destroy a closure
+ *
+ * Parameters:
+ *   cc       The closure; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void CC_free(Closure cc);
+
+
+/*
+ * Return the number of variable slots, the slot for a name, and the
+ * name for a slot, with the same meanings as the corresponding
+ * functions in prepared.h
+ */
+int CC_num_vars(Closure cc);
+int CC_var_slot(Closure cc, const char *name);
+const char *CC_var_name(Closure cc, int slot);
+
+
+/*
+ * Execute a closure. Variables that the expression only reads, and
+ * reads whatever branches it takes, are checked for being defined
+ * once, before execution starts, rather than at every use.
+ *
+ * Parameters:
+ *   cc         The closure
+ *   values     The value array, indexed by slot; NaN means undefined
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value on success. If an error is encountered,
+ *   copies an error message into errmsg and returns NaN.
+ */
+double CC_execute(Closure cc, double *values, char *errmsg, size_t errmsg_sz);
+
+#endif /* _CLOSURE_H_ */
@@ -0,0 +1,461 @@
+/*
+ * colfile.c
+ *
+ * Evaluation of compiled expressions over memory-mapped binary columns,
+ * a block of rows at a time
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "colfile.h"
+#include "prepared.h"
+
+#define CF_MAGIC "EWCOL001"
+#define CF_HEADER_BYTES 24
+
+// A mapped file
+typedef struct
+{
+  char *addr;
+  size_t size;
+  dev_t dev;         // the file, to recognize it as an output
+  ino_t ino;
+} CFMap;
+
+// A column, within a mapped file
+typedef struct
+{
+  char name[CF_NAME_BYTES];
+  double *data;
+  char *released;    // the end of the pages released so far
+} CFColumn;
+
+struct _col_table
+{
+  CFMap *map;
+  int num_maps, max_maps;
+  CFColumn *column;
+  int num_columns, max_columns;
+  long rows;         // -1 until the first column is added
+};
+
+// Documented in .h file
+CFTable CF_new()
+{
+  CFTable t = calloc(1, sizeof(struct _col_table));
+  assert(t);
+  t->rows = -1;
+  return t;
+}
+
+// Documented in .h file
+void CF_free(CFTable t)
+{
+  if (t == NULL)
+    return;
+  for (int i = 0; i < t->num_maps; i++)
+    if (t->map[i].size > 0)
+      munmap(t->map[i].addr, t->map[i].size);
+  free(t->map);
+  free(t->column);
+  free(t);
+}
+
+// Documented in .h file
+FILE *CF_open_output(CFTable t, const char *path, char *errmsg, size_t errmsg_sz)
+{
+  // open the file without emptying it, until it is known not to be mapped
+  int fd = open(path, O_WRONLY | O_CREAT, 0666);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Cannot open %s", path);
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  for (int i = 0; i < t->num_maps; i++)
+    if (t->map[i].dev == st.st_dev && t->map[i].ino == st.st_ino)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: %s is also an input", path);
+      close(fd);
+      return NULL;
+    }
+
+  FILE *out = NULL;
+  if ((!S_ISREG(st.st_mode) || ftruncate(fd, 0) == 0) && (out = fdopen(fd, "wb")) != NULL)
+    return out;
+  snprintf(errmsg, errmsg_sz, "Error: Cannot open %s", path);
+  close(fd);
+  return NULL;
+}
+
+// Documented in .h file
+long CF_rows(CFTable t)
+{
+  return t->rows < 0 ? 0 : t->rows;
+}
+
+// Convert values between little-endian and the machine's byte order, in
+// place
+static void _CF_little(double *v, size_t n)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (size_t i = 0; i < n; i++)
+  {
+    uint64_t u;
+    memcpy(&u, &v[i], 8);
+    u = __builtin_bswap64(u);
+    memcpy(&v[i], &u, 8);
+  }
+#endif
+}
+
+// Read a little-endian uint64
+static uint64_t _CF_u64(const char *p)
+{
+  uint64_t u = 0;
+  for (int i = 7; i >= 0; i--)
+    u = u << 8 | (unsigned char)p[i];
+  return u;
+}
+
+// Write a little-endian uint64
+static void _CF_put_u64(char *p, uint64_t u)
+{
+  for (int i = 0; i < 8; i++, u >>= 8)
+    p[i] = (char)(u & 0xff);
+}
+
+/*
+ * Map a file for reading
+ *
+ * Parameters:
+ *   t          The table, which keeps the mapping
+ *   path       The file
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The mapping, or NULL with an error message copied into errmsg
+ */
+static CFMap *_CF_map(CFTable t, const char *path, char *errmsg, size_t errmsg_sz)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Cannot open %s", path);
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  CFMap map = {NULL, st.st_size, st.st_dev, st.st_ino};
+  if (map.size > 0)
+  {
+    map.addr = mmap(NULL, map.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map.addr == MAP_FAILED)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: Cannot map %s", path);
+      close(fd);
+      return NULL;
+    }
+    madvise(map.addr, map.size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  if (t->num_maps == t->max_maps)
+  {
+    t->max_maps = t->max_maps ? 2 * t->max_maps : 4;
+    t->map = realloc(t->map, t->max_maps * sizeof(CFMap));
+    assert(t->map);
+  }
+  t->map[t->num_maps] = map;
+  return &t->map[t->num_maps++];
+}
+
+// Unmap the file mapped last, which added no columns
+static void _CF_unmap_last(CFTable t)
+{
+  CFMap *map = &t->map[--t->num_maps];
+  if (map->size > 0)
+    munmap(map->addr, map->size);
+}
+
+/*
+ * Add a column to a table
+ *
+ * Parameters:
+ *   t          The table
+ *   name       The column's name
+ *   len        The length of name
+ *   data       Its values
+ *   rows       The number of its values
+ *   path       The file it is in, for error messages
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, or false with an error message copied into
+ *   errmsg
+ */
+static bool _CF_add(CFTable t, const char *name, size_t len, double *data, long rows,
+                    const char *path, char *errmsg, size_t errmsg_sz)
+{
+  if (len == 0 || len >= CF_NAME_BYTES)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Invalid column name in %s", path);
+    return false;
+  }
+  if (t->rows >= 0 && rows != t->rows)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: %s has %ld rows, not %ld", path, rows, t->rows);
+    return false;
+  }
+  for (int c = 0; c < t->num_columns; c++)
+    if (strlen(t->column[c].name) == len && strncmp(t->column[c].name, name, len) == 0)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: %.*s is given twice", (int)len, name);
+      return false;
+    }
+
+  if (t->num_columns == t->max_columns)
+  {
+    t->max_columns = t->max_columns ? 2 * t->max_columns : 8;
+    t->column = realloc(t->column, t->max_columns * sizeof(CFColumn));
+    assert(t->column);
+  }
+  CFColumn *col = &t->column[t->num_columns++];
+  memcpy(col->name, name, len);
+  col->name[len] = '\0';
+  col->data = data;
+  col->released = (char *)data;
+  t->rows = rows;
+  return true;
+}
+
+// Documented in .h file
+bool CF_add_raw(CFTable t, const char *name, const char *path, char *errmsg, size_t errmsg_sz)
+{
+  CFMap *map = _CF_map(t, path, errmsg, errmsg_sz);
+  if (map == NULL)
+    return false;
+
+  if (map->size % sizeof(double) != 0)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: %s is not a whole number of doubles", path);
+    _CF_unmap_last(t);
+    return false;
+  }
+  if (!_CF_add(t, name, strlen(name), (double *)map->addr, map->size / sizeof(double), path,
+               errmsg, errmsg_sz))
+  {
+    _CF_unmap_last(t);
+    return false;
+  }
+  return true;
+}
+
+// Documented in .h file
+bool CF_add_file(CFTable t, const char *path, char *errmsg, size_t errmsg_sz)
+{
+  CFMap *map = _CF_map(t, path, errmsg, errmsg_sz);
+  if (map == NULL)
+    return false;
+
+  const char *addr = map->addr;
+  size_t size = map->size;
+  if (size < CF_HEADER_BYTES || memcmp(addr, CF_MAGIC, 8) != 0)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: %s is not a column file", path);
+    _CF_unmap_last(t);
+    return false;
+  }
+
+  // every column must lie within the file; the limits keep the sums
+  // below from overflowing
+  uint64_t rows = _CF_u64(addr + 8), num_columns = _CF_u64(addr + 16);
+  long table_rows = t->rows;
+  int added = 0;
+  bool ok = num_columns <= (size - CF_HEADER_BYTES) / CF_ENTRY_BYTES &&
+            rows <= size / sizeof(double);
+  for (uint64_t c = 0; ok && c < num_columns; c++)
+  {
+    const char *entry = addr + CF_HEADER_BYTES + c * CF_ENTRY_BYTES;
+    uint64_t offset = _CF_u64(entry + CF_NAME_BYTES);
+    ok = offset % sizeof(double) == 0 && offset <= size &&
+         rows <= (size - offset) / sizeof(double);
+    if (!ok)
+      break;
+    if (!_CF_add(t, entry, strnlen(entry, CF_NAME_BYTES), (double *)(map->addr + offset),
+                 (long)rows, path, errmsg, errmsg_sz))
+    {
+      t->num_columns -= added;
+      t->rows = table_rows;
+      _CF_unmap_last(t);
+      return false;
+    }
+    added++;
+  }
+  if (!ok)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: %s is truncated", path);
+    t->num_columns -= added;
+    t->rows = table_rows;
+    _CF_unmap_last(t);
+    return false;
+  }
+  if (added == 0)
+    _CF_unmap_last(t);
+  return true;
+}
+
+// Documented in .h file
+bool CF_write_header(FILE *out, const char **names, int num_columns, long rows)
+{
+  char header[CF_HEADER_BYTES], entry[CF_ENTRY_BYTES];
+  memcpy(header, CF_MAGIC, 8);
+  _CF_put_u64(header + 8, rows);
+  _CF_put_u64(header + 16, num_columns);
+  bool ok = fwrite(header, 1, sizeof(header), out) == sizeof(header);
+
+  uint64_t offset = CF_HEADER_BYTES + (uint64_t)num_columns * CF_ENTRY_BYTES;
+  for (int c = 0; ok && c < num_columns; c++, offset += (uint64_t)rows * sizeof(double))
+  {
+    memset(entry, 0, sizeof(entry));
+    strncpy(entry, names[c], CF_NAME_BYTES - 1);
+    _CF_put_u64(entry + CF_NAME_BYTES, offset);
+    ok = fwrite(entry, 1, sizeof(entry), out) == sizeof(entry);
+  }
+  return ok;
+}
+
+// Release the pages of a column that lie wholly before end, whose rows
+// have all been written
+static void _CF_release(CFColumn *col, const double *end)
+{
+  static long page_size = 0;
+  if (page_size == 0)
+    page_size = sysconf(_SC_PAGESIZE);
+
+  uintptr_t from = ((uintptr_t)col->released + page_size - 1) / page_size * page_size;
+  uintptr_t upto = (uintptr_t)end / page_size * page_size;
+  if (upto > from)
+  {
+    madvise((void *)from, upto - from, MADV_DONTNEED);
+    col->released = (char *)upto;
+  }
+}
+
+typedef struct
+{
+  const char *var;
+  bool assigned;
+} CFAssigned;
+
+static void _CF_assigned(const char *symbol, bool assigned, void *cb_data)
+{
+  CFAssigned *a = cb_data;
+  if (assigned && strcmp(symbol, a->var) == 0)
+    a->assigned = true;
+}
+
+// Documented in .h file
+long CF_evaluate(ExprTree tree, CFTable t, CDict vars, FILE *out, CFFormat format,
+                 char *errmsg, size_t errmsg_sz)
+{
+  Prepared p = EW_compile(tree, errmsg, errmsg_sz);
+  if (p == NULL)
+    return -1;
+
+  // a variable that is neither a column nor set, nor assigned before it
+  // is read, would make every row an error
+  int num_vars = EW_num_vars(p);
+  CFColumn *column_of[num_vars + 1];
+  bool in_place[num_vars + 1];
+  double *values = malloc((num_vars + 1) * sizeof(double));
+  assert(values);
+  EW_bind_dict(p, values, vars);
+  for (int v = 0; v < num_vars; v++)
+  {
+    column_of[v] = NULL;
+    for (int c = 0; c < t->num_columns; c++)
+      if (strcmp(EW_var_name(p, v), t->column[c].name) == 0)
+        column_of[v] = &t->column[c];
+    CFAssigned assigned = {EW_var_name(p, v), false};
+    ET_foreach_symbol(tree, _CF_assigned, &assigned);
+    // a column is read in place unless it is written or its bytes are
+    // swapped
+    in_place[v] = column_of[v] && !assigned.assigned &&
+                  __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+    if (column_of[v] == NULL && isnan(values[v]) && !assigned.assigned)
+    {
+      snprintf(errmsg, errmsg_sz, "Undefined variable: %s", EW_var_name(p, v));
+      free(values);
+      EW_free(p);
+      return -1;
+    }
+  }
+
+  long rows = CF_rows(t);
+  for (int c = 0; c < t->num_columns; c++)
+    t->column[c].released = (char *)t->column[c].data;
+  double *data = malloc(((size_t)num_vars + 1) * CF_BLOCK * sizeof(double));
+  assert(data);
+  double *columns[num_vars + 1];
+  double *results = data + (size_t)num_vars * CF_BLOCK;
+
+  const char *value_name = "value";
+  bool ok = format == CF_RAW || CF_write_header(out, &value_name, 1, rows);
+  char ignored[128] = "";
+  for (long r = 0; ok && r < rows; r += CF_BLOCK)
+  {
+    size_t n = rows - r < CF_BLOCK ? rows - r : CF_BLOCK;
+
+    // the other variables are filled in again, as the expression may
+    // assign them
+    for (int v = 0; v < num_vars; v++)
+    {
+      columns[v] = in_place[v] ? column_of[v]->data + r : data + (size_t)v * CF_BLOCK;
+      if (in_place[v])
+        continue;
+      if (column_of[v])
+      {
+        memcpy(columns[v], column_of[v]->data + r, n * sizeof(double));
+        _CF_little(columns[v], n);
+      }
+      else
+      {
+        for (size_t i = 0; i < n; i++)
+          columns[v][i] = values[v];
+      }
+    }
+
+    EW_execute_batch(p, columns, n, results, 0, ignored, sizeof(ignored));
+    _CF_little(results, n);
+    ok = fwrite(results, sizeof(double), n, out) == n;
+
+    for (int v = 0; v < num_vars; v++)
+      if (column_of[v])
+        _CF_release(column_of[v], column_of[v]->data + r + n);
+  }
+  ok = ok && fflush(out) == 0;
+  if (!ok)
+    snprintf(errmsg, errmsg_sz, "Error: Could not write the column");
+
+  free(data);
+  free(values);
+  EW_free(p);
+  return ok ? rows : -1;
+}
@@ -0,0 +1,187 @@
+/*
+ * colfile.h
+ *
+ * Evaluation of an expression over binary columns of numbers, read from
+ * memory-mapped files and written out in the same form, so that no
+ * number is ever converted to or from text.
+ *
+ * A raw column file holds its values alone, as little-endian 64-bit
+ * doubles; its length gives the number of rows. A column file holds any
+ * number of named columns of the same length, and describes itself:
+ *
+ *   offset 0   "EWCOL001", the format and its version
+ *          8   the number of rows, a little-endian uint64
+ *         16   the number of columns, a little-endian uint64
+ *         24   a directory entry of CF_ENTRY_BYTES per column: its name,
+ *              padded with NULs to CF_NAME_BYTES, then the offset of its
+ *              values in the file, a multiple of 8, as a little-endian
+ *              uint64
+ *
+ * and the values of each column, as in a raw column file, at its offset.
+ * CF_write_header writes the columns one after another, after the
+ * directory.
+ *
+ * The columns are evaluated a block of CF_BLOCK rows at a time, in
+ * place in the mapping, and the pages of each block are released once
+ * it is written, so memory use does not grow with the files.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _COLFILE_H_
+#define _COLFILE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "cdict.h"
+#include "expr_tree.h"
+
+// The rows evaluated and written at once
+#define CF_BLOCK 8192
+
+// The space for a column's name in a column file, with its NUL
+#define CF_NAME_BYTES 56
+
+// The size of a column's directory entry in a column file
+#define CF_ENTRY_BYTES 64
+
+typedef enum
+{
+  CF_RAW,     // the values alone
+  CF_COLUMNS  // a column file of one column, "value"
+} CFFormat;
+
+// Columns of numbers, mapped from files
+typedef struct _col_table *CFTable;
+
+
+/*
+ * Create a new table, of no columns
+ *
+ * Parameters: None
+ *
+ * Returns: The table, which the caller must free with CF_free
+ */
+CFTable CF_new();
+
+
+/*
+ * Free a table, unmapping its files
+ *
+ * Parameters:
+ *   t          The table, or NULL
+ *
+ * Returns: None
+ */
+void CF_free(CFTable t);
+
+
+/*
+ * Add a raw column file to a table, as the column of a variable
+ *
+ * Parameters:
+ *   t          The table
+ *   name       The name of the variable
+ *   path       The file
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, or false with an error message copied into
+ *   errmsg if the file cannot be mapped, is not a whole number of
+ *   doubles, has a different number of rows from the table's other
+ *   columns, or name is already a column
+ */
+bool CF_add_raw(CFTable t, const char *name, const char *path, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Add the columns of a column file to a table, each as the column of
+ * the variable it is named for
+ *
+ * Parameters:
+ *   t          The table
+ *   path       The file
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, or false with an error message copied into
+ *   errmsg if the file cannot be mapped, is not a column file or is
+ *   truncated, has a different number of rows from the table's other
+ *   columns, or names a column already in the table
+ */
+bool CF_add_file(CFTable t, const char *path, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Open a file to write results to, refusing one of the table's own
+ * files, which writing would change under its mapping. The file is
+ * emptied only once it is known not to be one of them.
+ *
+ * Parameters:
+ *   t          The table
+ *   path       The file
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The open file, which the caller must close, or NULL with an
+ *   error message copied into errmsg if the file is one of the table's,
+ *   by any name, or cannot be opened
+ */
+FILE *CF_open_output(CFTable t, const char *path, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Return the number of rows of a table's columns
+ *
+ * Parameters:
+ *   t          The table
+ *
+ * Returns: The number of rows, 0 if the table has no columns
+ */
+long CF_rows(CFTable t);
+
+
+/*
+ * Write the header of a column file, to be followed by the values of
+ * each column in turn, rows doubles each, little-endian
+ *
+ * Parameters:
+ *   out        Where to write the header
+ *   names      The names of the columns, each shorter than CF_NAME_BYTES
+ *   num_columns  The number of columns
+ *   rows       The number of rows
+ *
+ * Returns: true on success, false if writing fails
+ */
+bool CF_write_header(FILE *out, const char **names, int num_columns, long rows);
+
+
+/*
+ * Evaluate an expression on every row of a table, and write the results
+ * out in order, in the given format
+ *
+ * A variable that is a column of the table takes its value in each row
+ * from that column; other variables keep their values in vars. Results
+ * with an error are written as NaN.
+ *
+ * Parameters:
+ *   tree       The expression, with calls inlined (see FT_inline); it is
+ *              not modified, and the caller retains ownership of it
+ *   t          The table; it is not modified, even if the expression
+ *              assigns a column's variable
+ *   vars       The values of the variables not in the table
+ *   out        Where to write the results
+ *   format     CF_RAW or CF_COLUMNS
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The number of rows evaluated, or -1 with an error message
+ *   copied into errmsg if the expression cannot be compiled or reads a
+ *   variable with no value, or writing fails
+ */
+long CF_evaluate(ExprTree tree, CFTable t, CDict vars, FILE *out, CFFormat format,
+                 char *errmsg, size_t errmsg_sz);
+
+
+#endif /* _COLFILE_H_ */
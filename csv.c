@@ -0,0 +1,521 @@
+/*
+ * csv.c
+ *
+ * Evaluation of compiled expressions over the rows of CSV files, a
+ * block of rows at a time
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "csv.h"
+#include "prepared.h"
+
+// The longest number passed to strtod
+#define CS_NUMBER_MAX 127
+
+// The longest number written by "%.17g", with its newline
+#define CS_NUMBER_LEN 26
+
+#define CS_ONES 0x0101010101010101ull
+#define CS_HIGHS 0x8080808080808080ull
+
+// The powers of ten that are exact doubles
+static const double _CS_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Documented in .h file
+const char *CS_number(const char *p, const char *end, double *value)
+{
+  const char *start = p;
+  bool negative = p < end && *p == '-';
+  if (p < end && (*p == '-' || *p == '+'))
+    p++;
+
+  // the significant digits, of which a uint64_t holds 19, and the power
+  // of ten they are scaled by
+  uint64_t mantissa = 0;
+  int digits = 0, scale = 0;
+  bool any = false, exact = true;
+  for (; p < end && (unsigned)(*p - '0') < 10; p++, any = true)
+  {
+    if (digits == 19)
+      exact = false;
+    else
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa != 0;
+    }
+  }
+  if (p < end && (*p == 'x' || *p == 'X'))
+    goto slow;   // hexadecimal
+  if (p < end && *p == '.')
+    for (p++; p < end && (unsigned)(*p - '0') < 10; p++, any = true)
+    {
+      if (digits == 19)
+        exact = false;
+      else
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        scale--;
+      }
+    }
+  if (!any)
+    goto slow;   // inf, nan, or not a number
+
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char *e = p + 1;
+    bool negative_exp = e < end && *e == '-';
+    if (e < end && (*e == '-' || *e == '+'))
+      e++;
+    if (e < end && (unsigned)(*e - '0') < 10)
+    {
+      int exp = 0;
+      for (; e < end && (unsigned)(*e - '0') < 10; e++)
+        if (exp < 10000)
+          exp = exp * 10 + (*e - '0');
+      scale += negative_exp ? -exp : exp;
+      p = e;
+    }
+  }
+
+  // both the mantissa and the power of ten are exact, so one rounding
+  // gives the correctly rounded value
+  if (exact && mantissa <= (1ull << 53) && scale >= -22 && scale <= 22)
+  {
+    double d = scale < 0 ? (double)mantissa / _CS_pow10[-scale]
+                         : (double)mantissa * _CS_pow10[scale];
+    *value = negative ? -d : d;
+    return p;
+  }
+
+slow:;
+  char text[CS_NUMBER_MAX + 1];
+  size_t len = end - start < CS_NUMBER_MAX ? end - start : CS_NUMBER_MAX;
+  memcpy(text, start, len);
+  text[len] = '\0';
+  char *stop;
+  double d = strtod(text, &stop);
+  if (stop == text || (unsigned char)text[0] <= ' ')
+    return NULL;
+  *value = d;
+  return start + (stop - text);
+}
+
+// 0x80 in each byte of word that equals byte, and 0 in the others
+static inline uint64_t _CS_bytes_equal(uint64_t word, unsigned char byte)
+{
+  uint64_t v = word ^ (CS_ONES * byte);
+  return ~(((v & ~CS_HIGHS) + ~CS_HIGHS) | v | ~CS_HIGHS);
+}
+
+// The comma or newline that ends the field at p, or end; the bytes are
+// compared eight at a time
+static const char *_CS_field_end(const char *p, const char *end)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for (; end - p >= 8; p += 8)
+  {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    uint64_t found = _CS_bytes_equal(word, ',') | _CS_bytes_equal(word, '\n');
+    if (found)
+      return p + __builtin_ctzll(found) / 8;
+  }
+#endif
+  while (p < end && *p != ',' && *p != '\n')
+    p++;
+  return p;
+}
+
+// Skip the field at p, which may be quoted
+static const char *_CS_skip(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  if (p < end && *p == '"')
+  {
+    // to the closing quote; a doubled quote stands for one
+    for (p++; p < end; p++)
+      if (*p == '"')
+      {
+        if (p + 1 < end && p[1] == '"')
+          p++;
+        else
+        {
+          p++;
+          break;
+        }
+      }
+  }
+  return _CS_field_end(p, end);
+}
+
+// Convert the field at p to a number, or NaN if it is not one
+static const char *_CS_field(const char *p, const char *end, double *value)
+{
+  const char *start = p;
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  bool quoted = p < end && *p == '"';
+  const char *q = CS_number(p + quoted, end, value);
+  if (q)
+  {
+    if (quoted && q < end && *q == '"')
+      q++;
+    while (q < end && (*q == ' ' || *q == '\t' || *q == '\r'))
+      q++;
+    if (q == end || *q == ',' || *q == '\n')
+      return q;
+  }
+  *value = NAN;
+  return _CS_skip(start, end);
+}
+
+/*
+ * Read one row into the columns, and return the start of the next
+ *
+ * Parameters:
+ *   p, end          The row, and the end of the text
+ *   var_of_column   The variable each column holds, or -1
+ *   num_columns     The columns up to the last that a variable is in
+ *   columns         The variables' columns of values
+ *   row             The index of the row in columns
+ *
+ * Returns: The character after the row's newline, or end
+ */
+static const char *_CS_row(const char *p, const char *end, const int *var_of_column,
+                           int num_columns, double *const *columns, int row)
+{
+  int c = 0;
+  while (c < num_columns)
+  {
+    int v = var_of_column[c++];
+    p = v >= 0 ? _CS_field(p, end, &columns[v][row]) : _CS_skip(p, end);
+    if (p == end || *p != ',')
+      break;
+    p++;
+  }
+
+  // a short row
+  for (; c < num_columns; c++)
+    if (var_of_column[c] >= 0)
+      columns[var_of_column[c]][row] = NAN;
+
+  const char *newline = memchr(p, '\n', end - p);
+  return newline ? newline + 1 : end;
+}
+
+// The input, read a buffer of whole lines at a time
+typedef struct
+{
+  FILE *in;
+  char *buffer;
+  size_t cap, len;   // the buffer's size, and the bytes in it
+  size_t whole;      // the bytes of whole lines at its start
+} CSReader;
+
+// Read more of the file, keeping the partial line after the last whole
+// one; returns the bytes of whole lines now at the start of the buffer,
+// all of them at the end of the file, and 0 when there are none left
+static size_t _CS_read(CSReader *r)
+{
+  memmove(r->buffer, r->buffer + r->whole, r->len - r->whole);
+  r->len -= r->whole;
+
+  for (;;)
+  {
+    size_t got;
+    while (r->len < r->cap && (got = fread(r->buffer + r->len, 1, r->cap - r->len, r->in)) > 0)
+      r->len += got;
+    if (r->len < r->cap)
+      return r->whole = r->len;   // the end of the file
+
+    size_t keep = r->len;
+    while (keep > 0 && r->buffer[keep - 1] != '\n')
+      keep--;
+    if (keep > 0)
+      return r->whole = keep;
+
+    // a line longer than the buffer
+    r->cap *= 2;
+    r->buffer = realloc(r->buffer, r->cap);
+    assert(r->buffer);
+  }
+}
+
+typedef struct
+{
+  const char *var;
+  bool assigned;
+} CSAssigned;
+
+static void _CS_assigned(const char *symbol, bool assigned, void *cb_data)
+{
+  CSAssigned *a = cb_data;
+  if (assigned && strcmp(symbol, a->var) == 0)
+    a->assigned = true;
+}
+
+/*
+ * Match the header's names to the expression's variables
+ *
+ * Parameters:
+ *   text, end       The header line, without its newline
+ *   p               The compiled expression
+ *   var_of_column   Return space for a new array of the variable of each
+ *                   column, or -1, which the caller must free
+ *   is_column       Return space for whether each variable is a column
+ *   errmsg          Return space for an error message, filled in in case
+ *                   of error
+ *   errmsg_sz       The size of errmsg
+ *
+ * Returns: The columns up to the last that holds a variable, or -1 with
+ *   an error message copied into errmsg if a name is given twice
+ */
+static int _CS_header(const char *text, const char *end, Prepared p, int **var_of_column,
+                      bool *is_column, char *errmsg, size_t errmsg_sz)
+{
+  int num_columns = 0, max_columns = 16;
+  *var_of_column = malloc(max_columns * sizeof(int));
+  const char **names = malloc(2 * max_columns * sizeof(char *));
+  assert(*var_of_column && names);
+
+  for (int c = 0; text <= end; c++)
+  {
+    const char *field_end = _CS_skip(text, end);
+    const char *name = text, *name_end = field_end;
+    while (name < name_end && (*name == ' ' || *name == '\t' || *name == '"'))
+      name++;
+    while (name_end > name && (name_end[-1] == ' ' || name_end[-1] == '\t' ||
+                               name_end[-1] == '\r' || name_end[-1] == '"'))
+      name_end--;
+
+    if (c == max_columns)
+    {
+      max_columns *= 2;
+      *var_of_column = realloc(*var_of_column, max_columns * sizeof(int));
+      names = realloc(names, 2 * max_columns * sizeof(char *));
+      assert(*var_of_column && names);
+    }
+
+    // a name given twice would leave it unclear which column is meant
+    for (int d = 0; d < c && name < name_end; d++)
+      if (names[2 * d + 1] - names[2 * d] == name_end - name &&
+          memcmp(names[2 * d], name, name_end - name) == 0)
+      {
+        snprintf(errmsg, errmsg_sz, "Error: %.*s is given twice", (int)(name_end - name), name);
+        free(names);
+        return -1;
+      }
+    names[2 * c] = name;
+    names[2 * c + 1] = name_end;
+
+    (*var_of_column)[c] = -1;
+    for (int v = 0; v < EW_num_vars(p); v++)
+    {
+      const char *var = EW_var_name(p, v);
+      if (!is_column[v] && strlen(var) == name_end - name && strncmp(var, name, name_end - name) == 0)
+      {
+        (*var_of_column)[c] = v;
+        is_column[v] = true;
+        num_columns = c + 1;
+      }
+    }
+    text = field_end + 1;
+  }
+  free(names);
+  return num_columns;
+}
+
+// Evaluate a block of rows and write out the results; returns false if
+// writing fails
+static bool _CS_flush(Prepared p, double **columns, const bool *is_column,
+                      const double *values, int rows, double *results, char *text, FILE *out)
+{
+  // the other variables are filled in again, as the expression may
+  // assign them
+  for (int v = 0; v < EW_num_vars(p); v++)
+    if (!is_column[v])
+      for (int i = 0; i < rows; i++)
+        columns[v][i] = values[v];
+
+  char ignored[128] = "";
+  EW_execute_batch(p, columns, rows, results, 0, ignored, sizeof(ignored));
+
+  // NaN is written without the sign some printfs give it
+  char *end = text;
+  for (int i = 0; i < rows; i++)
+    end += isnan(results[i]) ? sprintf(end, "nan\n") : sprintf(end, "%.17g\n", results[i]);
+  return fwrite(text, 1, end - text, out) == (size_t)(end - text);
+}
+
+// Whether a file is the same regular file as fd
+static bool _CS_same_file(FILE *f, int fd)
+{
+  struct stat a, b;
+  return fstat(fileno(f), &a) == 0 && fstat(fd, &b) == 0 && S_ISREG(a.st_mode) &&
+         a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+// Documented in .h file
+FILE *CS_open_output(FILE *in, const char *path, char *errmsg, size_t errmsg_sz)
+{
+  // open the file without emptying it, until it is known not to be in
+  int fd = open(path, O_WRONLY | O_CREAT, 0666);
+  if (fd >= 0 && _CS_same_file(in, fd))
+  {
+    snprintf(errmsg, errmsg_sz, "Error: %s is also the input", path);
+    close(fd);
+    return NULL;
+  }
+
+  struct stat st;
+  FILE *out = NULL;
+  if (fd >= 0 && fstat(fd, &st) == 0 && (!S_ISREG(st.st_mode) || ftruncate(fd, 0) == 0) &&
+      (out = fdopen(fd, "w")) != NULL)
+    return out;
+  snprintf(errmsg, errmsg_sz, "Error: Cannot open %s", path);
+  if (fd >= 0)
+    close(fd);
+  return NULL;
+}
+
+// Documented in .h file
+long CS_evaluate(ExprTree tree, FILE *in, CDict vars, FILE *out, char *errmsg, size_t errmsg_sz)
+{
+  if (_CS_same_file(in, fileno(out)))
+  {
+    snprintf(errmsg, errmsg_sz, "Error: The output is also the input");
+    return -1;
+  }
+  Prepared p = EW_compile(tree, errmsg, errmsg_sz);
+  if (p == NULL)
+    return -1;
+
+  int num_vars = EW_num_vars(p);
+  CSReader r = {.in = in, .cap = CS_BUFFER_BYTES};
+  r.buffer = malloc(r.cap);
+  double *values = malloc((num_vars + 1) * sizeof(double));
+  double *data = malloc(((size_t)num_vars + 1) * CS_BLOCK * sizeof(double));
+  char *text = malloc((size_t)CS_BLOCK * CS_NUMBER_LEN + 1);
+  bool is_column[num_vars + 1];
+  int *var_of_column = NULL;
+  double *columns[num_vars + 1];
+  long total = -1;
+  assert(r.buffer && values && data && text);
+  EW_bind_dict(p, values, vars);
+  for (int v = 0; v < num_vars; v++)
+  {
+    columns[v] = data + (size_t)v * CS_BLOCK;
+    is_column[v] = false;
+  }
+  double *results = data + (size_t)num_vars * CS_BLOCK;
+
+  size_t whole = _CS_read(&r);
+  const char *line = r.buffer, *end = r.buffer + whole;
+  if (whole == 0)
+  {
+    snprintf(errmsg, errmsg_sz, ferror(in) ? "Error: Could not read the CSV file"
+                                           : "Error: The CSV file has no header");
+    goto done;
+  }
+  const char *newline = memchr(line, '\n', end - line);
+  int num_columns = _CS_header(line, newline ? newline : end, p, &var_of_column, is_column,
+                               errmsg, errmsg_sz);
+  if (num_columns < 0)
+    goto done;
+  line = newline ? newline + 1 : end;
+
+  // a variable that is neither a column nor set, nor assigned before it
+  // is read, would make every row an error
+  for (int v = 0; v < num_vars; v++)
+  {
+    CSAssigned assigned = {EW_var_name(p, v), false};
+    ET_foreach_symbol(tree, _CS_assigned, &assigned);
+    if (!is_column[v] && isnan(values[v]) && !assigned.assigned)
+    {
+      snprintf(errmsg, errmsg_sz, "Undefined variable: %s", EW_var_name(p, v));
+      goto done;
+    }
+  }
+
+  bool ok = fputs("value\n", out) >= 0;
+  long rows = 0, blank = 0;
+  int row = 0;
+  while (ok && whole > 0)
+  {
+    while (ok && line < end)
+    {
+      // blank lines are rows of NaN, as in a file of one column, but
+      // are counted until a row follows them, so those that end the
+      // file are dropped
+      const char *first = line;
+      while (first < end && (*first == ' ' || *first == '\t' || *first == '\r'))
+        first++;
+      if (first == end || *first == '\n')
+      {
+        blank++;
+        line = first < end ? first + 1 : end;
+        continue;
+      }
+
+      for (; ok && blank >= 0; blank--)
+      {
+        if (blank > 0)
+        {
+          for (int c = 0; c < num_columns; c++)
+            if (var_of_column[c] >= 0)
+              columns[var_of_column[c]][row] = NAN;
+        }
+        else
+          line = _CS_row(line, end, var_of_column, num_columns, columns, row);
+        if (++row == CS_BLOCK)
+        {
+          ok = _CS_flush(p, columns, is_column, values, row, results, text, out);
+          rows += row;
+          row = 0;
+        }
+      }
+      blank = 0;
+    }
+    whole = _CS_read(&r);
+    line = r.buffer;
+    end = r.buffer + whole;
+  }
+  if (ok && row > 0)
+  {
+    ok = _CS_flush(p, columns, is_column, values, row, results, text, out);
+    rows += row;
+  }
+  ok = ok && fflush(out) == 0;
+
+  if (ferror(in))
+    snprintf(errmsg, errmsg_sz, "Error: Could not read the CSV file");
+  else if (!ok)
+    snprintf(errmsg, errmsg_sz, "Error: Could not write the column");
+  else
+    total = rows;
+
+done:
+  free(var_of_column);
+  free(text);
+  free(data);
+  free(values);
+  free(r.buffer);
+  EW_free(p);
+  return total;
+}
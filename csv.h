@@ -0,0 +1,100 @@
+/*
+ * csv.h
+ *
+ * Evaluation of an expression over the rows of a CSV file, whose header
+ * names the variables held in its columns.
+ *
+ * The file is read a buffer at a time and scanned in place: the fields
+ * of the columns the expression reads are converted to numbers, and the
+ * others skipped over eight bytes at a time. The rows are gathered into
+ * blocks of CS_BLOCK, each evaluated with one call of EW_execute_batch
+ * and written out at once as a column of results, so memory use depends
+ * on the block and buffer sizes, not on the size of the file.
+ *
+ * Fields are separated by commas, and may be quoted; a quoted field
+ * cannot span lines. Every line after the header is a row, a blank one
+ * of NaN fields, except for blank lines at the end of the file.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _CSV_H_
+#define _CSV_H_
+
+#include <stdio.h>
+
+#include "cdict.h"
+#include "expr_tree.h"
+
+// The rows evaluated and written at once
+#define CS_BLOCK 1024
+
+// The input read at once, in bytes; a buffer holds whole lines, so it
+// grows to hold a longer one
+#define CS_BUFFER_BYTES (256 * 1024)
+
+
+/*
+ * Evaluate an expression on every row of a CSV file, and write the
+ * results out in order, as a column headed "value" with enough digits
+ * to be read back exactly
+ *
+ * A variable named in the file's header takes its value in each row
+ * from that column; other variables keep their values in vars. A field
+ * that is empty or not a number, or missing from a short row, is NaN,
+ * and so, usually, is the result for that row. Results with an error
+ * are written as NaN.
+ *
+ * Parameters:
+ *   tree       The expression, with calls inlined (see FT_inline); it is
+ *              not modified, and the caller retains ownership of it
+ *   in         The CSV file, from its header line
+ *   vars       The values of the variables not in the file
+ *   out        Where to write the results
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The number of rows evaluated, or -1 with an error message
+ *   copied into errmsg if the file has no header or its header gives a
+ *   name twice, out is the same file as in, the expression cannot be
+ *   compiled or reads a variable with no value, or reading or writing
+ *   fails
+ */
+long CS_evaluate(ExprTree tree, FILE *in, CDict vars, FILE *out, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Open a file to write results to, refusing the CSV file being read,
+ * which writing would change before it is read. The file is emptied
+ * only once it is known not to be that file.
+ *
+ * Parameters:
+ *   in         The CSV file
+ *   path       The file to open
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The open file, which the caller must close, or NULL with an
+ *   error message copied into errmsg if the file is in, by any name, or
+ *   cannot be opened
+ */
+FILE *CS_open_output(FILE *in, const char *path, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Convert the number at the start of a field, as strtod does, but
+ * reading no further than end. Decimal numbers of up to 19 significant
+ * digits and a power of ten within 1e22 of them, the most common, are
+ * converted directly, and exactly; others are passed to strtod.
+ *
+ * Parameters:
+ *   p          The start of the number
+ *   end        The end of the text, which need not be terminated
+ *   value      Return space for the number
+ *
+ * Returns: The character after the number, or NULL if there is none
+ */
+const char *CS_number(const char *p, const char *end, double *value);
+
+
+#endif /* _CSV_H_ */
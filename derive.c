@@ -0,0 +1,589 @@
+/*
+ * derive.c
+ *
+ * Symbolic differentiation of ExprTrees, with simplification
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "derive.h"
+#include "functions.h"
+
+// The derivative of each distinct subtree differentiated so far
+typedef struct
+{
+  uint64_t hash;
+  ExprTree deriv;   // NULL if the slot is empty
+} DVEntry;
+
+typedef struct
+{
+  const char *var;
+  DVEntry *done;
+  unsigned int mask;
+  bool failed;
+  char *errmsg;
+  size_t errmsg_sz;
+} DVContext;
+
+static bool _DV_is(ExprTree tree, double value)
+{
+  return ET_type(tree) == VALUE && ET_get_value(tree) == value;
+}
+
+// Are two trees the same? Decided by their hashes, as memo.c does
+static bool _DV_same(ExprTree a, ExprTree b)
+{
+  return ET_hash(a) == ET_hash(b);
+}
+
+static ExprTree _DV_number(ETNumber num)
+{
+  return num.is_int ? ET_integer(num.i) : ET_value(num.d);
+}
+
+static ExprTree _DV_zero(void)
+{
+  return ET_integer(0);
+}
+
+/*
+ * Fold op(left, right), taking ownership of the operands, if they are
+ * constants and that would hide no error
+ *
+ * Returns: The constant, or NULL, the operands then left alone
+ */
+static ExprTree _DV_fold(ExprNodeType op, ExprTree left, ExprTree right)
+{
+  if (ET_type(left) != VALUE || (right && ET_type(right) != VALUE))
+    return NULL;
+
+  char err[128] = "";
+  ETNumber result = ET_apply_number(op, ET_get_number(left),
+                                    right ? ET_get_number(right) : ET_get_number(left),
+                                    err, sizeof(err));
+  if (err[0] != '\0' || (!result.is_int && isnan(result.d)))
+    return NULL;
+  ET_free(left);
+  ET_free(right);
+  return _DV_number(result);
+}
+
+/*
+ * A copy of a subtree of the expression, with its operators on
+ * constants folded
+ */
+static ExprTree _DV_copy(ExprTree tree)
+{
+  ExprNodeType type = ET_type(tree);
+
+  if (type == FUNC_CALL)
+  {
+    ExprTree args[BI_MAX_ARGS];
+    for (int i = 0; i < ET_num_args(tree); i++)
+      args[i] = _DV_copy(ET_arg(tree, i));
+    return ET_call(ET_call_function(tree), args);
+  }
+  // the operators, UNARY_NEGATE to OP_NE, are folded, and the logical
+  // and conditional ones, to OP_BRANCHES, are copied around what is
+  if (type < UNARY_NEGATE || type > OP_BRANCHES)
+    return ET_copy(tree);
+
+  ExprTree left = _DV_copy(ET_child(tree, 0));
+  ExprTree right = ET_child(tree, 1) ? _DV_copy(ET_child(tree, 1)) : NULL;
+  ExprTree folded = type <= OP_NE ? _DV_fold(type, left, right) : NULL;
+  return folded ? folded : ET_node(type, left, right);
+}
+
+/*
+ * Build the node op(left, right), taking ownership of the operands,
+ * simplified where the rules below allow
+ */
+static ExprTree _DV_node(ExprNodeType op, ExprTree left, ExprTree right)
+{
+  ExprTree folded = _DV_fold(op, left, right);
+  if (folded)
+    return folded;
+
+  ExprTree keep = NULL;
+  switch (op)
+  {
+  case OP_ADD:
+    if (_DV_is(left, 0))
+      keep = right;
+    else if (_DV_is(right, 0))
+      keep = left;
+    else if (_DV_same(left, right))
+    {
+      ET_free(right);
+      return _DV_node(OP_MUL, ET_integer(2), left);
+    }
+    else if (ET_type(right) == UNARY_NEGATE)
+    {
+      ExprTree negated = ET_copy(ET_child(right, 0));
+      ET_free(right);
+      return _DV_node(OP_SUB, left, negated);
+    }
+    break;
+
+  case OP_SUB:
+    if (_DV_is(right, 0))
+      keep = left;
+    else if (_DV_is(left, 0))
+    {
+      ET_free(left);
+      return _DV_node(UNARY_NEGATE, right, NULL);
+    }
+    else if (_DV_same(left, right))
+    {
+      ET_free(left);
+      ET_free(right);
+      return _DV_zero();
+    }
+    break;
+
+  case OP_MUL:
+    if (_DV_is(left, 0) || _DV_is(right, 0))
+    {
+      ET_free(left);
+      ET_free(right);
+      return _DV_zero();
+    }
+    if (_DV_is(left, 1))
+      keep = right;
+    else if (_DV_is(right, 1))
+      keep = left;
+    else if (ET_type(right) == VALUE)
+      return _DV_node(OP_MUL, right, left); // constants to the left
+    else if (_DV_is(left, -1))
+    {
+      ET_free(left);
+      return _DV_node(UNARY_NEGATE, right, NULL);
+    }
+    else if (ET_type(left) == VALUE && ET_type(right) == OP_MUL &&
+             ET_type(ET_child(right, 0)) == VALUE)
+    {
+      // c1 * (c2 * x) = (c1 * c2) * x
+      ExprTree k = _DV_node(OP_MUL, left, ET_copy(ET_child(right, 0)));
+      ExprTree x = ET_copy(ET_child(right, 1));
+      ET_free(right);
+      return _DV_node(OP_MUL, k, x);
+    }
+    else if (_DV_same(left, right))
+    {
+      ET_free(right);
+      return _DV_node(OP_POWER, left, ET_integer(2));
+    }
+    else if (ET_type(left) == UNARY_NEGATE || ET_type(right) == UNARY_NEGATE)
+    {
+      // a * -b = -(a * b), so that a sum of it becomes a difference
+      ExprTree *negated = ET_type(left) == UNARY_NEGATE ? &left : &right;
+      ExprTree x = ET_copy(ET_child(*negated, 0));
+      ET_free(*negated);
+      *negated = x;
+      return _DV_node(UNARY_NEGATE, _DV_node(OP_MUL, left, right), NULL);
+    }
+    break;
+
+  case OP_DIV:
+    if (_DV_is(right, 1))
+      keep = left;
+    else if (_DV_is(left, 0) && !_DV_is(right, 0))
+      keep = left;
+    break;
+
+  case OP_POWER:
+    if (_DV_is(right, 0) || _DV_is(left, 1))
+    {
+      ET_free(left);
+      ET_free(right);
+      return ET_integer(1);
+    }
+    if (_DV_is(right, 1))
+      keep = left;
+    break;
+
+  case UNARY_NEGATE:
+    if (ET_type(left) == UNARY_NEGATE)
+    {
+      ExprTree x = ET_copy(ET_child(left, 0));
+      ET_free(left);
+      return x;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  if (keep)
+  {
+    ET_free(keep == left ? right : left);
+    return keep;
+  }
+  return ET_node(op, left, right);
+}
+
+// A call of the builtin name of one argument, taking ownership of it
+static ExprTree _DV_call(const char *name, ExprTree arg)
+{
+  return ET_call(BI_lookup(name, 1), &arg);
+}
+
+// cond ? a : b, or just a if the branches are the same
+static ExprTree _DV_cond(ExprTree cond, ExprTree a, ExprTree b)
+{
+  if (_DV_same(a, b))
+  {
+    ET_free(cond);
+    ET_free(b);
+    return a;
+  }
+  return ET_node(OP_COND, cond, ET_node(OP_BRANCHES, a, b));
+}
+
+static ExprTree _DV_error(DVContext *dv, const char *msg)
+{
+  snprintf(dv->errmsg, dv->errmsg_sz, "%s", msg);
+  dv->failed = true;
+  return NULL;
+}
+
+static ExprTree _DV_derive(DVContext *dv, ExprTree tree);
+
+/*
+ * The derivative of a call of a builtin, whose arguments are a and b
+ * (NULL if it takes one) and their derivatives da and db; takes
+ * ownership of the derivatives
+ */
+static ExprTree _DV_derive_call(const Builtin *fn, ExprTree a, ExprTree b, ExprTree da,
+                                ExprTree db)
+{
+  const char *name = fn->name;
+
+  if (fn->reduce)
+    return da; // the identity on numbers
+
+  if (fn->num_args == 2)
+  {
+    ExprNodeType choose = strcmp(name, "min") == 0 ? OP_LT : OP_GT;
+    return _DV_cond(ET_node(choose, _DV_copy(a), _DV_copy(b)), da, db);
+  }
+
+  ExprTree outer;
+  if (strcmp(name, "sqrt") == 0)
+    return _DV_node(OP_DIV, da,
+                    _DV_node(OP_MUL, ET_integer(2), _DV_call("sqrt", _DV_copy(a))));
+  else if (strcmp(name, "log") == 0)
+    return _DV_node(OP_DIV, da, _DV_copy(a));
+  else if (strcmp(name, "exp") == 0)
+    outer = _DV_call("exp", _DV_copy(a));
+  else if (strcmp(name, "sin") == 0)
+    outer = _DV_call("cos", _DV_copy(a));
+  else if (strcmp(name, "cos") == 0)
+    outer = _DV_node(UNARY_NEGATE, _DV_call("sin", _DV_copy(a)), NULL);
+  else
+  {
+    // abs: the sign of a, (a > 0) - (a < 0)
+    assert(strcmp(name, "abs") == 0);
+    outer = ET_node(OP_SUB, ET_node(OP_GT, _DV_copy(a), ET_integer(0)),
+                    ET_node(OP_LT, _DV_copy(a), ET_integer(0)));
+  }
+  return _DV_node(OP_MUL, outer, da);
+}
+
+// Is name the name of a variable or of a range's index in tree?
+static bool _DV_uses_name(ExprTree tree, const char *name)
+{
+  if (tree == NULL)
+    return false;
+
+  switch (ET_type(tree))
+  {
+  case VALUE:
+  case PARAM:
+    return false;
+
+  case SYMBOL:
+    return strcmp(ET_symbol_name(tree), name) == 0;
+
+  case RANGE_INDEX:
+    return strcmp(ET_index_name(tree), name) == 0;
+
+  case RANGE_SUM:
+  case RANGE_PROD:
+    if (strcmp(ET_index_name(tree), name) == 0)
+      return true;
+    // fall through
+  case FUNC_CALL:
+  case USER_CALL:
+  case ARRAY_LITERAL:
+    for (int i = 0; i < ET_num_args(tree); i++)
+      if (_DV_uses_name(ET_arg(tree, i), name))
+        return true;
+    return false;
+
+  default:
+    return _DV_uses_name(ET_child(tree, 0), name) || _DV_uses_name(ET_child(tree, 1), name);
+  }
+}
+
+/*
+ * The derivative of prod(i, lo, hi, f), whose body's derivative is
+ * df: sum(i, lo, hi, df * prod(i2, lo, hi, i2 == i ? 1 : f(i2))), which
+ * unlike prod * sum(df / f) holds where a term is 0. The inner index
+ * is given a name the product does not use, so that the derivative
+ * prints as it evaluates.
+ */
+static ExprTree _DV_derive_prod(ExprTree tree, ExprTree df)
+{
+  const char *index = ET_index_name(tree);
+  char fresh[strlen(index) + 12];
+  int n = 2;
+  do
+    snprintf(fresh, sizeof(fresh), "%s%d", index, n++);
+  while (_DV_uses_name(tree, fresh));
+
+  // the product, moved within the sum's body
+  ExprTree shifted = ET_shift_indexes(tree, 1);
+  ExprTree inner = ET_rename_index(shifted, fresh);
+  ET_free(shifted);
+  ExprTree body = ET_node(OP_COND,
+                          ET_node(OP_EQ, ET_range_index(0, fresh), ET_range_index(1, index)),
+                          ET_node(OP_BRANCHES, ET_integer(1), ET_copy(ET_arg(inner, 2))));
+  ExprTree others = ET_range(RANGE_PROD, fresh, ET_copy(ET_arg(inner, 0)),
+                             ET_copy(ET_arg(inner, 1)), body);
+  ET_free(inner);
+
+  return ET_range(RANGE_SUM, index, _DV_copy(ET_arg(tree, 0)), _DV_copy(ET_arg(tree, 1)),
+                  _DV_node(OP_MUL, df, others));
+}
+
+static ExprTree _DV_derive_node(DVContext *dv, ExprTree tree)
+{
+  ExprNodeType type = ET_type(tree);
+
+  switch (type)
+  {
+  case VALUE:
+  case PARAM:
+  case RANGE_INDEX:
+    return _DV_zero();
+
+  case SYMBOL:
+    return ET_integer(strcmp(ET_symbol_name(tree), dv->var) == 0);
+
+  case OP_ASSIGN:
+    return _DV_error(dv, "Error: Cannot differentiate an assignment");
+
+  case FUNC_DEF:
+    return _DV_error(dv, "Error: Function definition within an expression");
+
+  case ARRAY_LITERAL:
+    return _DV_error(dv, "Error: Arrays cannot be differentiated");
+
+  case OP_LT:
+  case OP_LE:
+  case OP_GT:
+  case OP_GE:
+  case OP_EQ:
+  case OP_NE:
+  case OP_AND:
+  case OP_OR:
+    return _DV_zero();
+
+  case OP_COND:
+  {
+    ExprTree branches = ET_child(tree, 1);
+    ExprTree da = _DV_derive(dv, ET_child(branches, 0));
+    ExprTree db = _DV_derive(dv, ET_child(branches, 1));
+    if (dv->failed)
+    {
+      ET_free(da);
+      ET_free(db);
+      return NULL;
+    }
+    return _DV_cond(_DV_copy(ET_child(tree, 0)), da, db);
+  }
+
+  case FUNC_CALL:
+  {
+    const Builtin *fn = ET_call_function(tree);
+    ExprTree a = ET_arg(tree, 0), b = fn->num_args == 2 ? ET_arg(tree, 1) : NULL;
+    ExprTree da = _DV_derive(dv, a);
+    ExprTree db = b ? _DV_derive(dv, b) : _DV_zero();
+    if (dv->failed)
+    {
+      ET_free(da);
+      ET_free(db);
+      return NULL;
+    }
+    if (_DV_is(da, 0) && _DV_is(db, 0))
+    {
+      ET_free(da);
+      return db;
+    }
+    if (b == NULL)
+      ET_free(db);
+    return _DV_derive_call(fn, a, b, da, b ? db : NULL);
+  }
+
+  case USER_CALL:
+  {
+    // a call left as a call is differentiated only if it is constant
+    const UserFunc *fn = ET_user_function(tree);
+    bool constant = fn != NULL;
+    for (int i = 0; constant && i < fn->num_symbols; i++)
+      constant = strcmp(fn->symbol[i], dv->var) != 0;
+    for (int i = 0; constant && i < ET_num_args(tree); i++)
+    {
+      ExprTree d = _DV_derive(dv, ET_arg(tree, i));
+      constant = d && _DV_is(d, 0);
+      ET_free(d);
+    }
+    if (dv->failed)
+      return NULL;
+    if (!constant)
+    {
+      snprintf(dv->errmsg, dv->errmsg_sz, "Error: Cannot differentiate a call of %s",
+               ET_call_name(tree));
+      dv->failed = true;
+      return NULL;
+    }
+    return _DV_zero();
+  }
+
+  case RANGE_SUM:
+  case RANGE_PROD:
+  {
+    ExprTree df = _DV_derive(dv, ET_arg(tree, 2));
+    if (df == NULL || _DV_is(df, 0))
+      return df;
+    if (type == RANGE_PROD)
+      return _DV_derive_prod(tree, df);
+    return ET_range(RANGE_SUM, ET_index_name(tree), _DV_copy(ET_arg(tree, 0)),
+                    _DV_copy(ET_arg(tree, 1)), df);
+  }
+
+  default:
+    break;
+  }
+
+  ExprTree a = ET_child(tree, 0), b = ET_child(tree, 1);
+  ExprTree da = _DV_derive(dv, a);
+  ExprTree db = b ? _DV_derive(dv, b) : NULL;
+  if (dv->failed)
+  {
+    ET_free(da);
+    ET_free(db);
+    return NULL;
+  }
+
+  switch (type)
+  {
+  case OP_ADD:
+  case OP_SUB:
+    return _DV_node(type, da, db);
+
+  case UNARY_NEGATE:
+    return _DV_node(UNARY_NEGATE, da, NULL);
+
+  case OP_MUL:
+    return _DV_node(OP_ADD, _DV_node(OP_MUL, da, _DV_copy(b)),
+                    _DV_node(OP_MUL, _DV_copy(a), db));
+
+  case OP_DIV:
+    // (da b - a db) / b^2, or da / b if b is constant
+    if (_DV_is(db, 0))
+    {
+      ET_free(db);
+      return _DV_node(OP_DIV, da, _DV_copy(b));
+    }
+    return _DV_node(OP_DIV,
+                    _DV_node(OP_SUB, _DV_node(OP_MUL, da, _DV_copy(b)),
+                             _DV_node(OP_MUL, _DV_copy(a), db)),
+                    _DV_node(OP_POWER, _DV_copy(b), ET_integer(2)));
+
+  case OP_POWER:
+    // b a^(b-1) da if b is constant; otherwise a^b (db ln a + b da / a)
+    if (_DV_is(db, 0))
+    {
+      ET_free(db);
+      ExprTree exponent = _DV_node(OP_SUB, _DV_copy(b), ET_integer(1));
+      return _DV_node(OP_MUL,
+                      _DV_node(OP_MUL, _DV_copy(b), _DV_node(OP_POWER, _DV_copy(a), exponent)),
+                      da);
+    }
+    return _DV_node(OP_MUL, _DV_node(OP_POWER, _DV_copy(a), _DV_copy(b)),
+                    _DV_node(OP_ADD, _DV_node(OP_MUL, db, _DV_call("log", _DV_copy(a))),
+                             _DV_node(OP_DIV, _DV_node(OP_MUL, _DV_copy(b), da), _DV_copy(a))));
+
+  default:
+    ET_free(da);
+    ET_free(db);
+    return _DV_error(dv, "Error: Invalid operator");
+  }
+}
+
+/*
+ * The derivative of tree, as found in dv->done if the same subtree
+ * has been differentiated already
+ */
+static ExprTree _DV_derive(DVContext *dv, ExprTree tree)
+{
+  if (dv->failed)
+    return NULL;
+
+  uint64_t hash = ET_hash(tree);
+  unsigned int i = hash & dv->mask;
+  while (dv->done[i].deriv && dv->done[i].hash != hash)
+    i = (i + 1) & dv->mask;
+  if (dv->done[i].deriv)
+    return ET_copy(dv->done[i].deriv);
+
+  ExprTree deriv = _DV_derive_node(dv, tree);
+  if (deriv)
+  {
+    // the table has room for every subtree; the subtree's own may have
+    // taken slot i meanwhile
+    while (dv->done[i].deriv)
+      i = (i + 1) & dv->mask;
+    dv->done[i].hash = hash;
+    dv->done[i].deriv = ET_copy(deriv);
+  }
+  return deriv;
+}
+
+// Documented in .h file
+ExprTree ET_derive(ExprTree tree, const char *var, char *errmsg, size_t errmsg_sz)
+{
+  assert(tree && var);
+
+  // at most half full, so that probes stay short
+  unsigned int size = 16;
+  while (size < 2 * (unsigned int)ET_count(tree))
+    size *= 2;
+
+  DVContext dv = {.var = var, .mask = size - 1, .errmsg = errmsg, .errmsg_sz = errmsg_sz};
+  dv.done = calloc(size, sizeof(DVEntry));
+  assert(dv.done);
+
+  ExprTree deriv = _DV_derive(&dv, tree);
+
+  for (unsigned int i = 0; i < size; i++)
+    ET_free(dv.done[i].deriv);
+  free(dv.done);
+
+  if (dv.failed)
+  {
+    ET_free(deriv);
+    return NULL;
+  }
+  return deriv;
+}
@@ -0,0 +1,57 @@
+/*
+ * derive.h
+ *
+ * Symbolic differentiation: the derivative of an expression as
+ * another expression, which can be printed, evaluated or compiled by
+ * any of the backends like one that was parsed, and then evaluated
+ * again and again without differentiating anew (compare autodiff.h,
+ * which differentiates numerically at one point per call).
+ *
+ * The derivative is simplified as it is built: constants are folded,
+ * in the parts copied from the expression too, terms that are 0 or
+ * factors that are 1 are dropped, and subtrees that are structurally
+ * equal, as found by their hashes (see ET_hash), cancel or combine,
+ * as in x - x or y + y. A quotient y / y is kept, as y may be 0, and
+ * no folding hides an error such as 0 / 0. A subtree that occurs
+ * several times is differentiated only once, its derivative then
+ * being copied.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _DERIVE_H_
+#define _DERIVE_H_
+
+#include "expr_tree.h"
+
+
+/*
+ * Differentiate an expression with respect to one variable
+ *
+ * The expression may hold the operators, builtins, conditionals and
+ * ranges that ET_evaluate does. A conditional's derivative is that of
+ * the branch taken, as is that of abs, min and max where they have
+ * none; comparisons and logical operators have derivative 0. Calls of
+ * user-defined functions must have been inlined (see FT_inline).
+ *
+ * The derivative of a product over a range of n terms is the sum, over
+ * each term, of its derivative times the product of the n - 1 others,
+ * which holds where a term is 0 but evaluates the terms O(n^2) times,
+ * where the product evaluates them n times.
+ *
+ * Parameters:
+ *   tree       The expression; it is not modified
+ *   var        The variable
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The derivative, a new tree that it is up to the caller to
+ *   ET_free. If the expression assigns a variable, defines a function,
+ *   holds an array or calls a function left as a call (a recursive
+ *   one) that depends on var, copies an error message into errmsg and
+ *   returns NULL.
+ */
+ExprTree ET_derive(ExprTree tree, const char *var, char *errmsg, size_t errmsg_sz);
+
+
+#endif /* _DERIVE_H_ */
@@ -0,0 +1,1123 @@
+/*
+ * ew_bench.c
+ *
+ * Benchmarks for the ExprWhizz evaluation backends
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clist.h"
+#include "tokenize.h"
+#include "expr_tree.h"
+#include "parse.h"
+#include "prepared.h"
+#include "closure.h"
+#include "fastmath.h"
+#include "array.h"
+#include "range.h"
+#include "autodiff.h"
+#include "derive.h"
+#include "solve.h"
+#include "quad.h"
+#include "montecarlo.h"
+#include "grid.h"
+#include "batch.h"
+#include "csv.h"
+#include "colfile.h"
+
+#define DEFAULT_ITERATIONS 1000000
+#define BATCH_ROWS 4096
+#define ACCURACY_SAMPLES 1000000
+
+static const char *bench_exprs[] = {
+  "x + 1",
+  "a * x + b",
+  "(x + 1) * (x - 1) / (y + 2)",
+  "a * x ^ 3 + b * x ^ 2 + c * x + 4",
+  "((a - b) * (x + y) - (a + b) * (x - y)) / ((x * x + y * y) + 1)",
+};
+static const int num_bench_exprs = sizeof(bench_exprs) / sizeof(bench_exprs[0]);
+
+// Further expressions for the batch benchmarks only, whose cost is in
+// pow() and the builtin functions
+static const char *batch_exprs[] = {
+  "x ^ y",
+  "a * x ^ 2.5 + b * y ^ -0.5",
+  "sqrt(x * x + y * y)",
+  "exp(-x) * log(y) + max(x, y)",
+  "x > y ? sqrt(x) : a * y * y",
+};
+static const int num_batch_exprs = sizeof(batch_exprs) / sizeof(batch_exprs[0]);
+
+// The bodies of the sums over ranges, whose index is i
+static const char *range_bodies[] = {
+  "1 / i ^ 2",
+  "sqrt(i) * x",
+  "i > 1000 ? x / i : -x / i",
+};
+static const int num_range_bodies = sizeof(range_bodies) / sizeof(range_bodies[0]);
+
+// Equations in x, with an interval holding a root (or a starting point)
+static const struct { const char *expr; double lo, hi; } equations[] = {
+  {"x * x - 2", 0, 2},
+  {"x * x - 2", 1, 1},
+  {"cos(x) - x", 0, 1},
+  {"a * x ^ 3 + b * x ^ 2 + c * x - 40", 0, 10},
+  {"exp(-x) * log(x + 1) - 0.1", 0, 1},
+  {"sqrt(x * x + y * y) - 10", 0, 20},
+  {"x > 3 ? x * x - 20 : x - 30", 0, 40},
+};
+static const int num_equations = sizeof(equations) / sizeof(equations[0]);
+
+// Integrands in x, with their bounds
+static const struct { const char *expr; double a, b; } integrands[] = {
+  {"x * x", 0, 1},
+  {"exp(-x * x / 2)", -10, 10},
+  {"sqrt(x) * log(x + a)", 0, 4},
+  {"abs(x - 1 / 3) * sin(x)", 0, 3},
+  {"sin(1 / x)", 0.01, 1},
+  {"sin(50 * x) ^ 2 / (1 + x * x)", 0, 20},
+};
+static const int num_integrands = sizeof(integrands) / sizeof(integrands[0]);
+
+// Expressions of the random variables in bench_montecarlo: x is
+// normal(0, 1), y uniform(0, 1), z lognormal(0, 0.25) and w
+// exponential(1)
+static const char *mc_exprs[] = {
+  "x",
+  "x * y + z",
+  "exp(-x * x / 2) * w",
+  "sqrt(z) * log(1 + w) - y",
+};
+static const int num_mc_exprs = sizeof(mc_exprs) / sizeof(mc_exprs[0]);
+
+// Expressions of x, y and z tabulated by bench_tabulate
+static const char *grid_exprs[] = {
+  "x * y * z",
+  "sin(x) * cos(y) + exp(-z * z)",
+  "sqrt(x * x + y * y + z * z)",
+};
+static const int num_grid_exprs = sizeof(grid_exprs) / sizeof(grid_exprs[0]);
+
+// The lines of the files run by bench_batch_file, repeated in turn
+static const char *file_lines[] = {
+  "x = 1.5",
+  "y = x * 2 + 1",
+  "sin(x) * cos(y) + exp(-x * x / 2)",
+  "x = x + 0.25",
+  "(x + 1) * (y - 1) / (x * y + 1) - sqrt(x * x + y * y)",
+};
+static const int num_file_lines = sizeof(file_lines) / sizeof(file_lines[0]);
+
+// Expressions over the columns of bench_csv's file, "id,label,x,y,z"
+static const char *csv_exprs[] = {
+  "x * y + z",
+  "sqrt(x * x + y * y) * exp(-z)",
+};
+static const int num_csv_exprs = sizeof(csv_exprs) / sizeof(csv_exprs[0]);
+
+
+/*
+ * Return the current time in seconds, from a monotonic clock
+ */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Tokenize and parse a string, exiting on error
+ */
+static ExprTree parse_or_die(const char *input)
+{
+  char errmsg[128];
+  CList tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+  ExprTree tree = tokens ? Parse(tokens, errmsg, sizeof(errmsg)) : NULL;
+  CL_free(tokens);
+
+  if (tree == NULL) {
+    fprintf(stderr, "%s: %s\n", input, errmsg);
+    exit(1);
+  }
+  return tree;
+}
+
+
+/*
+ * Time the tree walker, the bytecode VM and the closure compiler on
+ * one expression, printing nanoseconds per evaluation for each
+ */
+static void bench_backends(const char *expr, long iterations)
+{
+  const char *names[] = {"a", "b", "c", "x", "y"};
+  const int num_names = sizeof(names) / sizeof(names[0]);
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  Prepared p = EW_compile(tree, errmsg, sizeof(errmsg));
+  Closure cc = CC_compile(tree, errmsg, sizeof(errmsg));
+  CDict dict = CD_new();
+  double values[num_names];
+  volatile double sink = 0;
+
+  for (int i = 0; i < num_names; i++)
+    CD_store(dict, names[i], i + 1.5);
+  EW_bind_dict(p, values, dict);
+  int slot_x = EW_var_slot(p, "x");
+
+  double start = now();
+  for (long i = 0; i < iterations; i++) {
+    CD_store(dict, "x", i & 1023);
+    sink += ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+  }
+  double t_tree = now() - start;
+
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    if (slot_x >= 0)
+      values[slot_x] = i & 1023;
+    sink += EW_execute(p, values, errmsg, sizeof(errmsg));
+  }
+  double t_bytecode = now() - start;
+
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    if (slot_x >= 0)
+      values[slot_x] = i & 1023;
+    sink += CC_execute(cc, values, errmsg, sizeof(errmsg));
+  }
+  double t_closure = now() - start;
+
+  printf("%-66s tree %7.1f  bytecode %7.1f  closure %7.1f ns/eval\n", expr,
+         t_tree * 1e9 / iterations, t_bytecode * 1e9 / iterations,
+         t_closure * 1e9 / iterations);
+
+  (void)sink;
+  CC_free(cc);
+  EW_free(p);
+  ET_free(tree);
+  CD_free(dict);
+}
+
+
+/*
+ * Return the distance from approx to exact in units of the spacing of
+ * doubles at exact
+ */
+static double ulp_error(double approx, double exact)
+{
+  if (approx == exact || (isnan(approx) && isnan(exact)))
+    return 0;
+  if (isinf(exact) || isnan(approx) || isnan(exact))
+    return INFINITY;
+
+  double ulp = nextafter(fabs(exact), INFINITY) - fabs(exact);
+  return fabs(approx - exact) / ulp;
+}
+
+
+/*
+ * Return a pseudo-random double, uniform in [lo, hi)
+ */
+static double uniform(double lo, double hi)
+{
+  return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+
+/*
+ * Compare the fastmath.h functions against libm, printing the maximum
+ * and mean error in ulps over each range sampled. For general pow,
+ * also print the largest ratio of error to the documented bound.
+ */
+static void report_accuracy()
+{
+  const double small_ints[] = {0, 1, 2, 3, 4, -1, -2, 0.5};
+  const int num_small_ints = sizeof(small_ints) / sizeof(small_ints[0]);
+  double max_err, sum_err, worst_ratio;
+
+  printf("\nRelaxed math accuracy against libm (%d samples each):\n", ACCURACY_SAMPLES);
+  srand(1);
+
+  max_err = sum_err = 0;
+  for (int i = 0; i < ACCURACY_SAMPLES; i++) {
+    double x = exp(uniform(-700, 700));
+    double err = ulp_error(FM_log(x), log(x));
+    max_err = fmax(max_err, err);
+    sum_err += err;
+  }
+  printf("  %-44s max %8.2f  mean %6.3f ulp\n", "FM_log  x in [e^-700, e^700]",
+         max_err, sum_err / ACCURACY_SAMPLES);
+
+  max_err = sum_err = 0;
+  for (int i = 0; i < ACCURACY_SAMPLES; i++) {
+    double t = uniform(-708, 708);
+    double err = ulp_error(FM_exp(t), exp(t));
+    max_err = fmax(max_err, err);
+    sum_err += err;
+  }
+  printf("  %-44s max %8.2f  mean %6.3f ulp\n", "FM_exp  t in [-708, 708]",
+         max_err, sum_err / ACCURACY_SAMPLES);
+
+  max_err = sum_err = 0;
+  for (int i = 0; i < ACCURACY_SAMPLES; i++) {
+    double x = exp(uniform(-100, 100));
+    double y = small_ints[i % num_small_ints];
+    double err = ulp_error(FM_pow(x, y), pow(x, y));
+    max_err = fmax(max_err, err);
+    sum_err += err;
+  }
+  printf("  %-44s max %8.2f  mean %6.3f ulp\n", "FM_pow  y in {0,1,2,3,4,-1,-2,0.5}",
+         max_err, sum_err / ACCURACY_SAMPLES);
+
+  const struct { const char *label; double log_lo, log_hi, y_lo, y_hi; } ranges[] = {
+    {"FM_pow  x in [1/2, 2],       y in [-10, 10]", -0.69, 0.69, -10, 10},
+    {"FM_pow  x in [e^-20, e^20],  y in [-10, 10]", -20, 20, -10, 10},
+    {"FM_pow  x in [e^-700, e^700], |y ln x| < 700", -700, 700, -1, 1},
+  };
+  for (int r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+    max_err = sum_err = worst_ratio = 0;
+    for (int i = 0; i < ACCURACY_SAMPLES; i++) {
+      double x = exp(uniform(ranges[r].log_lo, ranges[r].log_hi));
+      double y = uniform(ranges[r].y_lo, ranges[r].y_hi);
+      double err = ulp_error(FM_pow(x, y), pow(x, y));
+      max_err = fmax(max_err, err);
+      sum_err += err;
+      worst_ratio = fmax(worst_ratio, err / (2 + 3 * fabs(y * log(x))));
+    }
+    printf("  %-44s max %8.2f  mean %6.3f ulp  (%.2f of bound)\n", ranges[r].label,
+           max_err, sum_err / ACCURACY_SAMPLES, worst_ratio);
+  }
+}
+
+
+/*
+ * Time EW_execute row by row against EW_execute_batch, with and
+ * without relaxed math, on one expression, printing nanoseconds per row
+ */
+static void bench_batch(const char *expr, long iterations)
+{
+  char errmsg[128] = "";
+  Prepared p = EW_prepare(expr, errmsg, sizeof(errmsg));
+  if (p == NULL) {
+    fprintf(stderr, "%s: %s\n", expr, errmsg);
+    exit(1);
+  }
+
+  int num_vars = EW_num_vars(p);
+  double *columns[num_vars];
+  double *results = malloc(BATCH_ROWS * sizeof(double));
+  double values[num_vars];
+  volatile double sink = 0;
+  long rounds = iterations / BATCH_ROWS + 1;
+
+  srand(2);
+  for (int v = 0; v < num_vars; v++) {
+    columns[v] = malloc(BATCH_ROWS * sizeof(double));
+    for (int i = 0; i < BATCH_ROWS; i++)
+      columns[v][i] = uniform(0.5, 4);
+  }
+
+  double start = now();
+  for (long r = 0; r < rounds; r++)
+    for (int i = 0; i < BATCH_ROWS; i++) {
+      for (int v = 0; v < num_vars; v++)
+        values[v] = columns[v][i];
+      sink += EW_execute(p, values, errmsg, sizeof(errmsg));
+    }
+  double t_scalar = now() - start;
+
+  start = now();
+  for (long r = 0; r < rounds; r++) {
+    EW_execute_batch(p, columns, BATCH_ROWS, results, 0, errmsg, sizeof(errmsg));
+    sink += results[0];
+  }
+  double t_batch = now() - start;
+
+  start = now();
+  for (long r = 0; r < rounds; r++) {
+    EW_execute_batch(p, columns, BATCH_ROWS, results, EW_RELAXED_MATH, errmsg, sizeof(errmsg));
+    sink += results[0];
+  }
+  double t_relaxed = now() - start;
+
+  double rows = (double)rounds * BATCH_ROWS;
+  printf("%-40s scalar %7.1f  batch %7.1f  relaxed %7.1f ns/row\n", expr,
+         t_scalar * 1e9 / rows, t_batch * 1e9 / rows, t_relaxed * 1e9 / rows);
+
+  (void)sink;
+  for (int v = 0; v < num_vars; v++)
+    free(columns[v]);
+  free(results);
+  EW_free(p);
+}
+
+
+/*
+ * Time the tree-walking evaluator on an expression whose variables x
+ * and y are arrays of BATCH_ROWS elements, so that every operator runs
+ * element by element, against the batch evaluator on the same rows
+ */
+static void bench_arrays(const char *expr, long iterations)
+{
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  Prepared p = EW_compile(tree, errmsg, sizeof(errmsg));
+  CDict vars = CD_new();
+  long rounds = iterations / BATCH_ROWS + 1;
+  volatile double sink = 0;
+
+  srand(2);
+  CD_store(vars, "a", uniform(0.5, 4));
+  CD_store(vars, "b", uniform(0.5, 4));
+  CD_store(vars, "c", uniform(0.5, 4));
+  for (const char *name = "xy"; *name; name++) {
+    Array col = AR_new(BATCH_ROWS);
+    double *data = AR_mutable(&col);
+    for (int i = 0; i < BATCH_ROWS; i++)
+      data[i] = uniform(0.5, 4);
+    CD_store_array(vars, (char[]){*name, '\0'}, col);
+    AR_release(col);
+  }
+
+  // the batch evaluator reads the same rows as columns
+  int num_vars = EW_num_vars(p);
+  double *columns[num_vars];
+  double *results = malloc(BATCH_ROWS * sizeof(double));
+  for (int v = 0; v < num_vars; v++) {
+    columns[v] = malloc(BATCH_ROWS * sizeof(double));
+    Array col = CD_retrieve_array(vars, EW_var_name(p, v));
+    for (int i = 0; i < BATCH_ROWS; i++)
+      columns[v][i] = col ? AR_data(col)[i] : CD_retrieve(vars, EW_var_name(p, v));
+  }
+
+  double start = now();
+  for (long r = 0; r < rounds; r++) {
+    ETNumber result = ET_evaluate_number(tree, vars, errmsg, sizeof(errmsg));
+    sink += AR_data(result.array)[0];
+    AR_release(result.array);
+  }
+  double t_array = now() - start;
+
+  start = now();
+  for (long r = 0; r < rounds; r++) {
+    EW_execute_batch(p, columns, BATCH_ROWS, results, 0, errmsg, sizeof(errmsg));
+    sink += results[0];
+  }
+  double t_batch = now() - start;
+
+  double rows = (double)rounds * BATCH_ROWS;
+  printf("%-40s arrays %7.2f  batch %7.2f ns/element\n", expr,
+         t_array * 1e9 / rows, t_batch * 1e9 / rows);
+
+  (void)sink;
+  for (int v = 0; v < num_vars; v++)
+    free(columns[v]);
+  free(results);
+  EW_free(p);
+  CD_free(vars);
+  ET_free(tree);
+}
+
+
+/*
+ * Time a sum over a range of iterations indices, which is compiled
+ * and run in batches on several threads, against the same terms
+ * summed in ranges too short for that, which walk the tree
+ */
+static void bench_ranges(const char *body, long iterations)
+{
+  char errmsg[128] = "", expr[256];
+  const long walked = RG_BATCH_MIN - 1;
+  long rounds = iterations / walked + 1;
+  CDict vars = CD_new();
+  volatile double sink = 0;
+
+  CD_store(vars, "x", 0.75);
+
+  snprintf(expr, sizeof(expr), "sum(i, 1, %ld, %s)", iterations, body);
+  ExprTree tree = parse_or_die(expr);
+  double start = now();
+  sink += ET_evaluate(tree, vars, errmsg, sizeof(errmsg));
+  double t_range = now() - start;
+  ET_free(tree);
+
+  snprintf(expr, sizeof(expr), "sum(i, k, k + %ld, %s)", walked - 1, body);
+  tree = parse_or_die(expr);
+  start = now();
+  for (long r = 0; r < rounds; r++) {
+    CD_store(vars, "k", r * walked + 1);
+    sink += ET_evaluate(tree, vars, errmsg, sizeof(errmsg));
+  }
+  double t_walk = now() - start;
+  ET_free(tree);
+
+  printf("%-40s compiled %7.2f  tree walk %7.2f ns/index\n", body,
+         t_range * 1e9 / iterations, t_walk * 1e9 / (rounds * walked));
+
+  (void)sink;
+  CD_free(vars);
+}
+
+
+/*
+ * Time the gradient of an expression with respect to all five of its
+ * variables: by reverse mode, by forward mode one direction at a time,
+ * and by central differences, each against one evaluation
+ */
+static void bench_gradient(const char *expr, long iterations)
+{
+  const char *names[] = {"a", "b", "c", "x", "y"};
+  const int num_names = sizeof(names) / sizeof(names[0]);
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  CDict dict = CD_new();
+  double grad[num_names], deriv, unit[num_names];
+  volatile double sink = 0;
+
+  for (int i = 0; i < num_names; i++)
+    CD_store(dict, names[i], i + 1.5);
+
+  double start = now();
+  for (long i = 0; i < iterations; i++) {
+    CD_store(dict, "x", (i & 1023) + 0.5);
+    sink += ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+  }
+  double t_eval = now() - start;
+
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    CD_store(dict, "x", (i & 1023) + 0.5);
+    sink += ET_gradient(tree, dict, names, num_names, grad, errmsg, sizeof(errmsg));
+  }
+  double t_reverse = now() - start;
+
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    CD_store(dict, "x", (i & 1023) + 0.5);
+    for (int k = 0; k < num_names; k++) {
+      for (int j = 0; j < num_names; j++)
+        unit[j] = j == k;
+      sink += ET_directional(tree, dict, names, unit, num_names, &deriv, errmsg,
+                             sizeof(errmsg));
+    }
+  }
+  double t_forward = now() - start;
+
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    CD_store(dict, "x", (i & 1023) + 0.5);
+    for (int k = 0; k < num_names; k++) {
+      double v = CD_retrieve(dict, names[k]);
+      CD_store(dict, names[k], v + 1e-6);
+      sink += ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+      CD_store(dict, names[k], v - 1e-6);
+      sink -= ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+      CD_store(dict, names[k], v);
+    }
+  }
+  double t_diff = now() - start;
+
+  // each partial derivative differentiated symbolically once and
+  // compiled, then run as any compiled expression
+  Prepared p[num_names];
+  double *values[num_names];
+  int x_slot[num_names];
+  for (int k = 0; k < num_names; k++) {
+    ExprTree d = ET_derive(tree, names[k], errmsg, sizeof(errmsg));
+    p[k] = d ? EW_compile(d, errmsg, sizeof(errmsg)) : NULL;
+    ET_free(d);
+    if (!p[k]) {
+      printf("%-40s %s\n", expr, errmsg);
+      exit(1);
+    }
+    values[k] = malloc((EW_num_vars(p[k]) + 1) * sizeof(double));
+    EW_bind_dict(p[k], values[k], dict);
+    x_slot[k] = EW_var_slot(p[k], "x");
+  }
+  start = now();
+  for (long i = 0; i < iterations; i++) {
+    double x = (i & 1023) + 0.5;
+    for (int k = 0; k < num_names; k++) {
+      if (x_slot[k] >= 0)
+        EW_bind(p[k], values[k], x_slot[k], x);
+      sink += EW_execute(p[k], values[k], errmsg, sizeof(errmsg));
+    }
+  }
+  double t_symbolic = now() - start;
+  for (int k = 0; k < num_names; k++) {
+    EW_free(p[k]);
+    free(values[k]);
+  }
+
+  printf("%-40s reverse %5.1fx  forward %5.1fx  differences %5.1fx  symbolic %5.2fx\n", expr,
+         t_reverse / t_eval, t_forward / t_eval, t_diff / t_eval, t_symbolic / t_eval);
+
+  (void)sink;
+  CD_free(dict);
+  ET_free(tree);
+}
+
+
+/*
+ * Time SV_solve on one equation, printing its iterations and
+ * nanoseconds per iteration, against the nanoseconds of one tree walk
+ * of the expression, the least an iteration costs without compiling
+ */
+static void bench_solve(const char *expr, double lo, double hi, long iterations)
+{
+  const char *names[] = {"a", "b", "c", "y"};
+  const int num_names = sizeof(names) / sizeof(names[0]);
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  CDict dict = CD_new();
+  volatile double sink = 0;
+  int steps = 0;
+
+  for (int i = 0; i < num_names; i++)
+    CD_store(dict, names[i], i + 1.5);
+
+  long solves = iterations / 100 > 0 ? iterations / 100 : 1;
+  Solver s = SV_new(tree, "x", dict, errmsg, sizeof(errmsg));
+  double start = now();
+  for (long i = 0; i < solves; i++)
+    sink += SV_solve(s, lo, hi, &steps, errmsg, sizeof(errmsg));
+  double t_solve = now() - start;
+  SV_free(s);
+  if (errmsg[0] != '\0') {
+    printf("%-40s %s\n", expr, errmsg);
+    exit(1);
+  }
+
+  start = now();
+  for (long i = 0; i < solves; i++) {
+    CD_store(dict, "x", lo + (i & 1023) * 1e-3);
+    sink += ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+  }
+  double t_walk = now() - start;
+
+  printf("%-40s %3d iterations  %6.1f ns per iteration  (tree walk %6.1f ns)\n", expr, steps,
+         t_solve * 1e9 / solves / steps, t_walk * 1e9 / solves);
+
+  (void)sink;
+  CD_free(dict);
+  ET_free(tree);
+}
+
+
+/*
+ * Time QD_integrate on one integrand, printing the work it does and
+ * nanoseconds per evaluation of the integrand, against those of
+ * evaluating the same nodes one at a time with EW_execute
+ */
+static void bench_integrate(const char *expr, double a, double b, long iterations)
+{
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  CDict dict = CD_new();
+  QDStats stats;
+  volatile double sink = 0;
+
+  CD_store(dict, "a", 1.5);
+  double start = now();
+  long runs = 0, evaluations = 0;
+  while (evaluations < iterations) {
+    sink += QD_integrate(tree, "x", dict, a, b, &stats, errmsg, sizeof(errmsg));
+    evaluations += stats.evaluations;
+    runs++;
+  }
+  double t_quad = now() - start;
+  if (errmsg[0] != '\0') {
+    printf("%-40s %s\n", expr, errmsg);
+    exit(1);
+  }
+
+  Prepared p = EW_compile(tree, errmsg, sizeof(errmsg));
+  double values[EW_num_vars(p) + 1];
+  EW_bind_dict(p, values, dict);
+  int slot = EW_var_slot(p, "x");
+  start = now();
+  for (long i = 0; i < evaluations; i++) {
+    values[slot] = a + (b - a) * (i & 1023) / 1024.0;
+    sink += EW_execute(p, values, errmsg, sizeof(errmsg));
+  }
+  double t_scalar = now() - start;
+
+  printf("%-40s %6d intervals %8ld evaluations  %5.1f ns per evaluation  (one at a time %5.1f ns)\n",
+         expr, stats.intervals, stats.evaluations, t_quad * 1e9 / evaluations,
+         t_scalar * 1e9 / evaluations);
+
+  (void)sink;
+  EW_free(p);
+  CD_free(dict);
+  ET_free(tree);
+}
+
+
+/*
+ * Time a Monte Carlo run of an expression of the random variables in
+ * mc_exprs against drawing the same distributions one sample at a
+ * time with drand48() and libm, evaluating with EW_execute, and
+ * keeping only the mean and variance. Print nanoseconds per sample.
+ */
+static void bench_montecarlo(const char *expr, long samples)
+{
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  CDict dict = CD_new();
+  MOModel m = MO_new(1);
+  const double normal[2] = {0, 1}, uniform[2] = {0, 1}, lognormal[2] = {0, 0.25};
+  const double exponential[1] = {1};
+  MOStats stats;
+
+  MO_bind(m, "x", "normal", normal, 2, errmsg, sizeof(errmsg));
+  MO_bind(m, "y", "uniform", uniform, 2, errmsg, sizeof(errmsg));
+  MO_bind(m, "z", "lognormal", lognormal, 2, errmsg, sizeof(errmsg));
+  MO_bind(m, "w", "exponential", exponential, 1, errmsg, sizeof(errmsg));
+  double start = now();
+  MO_run(m, tree, dict, samples, &stats, errmsg, sizeof(errmsg));
+  double t_mc = now() - start;
+  if (errmsg[0] != '\0') {
+    printf("%-40s %s\n", expr, errmsg);
+    exit(1);
+  }
+
+  Prepared p = EW_compile(tree, errmsg, sizeof(errmsg));
+  double values[EW_num_vars(p) + 1];
+  int x = EW_var_slot(p, "x"), y = EW_var_slot(p, "y"), z = EW_var_slot(p, "z");
+  int w = EW_var_slot(p, "w");
+  double mean = 0, m2 = 0;
+  srand48(1);
+  start = now();
+  for (long i = 0; i < samples; i++) {
+    double u1 = 1 - drand48(), u2 = drand48(), u3 = 1 - drand48(), u4 = drand48();
+    if (x >= 0)
+      values[x] = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+    if (y >= 0)
+      values[y] = u4;
+    if (z >= 0)
+      values[z] = exp(0.25 * sqrt(-2 * log(u1)) * sin(2 * M_PI * u2));
+    if (w >= 0)
+      values[w] = -log(u3);
+    double r = EW_execute(p, values, errmsg, sizeof(errmsg)), delta = r - mean;
+    mean += delta / (i + 1);
+    m2 += delta * (r - mean);
+  }
+  double t_scalar = now() - start;
+
+  printf("%-40s mean %8.5f  sd %7.5f  %5.1f ns per sample, %d thread%s  (one at a time %5.1f ns)\n",
+         expr, stats.mean, stats.std_dev, t_mc * 1e9 / samples, stats.threads,
+         stats.threads == 1 ? " " : "s", t_scalar * 1e9 / samples);
+
+  EW_free(p);
+  MO_free(m);
+  CD_free(dict);
+  ET_free(tree);
+}
+
+
+/*
+ * Time tabulating an expression over a 3-D grid of about the given
+ * number of points, to /dev/null, as binary and as text, against
+ * evaluating and printing one point at a time. Print nanoseconds per
+ * point.
+ */
+static void bench_tabulate(const char *expr, long points)
+{
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  CDict dict = CD_new();
+  FILE *out = fopen("/dev/null", "w");
+  long side = (long)ceil(cbrt((double)points));
+  GRAxis axes[3] = {{"x", 0, 1, side}, {"y", -1, 1, side}, {"z", 0, 2, side}};
+  points = side * side * side;
+
+  double start = now();
+  GR_tabulate(tree, axes, 3, dict, out, GR_BINARY, errmsg, sizeof(errmsg));
+  double t_binary = now() - start;
+  start = now();
+  GR_tabulate(tree, axes, 3, dict, out, GR_TEXT, errmsg, sizeof(errmsg));
+  double t_text = now() - start;
+  if (errmsg[0] != '\0') {
+    printf("%-40s %s\n", expr, errmsg);
+    exit(1);
+  }
+
+  Prepared p = EW_compile(tree, errmsg, sizeof(errmsg));
+  double values[EW_num_vars(p) + 1];
+  int x = EW_var_slot(p, "x"), y = EW_var_slot(p, "y"), z = EW_var_slot(p, "z");
+  start = now();
+  for (long i = 0; i < side; i++)
+    for (long j = 0; j < side; j++)
+      for (long k = 0; k < side; k++) {
+        values[x] = (double)i / (side - 1);
+        values[y] = -1 + 2.0 * j / (side - 1);
+        values[z] = 2.0 * k / (side - 1);
+        fprintf(out, "%.17g %.17g %.17g %.17g\n", values[x], values[y], values[z],
+                EW_execute(p, values, errmsg, sizeof(errmsg)));
+      }
+  double t_scalar = now() - start;
+
+  printf("%-40s binary %5.1f ns per point  text %6.1f ns  (one at a time, text %6.1f ns)\n",
+         expr, t_binary * 1e9 / points, t_text * 1e9 / points, t_scalar * 1e9 / points);
+
+  EW_free(p);
+  fclose(out);
+  CD_free(dict);
+  ET_free(tree);
+}
+
+
+// Evaluates a line of bench_batch_file's file; cb_data is the dictionary
+static void bench_file_line(const BTLine *line, void *cb_data)
+{
+  char errmsg[128] = "";
+  if (line->tree)
+    ET_evaluate(line->tree, cb_data, errmsg, sizeof(errmsg));
+}
+
+static bool bench_no_command(const char *text, size_t len)
+{
+  return false;
+}
+
+/*
+ * Time a file of lines through the batch pipeline, against reading,
+ * tokenizing, parsing and evaluating it one line at a time
+ */
+static void bench_batch_file(long lines)
+{
+  char errmsg[128] = "";
+  FILE *in = tmpfile();
+  CDict dict = CD_new();
+  char *buf = NULL;
+  size_t cap = 0;
+  ssize_t len;
+
+  if (in == NULL) {
+    perror("tmpfile");
+    exit(1);
+  }
+  for (long i = 0; i < lines; i++)
+    fprintf(in, "%s\n", file_lines[i % num_file_lines]);
+
+  rewind(in);
+  double start = now();
+  BTConfig config = {.is_command = bench_no_command, .evaluate = bench_file_line,
+                     .cb_data = dict};
+  BT_run(in, &config);
+  double t_pipeline = now() - start;
+
+  rewind(in);
+  start = now();
+  while ((len = getline(&buf, &cap, in)) > 0) {
+    buf[len - 1] = '\0';
+    CList tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+    ExprTree tree = Parse(tokens, errmsg, sizeof(errmsg));
+    ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+    ET_free(tree);
+    CL_free(tokens);
+  }
+  double t_sequential = now() - start;
+
+  printf("%-40s %6.0f ns per line  (one at a time, %6.0f ns)\n", "pipeline",
+         t_pipeline * 1e9 / lines, t_sequential * 1e9 / lines);
+
+  free(buf);
+  CD_free(dict);
+  fclose(in);
+}
+
+
+/*
+ * Time evaluating an expression over the rows of a CSV file, written to
+ * /dev/null, against reading each line, splitting it with strtok,
+ * converting its fields with strtod and evaluating it one row at a
+ * time. Print nanoseconds per row.
+ */
+static void bench_csv(const char *expr, long rows)
+{
+  char errmsg[128] = "";
+  ExprTree tree = parse_or_die(expr);
+  CDict dict = CD_new();
+  FILE *in = tmpfile(), *out = fopen("/dev/null", "w");
+  char *buf = NULL;
+  size_t cap = 0;
+
+  if (in == NULL || out == NULL) {
+    perror("bench_csv");
+    exit(1);
+  }
+  fprintf(in, "id,label,x,y,z\n");
+  for (long i = 0; i < rows; i++)
+    fprintf(in, "%ld,\"row %ld\",%.6f,%.17g,%g\n", i, i, i * 0.001, 1.0 / (i + 1), i % 7 * 0.5);
+
+  rewind(in);
+  double start = now();
+  if (CS_evaluate(tree, in, dict, out, errmsg, sizeof(errmsg)) < 0) {
+    printf("%-40s %s\n", expr, errmsg);
+    exit(1);
+  }
+  double t_csv = now() - start;
+
+  Prepared p = EW_compile(tree, errmsg, sizeof(errmsg));
+  double values[EW_num_vars(p) + 1];
+  int slot[5] = {-1, -1, EW_var_slot(p, "x"), EW_var_slot(p, "y"), EW_var_slot(p, "z")};
+  rewind(in);
+  start = now();
+  getline(&buf, &cap, in);
+  while (getline(&buf, &cap, in) > 0) {
+    char *field = strtok(buf, ",\n");
+    for (int c = 0; field != NULL; c++, field = strtok(NULL, ",\n"))
+      if (c < 5 && slot[c] >= 0)
+        values[slot[c]] = strtod(field, NULL);
+    fprintf(out, "%.17g\n", EW_execute(p, values, errmsg, sizeof(errmsg)));
+  }
+  double t_scalar = now() - start;
+
+  printf("%-40s %6.1f ns per row  (one at a time, %6.1f ns)\n", expr, t_csv * 1e9 / rows,
+         t_scalar * 1e9 / rows);
+
+  free(buf);
+  EW_free(p);
+  fclose(out);
+  fclose(in);
+  CD_free(dict);
+  ET_free(tree);
+}
+
+
+/*
+ * Time evaluating an expression over raw binary columns of x, y and z,
+ * written raw to /dev/null, against the same rows read from CSV text
+ * and written as text. Print nanoseconds per row, and the bytes read
+ * and written per second from the binary columns.
+ */
+static void bench_columns(const char *expr, long rows)
+{
+  const char *names[] = {"x", "y", "z"};
+  char errmsg[128] = "";
+  char path[3][32];
+  ExprTree tree = parse_or_die(expr);
+  CDict dict = CD_new();
+  CFTable t = CF_new();
+  FILE *csv = tmpfile(), *out = fopen("/dev/null", "w");
+
+  if (csv == NULL || out == NULL) {
+    perror("bench_columns");
+    exit(1);
+  }
+  fprintf(csv, "x,y,z\n");
+  for (int c = 0; c < 3; c++) {
+    strcpy(path[c], "/tmp/ew_bench_XXXXXX");
+    int fd = mkstemp(path[c]);
+    FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (f == NULL) {
+      perror("bench_columns");
+      exit(1);
+    }
+    for (long i = 0; i < rows; i++) {
+      double value = c == 0 ? i * 0.001 : c == 1 ? 1.0 / (i + 1) : i % 7 * 0.5;
+      fwrite(&value, sizeof(value), 1, f);
+    }
+    fclose(f);
+    if (!CF_add_raw(t, names[c], path[c], errmsg, sizeof(errmsg))) {
+      printf("%s\n", errmsg);
+      exit(1);
+    }
+  }
+  for (long i = 0; i < rows; i++)
+    fprintf(csv, "%.6f,%.17g,%g\n", i * 0.001, 1.0 / (i + 1), i % 7 * 0.5);
+
+  double start = now();
+  if (CF_evaluate(tree, t, dict, out, CF_RAW, errmsg, sizeof(errmsg)) < 0) {
+    printf("%-40s %s\n", expr, errmsg);
+    exit(1);
+  }
+  double t_binary = now() - start;
+
+  rewind(csv);
+  start = now();
+  CS_evaluate(tree, csv, dict, out, errmsg, sizeof(errmsg));
+  double t_text = now() - start;
+
+  printf("%-40s %6.2f ns per row, %5.2f GB/s  (CSV text, %6.1f ns)\n", expr,
+         t_binary * 1e9 / rows, 4.0 * sizeof(double) * rows / t_binary * 1e-9,
+         t_text * 1e9 / rows);
+
+  for (int c = 0; c < 3; c++)
+    unlink(path[c]);
+  fclose(out);
+  fclose(csv);
+  CF_free(t);
+  CD_free(dict);
+  ET_free(tree);
+}
+
+
+/*
+ * Return the relative difference of approx from exact, which is taken
+ * to be the double-precision result
+ */
+static double rel_error(double approx, double exact)
+{
+  if (approx == exact)
+    return 0;
+  return fabs(approx - exact) / fabs(exact);
+}
+
+
+/*
+ * Time EW_execute_batch against EW_execute_batch_f32, with and without
+ * relaxed math, on one expression. Print nanoseconds per row and the
+ * largest and mean relative error of each float result against the
+ * double result for the same row.
+ */
+static void bench_f32(const char *expr, long iterations)
+{
+  char errmsg[128] = "";
+  Prepared p = EW_prepare(expr, errmsg, sizeof(errmsg));
+  if (p == NULL) {
+    fprintf(stderr, "%s: %s\n", expr, errmsg);
+    exit(1);
+  }
+
+  int num_vars = EW_num_vars(p);
+  double *columns[num_vars];
+  float *columns_f[num_vars];
+  double *results = malloc(BATCH_ROWS * sizeof(double));
+  double *exact = malloc(BATCH_ROWS * sizeof(double));
+  float *results_f = malloc(BATCH_ROWS * sizeof(float));
+  volatile double sink = 0;
+  long rounds = iterations / BATCH_ROWS + 1;
+
+  srand(2);
+  for (int v = 0; v < num_vars; v++) {
+    columns[v] = malloc(BATCH_ROWS * sizeof(double));
+    columns_f[v] = malloc(BATCH_ROWS * sizeof(float));
+    for (int i = 0; i < BATCH_ROWS; i++) {
+      // the same inputs for both, exactly representable as float
+      columns_f[v][i] = uniform(0.5, 4);
+      columns[v][i] = columns_f[v][i];
+    }
+  }
+
+  EW_execute_batch(p, columns, BATCH_ROWS, exact, 0, errmsg, sizeof(errmsg));
+
+  double times[4], max_err[2] = {0, 0}, sum_err[2] = {0, 0};
+  for (int run = 0; run < 4; run++) {
+    int flags = (run & 1) ? EW_RELAXED_MATH : 0;
+    bool f32 = (run >= 2);
+
+    double start = now();
+    for (long r = 0; r < rounds; r++) {
+      if (f32)
+        EW_execute_batch_f32(p, columns_f, BATCH_ROWS, results_f, flags, errmsg, sizeof(errmsg));
+      else
+        EW_execute_batch(p, columns, BATCH_ROWS, results, flags, errmsg, sizeof(errmsg));
+      sink += f32 ? results_f[0] : results[0];
+    }
+    times[run] = now() - start;
+
+    if (f32)
+      for (int i = 0; i < BATCH_ROWS; i++) {
+        double err = rel_error(results_f[i], exact[i]);
+        max_err[run & 1] = fmax(max_err[run & 1], err);
+        sum_err[run & 1] += err;
+      }
+  }
+
+  double rows = (double)rounds * BATCH_ROWS;
+  printf("%-40s f64 %6.1f %6.1f  f32 %6.1f %6.1f ns/row   f32 error max %.1e mean %.1e,"
+         " relaxed max %.1e mean %.1e\n", expr,
+         times[0] * 1e9 / rows, times[1] * 1e9 / rows, times[2] * 1e9 / rows, times[3] * 1e9 / rows,
+         max_err[0], sum_err[0] / BATCH_ROWS, max_err[1], sum_err[1] / BATCH_ROWS);
+
+  (void)sink;
+  for (int v = 0; v < num_vars; v++) {
+    free(columns[v]);
+    free(columns_f[v]);
+  }
+  free(results);
+  free(exact);
+  free(results_f);
+  EW_free(p);
+}
+
+int main(int argc, char *argv[])
+{
+  long iterations = (argc > 1) ? atol(argv[1]) : DEFAULT_ITERATIONS;
+
+  printf("Backends (%ld iterations each):\n", iterations);
+  for (int i = 0; i < num_bench_exprs; i++)
+    bench_backends(bench_exprs[i], iterations);
+
+  printf("\nBatch execution (%ld rows each):\n", iterations);
+  for (int i = 0; i < num_bench_exprs; i++)
+    bench_batch(bench_exprs[i], iterations);
+  for (int i = 0; i < num_batch_exprs; i++)
+    bench_batch(batch_exprs[i], iterations);
+
+  printf("\nSingle against double precision batches (%ld rows each; times plain, relaxed):\n",
+         iterations);
+  for (int i = 0; i < num_bench_exprs; i++)
+    bench_f32(bench_exprs[i], iterations);
+  for (int i = 0; i < num_batch_exprs; i++)
+    bench_f32(batch_exprs[i], iterations);
+
+  printf("\nArray variables against batches (%ld elements each):\n", iterations);
+  for (int i = 0; i < num_bench_exprs; i++)
+    bench_arrays(bench_exprs[i], iterations);
+  for (int i = 0; i < num_batch_exprs; i++)
+    bench_arrays(batch_exprs[i], iterations);
+
+  printf("\nSums over ranges (%ld indices each):\n", iterations);
+  for (int i = 0; i < num_range_bodies; i++)
+    bench_ranges(range_bodies[i], iterations);
+
+  printf("\nGradients in 5 variables, in evaluations (%ld iterations each):\n", iterations);
+  for (int i = 0; i < num_bench_exprs; i++)
+    bench_gradient(bench_exprs[i], iterations);
+  for (int i = 0; i < num_batch_exprs; i++)
+    bench_gradient(batch_exprs[i], iterations);
+
+  printf("\nRoot finding (%ld solves each):\n", iterations / 100 > 0 ? iterations / 100 : 1);
+  for (int i = 0; i < num_equations; i++)
+    bench_solve(equations[i].expr, equations[i].lo, equations[i].hi, iterations);
+
+  printf("\nIntegration (at least %ld evaluations each):\n", iterations);
+  for (int i = 0; i < num_integrands; i++)
+    bench_integrate(integrands[i].expr, integrands[i].a, integrands[i].b, iterations);
+
+  printf("\nMonte Carlo (%ld samples each):\n", iterations);
+  for (int i = 0; i < num_mc_exprs; i++)
+    bench_montecarlo(mc_exprs[i], iterations);
+
+  printf("\nTabulation over 3-D grids (about %ld points each):\n", iterations);
+  for (int i = 0; i < num_grid_exprs; i++)
+    bench_tabulate(grid_exprs[i], iterations);
+
+  printf("\nBatch files (%ld lines):\n", iterations);
+  bench_batch_file(iterations);
+
+  printf("\nCSV columns (%ld rows each):\n", iterations);
+  for (int i = 0; i < num_csv_exprs; i++)
+    bench_csv(csv_exprs[i], iterations);
+
+  printf("\nBinary columns (%ld rows each):\n", iterations);
+  for (int i = 0; i < num_csv_exprs; i++)
+    bench_columns(csv_exprs[i], iterations);
+
+  report_accuracy();
+
+  return 0;
+}
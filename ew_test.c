@@ -13,12 +13,31 @@
 #include <ctype.h>   // isblank
 #include <math.h>    // fabs
 #include <stdbool.h>
+#include <unistd.h>  // unlink
 
 #include "clist.h"
 #include "token.h"
 #include "tokenize.h"
 #include "expr_tree.h"
 #include "parse.h"
+#include "sheet.h"
+#include "parse_cache.h"
+#include "memo.h"
+#include "prepared.h"
+#include "tier.h"
+#include "closure.h"
+#include "fastmath.h"
+#include "functions.h"
+#include "array.h"
+#include "autodiff.h"
+#include "derive.h"
+#include "solve.h"
+#include "quad.h"
+#include "montecarlo.h"
+#include "grid.h"
+#include "batch.h"
+#include "csv.h"
+#include "colfile.h"
 
 
 // Checks that value is true; if not, prints a failure message and
@@ -501,6 +520,2774 @@ int test_parse_errors()
 }
 
 
+/*
+ * Tokenizes and parses a string, for tests that work from source text
+ *
+ * Parameters:
+ *   input    The expression to parse
+ *
+ * Returns: The parsed tree, or NULL on a tokenize or parse error
+ */
+static ExprTree parse_str(const char *input)
+{
+  char errmsg[128];
+  CList tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+  if (tokens == NULL)
+    return NULL;
+
+  ExprTree tree = Parse(tokens, errmsg, sizeof(errmsg));
+  CL_free(tokens);
+  return tree;
+}
+
+
+/*
+ * Evaluates a string through a Sheet, returning the result
+ */
+static double sheet_eval(Sheet sheet, const char *input, char *errmsg, size_t errmsg_sz)
+{
+  ExprTree tree = parse_str(input);
+  errmsg[0] = '\0';
+  double result = tree ? SH_evaluate(sheet, tree, errmsg, errmsg_sz) : NAN;
+  ET_free(tree);
+  return result;
+}
+
+
+/*
+ * Tests reactive evaluation: formulas are recomputed only when a
+ * variable they read changes
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_sheet()
+{
+  CDict dict = CD_new();
+  Sheet sheet = SH_new(dict);
+  ExprTree tree = NULL;
+  ETNumber num = {.array = NULL};
+  char errmsg[128];
+  int ret = 0;
+
+  test_assert( sheet_eval(sheet, "x = 2", errmsg, sizeof(errmsg)) == 2 );
+  test_assert( sheet_eval(sheet, "y = 3", errmsg, sizeof(errmsg)) == 3 );
+  test_assert( sheet_eval(sheet, "a = x * 10", errmsg, sizeof(errmsg)) == 20 );
+  test_assert( sheet_eval(sheet, "b = a + 1", errmsg, sizeof(errmsg)) == 21 );
+  test_assert( sheet_eval(sheet, "c = y + 1", errmsg, sizeof(errmsg)) == 4 );
+  test_assert( SH_num_dirty(sheet) == 0 );
+
+  // changing x dirties a and b, but not c
+  test_assert( sheet_eval(sheet, "x = 0", errmsg, sizeof(errmsg)) == 0 );
+  test_assert( SH_num_dirty(sheet) == 2 );
+  test_assert( sheet_eval(sheet, "c", errmsg, sizeof(errmsg)) == 4 );
+  test_assert( SH_num_recomputed(sheet) == 0 );
+  test_assert( sheet_eval(sheet, "b", errmsg, sizeof(errmsg)) == 1 );
+  test_assert( SH_num_recomputed(sheet) == 2 );
+  test_assert( SH_num_dirty(sheet) == 0 );
+
+  // redefining a formula re-wires its dependencies
+  test_assert( sheet_eval(sheet, "a = y", errmsg, sizeof(errmsg)) == 3 );
+  test_assert( SH_num_dirty(sheet) == 1 );    // b
+  test_assert( sheet_eval(sheet, "x = 5", errmsg, sizeof(errmsg)) == 5 );
+  test_assert( SH_num_dirty(sheet) == 1 );
+  test_assert( sheet_eval(sheet, "y = 7", errmsg, sizeof(errmsg)) == 7 );
+  test_assert( sheet_eval(sheet, "b", errmsg, sizeof(errmsg)) == 8 );
+
+  // self reference is a one-shot update, indirect cycles are errors
+  test_assert( sheet_eval(sheet, "x = x + 1", errmsg, sizeof(errmsg)) == 6 );
+  test_assert( isnan(sheet_eval(sheet, "y = b * 2", errmsg, sizeof(errmsg))) );
+  test_assert( strlen(errmsg) != 0 );
+  test_assert( sheet_eval(sheet, "b", errmsg, sizeof(errmsg)) == 8 );
+
+  // integers stay exact, and a formula may have an array as its value
+  const char *lines[] = {"n = 9007199254740993 + 0", "v = [1, 2, 3]", "w = v * x", "v = [1, 1]",
+                         "w"};
+  for (int i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+    tree = parse_str(lines[i]);
+    errmsg[0] = '\0';
+    AR_release(num.array);
+    num = SH_evaluate_number(sheet, tree, errmsg, sizeof(errmsg));
+    test_assert( errmsg[0] == '\0' );
+    test_assert( i != 0 || (num.is_int && num.i == 9007199254740993) );
+    ET_free(tree);
+    tree = NULL;
+  }
+  test_assert( num.array != NULL && AR_length(num.array) == 2 && AR_data(num.array)[1] == 6 );
+
+  ret = 1;
+
+ test_error:
+  AR_release(num.array);
+  ET_free(tree);
+  SH_free(sheet);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests the parsed-expression cache: hits, misses, normalization and
+ * LRU eviction under the memory cap
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_parse_cache()
+{
+  ParseCache cache = PC_new(4096);
+  CDict dict = CD_new();
+  char errmsg[128] = {0};
+  PCStats stats;
+  ExprTree tree;
+  int ret = 0;
+
+  tree = PC_parse(cache, "1 + 2 * 3", errmsg, sizeof(errmsg));
+  test_assert( tree != NULL );
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 7 );
+
+  // same text modulo whitespace is a hit and returns the same tree
+  test_assert( PC_parse(cache, "  1 +   2 * 3 ", errmsg, sizeof(errmsg)) == tree );
+  PC_stats(cache, &stats);
+  test_assert( stats.hits == 1 && stats.misses == 1 && stats.entries == 1 );
+
+  // errors and empty input are not cached
+  test_assert( PC_parse(cache, "1 +", errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strlen(errmsg) != 0 );
+  errmsg[0] = '\0';
+  test_assert( PC_parse(cache, "   ", errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strlen(errmsg) == 0 );
+  PC_stats(cache, &stats);
+  test_assert( stats.entries == 1 );
+
+  // filling the cache evicts the least recently used entries
+  char buf[32];
+  for (int i = 0; i < 100; i++) {
+    snprintf(buf, sizeof(buf), "%d * 2", i);
+    tree = PC_parse(cache, buf, errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == i * 2 );
+  }
+  PC_stats(cache, &stats);
+  test_assert( stats.evictions > 0 );
+  test_assert( stats.bytes <= stats.max_bytes );
+  test_assert( stats.entries + stats.evictions == 101 );
+
+  ret = 1;
+
+ test_error:
+  PC_free(cache);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests CDict key versions and subtree memoization
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_memo()
+{
+  CDict dict = CD_new();
+  MemoCache memo = MC_new(64);
+  ExprTree f = parse_str("(x + 1) * (y ^ 2) + 3");
+  ExprTree g = parse_str("(y ^ 2) * 10");
+  ExprTree h = NULL;
+  char errmsg[128] = {0};
+  MCStats stats;
+  int ret = 0;
+
+  test_assert( f != NULL && g != NULL );
+
+  // versions change on every store, survive a rehash, and reset on delete
+  test_assert( CD_version(dict, "x") == 0 );
+  CD_store(dict, "x", 1);
+  unsigned long vx = CD_version(dict, "x");
+  test_assert( vx != 0 );
+  CD_store(dict, "x", 1);
+  test_assert( CD_version(dict, "x") > vx );
+  vx = CD_version(dict, "x");
+  char key[8];
+  for (int i = 0; i < 20; i++) {
+    snprintf(key, sizeof(key), "k%d", i);
+    CD_store(dict, key, i);
+  }
+  test_assert( CD_version(dict, "x") == vx );
+  CD_delete(dict, "k3");
+  test_assert( CD_version(dict, "k3") == 0 );
+  CD_store(dict, "y", 3);
+
+  test_assert( MC_evaluate(memo, f, dict, errmsg, sizeof(errmsg)) == 21 );
+  MC_stats(memo, &stats);
+  test_assert( stats.hits == 0 );
+
+  // repeated query: the root is a hit
+  test_assert( MC_evaluate(memo, f, dict, errmsg, sizeof(errmsg)) == 21 );
+  MC_stats(memo, &stats);
+  test_assert( stats.hits == 1 );
+
+  // shared subexpression y^2 in a different formula is a hit
+  test_assert( MC_evaluate(memo, g, dict, errmsg, sizeof(errmsg)) == 90 );
+  MC_stats(memo, &stats);
+  test_assert( stats.hits == 2 );
+
+  // changing x invalidates f but not y^2
+  CD_store(dict, "x", 2);
+  test_assert( MC_evaluate(memo, f, dict, errmsg, sizeof(errmsg)) == 30 );
+  MC_stats(memo, &stats);
+  test_assert( stats.hits == 3 );
+  test_assert( strlen(errmsg) == 0 );
+
+  // changing y invalidates everything reading it
+  CD_store(dict, "y", 1);
+  test_assert( MC_evaluate(memo, g, dict, errmsg, sizeof(errmsg)) == 10 );
+  test_assert( MC_evaluate(memo, f, dict, errmsg, sizeof(errmsg)) == 6 );
+
+  // integers stay exact, from the cache too, and arrays are kept
+  const struct { const char *expr; int64_t value; } exact[] = {
+    {"(9007199254740993 + 0) * y", 9007199254740993},
+    {"2 ^ 62 + 1", 4611686018427387905},
+  };
+  for (int i = 0; i < 2; i++) {
+    h = parse_str(exact[i].expr);
+    for (int again = 0; again < 2; again++) {
+      ETNumber num = MC_evaluate_number(memo, h, dict, errmsg, sizeof(errmsg));
+      test_assert( num.is_int && num.i == exact[i].value );
+    }
+    ET_free(h);
+  }
+  h = parse_str("[1, 2, 3] * (y + 1)");
+  ETNumber num = MC_evaluate_number(memo, h, dict, errmsg, sizeof(errmsg));
+  test_assert( errmsg[0] == '\0' && num.array != NULL && AR_length(num.array) == 3 );
+  test_assert( AR_data(num.array)[2] == 6 );
+  AR_release(num.array);
+  test_assert( isnan(MC_evaluate(memo, h, dict, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Array value where a number is expected") == 0 );
+
+  // a result computed with an error is not cached, though it is not NaN
+  const char *errors[] = {"(1 / 0) ^ 0", "zz ^ 0 + 1", "1 ^ zz"};
+  for (int i = 0; i < 3; i++) {
+    ET_free(h);
+    h = parse_str(errors[i]);
+    for (int again = 0; again < 2; again++) {
+      errmsg[0] = '\0';
+      MC_evaluate(memo, h, dict, errmsg, sizeof(errmsg));
+      test_assert( errmsg[0] != '\0' );
+    }
+  }
+
+  ret = 1;
+
+ test_error:
+  ET_free(f);
+  ET_free(g);
+  ET_free(h);
+  MC_free(memo);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests prepared expressions against ET_evaluate
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_prepared()
+{
+  const char *exprs[] = {
+    "1 + 2 * 3", "-x ^ 2", "2 ^ 3 ^ 2", "(a - b) / (a + b)", "a * x + b - x / 4",
+    "y = a * 2", "-(-(x))", "10 - 2 - 3"
+  };
+  const int num_exprs = sizeof(exprs) / sizeof(exprs[0]);
+  CDict dict = CD_new();
+  Prepared p = NULL;
+  ExprTree tree = NULL;
+  char errmsg[128] = {0};
+  double values[8];
+  int ret = 0;
+
+  CD_store(dict, "x", 1.5);
+  CD_store(dict, "a", 3);
+  CD_store(dict, "b", -2);
+
+  for (int i = 0; i < num_exprs; i++) {
+    tree = parse_str(exprs[i]);
+    p = EW_prepare(exprs[i], errmsg, sizeof(errmsg));
+    test_assert( tree != NULL && p != NULL );
+    test_assert( EW_num_vars(p) <= 8 );
+
+    EW_bind_dict(p, values, dict);
+    double expected = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+    test_assert( EW_execute(p, values, errmsg, sizeof(errmsg)) == expected );
+    test_assert( strlen(errmsg) == 0 );
+
+    ET_free(tree);
+    tree = NULL;
+    EW_free(p);
+    p = NULL;
+  }
+
+  // variables are listed in order of first appearance
+  p = EW_prepare("r = a * x + b", errmsg, sizeof(errmsg));
+  test_assert( EW_num_vars(p) == 4 );
+  test_assert( strcmp(EW_var_name(p, 0), "a") == 0 );
+  test_assert( EW_var_slot(p, "r") == 3 );
+  test_assert( EW_var_slot(p, "z") == -1 );
+
+  // execute many times with different bindings; assignment writes back
+  for (int i = 0; i < 10; i++) {
+    EW_bind(p, values, 0, i);
+    test_assert( EW_bind_name(p, values, "x", 2) );
+    test_assert( EW_bind_name(p, values, "b", 1) );
+    test_assert( EW_execute(p, values, errmsg, sizeof(errmsg)) == 2 * i + 1 );
+    test_assert( values[3] == 2 * i + 1 );
+  }
+
+  // errors match ET_evaluate
+  EW_bind(p, values, 1, NAN);
+  test_assert( isnan(EW_execute(p, values, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Undefined variable: x") == 0 );
+  EW_free(p);
+  p = EW_prepare("1 / (x - x)", errmsg, sizeof(errmsg));
+  values[0] = 1;
+  test_assert( isnan(EW_execute(p, values, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Division by zero") == 0 );
+
+  test_assert( EW_prepare("1 +", errmsg, sizeof(errmsg)) == NULL );
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  EW_free(p);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests tiered execution: results are the same on every tier, and
+ * expressions are promoted according to the policy
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tier()
+{
+  ExprTree tree = parse_str("y = (x + 1) * (x - 1) / 2");
+  TieredExpr sync = NULL, bg = NULL;
+  TRPolicy policy = {3, 5, false};
+  char errmsg[128] = {0};
+  double values[2];
+  int ret = 0;
+
+  test_assert( tree != NULL );
+  sync = TR_new(tree, &policy);
+  bg = TR_new(tree, NULL);
+
+  // slots are numbered as EW_compile would number them
+  test_assert( TR_num_vars(sync) == 2 );
+  test_assert( TR_var_slot(sync, "x") == 0 && TR_var_slot(sync, "y") == 1 );
+  test_assert( TR_tier(sync) == TIER_TREE );
+
+  for (int i = 0; i < 2000; i++) {
+    values[TR_var_slot(sync, "x")] = i;
+    test_assert( TR_execute(sync, values, errmsg, sizeof(errmsg)) == (i * i - 1) / 2.0 );
+    test_assert( values[1] == (i * i - 1) / 2.0 );
+    if (i + 1 < policy.bytecode_after)
+      test_assert( TR_tier(sync) == TIER_TREE );
+    if (i + 1 >= policy.bytecode_after)
+      test_assert( TR_tier(sync) >= TIER_BYTECODE );
+
+    values[0] = i;
+    test_assert( TR_execute(bg, values, errmsg, sizeof(errmsg)) == (i * i - 1) / 2.0 );
+  }
+
+  test_assert( TR_tier(sync) == TIER_FAST );
+  // a background compile may still have been running when the loop
+  // ended; once it lands, the next execution starts the next one
+  TR_wait(bg);
+  test_assert( TR_tier(bg) >= TIER_BYTECODE );
+  values[0] = 3;
+  test_assert( TR_execute(bg, values, errmsg, sizeof(errmsg)) == 4 );
+  TR_wait(bg);
+  test_assert( TR_tier(bg) == TIER_FAST );
+  test_assert( TR_executions(bg) == 2001 );
+
+  values[0] = NAN;
+  test_assert( isnan(TR_execute(sync, values, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Undefined variable: x") == 0 );
+
+  ret = 1;
+
+ test_error:
+  TR_free(sync);
+  TR_free(bg);
+  ET_free(tree);
+  return ret;
+}
+
+
+/*
+ * Tests the closure compiler against ET_evaluate
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_closure()
+{
+  const char *exprs[] = {
+    "1 + 2 * 3", "x", "7", "-x ^ 2", "2 ^ 3 ^ 2", "(a - b) / (a + b)",
+    "a * x + b - x / 4", "y = a * 2", "-(-(x))", "10 - 2 - 3", "x * 2 + 3 * a",
+    "y = x", "y = 4", "(y = x + 1) * y", "2 * 3 + x / (1 + 1)"
+  };
+  const int num_exprs = sizeof(exprs) / sizeof(exprs[0]);
+  CDict dict = CD_new();
+  Closure cc = NULL;
+  ExprTree tree = NULL;
+  char errmsg[128] = {0};
+  double values[8];
+  int ret = 0;
+
+  CD_store(dict, "x", 1.5);
+  CD_store(dict, "a", 3);
+  CD_store(dict, "b", -2);
+
+  for (int i = 0; i < num_exprs; i++) {
+    tree = parse_str(exprs[i]);
+    test_assert( tree != NULL );
+    cc = CC_compile(tree, errmsg, sizeof(errmsg));
+    test_assert( cc != NULL );
+
+    for (int v = 0; v < CC_num_vars(cc); v++)
+      values[v] = CD_retrieve(dict, CC_var_name(cc, v));
+    double expected = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+    test_assert( CC_execute(cc, values, errmsg, sizeof(errmsg)) == expected );
+    test_assert( strlen(errmsg) == 0 );
+
+    ET_free(tree);
+    tree = NULL;
+    CC_free(cc);
+    cc = NULL;
+  }
+
+  // errors are reported, including division by a folded zero
+  tree = parse_str("x / (2 - 2)");
+  cc = CC_compile(tree, errmsg, sizeof(errmsg));
+  values[0] = 1;
+  test_assert( isnan(CC_execute(cc, values, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Division by zero") == 0 );
+  CC_free(cc);
+  ET_free(tree);
+  tree = parse_str("x + 1");
+  cc = CC_compile(tree, errmsg, sizeof(errmsg));
+  values[0] = NAN;
+  test_assert( isnan(CC_execute(cc, values, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Undefined variable: x") == 0 );
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  CC_free(cc);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests the int64 fast path of ET_evaluate_number
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_integer()
+{
+  typedef struct {
+    const char *expr;
+    bool is_int;
+    int64_t i;
+    double d;
+  } test_matrix_t;
+
+  test_matrix_t tests[] =
+    {
+      {"2 + 3 * 4", true, 14},
+      {"7 - 10", true, -3},
+      {"12 / 4", true, 3},
+      {"7 / 2", false, 0, 3.5},
+      {"-(2 ^ 10)", true, -1024},
+      {"3 ^ 39", true, 4052555153018976267LL},
+      {"2 ^ -1", false, 0, 0.5},
+      {"(-1) ^ -3", true, -1},
+      {"2.0 * 3", false, 0, 6},
+      {"n * (n + 1) / 2", true, 5000050000LL},
+      // exact where double arithmetic would lose the 1
+      {"2 ^ 60 + 1 - 2 ^ 60", true, 1},
+      {"9223372036854775807 - 1", true, 9223372036854775806LL},
+      // overflow promotes to double
+      {"9223372036854775807 + 1", false, 0, 9223372036854775808.0},
+      {"2 ^ 64", false, 0, 18446744073709551616.0},
+      {"99999999999999999999", false, 0, 1e20},
+    };
+
+  const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
+  char errmsg[128] = {0};
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  int ret = 0;
+
+  CD_store(dict, "n", 100000);
+
+  for (int i = 0; i < num_tests; i++) {
+    tree = parse_str(tests[i].expr);
+    test_assert( tree != NULL );
+    ETNumber num = ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg));
+    test_assert( strlen(errmsg) == 0 );
+    test_assert( num.is_int == tests[i].is_int );
+    if (num.is_int) {
+      test_assert( num.i == tests[i].i );
+    } else {
+      test_assert( num.d == tests[i].d );
+    }
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // integer literals print exactly
+  char buf[64];
+  tree = parse_str("123456789012345678 + 1.5");
+  ET_tree2string(tree, buf, sizeof(buf));
+  test_assert( strcmp(buf, "(123456789012345678+1.5)") == 0 );
+  ET_free(tree);
+
+  tree = parse_str("n / (n - 100000)");
+  test_assert( isnan(ET_evaluate(tree, dict, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Division by zero") == 0 );
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests EW_execute_batch against EW_execute, and the relaxed pow of
+ * fastmath.h against libm
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_batch()
+{
+  const char *exprs[] = {
+    "a * x + b", "(x + 1) * (x - 1) / (a + 2)", "-x ^ 2 + x ^ 0.5", "x ^ a", "y = a * x ^ 3"
+  };
+  const int num_exprs = sizeof(exprs) / sizeof(exprs[0]);
+  const int rows = 600;     // not a multiple of the block size
+  Prepared p = NULL;
+  char errmsg[128] = {0};
+  double *columns[4], results[rows], values[4];
+  float *fcolumns[4], fresults[rows];
+  int ret = 0;
+
+  for (int v = 0; v < 4; v++) {
+    columns[v] = malloc(rows * sizeof(double));
+    fcolumns[v] = malloc(rows * sizeof(float));
+  }
+
+  srand(3);
+  for (int e = 0; e < num_exprs; e++) {
+    p = EW_prepare(exprs[e], errmsg, sizeof(errmsg));
+    test_assert( p != NULL && EW_num_vars(p) <= 4 );
+
+    for (int flags = 0; flags <= EW_RELAXED_MATH; flags += EW_RELAXED_MATH) {
+      for (int v = 0; v < EW_num_vars(p); v++)
+        for (int i = 0; i < rows; i++)
+          columns[v][i] = 0.25 + 4.0 * rand() / RAND_MAX;
+
+      EW_execute_batch(p, columns, rows, results, flags, errmsg, sizeof(errmsg));
+      test_assert( strlen(errmsg) == 0 );
+
+      for (int i = 0; i < rows; i++) {
+        for (int v = 0; v < EW_num_vars(p); v++)
+          values[v] = columns[v][i];
+        double expected = EW_execute(p, values, errmsg, sizeof(errmsg));
+        if (flags == 0) {
+          test_assert( results[i] == expected );
+        } else {
+          test_assert( fabs(results[i] - expected) <= 1e-13 * fabs(expected) );
+        }
+      }
+    }
+
+    EW_free(p);
+    p = NULL;
+  }
+
+  // assignments write back, and errors affect only their own rows
+  p = EW_prepare("y = 1 / (x - 2)", errmsg, sizeof(errmsg));
+  for (int i = 0; i < rows; i++)
+    columns[0][i] = i;
+  columns[0][7] = NAN;
+  EW_execute_batch(p, columns, rows, results, 0, errmsg, sizeof(errmsg));
+  test_assert( strlen(errmsg) != 0 );
+  test_assert( isnan(results[2]) && isnan(results[7]) );
+  test_assert( results[3] == 1 && results[rows - 1] == 1.0 / (rows - 3) );
+  test_assert( columns[1][4] == 0.5 );
+  EW_free(p);
+  p = NULL;
+
+  // single precision agrees with double to float accuracy, relaxed or not
+  errmsg[0] = '\0';
+  for (int e = 0; e < num_exprs; e++) {
+    p = EW_prepare(exprs[e], errmsg, sizeof(errmsg));
+    for (int v = 0; v < EW_num_vars(p); v++)
+      for (int i = 0; i < rows; i++) {
+        fcolumns[v][i] = 0.25 + 4.0 * rand() / RAND_MAX;
+        columns[v][i] = fcolumns[v][i];
+      }
+    EW_execute_batch(p, columns, rows, results, 0, errmsg, sizeof(errmsg));
+
+    for (int flags = 0; flags <= EW_RELAXED_MATH; flags += EW_RELAXED_MATH) {
+      EW_execute_batch_f32(p, fcolumns, rows, fresults, flags, errmsg, sizeof(errmsg));
+      test_assert( strlen(errmsg) == 0 );
+      for (int i = 0; i < rows; i++)
+        test_assert( fabs(fresults[i] - results[i]) <= 4e-6 * fabs(results[i]) );
+    }
+
+    EW_free(p);
+    p = NULL;
+  }
+
+  p = EW_prepare("y = 1 / (x - 2)", errmsg, sizeof(errmsg));
+  for (int i = 0; i < rows; i++)
+    fcolumns[0][i] = i;
+  fcolumns[0][7] = NAN;
+  EW_execute_batch_f32(p, fcolumns, rows, fresults, 0, errmsg, sizeof(errmsg));
+  test_assert( strlen(errmsg) != 0 );
+  test_assert( isnan(fresults[2]) && isnan(fresults[7]) );
+  test_assert( fresults[3] == 1 && fcolumns[1][4] == 0.5f );
+
+  // relaxed pow: exact special cases, libm's results for special values
+  test_assert( FM_pow(3, 2) == 9 && FM_pow(2, -1) == 0.5 && FM_pow(2, 0.5) == sqrt(2) );
+  test_assert( FM_pow(-2, 3) == -8 && FM_pow(0, -1) == INFINITY && FM_pow(-1, INFINITY) == 1 );
+  test_assert( isnan(FM_pow(-2, 0.5)) && FM_pow(NAN, 0) == 1 );
+  for (int i = 0; i < 10000; i++) {
+    double x = exp(40.0 * rand() / RAND_MAX - 20), y = 20.0 * rand() / RAND_MAX - 10;
+    double bound = (2 + 3 * fabs(y * log(x))) * 2.3e-16;
+    test_assert( fabs(FM_pow(x, y) - pow(x, y)) <= bound * pow(x, y) );
+  }
+
+  ret = 1;
+
+ test_error:
+  for (int v = 0; v < 4; v++) {
+    free(columns[v]);
+    free(fcolumns[v]);
+  }
+  EW_free(p);
+  return ret;
+}
+
+
+/*
+ * Tests calls of builtin functions: parsing, every evaluator, and the
+ * batch kernels against the scalar functions
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_builtins()
+{
+  const char *exprs[] = {
+    "sqrt(x * x + y * y)", "exp(-x) * log(y)", "sin(x) ^ 2 + cos(x) ^ 2", "abs(x - y)",
+    "max(x, y) - min(x, 2 * y)", "sqrt(max(x, y) + 1)", "y = log(x)", "max(x, sqrt(4))"
+  };
+  const int num_exprs = sizeof(exprs) / sizeof(exprs[0]);
+  const int rows = 300;
+  CDict dict = CD_new();
+  MemoCache memo = MC_new(64);
+  ExprTree tree = NULL, copy = NULL;
+  Prepared p = NULL;
+  Closure cc = NULL;
+  CList tokens = NULL;
+  char errmsg[128] = {0}, buf[128];
+  double values[2], results[rows], *columns[2];
+  float *fcolumns[2], fresults[rows];
+  int ret = 0;
+
+  for (int v = 0; v < 2; v++) {
+    columns[v] = malloc(rows * sizeof(double));
+    fcolumns[v] = malloc(rows * sizeof(float));
+  }
+
+  tree = parse_str("sqrt(x * x + y * y) + max(a, -b)");
+  test_assert( tree != NULL && ET_type(tree) == OP_ADD );
+  ET_tree2string(tree, buf, sizeof(buf));
+  test_assert( strcmp(buf, "(sqrt(((x*x)+(y*y)))+max(a,(-b)))") == 0 );
+  test_assert( ET_count(tree) == 13 && ET_depth(tree) == 5 );
+  copy = ET_copy(tree);
+  test_assert( ET_hash(copy) == ET_hash(tree) );
+  ET_free(copy);
+  copy = parse_str("sqrt(x * x + y * y) + min(a, -b)");
+  test_assert( ET_hash(copy) != ET_hash(tree) );
+  ET_free(copy);
+  copy = NULL;
+  CD_store(dict, "x", 3);
+  CD_store(dict, "y", 4);
+  CD_store(dict, "a", 1);
+  CD_store(dict, "b", 2);
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 6 );
+  ET_free(tree);
+
+  // a builtin's name is still an ordinary variable name
+  tree = parse_str("sin = 2 * sin");
+  CD_store(dict, "sin", 4);
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 8 );
+  ET_free(tree);
+  tree = NULL;
+
+  // every evaluator agrees
+  CD_store(dict, "x", 0.75);
+  for (int e = 0; e < num_exprs; e++) {
+    tree = parse_str(exprs[e]);
+    test_assert( tree != NULL );
+    double expected = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+    test_assert( strlen(errmsg) == 0 );
+    test_assert( MC_evaluate(memo, tree, dict, errmsg, sizeof(errmsg)) == expected );
+
+    p = EW_compile(tree, errmsg, sizeof(errmsg));
+    cc = CC_compile(tree, errmsg, sizeof(errmsg));
+    test_assert( p != NULL && cc != NULL );
+    EW_bind_dict(p, values, dict);
+    test_assert( EW_execute(p, values, errmsg, sizeof(errmsg)) == expected );
+    EW_bind_dict(p, values, dict);
+    test_assert( CC_execute(cc, values, errmsg, sizeof(errmsg)) == expected );
+
+    // the batch kernels give the scalar results, or within the
+    // relaxed bounds; the x column crosses zero, so the relaxed log
+    // also meets arguments it hands to libm
+    for (int flags = 0; flags <= EW_RELAXED_MATH; flags += EW_RELAXED_MATH) {
+      for (int v = 0; v < EW_num_vars(p); v++)
+        for (int i = 0; i < rows; i++) {
+          fcolumns[v][i] = (i - 30) / (v + 20.0);
+          columns[v][i] = fcolumns[v][i];
+        }
+      EW_execute_batch(p, columns, rows, results, flags, errmsg, sizeof(errmsg));
+      EW_execute_batch_f32(p, fcolumns, rows, fresults, flags, errmsg, sizeof(errmsg));
+
+      for (int i = 0; i < rows; i++) {
+        for (int v = 0; v < EW_num_vars(p); v++)
+          values[v] = (float)((i - 30) / (v + 20.0));
+        double exact = EW_execute(p, values, errmsg, sizeof(errmsg));
+        if (isnan(exact)) {
+          test_assert( isnan(results[i]) && isnan(fresults[i]) );
+        } else if (flags == 0) {
+          test_assert( results[i] == exact );
+        } else {
+          test_assert( results[i] == exact || fabs(results[i] - exact) <= 1e-13 * fabs(exact) );
+        }
+        if (!isnan(exact))
+          test_assert( fresults[i] == exact ||
+                       fabs(fresults[i] - exact) <= 1e-5 * fmax(fabs(exact), 1) );
+      }
+    }
+
+    ET_free(tree);
+    tree = NULL;
+    EW_free(p);
+    p = NULL;
+    CC_free(cc);
+    cc = NULL;
+  }
+
+  // wrong argument counts to builtins are parse errors
+  const char *bad[][2] = {
+    {"sqrt(1, 2)", "Function sqrt takes 1 argument"},
+    {"max(1, 2, 3)", "Function max takes 1 or 2 arguments"},
+    {"sqrt(1", "Unexpected token (end)"},
+    {"max(1,)", "Unexpected token CLOSE_PAREN"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    tokens = TOK_tokenize_input(bad[i][0], errmsg, sizeof(errmsg));
+    test_assert( tokens != NULL );
+    test_assert( Parse(tokens, errmsg, sizeof(errmsg)) == NULL );
+    test_assert( strcmp(errmsg, bad[i][1]) == 0 );
+    CL_free(tokens);
+    tokens = NULL;
+  }
+
+  ret = 1;
+
+ test_error:
+  for (int v = 0; v < 2; v++) {
+    free(columns[v]);
+    free(fcolumns[v]);
+  }
+  CL_free(tokens);
+  ET_free(tree);
+  ET_free(copy);
+  EW_free(p);
+  CC_free(cc);
+  MC_free(memo);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Parses input and inlines its calls to the functions in ft
+ */
+static ExprTree inline_str(FuncTable ft, const char *input, char *errmsg, size_t errmsg_sz)
+{
+  ExprTree parsed = parse_str(input);
+  if (parsed == NULL)
+    return NULL;
+
+  ExprTree tree = FT_inline(ft, parsed, errmsg, errmsg_sz);
+  ET_free(parsed);
+  return tree;
+}
+
+
+/*
+ * Defines the function given by input in ft
+ */
+static const UserFunc *define_str(FuncTable ft, const char *input, char *errmsg, size_t errmsg_sz)
+{
+  ExprTree def = parse_str(input);
+  if (def == NULL)
+    return NULL;
+
+  const UserFunc *fn = FT_define(ft, def, errmsg, errmsg_sz);
+  ET_free(def);
+  return fn;
+}
+
+
+/*
+ * Tests user-defined functions: inlining, early binding, recursive
+ * calls, and agreement of the backends on bound calls
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_functions()
+{
+  const char *exprs[] = {
+    "f(x, y) * h(x)", "h(c = x + 1) + c", "g(x) - f(y, 2)", "two() * sq(y) + sq(c = y)"
+  };
+  const int num_exprs = sizeof(exprs) / sizeof(exprs[0]);
+  const int rows = 50;
+  FuncTable ft = FT_new();
+  CDict dict = CD_new();
+  MemoCache memo = MC_new(64);
+  ExprTree tree = NULL;
+  Prepared p = NULL;
+  Closure cc = NULL;
+  TieredExpr te = NULL;
+  const UserFunc *fn;
+  char errmsg[128] = {0}, buf[128];
+  double *columns[4] = {NULL}, results[rows];
+  int ret = 0;
+
+  // a definition parses to FUNC_DEF; its parameters become PARAM nodes
+  fn = define_str(ft, "f(x, y) = 3 * x + y", errmsg, sizeof(errmsg));
+  test_assert( fn != NULL && strcmp(fn->name, "f") == 0 && fn->num_params == 2 );
+  test_assert( !fn->recursive && fn->pure );
+  ET_tree2string(fn->body, buf, sizeof(buf));
+  test_assert( strcmp(buf, "((3*$1)+$2)") == 0 );
+  test_assert( FT_lookup(ft, "f") == fn && FT_lookup(ft, "g") == NULL );
+
+  // calls are inlined, so later folding sees through them
+  tree = inline_str(ft, "f(2, a) + 1", errmsg, sizeof(errmsg));
+  test_assert( tree != NULL );
+  ET_tree2string(tree, buf, sizeof(buf));
+  test_assert( strcmp(buf, "(((3*2)+a)+1)") == 0 );
+  CD_store(dict, "a", 4);
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 11 );
+  ET_free(tree);
+
+  // ...including within a definition, which binds early
+  fn = define_str(ft, "g(x) = f(x, x) * 2", errmsg, sizeof(errmsg));
+  test_assert( fn != NULL && fn->pure );
+  ET_tree2string(fn->body, buf, sizeof(buf));
+  test_assert( strcmp(buf, "(((3*$1)+$1)*2)") == 0 );
+  test_assert( define_str(ft, "f(x, y) = x - y", errmsg, sizeof(errmsg)) != NULL );
+  tree = inline_str(ft, "g(1) * 10 + f(5, 2)", errmsg, sizeof(errmsg));
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 83 );
+  ET_free(tree);
+
+  // a recursive function is called, not inlined, and is cut off
+  // at ET_MAX_CALL_DEPTH by every backend
+  fn = define_str(ft, "r(x) = r(x + 1)", errmsg, sizeof(errmsg));
+  test_assert( fn != NULL && fn->recursive && fn->pure );
+  ET_tree2string(fn->body, buf, sizeof(buf));
+  test_assert( strcmp(buf, "r(($1+1))") == 0 );
+  tree = inline_str(ft, "r(0)", errmsg, sizeof(errmsg));
+  test_assert( ET_type(tree) == USER_CALL && ET_user_function(tree) == fn );
+  errmsg[0] = '\0';
+  test_assert( isnan(ET_evaluate(tree, dict, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Recursion too deep in r") == 0 );
+  p = EW_compile(tree, errmsg, sizeof(errmsg));
+  cc = CC_compile(tree, errmsg, sizeof(errmsg));
+  test_assert( p != NULL && cc != NULL );
+  errmsg[0] = '\0';
+  test_assert( isnan(EW_execute(p, NULL, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Recursion too deep in r") == 0 );
+  errmsg[0] = '\0';
+  test_assert( isnan(CC_execute(cc, NULL, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Recursion too deep in r") == 0 );
+  te = TR_new(tree, NULL);
+  errmsg[0] = '\0';
+  test_assert( isnan(TR_execute(te, NULL, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Recursion too deep in r") == 0 );
+  TR_free(te);
+  te = NULL;
+  EW_free(p);
+  p = NULL;
+  CC_free(cc);
+  cc = NULL;
+  ET_free(tree);
+  tree = NULL;
+
+  // an argument with a side effect is passed to a real call instead,
+  // so that it happens exactly once
+  test_assert( define_str(ft, "h(x) = x * x + t", errmsg, sizeof(errmsg)) != NULL );
+  test_assert( define_str(ft, "sq(x) = (t = x) * x", errmsg, sizeof(errmsg)) != NULL );
+  test_assert( !FT_lookup(ft, "sq")->pure && FT_lookup(ft, "sq")->num_symbols == 1 );
+  test_assert( define_str(ft, "two() = 2", errmsg, sizeof(errmsg)) != NULL );
+  tree = inline_str(ft, "h(c = 3)", errmsg, sizeof(errmsg));
+  test_assert( ET_type(tree) == USER_CALL && ET_is_pure(tree) == false );
+  CD_store(dict, "t", 1);
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 10 );
+  test_assert( CD_retrieve(dict, "c") == 3 );
+  ET_free(tree);
+  tree = NULL;
+
+  // the backends agree on inlined and bound calls alike
+  for (int e = 0; e < num_exprs; e++) {
+    errmsg[0] = '\0';
+    tree = inline_str(ft, exprs[e], errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    p = EW_compile(tree, errmsg, sizeof(errmsg));
+    cc = CC_compile(tree, errmsg, sizeof(errmsg));
+    test_assert( p != NULL && cc != NULL && EW_num_vars(p) <= 4 );
+
+    for (int v = 0; v < EW_num_vars(p); v++)
+      columns[v] = realloc(columns[v], rows * sizeof(double));
+
+    for (int i = 0; i < rows; i++) {
+      CD_store(dict, "x", i * 0.25 - 3);
+      CD_store(dict, "y", 7 - i * 0.5);
+      CD_store(dict, "t", 1);
+      CD_store(dict, "c", 0);
+
+      double values[4];
+      EW_bind_dict(p, values, dict);
+      for (int v = 0; v < EW_num_vars(p); v++)
+        columns[v][i] = values[v];
+
+      double exact = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+      CD_store(dict, "t", 1);
+      CD_store(dict, "c", 0);
+      test_assert( MC_evaluate(memo, tree, dict, errmsg, sizeof(errmsg)) == exact );
+      EW_bind_dict(p, values, dict);
+      test_assert( EW_execute(p, values, errmsg, sizeof(errmsg)) == exact );
+      EW_bind_dict(p, values, dict);
+      test_assert( CC_execute(cc, values, errmsg, sizeof(errmsg)) == exact );
+      results[i] = exact;
+    }
+    test_assert( errmsg[0] == '\0' );
+
+    double batch[rows];
+    EW_execute_batch(p, columns, rows, batch, 0, errmsg, sizeof(errmsg));
+    for (int i = 0; i < rows; i++)
+      test_assert( batch[i] == results[i] );
+
+    ET_free(tree);
+    tree = NULL;
+    EW_free(p);
+    p = NULL;
+    CC_free(cc);
+    cc = NULL;
+  }
+
+  // errors in definitions and calls
+  test_assert( inline_str(ft, "nope(1)", errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strcmp(errmsg, "Unknown function: nope") == 0 );
+  test_assert( inline_str(ft, "f(1)", errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strcmp(errmsg, "Function f takes 2 arguments") == 0 );
+  test_assert( define_str(ft, "k(x) = x = 1", errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strcmp(errmsg, "Cannot assign to parameter x of k") == 0 );
+  test_assert( define_str(ft, "k(x) = m(x)", errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strcmp(errmsg, "Unknown function: m") == 0 );
+  test_assert( FT_lookup(ft, "k") == NULL );
+
+  const char *bad[][2] = {
+    {"f(x, x) = 1", "Parameters of f must be distinct variable names"},
+    {"f(x, 2) = 1", "Parameters of f must be distinct variable names"},
+    {"sqrt(x) = 1", "Cannot redefine builtin function sqrt"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    CList tokens = TOK_tokenize_input(bad[i][0], errmsg, sizeof(errmsg));
+    test_assert( tokens != NULL );
+    tree = Parse(tokens, errmsg, sizeof(errmsg));
+    CL_free(tokens);
+    test_assert( tree == NULL );
+    test_assert( strcmp(errmsg, bad[i][1]) == 0 );
+  }
+
+  // a call that was never resolved fails when evaluated
+  tree = parse_str("foo(1)");
+  test_assert( tree != NULL && ET_type(tree) == USER_CALL );
+  errmsg[0] = '\0';
+  test_assert( isnan(ET_evaluate(tree, dict, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Unknown function: foo") == 0 );
+
+  ret = 1;
+
+ test_error:
+  for (int v = 0; v < 4; v++)
+    free(columns[v]);
+  ET_free(tree);
+  EW_free(p);
+  CC_free(cc);
+  TR_free(te);
+  MC_free(memo);
+  CD_free(dict);
+  FT_free(ft);
+  return ret;
+}
+
+
+/*
+ * Tests comparisons, && and ||, and the conditional operator: their
+ * parsing, lazy evaluation, and the branch-free batch forms
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_conditionals()
+{
+  const char *exprs[] = {
+    "x > 0 ? sqrt(x) : -x", "x != 0 ? 1 / x : 0", "x > 1 && y < 2 || x == y",
+    "x < y ? fib(3) + x : y", "(x >= 0) * x + (x < 0) * y / 2", "x <= y ? (z = x) : y"
+  };
+  const int num_exprs = sizeof(exprs) / sizeof(exprs[0]);
+  const int rows = 41;
+  FuncTable ft = FT_new();
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  Prepared p = NULL;
+  Closure cc = NULL;
+  TieredExpr te = NULL;
+  CList tokens = NULL;
+  char errmsg[128] = {0}, buf[128];
+  double *columns[3] = {NULL}, results[rows], batch[rows];
+  int ret = 0;
+
+  tokens = TOK_tokenize_input("a<=b>=c<d>e==f!=g&&h||i?j:k", errmsg, sizeof(errmsg));
+  test_assert( tokens != NULL );
+  const TokenType types[] = {
+    TOK_LESS_EQUAL, TOK_GREATER_EQUAL, TOK_LESS, TOK_GREATER, TOK_EQUAL_EQUAL,
+    TOK_NOT_EQUAL, TOK_AND, TOK_OR, TOK_QUESTION, TOK_COLON
+  };
+  for (int i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    TOK_consume(tokens);
+    test_assert( TOK_next_type(tokens) == types[i] );
+    TOK_consume(tokens);
+  }
+  CL_free(tokens);
+  tokens = NULL;
+  test_assert( TOK_tokenize_input("a & b", errmsg, sizeof(errmsg)) == NULL );
+  errmsg[0] = '\0';
+
+  // precedence and grouping follow C
+  const char *printed[][2] = {
+    {"x < 1 ? 2 : 3", "((x<1)?2:3)"},
+    {"a || b && c", "(a||(b&&c))"},
+    {"1 + 2 < 3 * 4 == 1", "(((1+2)<(3*4))==1)"},
+    {"a ? b : c ? d : e", "(a?b:(c?d:e))"},
+    {"a = b != c", "(a=(b!=c))"},
+  };
+  for (int i = 0; i < sizeof(printed) / sizeof(printed[0]); i++) {
+    tree = parse_str(printed[i][0]);
+    test_assert( tree != NULL );
+    ET_tree2string(tree, buf, sizeof(buf));
+    test_assert( strcmp(buf, printed[i][1]) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // only the branch taken is evaluated
+  CD_store(dict, "x", 1);
+  tree = parse_str("x > 0 ? (y = 1) : (z = 2)");
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 1 );
+  test_assert( CD_retrieve(dict, "y") == 1 && isnan(CD_retrieve(dict, "z")) );
+  ET_free(tree);
+  tree = parse_str("0 && (y = 5) || 1 || 1 / 0");
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 1 );
+  test_assert( CD_retrieve(dict, "y") == 1 && errmsg[0] == '\0' );
+  ET_free(tree);
+  CD_store(dict, "x", 0);
+  tree = parse_str("x != 0 ? 1 / x : 0");
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 0 && errmsg[0] == '\0' );
+  ET_free(tree);
+
+  // truth values are integers, and integers compare exactly
+  tree = parse_str("9007199254740993 > 9007199254740992");
+  ETNumber num = ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg));
+  test_assert( num.is_int && num.i == 1 );
+  ET_free(tree);
+
+  // a conditional ends recursion
+  test_assert( define_str(ft, "fact(n) = n <= 1 ? 1 : n * fact(n - 1)", errmsg,
+                          sizeof(errmsg)) != NULL );
+  test_assert( define_str(ft, "fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2)", errmsg,
+                          sizeof(errmsg)) != NULL );
+  test_assert( FT_lookup(ft, "fib")->recursive && FT_lookup(ft, "fib")->pure );
+  tree = inline_str(ft, "fact(20)", errmsg, sizeof(errmsg));
+  num = ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg));
+  test_assert( num.is_int && num.i == 2432902008176640000 );
+  ET_free(tree);
+  tree = inline_str(ft, "fib(15)", errmsg, sizeof(errmsg));
+  p = EW_compile(tree, errmsg, sizeof(errmsg));
+  cc = CC_compile(tree, errmsg, sizeof(errmsg));
+  te = TR_new(tree, NULL);
+  test_assert( p != NULL && cc != NULL );
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == 610 );
+  test_assert( EW_execute(p, NULL, errmsg, sizeof(errmsg)) == 610 );
+  test_assert( CC_execute(cc, NULL, errmsg, sizeof(errmsg)) == 610 );
+  test_assert( TR_execute(te, NULL, errmsg, sizeof(errmsg)) == 610 );
+  test_assert( errmsg[0] == '\0' );
+  TR_free(te);
+  te = NULL;
+  EW_free(p);
+  p = NULL;
+  CC_free(cc);
+  cc = NULL;
+  ET_free(tree);
+  tree = NULL;
+
+  // the batch evaluator blends where it can and runs islands a row at
+  // a time where it cannot, agreeing with the lazy evaluators either way
+  for (int e = 0; e < num_exprs; e++) {
+    errmsg[0] = '\0';
+    tree = inline_str(ft, exprs[e], errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    p = EW_compile(tree, errmsg, sizeof(errmsg));
+    cc = CC_compile(tree, errmsg, sizeof(errmsg));
+    test_assert( p != NULL && cc != NULL && EW_num_vars(p) <= 3 );
+
+    for (int v = 0; v < EW_num_vars(p); v++)
+      columns[v] = realloc(columns[v], rows * sizeof(double));
+
+    for (int i = 0; i < rows; i++) {
+      double values[3];
+      CD_store(dict, "x", (i - 20) * 0.25);
+      CD_store(dict, "y", 2 - i * 0.1);
+      CD_store(dict, "z", 0);
+      EW_bind_dict(p, values, dict);
+      for (int v = 0; v < EW_num_vars(p); v++)
+        columns[v][i] = values[v];
+
+      results[i] = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+      EW_bind_dict(p, values, dict);
+      test_assert( EW_execute(p, values, errmsg, sizeof(errmsg)) == results[i] );
+      EW_bind_dict(p, values, dict);
+      test_assert( CC_execute(cc, values, errmsg, sizeof(errmsg)) == results[i] );
+    }
+    test_assert( errmsg[0] == '\0' );
+
+    EW_execute_batch(p, columns, rows, batch, 0, errmsg, sizeof(errmsg));
+    test_assert( errmsg[0] == '\0' );
+    for (int i = 0; i < rows; i++)
+      test_assert( batch[i] == results[i] );
+
+    ET_free(tree);
+    tree = NULL;
+    EW_free(p);
+    p = NULL;
+    CC_free(cc);
+    cc = NULL;
+  }
+
+  // an assignment in the branch taken reaches the batch's columns
+  test_assert( columns[2][0] == columns[0][0] && columns[2][rows - 1] == 0 );
+
+  // NaN, the value of an error or an undefined variable, has no truth
+  // value: comparisons, && and || that need it, and conditionals on it
+  // give NaN in every evaluator, and every row with an error is NaN
+  const char *untrue[] = {
+    "q < 1", "q < 1 ? 5 : 6", "(1 / 0) > 1", "q == q", "1 && q", "q && 0", "0 || q",
+    "q || 1", "x > 0 && q", "x > 0 ? q : 7", "w > 0 ? 1 / w : 7", "1 / w < 1 ? x : -x",
+    "(q > 0) + 1", "q > 0 ? (z = 1) : (z = 2)",
+  };
+  for (int e = 0; e < sizeof(untrue) / sizeof(untrue[0]); e++) {
+    tree = inline_str(ft, untrue[e], errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    p = EW_compile(tree, errmsg, sizeof(errmsg));
+    cc = CC_compile(tree, errmsg, sizeof(errmsg));
+    te = TR_new(tree, NULL);
+    test_assert( p != NULL && cc != NULL && EW_num_vars(p) <= 3 );
+
+    for (int v = 0; v < EW_num_vars(p); v++)
+      columns[v] = realloc(columns[v], rows * sizeof(double));
+    for (int i = 0; i < rows; i++) {
+      double values[3];
+      CD_store(dict, "x", i % 2 ? 1 : -1);
+      CD_store(dict, "q", i % 3 ? i - 20 : NAN);
+      CD_store(dict, "w", i % 4 ? i * 0.5 : 0);
+      CD_store(dict, "z", 0);
+      EW_bind_dict(p, values, dict);
+      for (int v = 0; v < EW_num_vars(p); v++)
+        columns[v][i] = values[v];
+
+      errmsg[0] = '\0';
+      results[i] = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+      test_assert( errmsg[0] == '\0' || isnan(results[i]) );
+      double got[3];
+      EW_bind_dict(p, values, dict);
+      errmsg[0] = '\0';
+      got[0] = EW_execute(p, values, errmsg, sizeof(errmsg));
+      test_assert( errmsg[0] == '\0' || isnan(got[0]) );
+      EW_bind_dict(p, values, dict);
+      errmsg[0] = '\0';
+      got[1] = CC_execute(cc, values, errmsg, sizeof(errmsg));
+      test_assert( errmsg[0] == '\0' || isnan(got[1]) );
+      EW_bind_dict(p, values, dict);
+      errmsg[0] = '\0';
+      got[2] = TR_execute(te, values, errmsg, sizeof(errmsg));
+      test_assert( errmsg[0] == '\0' || isnan(got[2]) );
+      for (int b = 0; b < 3; b++)
+        test_assert( got[b] == results[i] || (isnan(got[b]) && isnan(results[i])) );
+      if (e < 4 && (i % 3 == 0 || e == 2))
+        test_assert( isnan(results[i]) );
+    }
+
+    EW_execute_batch(p, columns, rows, batch, 0, errmsg, sizeof(errmsg));
+    for (int i = 0; i < rows; i++)
+      test_assert( batch[i] == results[i] || (isnan(batch[i]) && isnan(results[i])) );
+
+    ET_free(tree);
+    tree = NULL;
+    EW_free(p);
+    p = NULL;
+    CC_free(cc);
+    cc = NULL;
+    TR_free(te);
+    te = NULL;
+  }
+  errmsg[0] = '\0';
+
+  // a variable read only in a branch that no row takes is not reported,
+  // though it is undefined in every row
+  tree = parse_str("x > -100 ? x * 2 : u");
+  p = EW_compile(tree, errmsg, sizeof(errmsg));
+  test_assert( p != NULL && EW_num_vars(p) == 2 );
+  for (int v = 0; v < 2; v++)
+    columns[v] = realloc(columns[v], rows * sizeof(double));
+  for (int i = 0; i < rows; i++) {
+    columns[EW_var_slot(p, "x")][i] = i - 20;
+    columns[EW_var_slot(p, "u")][i] = NAN;
+  }
+  EW_execute_batch(p, columns, rows, batch, 0, errmsg, sizeof(errmsg));
+  test_assert( errmsg[0] == '\0' );
+  for (int i = 0; i < rows; i++)
+    test_assert( batch[i] == 2 * (i - 20) );
+  ET_free(tree);
+  tree = NULL;
+  EW_free(p);
+  p = NULL;
+
+  // errors
+  const char *bad[][2] = {
+    {"x ? 1", "Unexpected token (end)"},
+    {"x ? 1 , 2", "Unexpected token COMMA"},
+    {"x < ", "Unexpected token (end)"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    tokens = TOK_tokenize_input(bad[i][0], errmsg, sizeof(errmsg));
+    test_assert( tokens != NULL );
+    tree = Parse(tokens, errmsg, sizeof(errmsg));
+    CL_free(tokens);
+    tokens = NULL;
+    test_assert( tree == NULL );
+    test_assert( strcmp(errmsg, bad[i][1]) == 0 );
+  }
+
+  ret = 1;
+
+ test_error:
+  for (int v = 0; v < 3; v++)
+    free(columns[v]);
+  CL_free(tokens);
+  ET_free(tree);
+  EW_free(p);
+  CC_free(cc);
+  TR_free(te);
+  CD_free(dict);
+  FT_free(ft);
+  return ret;
+}
+
+
+/*
+ * Is num an array holding exactly the n elements of expect? Releases
+ * the array either way.
+ */
+static bool array_equals(ETNumber num, const double *expect, size_t n)
+{
+  bool equal = num.array && AR_length(num.array) == n;
+  for (size_t i = 0; equal && i < n; i++)
+    equal = AR_data(num.array)[i] == expect[i] ||
+            (isnan(AR_data(num.array)[i]) && isnan(expect[i]));
+  AR_release(num.array);
+  return equal;
+}
+
+int test_arrays()
+{
+  FuncTable ft = FT_new();
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  Prepared p = NULL;
+  ETNumber num;
+  Array big = NULL;
+  char errmsg[128] = {0}, buf[128];
+  int ret = 0;
+
+  // copy-on-write: a private array is written in place, a shared one
+  // is copied first
+  Array a = AR_from((double[]){1, 2, 3}, 3), b = AR_retain(a);
+  test_assert( AR_refs(a) == 2 && AR_mutable(&b) != AR_data(a) );
+  test_assert( AR_refs(a) == 1 && AR_refs(b) == 1 );
+  test_assert( AR_mutable(&a) == AR_data(a) );
+  AR_release(a);
+  AR_release(b);
+
+  // assignment shares the array rather than copying it
+  tree = parse_str("v = [1, 2, 3]");
+  ET_tree2string(tree, buf, sizeof(buf));
+  test_assert( strcmp(buf, "(v=[1,2,3])") == 0 );
+  test_assert( array_equals(ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg)),
+                            (double[]){1, 2, 3}, 3) );
+  ET_free(tree);
+  tree = parse_str("w = v");
+  AR_release(ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg)).array);
+  test_assert( CD_retrieve_array(dict, "w") == CD_retrieve_array(dict, "v") );
+  test_assert( AR_refs(CD_retrieve_array(dict, "v")) == 2 && isnan(CD_retrieve(dict, "v")) );
+  ET_free(tree);
+  tree = NULL;
+
+  // element-wise operators, broadcasting numbers and one-element arrays
+  const struct { const char *expr; double expect[4]; size_t n; } cases[] = {
+    {"v * 2 + 1", {3, 5, 7}, 3},
+    {"-v ^ 2", {1, 4, 9}, 3},
+    {"v + [10, 20, 30]", {11, 22, 33}, 3},
+    {"[10] - v", {9, 8, 7}, 3},
+    {"v > 1 ? v : 0", {0, 2, 3}, 3},
+    {"v >= 2 && v != 3", {0, 1, 0}, 3},
+    {"1 && v - 2", {1, 0, 1}, 3},
+    {"sqrt([4, 9, 16]) * max(v, 2)", {4, 6, 12}, 3},
+    {"[v, 4]", {1, 2, 3, 4}, 4},
+    {"f(v)", {2, 5, 10}, 3},
+    {"g(v)", {1, 4, 9}, 3},
+    {"[]", {0}, 0},
+  };
+  test_assert( define_str(ft, "f(x) = x * x + 1", errmsg, sizeof(errmsg)) != NULL );
+  test_assert( define_str(ft, "g(x) = sum(x) > 100 ? 0 : x * x", errmsg, sizeof(errmsg)) != NULL );
+  for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    tree = inline_str(ft, cases[i].expr, errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    num = ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg));
+    test_assert( array_equals(num, cases[i].expect, cases[i].n) );
+    test_assert( errmsg[0] == '\0' );
+    ET_free(tree);
+    tree = NULL;
+  }
+  const double *v = AR_data(CD_retrieve_array(dict, "v"));
+  test_assert( v[0] == 1 && v[1] == 2 && v[2] == 3 );
+
+  // reductions give numbers, and leave numbers alone
+  const struct { const char *expr; double expect; } reductions[] = {
+    {"sum(v)", 6}, {"mean(v)", 2}, {"min(v * -1)", -3}, {"max(v)", 3},
+    {"sum(7)", 7}, {"max(4, 5)", 5}, {"sum([])", 0},
+  };
+  for (int i = 0; i < sizeof(reductions) / sizeof(reductions[0]); i++) {
+    tree = parse_str(reductions[i].expr);
+    test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == reductions[i].expect );
+    test_assert( errmsg[0] == '\0' );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // a large array, in whose arithmetic intermediate results are reused
+  size_t n = 100003;
+  big = AR_new(n);
+  double *data = AR_mutable(&big);
+  for (size_t i = 0; i < n; i++)
+    data[i] = i + 1;
+  CD_store_array(dict, "big", big);
+  tree = parse_str("sum(big * 2 - big) - n * (n + 1) / 2 + max(big) + min(big)");
+  CD_store(dict, "n", n);
+  test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == n + 1 );
+  test_assert( AR_refs(big) == 2 && AR_data(big)[n - 1] == n );
+  ET_free(tree);
+  tree = NULL;
+
+  // errors
+  const struct { const char *expr; const char *error; } bad[] = {
+    {"[1, 2] + [1, 2, 3]", "Error: Array lengths differ: 2 and 3"},
+    {"v / [1, 0, 1]", "Error: Division by zero"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    errmsg[0] = '\0';
+    tree = parse_str(bad[i].expr);
+    AR_release(ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg)).array);
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+  tree = parse_str("v + 1");
+  test_assert( isnan(ET_evaluate(tree, dict, errmsg, sizeof(errmsg))) );
+  test_assert( strcmp(errmsg, "Error: Array value where a number is expected") == 0 );
+  ET_free(tree);
+  tree = NULL;
+
+  // the compiled evaluators take numbers only
+  errmsg[0] = '\0';
+  tree = parse_str("sum([1, 2])");
+  test_assert( EW_compile(tree, errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strcmp(errmsg, "Error: Arrays are not supported in compiled expressions") == 0 );
+  ET_free(tree);
+  tree = parse_str("[1, 2");
+  test_assert( tree == NULL );
+
+  ret = 1;
+
+ test_error:
+  AR_release(big);
+  ET_free(tree);
+  EW_free(p);
+  CD_free(dict);
+  FT_free(ft);
+  return ret;
+}
+
+
+/*
+ * Tests sum() and prod() over ranges: binding of the index, exact
+ * integer results, compensated summation, and the compiled loop used
+ * for large ranges
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_ranges()
+{
+  FuncTable ft = FT_new();
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  ETNumber num;
+  char errmsg[128] = {0}, buf[128];
+  int ret = 0;
+
+  tree = parse_str("sum(i, 1, n, sum(j, 1, i, i * j))");
+  ET_tree2string(tree, buf, sizeof(buf));
+  test_assert( strcmp(buf, "sum(i,1,n,sum(j,1,i,(i*j)))") == 0 );
+  ET_free(tree);
+  tree = NULL;
+
+  // the index is bound in the body only; an argument substituted into
+  // a range keeps referring to its own index
+  const struct { const char *expr; double expect; } cases[] = {
+    {"sum(i, 1, 10, i ^ 2)", 385},
+    {"prod(k, 1, 20, k)", 2432902008176640000.0},
+    {"prod(k, 1, 21, k)", 51090942171709440000.0},
+    {"sum(i, 1, 0, i)", 0},
+    {"prod(i, 5, 4, i)", 1},
+    {"sum(i, 1, n, sum(j, 1, i, j))", 171700},
+    {"sum(i, 1, 3, i) + i", 13},
+    {"sum(i, 1, 4, h(i))", 30},
+    {"sum(i, 1, 1000, g(i))", 3003000},
+    {"sum(i, -1000, 1000, i ^ 3)", 0},
+    {"sum(i, 1, 1000000, i)", 500000500000.0},
+    {"sum(i, 1, 100, 0.1)", 10},
+    {"sum(i, 1, 1000000, 0.1)", 100000},
+  };
+  CD_store(dict, "n", 100);
+  CD_store(dict, "i", 7);
+  test_assert( define_str(ft, "h(x) = sum(i, 1, 3, x)", errmsg, sizeof(errmsg)) != NULL );
+  test_assert( define_str(ft, "g(i) = sum(j, 1, 3, i * j)", errmsg, sizeof(errmsg)) != NULL );
+  for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    tree = inline_str(ft, cases[i].expr, errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    test_assert( ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == cases[i].expect );
+    test_assert( errmsg[0] == '\0' );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // integer terms are summed exactly beyond 2^53
+  tree = parse_str("sum(i, 1, 100, 2 ^ 53 + i)");
+  num = ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg));
+  test_assert( num.is_int && num.i == 900719925474104250LL );
+  ET_free(tree);
+  tree = NULL;
+
+  // and by the compiled loop, which leaves terms beyond 2^53 to the
+  // tree walk
+  const struct { const char *expr; int64_t expect; } exact[] = {
+    {"sum(i, 1, 1000000, i * i)", 333333833333500000LL},
+    {"sum(i, -300, 299, i ^ 5)", -2430000000000LL},
+    {"prod(i, 1, 300, i > 20 ? 1 : i)", 2432902008176640000LL},
+    {"sum(i, 1, 300, 2 ^ 53 + i)", 2702159776422342750LL},
+  };
+  for (int i = 0; i < sizeof(exact) / sizeof(exact[0]); i++) {
+    tree = parse_str(exact[i].expr);
+    num = ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg));
+    test_assert( num.is_int && num.i == exact[i].expect );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // the compiled loop over a large range agrees with the tree walk
+  CD_store(dict, "x", 0.5);
+  tree = parse_str("sum(i, 1, 300000, sqrt(i) * x) - sum(i, 1, 300000, i ^ 0.5) / 2");
+  test_assert( fabs(ET_evaluate(tree, dict, errmsg, sizeof(errmsg))) < 1e-6 );
+  ET_free(tree);
+  tree = parse_str("sum(i, 1, 300, [i, 1])");
+  test_assert( array_equals(ET_evaluate_number(tree, dict, errmsg, sizeof(errmsg)),
+                            (double[]){45150, 300}, 2) );
+  ET_free(tree);
+  tree = NULL;
+
+  // errors
+  const struct { const char *expr; const char *error; } bad[] = {
+    {"prod(i, 1.5, 3, i)", "Error: Bounds of prod must be integers"},
+    {"sum(i, 1, 1000, 1 / (i - 500))", "Error: Division by zero"},
+    {"sum(i, 1, 10, 1 / (i - 5))", "Error: Division by zero"},
+    {"sum(i, 1, 1000, y)", "Undefined variable: y"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    errmsg[0] = '\0';
+    tree = parse_str(bad[i].expr);
+    test_assert( isnan(ET_evaluate(tree, dict, errmsg, sizeof(errmsg))) );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+  test_assert( parse_str("sum(2, 1, 3, 4)") == NULL );
+  test_assert( parse_str("sum(i, 1, 3, i = 2)") == NULL );
+
+  // the compiled evaluators reject ranges
+  errmsg[0] = '\0';
+  tree = parse_str("sum(i, 1, 3, i)");
+  test_assert( EW_compile(tree, errmsg, sizeof(errmsg)) == NULL );
+  test_assert( strcmp(errmsg, "Error: sum over a range is not supported in compiled expressions") == 0 );
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  CD_free(dict);
+  FT_free(ft);
+  return ret;
+}
+
+
+/*
+ * Tests automatic differentiation: the gradient and directional
+ * derivatives against central differences, and errors
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_autodiff()
+{
+  const char *exprs[] = {
+    "x * y + z ^ 2",
+    "sqrt(x * x + y * y) / z",
+    "exp(-x) * log(y) + max(x, y) - abs(x - z)",
+    "sin(x * y) - cos(z) / (1 + x)",
+    "x ^ y + 2 ^ z",
+    "x > y ? x * x : y * z",
+    "x < 1 && y > 1 ? (t = x * y) + t * z : 0",
+    "f(x, y) * z",
+    "r(3, x) + y",
+    "sum(i, 1, 10, x ^ i / i) * prod(i, 1, 3, y + i)",
+  };
+  const char *names[] = {"x", "y", "z", "w"};
+  const double point[] = {0.7, 1.3, 2.0};
+  const double dir[] = {0.5, -1, 2, 3};
+  FuncTable ft = FT_new();
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  char errmsg[128] = {0};
+  double grad[4], deriv;
+  int ret = 0;
+
+  test_assert( define_str(ft, "f(a, b) = a ^ 2 + b", errmsg, sizeof(errmsg)) != NULL );
+  test_assert( define_str(ft, "r(n, v) = n > 0 ? v * r(n - 1, v) : 1", errmsg,
+                          sizeof(errmsg)) != NULL );
+  for (int k = 0; k < 3; k++)
+    CD_store(dict, names[k], point[k]);
+
+  // exact for products and powers
+  tree = parse_str("x * y + z ^ 2");
+  test_assert( ET_gradient(tree, dict, names, 4, grad, errmsg, sizeof(errmsg)) == 0.91 + 4 );
+  test_assert( grad[0] == 1.3 && grad[1] == 0.7 && grad[2] == 4 && grad[3] == 0 );
+  ET_free(tree);
+  tree = NULL;
+
+  for (int i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+    tree = inline_str(ft, exprs[i], errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    double value = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+    test_assert( ET_gradient(tree, dict, names, 4, grad, errmsg, sizeof(errmsg)) == value );
+    test_assert( ET_directional(tree, dict, names, dir, 4, &deriv, errmsg,
+                                sizeof(errmsg)) == value );
+    test_assert( errmsg[0] == '\0' );
+
+    double dot = 0;
+    for (int k = 0; k < 3; k++) {
+      const double h = 1e-6;
+      CD_store(dict, names[k], point[k] + h);
+      double up = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+      CD_store(dict, names[k], point[k] - h);
+      double down = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
+      CD_store(dict, names[k], point[k]);
+      test_assert( fabs(grad[k] - (up - down) / (2 * h)) <= 1e-6 * (1 + fabs(grad[k])) );
+      dot += dir[k] * grad[k];
+    }
+    test_assert( grad[3] == 0 );
+    test_assert( fabs(deriv - dot) <= 1e-12 * (1 + fabs(dot)) );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // a variable assigned in the expression carries its derivative
+  tree = parse_str("(t = x * x) + t");
+  test_assert( ET_gradient(tree, dict, names, 1, grad, errmsg, sizeof(errmsg)) ==
+               2 * (0.7 * 0.7) );
+  test_assert( grad[0] == 4 * 0.7 && CD_retrieve(dict, "t") == 0.7 * 0.7 );
+  ET_free(tree);
+  tree = NULL;
+
+  // errors
+  const struct { const char *expr; const char *error; } bad[] = {
+    {"x / (y - y)", "Error: Division by zero"},
+    {"x + q", "Undefined variable: q"},
+    {"[x, y]", "Error: Arrays cannot be differentiated"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    errmsg[0] = '\0';
+    tree = parse_str(bad[i].expr);
+    test_assert( isnan(ET_gradient(tree, dict, names, 2, grad, errmsg, sizeof(errmsg))) );
+    test_assert( isnan(grad[0]) && isnan(grad[1]) );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    errmsg[0] = '\0';
+    test_assert( isnan(ET_directional(tree, dict, names, dir, 2, &deriv, errmsg,
+                                      sizeof(errmsg))) );
+    test_assert( isnan(deriv) && strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  CD_free(dict);
+  FT_free(ft);
+  return ret;
+}
+
+/*
+ * Tests symbolic differentiation: simplified results, agreement with
+ * automatic differentiation, compiling the derivative, and errors
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_derive()
+{
+  const struct { const char *expr; const char *deriv; } simplified[] = {
+    {"x * x + 3 * x", "((2*x)+3)"},
+    {"x - x + y", "0"},
+    {"y * y", "0"},
+    {"-(-x)", "1"},
+    {"x ^ 3", "(3*(x^2))"},
+    {"sin(x) ^ 2", "((2*sin(x))*cos(x))"},
+    {"log(x) * cos(x)", "(((1/x)*cos(x))-(log(x)*sin(x)))"},
+    {"sum(i, 1, 3, x ^ i)", "sum(i,1,3,(i*(x^(i-1))))"},
+    {"x ^ 2 ^ 2", "(4*(x^3))"},
+    {"x ^ x", "((x^x)*(log(x)+(x/x)))"},
+    {"0 ^ x", "((0^x)*(log(0)+(0/0)))"},
+  };
+  const char *exprs[] = {
+    "x * y + z ^ 2",
+    "sqrt(x * x + y * y) / z",
+    "exp(-x) * log(y) + max(x, y) - abs(x - z)",
+    "sin(x * y) - cos(z) / (1 + x)",
+    "x ^ y + 2 ^ x",
+    "x > y ? x * x : y * z",
+    "f(x, y) * z",
+    "sum(i, 1, 10, x ^ i / i) * prod(i, 1, 3, x + i)",
+    "prod(i, 0, 4, x - i)",
+    "prod(i, 1, 3, x * i + i2)",
+  };
+  const char *names[] = {"x"};
+  FuncTable ft = FT_new();
+  CDict dict = CD_new();
+  ExprTree tree = NULL, deriv = NULL;
+  Prepared p = NULL;
+  Closure cc = NULL;
+  char errmsg[128] = {0}, buf[1024];
+  double values[8], grad;
+  int ret = 0;
+
+  test_assert( define_str(ft, "f(a, b) = a ^ 2 + b", errmsg, sizeof(errmsg)) != NULL );
+  test_assert( define_str(ft, "r(n, v) = n > 0 ? v * r(n - 1, v) : 1", errmsg,
+                          sizeof(errmsg)) != NULL );
+  CD_store(dict, "x", 0.7);
+  CD_store(dict, "y", 1.3);
+  CD_store(dict, "z", 2.0);
+  CD_store(dict, "i2", 0.5);
+
+  for (int i = 0; i < sizeof(simplified) / sizeof(simplified[0]); i++) {
+    tree = parse_str(simplified[i].expr);
+    deriv = ET_derive(tree, "x", errmsg, sizeof(errmsg));
+    test_assert( deriv != NULL );
+    ET_tree2string(deriv, buf, sizeof(buf));
+    test_assert( strcmp(buf, simplified[i].deriv) == 0 );
+    ET_free(deriv);
+    deriv = NULL;
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // the derivative evaluates to the gradient, and compiles
+  for (int i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+    tree = inline_str(ft, exprs[i], errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    deriv = ET_derive(tree, "x", errmsg, sizeof(errmsg));
+    test_assert( deriv != NULL );
+    ET_gradient(tree, dict, names, 1, &grad, errmsg, sizeof(errmsg));
+    double d = ET_evaluate(deriv, dict, errmsg, sizeof(errmsg));
+    test_assert( errmsg[0] == '\0' );
+    test_assert( fabs(d - grad) <= 1e-12 * (1 + fabs(grad)) );
+
+    // and prints as an expression of the same value
+    ET_tree2string(deriv, buf, sizeof(buf));
+    ET_free(tree);
+    tree = parse_str(buf);
+    test_assert( tree != NULL && ET_evaluate(tree, dict, errmsg, sizeof(errmsg)) == d );
+
+    // the compiled evaluators take no ranges
+    if (!strstr(exprs[i], "sum") && !strstr(exprs[i], "prod")) {
+      p = EW_compile(deriv, errmsg, sizeof(errmsg));
+      cc = CC_compile(deriv, errmsg, sizeof(errmsg));
+      test_assert( p != NULL && cc != NULL );
+      EW_bind_dict(p, values, dict);
+      test_assert( EW_execute(p, values, errmsg, sizeof(errmsg)) == d );
+      EW_bind_dict(p, values, dict);
+      test_assert( CC_execute(cc, values, errmsg, sizeof(errmsg)) == d );
+      EW_free(p);
+      p = NULL;
+      CC_free(cc);
+      cc = NULL;
+    }
+    ET_free(deriv);
+    deriv = NULL;
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // errors
+  const struct { const char *expr; const char *error; } bad[] = {
+    {"(t = x) * 2", "Error: Cannot differentiate an assignment"},
+    {"[x, 1]", "Error: Arrays cannot be differentiated"},
+    {"r(3, x)", "Error: Cannot differentiate a call of r"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    tree = inline_str(ft, bad[i].expr, errmsg, sizeof(errmsg));
+    test_assert( tree != NULL );
+    test_assert( ET_derive(tree, "x", errmsg, sizeof(errmsg)) == NULL );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // a recursive call that does not depend on the variable is constant
+  tree = inline_str(ft, "r(3, y) * x", errmsg, sizeof(errmsg));
+  deriv = ET_derive(tree, "x", errmsg, sizeof(errmsg));
+  test_assert( deriv != NULL && ET_evaluate(deriv, dict, errmsg, sizeof(errmsg)) ==
+               1.3 * 1.3 * 1.3 );
+
+  ret = 1;
+
+ test_error:
+  EW_free(p);
+  CC_free(cc);
+  ET_free(deriv);
+  ET_free(tree);
+  CD_free(dict);
+  FT_free(ft);
+  return ret;
+}
+
+/*
+ * Tests root finding: bracketed and from a starting point, with and
+ * without a compiled derivative, and errors
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_solve()
+{
+  const struct { const char *expr; double lo, hi, root; } roots[] = {
+    {"x * x - 2", 0, 2, sqrt(2)},
+    {"x * x - 2", 1, 1, sqrt(2)},
+    {"x ^ 3 - y", -10, 10, cbrt(3)},
+    {"exp(x) - 1e6", 0, 100, log(1e6)},
+    {"exp(x) - 1e6", 1, 1, log(1e6)},
+    {"sqrt(x) - 0.5", 0, 4, 0.25},             // no derivative at 0
+    {"x > 1 ? x - 2 : -1", 0, 10, 2},
+    {"sum(i, 1, 3, x ^ i) - 14", 0, 5, 2},     // walked, not compiled
+    {"r(2, x) - 9", 0, 5, 3},                  // no derivative at all
+    {"r(2, x) - 9", 1, 1, 3},
+    {"(x - 1) ^ 3", 0, 3, 1},
+  };
+  FuncTable ft = FT_new();
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  Solver s = NULL;
+  char errmsg[128] = {0};
+  int iterations, ret = 0;
+
+  test_assert( define_str(ft, "r(n, v) = n > 0 ? v * r(n - 1, v) : 1", errmsg,
+                          sizeof(errmsg)) != NULL );
+  CD_store(dict, "y", 3);
+
+  for (int i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+    tree = inline_str(ft, roots[i].expr, errmsg, sizeof(errmsg));
+    s = SV_new(tree, "x", dict, errmsg, sizeof(errmsg));
+    test_assert( s != NULL );
+    double root = SV_solve(s, roots[i].lo, roots[i].hi, &iterations, errmsg, sizeof(errmsg));
+    test_assert( errmsg[0] == '\0' );
+    test_assert( fabs(root - roots[i].root) <= 4e-16 * roots[i].root );
+    test_assert( iterations > 0 && iterations <= SV_MAX_ITERATIONS );
+    SV_free(s);
+    s = NULL;
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // Newton's method converges quadratically
+  tree = parse_str("x * x - 2");
+  s = SV_new(tree, "x", dict, errmsg, sizeof(errmsg));
+  SV_solve(s, 0, 2, &iterations, errmsg, sizeof(errmsg));
+  test_assert( iterations <= 10 );
+  SV_free(s);
+  s = NULL;
+  ET_free(tree);
+  tree = NULL;
+
+  // errors
+  const struct { const char *expr; double lo, hi; const char *error; } bad[] = {
+    {"x * x + 1", -1, 1, "Error: Expression does not change sign between x = -1 and 1"},
+    {"x * x + 1", 0, 0, "Error: No root found from x = 0; give an interval"},
+    {"y + 1", 0, 1, "Error: Expression does not depend on x"},
+    {"[x, 1]", 0, 1, "Error: Arrays cannot be solved for"},
+    {"log(x) + 1", -1, 1, "Error: Expression is not a number at x = -1"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    errmsg[0] = '\0';
+    tree = parse_str(bad[i].expr);
+    s = SV_new(tree, "x", dict, errmsg, sizeof(errmsg));
+    if (s)
+      test_assert( isnan(SV_solve(s, bad[i].lo, bad[i].hi, &iterations, errmsg,
+                                  sizeof(errmsg))) );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    SV_free(s);
+    s = NULL;
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  ret = 1;
+
+ test_error:
+  SV_free(s);
+  ET_free(tree);
+  CD_free(dict);
+  FT_free(ft);
+  return ret;
+}
+
+/*
+ * Tests numerical integration: known integrals to within the
+ * tolerance, refinement where it is needed, and errors
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_integrate()
+{
+  const double pi = 3.14159265358979323846;
+  const struct { const char *expr; double a, b, integral; } integrals[] = {
+    {"x ^ 2", 0, 1, 1.0 / 3},
+    {"x ^ 2", 1, 0, -1.0 / 3},
+    {"sin(x)", 0, pi, 2},
+    {"exp(-x * x / y)", -20, 20, sqrt(2 * pi)},
+    {"abs(x - 1 / 3)", 0, 1, 5.0 / 18},
+    {"x > 0.3 ? 1 : 0", 0, 1, 0.7},
+    {"sqrt(x)", 0, 1, 2.0 / 3},
+    {"log(x)", 0, 1, -1},
+    {"sin(1 / x)", 0.01, 1, 0.5039818931754155},
+    {"y", 2, 5, 6},
+    {"sin(100 * x) ^ 2", 0, 10, 5 - sin(2000) / 400},
+  };
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  QDStats stats;
+  char errmsg[128] = {0};
+  int ret = 0;
+
+  CD_store(dict, "y", 2);
+
+  for (int i = 0; i < sizeof(integrals) / sizeof(integrals[0]); i++) {
+    tree = parse_str(integrals[i].expr);
+    double value = QD_integrate(tree, "x", dict, integrals[i].a, integrals[i].b, &stats, errmsg,
+                                sizeof(errmsg));
+    test_assert( errmsg[0] == '\0' );
+    test_assert( fabs(value - integrals[i].integral) <= 1e-9 * fabs(integrals[i].integral) );
+    test_assert( stats.error <= 1e-9 * fabs(integrals[i].integral) );
+    test_assert( stats.evaluations == 21L * (2 * stats.intervals - QD_BATCH) );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  // a smooth integrand needs only the first batch; a kink is refined
+  tree = parse_str("x * x");
+  QD_integrate(tree, "x", dict, 0, 1, &stats, errmsg, sizeof(errmsg));
+  test_assert( stats.intervals == QD_BATCH && stats.evaluations == 21 * QD_BATCH );
+  ET_free(tree);
+  tree = parse_str("abs(x - 0.3)");
+  QD_integrate(tree, "x", dict, 0, 1, &stats, errmsg, sizeof(errmsg));
+  test_assert( stats.intervals > QD_BATCH );
+  ET_free(tree);
+  tree = NULL;
+
+  // a variable in a branch not taken need not be defined
+  tree = parse_str("x > -1 ? x : q");
+  test_assert( QD_integrate(tree, "x", dict, 0, 1, &stats, errmsg, sizeof(errmsg)) == 0.5 );
+  test_assert( errmsg[0] == '\0' );
+  ET_free(tree);
+  tree = NULL;
+
+  // errors
+  const struct { const char *expr; double a, b; const char *error; } bad[] = {
+    {"x + q", 0, 1, "Undefined variable: q"},
+    {"sqrt(x)", -1, 1, "Error: Integrand is not a finite number at x = -0.999729"},
+    {"sum(i, 1, 3, x)", 0, 1, "Error: sum over a range is not supported in compiled expressions"},
+    {"x", 0, INFINITY, "Error: Bounds of integrate must be finite"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    errmsg[0] = '\0';
+    tree = parse_str(bad[i].expr);
+    test_assert( isnan(QD_integrate(tree, "x", dict, bad[i].a, bad[i].b, &stats, errmsg,
+                                    sizeof(errmsg))) );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests Monte Carlo evaluation: the generator against its published
+ * answers, the moments and quantiles of each distribution to within
+ * their sampling error, reproducibility, and errors
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_montecarlo()
+{
+  const long n = 200000;
+  const struct { const char *dist; double params[2]; int num_params;
+    double mean, std_dev, p5, median, p95; } dists[] = {
+    {"uniform", {2, 5}, 2, 3.5, sqrt(0.75), 2.15, 3.5, 4.85},
+    {"normal", {1, 2}, 2, 1, 2, 1 - 2 * 1.6448536269514722, 1, 1 + 2 * 1.6448536269514722},
+    {"exponential", {4}, 1, 0.25, 0.25, -log(0.95) / 4, log(2) / 4, -log(0.05) / 4},
+    {"lognormal", {0, 0.5}, 2, 1.1331484530668263, 0.6039005332108811,
+     0.4393641049274925, 1, 1 / 0.4393641049274925},
+  };
+  MOModel m = MO_new(42), other = NULL;
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  MOStats stats, again;
+  char errmsg[128] = {0};
+  int ret = 0;
+
+  // Philox4x32-10's known-answer tests
+  uint32_t counter[4] = {0, 0, 0, 0}, key[2] = {0, 0};
+  MO_philox(counter, key);
+  test_assert( counter[0] == 0x6627e8d5 && counter[1] == 0xe169c58d &&
+               counter[2] == 0xbc57ac4c && counter[3] == 0x9b00dbd8 );
+  uint32_t counter_pi[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+  uint32_t key_pi[2] = {0xa4093822, 0x299f31d0};
+  MO_philox(counter_pi, key_pi);
+  test_assert( counter_pi[0] == 0xd16cfe09 && counter_pi[1] == 0x94fdcceb &&
+               counter_pi[2] == 0x5001e420 && counter_pi[3] == 0x24126ea1 );
+
+  tree = parse_str("x");
+  for (int i = 0; i < sizeof(dists) / sizeof(dists[0]); i++) {
+    test_assert( MO_bind(m, "x", dists[i].dist, dists[i].params, dists[i].num_params, errmsg,
+                         sizeof(errmsg)) );
+    double mean = MO_run(m, tree, dict, n, &stats, errmsg, sizeof(errmsg));
+    test_assert( errmsg[0] == '\0' );
+    test_assert( stats.samples == n && stats.undefined == 0 && mean == stats.mean );
+    test_assert( fabs(stats.mean - dists[i].mean) <= 5 * stats.std_error );
+    test_assert( fabs(stats.std_dev - dists[i].std_dev) <= 0.02 * dists[i].std_dev );
+    test_assert( fabs(stats.p5 - dists[i].p5) <= 0.02 * dists[i].std_dev );
+    test_assert( fabs(stats.median - dists[i].median) <= 0.02 * dists[i].std_dev );
+    test_assert( fabs(stats.p95 - dists[i].p95) <= 0.02 * dists[i].std_dev );
+    test_assert( stats.min <= stats.p5 && stats.p5 <= stats.p25 && stats.p25 <= stats.median &&
+                 stats.median <= stats.p75 && stats.p75 <= stats.p95 && stats.p95 <= stats.max );
+  }
+  test_assert( stats.min > 0 );
+  ET_free(tree);
+
+  // the same seed gives the same samples; the next run new ones
+  const double unit[2] = {0, 1};
+  other = MO_new(42);
+  test_assert( MO_bind(m, "x", "normal", unit, 2, errmsg, sizeof(errmsg)) );
+  test_assert( MO_bind(other, "x", "lognormal", unit, 2, errmsg, sizeof(errmsg)) );
+  test_assert( MO_bind(other, "x", "normal", unit, 2, errmsg, sizeof(errmsg)) );
+  tree = parse_str("x * x + y");
+  CD_store(dict, "y", 10);
+  for (int i = 0; i < 4; i++)
+    MO_run(other, tree, dict, 1000, &again, errmsg, sizeof(errmsg));
+  MO_run(other, tree, dict, 5000, &again, errmsg, sizeof(errmsg));
+  MO_run(m, tree, dict, 5000, &stats, errmsg, sizeof(errmsg));
+  test_assert( stats.mean == again.mean && stats.median == again.median );
+  test_assert( stats.min >= 10 && fabs(stats.mean - 11) <= 5 * stats.std_error );
+  MO_run(m, tree, dict, 5000, &again, errmsg, sizeof(errmsg));
+  test_assert( stats.mean != again.mean );
+  ET_free(tree);
+
+  // samples without a value are left out
+  tree = parse_str("sqrt(x)");
+  MO_run(m, tree, dict, n, &stats, errmsg, sizeof(errmsg));
+  test_assert( errmsg[0] == '\0' );
+  test_assert( stats.undefined > 0.48 * n && stats.undefined < 0.52 * n );
+  test_assert( stats.min >= 0 );
+  ET_free(tree);
+
+  // an indicator's quantiles are exactly 0 and 1, of either sign
+  test_assert( MO_bind(m, "u", "uniform", (double[]){0, 1}, 2, errmsg, sizeof(errmsg)) );
+  const char *indicators[] = {"u > 0.5 ? 0 : 1", "u > 0.5 ? -0 : -1"};
+  for (int i = 0; i < 2; i++) {
+    tree = parse_str(indicators[i]);
+    MO_run(m, tree, dict, n, &stats, errmsg, sizeof(errmsg));
+    test_assert( errmsg[0] == '\0' );
+    double zero = i == 0 ? stats.p25 : stats.p75, one = i == 0 ? stats.p75 : -stats.p25;
+    test_assert( zero == 0 && one == 1 );
+    test_assert( stats.median == 0 || fabs(stats.median) == 1 );
+    test_assert( stats.min == (i == 0 ? 0 : -1) && stats.max == (i == 0 ? 1 : 0) );
+    ET_free(tree);
+  }
+  tree = NULL;
+
+  // errors
+  test_assert( !MO_bind(m, "x", "gamma", unit, 2, errmsg, sizeof(errmsg)) );
+  test_assert( strcmp(errmsg, "Error: Unknown distribution gamma") == 0 );
+  test_assert( !MO_bind(m, "x", "exponential", unit, 2, errmsg, sizeof(errmsg)) );
+  test_assert( strcmp(errmsg, "Error: exponential takes 1 parameter") == 0 );
+  const double backwards[2] = {1, 0};
+  test_assert( !MO_bind(m, "x", "uniform", backwards, 2, errmsg, sizeof(errmsg)) );
+  test_assert( strcmp(errmsg, "Error: Invalid parameters for uniform") == 0 );
+
+  const struct { const char *expr; long n; const char *error; } bad[] = {
+    {"x + q", 100, "Undefined variable: q"},
+    {"x", 0, "Error: Number of samples must be at least 1"},
+    {"sum(i, 1, 3, x)", 100, "Error: sum over a range is not supported in compiled expressions"},
+    {"sqrt(-1 - x * x)", 100, "Error: Expression is not a number at any sample"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    tree = parse_str(bad[i].expr);
+    test_assert( isnan(MO_run(m, tree, dict, bad[i].n, &stats, errmsg, sizeof(errmsg))) );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  MO_free(other);
+  MO_free(m);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests tabulation over grids: the order and coordinates of the points
+ * in text and binary tables, grids of more than one tile, and errors
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tabulate()
+{
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  FILE *out = tmpfile();
+  char errmsg[128] = {0};
+  char line[256];
+  int ret = 0;
+
+  test_assert( out != NULL );
+  CD_store(dict, "a", 2);
+
+  // text: the last axis varies fastest, and its ends are exact
+  tree = parse_str("a * x + y");
+  GRAxis xy[] = {{"x", 0, 1, 3}, {"y", -1, 0.3, 2}};
+  test_assert( GR_tabulate(tree, xy, 2, dict, out, GR_TEXT, errmsg, sizeof(errmsg)) == 6 );
+  const char *expected[] = {
+    "# x y value\n",
+    "0 -1 -1\n",
+    "0 0.29999999999999999 0.29999999999999999\n",
+    "0.5 -1 0\n",
+    "0.5 0.29999999999999999 1.3\n",
+    "1 -1 1\n",
+    "1 0.29999999999999999 2.2999999999999998\n",
+  };
+  rewind(out);
+  for (int i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    test_assert( fgets(line, sizeof(line), out) != NULL );
+    test_assert( strcmp(line, expected[i]) == 0 );
+  }
+  test_assert( fgets(line, sizeof(line), out) == NULL );
+  ET_free(tree);
+
+  // points with an error are NaN
+  tree = parse_str("sqrt(x)");
+  GRAxis single[] = {{"x", -1, 1, 3}};
+  rewind(out);
+  test_assert( GR_tabulate(tree, single, 1, dict, out, GR_TEXT, errmsg, sizeof(errmsg)) == 3 );
+  rewind(out);
+  test_assert( fgets(line, sizeof(line), out) && strcmp(line, "# x value\n") == 0 );
+  test_assert( fgets(line, sizeof(line), out) && strcmp(line, "-1 nan\n") == 0 );
+  ET_free(tree);
+
+  // binary, over many tiles, with an axis the expression does not use
+  tree = parse_str("x * 100 + y * 10 + a");
+  GRAxis cube[] = {{"x", 0, 30, 31}, {"y", 0, 6, 7}, {"z", 0, 1, 11}};
+  rewind(out);
+  test_assert( GR_tabulate(tree, cube, 3, dict, out, GR_BINARY, errmsg, sizeof(errmsg)) ==
+               31 * 7 * 11 );
+  rewind(out);
+  for (int i = 0; i < 31 * 7 * 11; i++) {
+    double value;
+    test_assert( fread(&value, sizeof(value), 1, out) == 1 );
+    test_assert( value == i / 77 * 100 + i / 11 % 7 * 10 + 2 );
+  }
+  ET_free(tree);
+  tree = NULL;
+
+  // errors
+  const struct { const char *expr; GRAxis axis[2]; int num_axes; const char *error; } bad[] = {
+    {"x + q", {{"x", 0, 1, 2}}, 1, "Undefined variable: q"},
+    {"x", {{"x", 0, 1, 0}}, 1, "Error: Invalid range for x"},
+    {"x", {{"x", 0, INFINITY, 2}}, 1, "Error: Invalid range for x"},
+    {"x * y", {{"x", 0, 1, 2}, {"x", 0, 1, 2}}, 2, "Error: x is given twice"},
+    {"x * y", {{"x", 0, 1, 1e8}, {"y", 0, 1, 1e8}}, 2, "Error: Grid is too large"},
+    {"x", {{"x", 0, 1, 2}}, 0, "Error: A grid has 1 to 3 variables"},
+    {"sum(i, 1, 3, x)", {{"x", 0, 1, 2}}, 1,
+     "Error: sum over a range is not supported in compiled expressions"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    tree = parse_str(bad[i].expr);
+    test_assert( GR_tabulate(tree, bad[i].axis, bad[i].num_axes, dict, out, GR_TEXT, errmsg,
+                             sizeof(errmsg)) == -1 );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  if (out)
+    fclose(out);
+  CD_free(dict);
+  return ret;
+}
+
+// What the batch test's evaluator saw of each line
+typedef struct
+{
+  CDict dict;
+  int count;
+  long number[4096];
+  char seen[4096][160];
+} BatchSeen;
+
+static bool batch_is_command(const char *text, size_t len)
+{
+  return len >= 3 && strncmp(text, "cmd", 3) == 0;
+}
+
+static void batch_compute(BTLine *line, CDict vars, void *cb_data)
+{
+  line->result = ET_evaluate_number(line->tree, vars, line->errmsg, sizeof(line->errmsg));
+}
+
+static void batch_evaluate(const BTLine *line, void *cb_data)
+{
+  BatchSeen *b = cb_data;
+  char errmsg[128] = "";
+  char *seen = b->seen[b->count];
+
+  b->number[b->count++] = line->number;
+  if (line->command) {
+    snprintf(seen, 160, "command %s", line->command);
+  } else if (line->tree == NULL) {
+    snprintf(seen, 160, "error %s", line->errmsg);
+  } else if (line->computed) {
+    if (line->errmsg[0] != '\0')
+      snprintf(seen, 160, "error %s", line->errmsg);
+    else
+      snprintf(seen, 160, "%.17g", line->result.is_int ? line->result.i : line->result.d);
+  } else {
+    double value = ET_evaluate(line->tree, b->dict, errmsg, sizeof(errmsg));
+    if (*errmsg != '\0')
+      snprintf(seen, 160, "error %s", errmsg);
+    else
+      snprintf(seen, 160, "%.17g", value);
+  }
+}
+
+int test_batch_file()
+{
+  BatchSeen *b = calloc(1, sizeof(BatchSeen));
+  FILE *in = tmpfile(), *pipe = NULL;
+  CList tokens = NULL;
+  char (*sequential)[160] = NULL;
+  char errmsg[128] = "";
+  char command[64];
+  int repeats = 2 * BT_CHUNK_BYTES / 10 + 7;
+  int ret = 0;
+
+  test_assert( b != NULL && in != NULL );
+  b->dict = CD_new();
+
+  // a span is tokenized without reading past its end
+  tokens = TOK_tokenize_span("12+345", 5, errmsg, sizeof(errmsg));
+  test_assert( tokens && TOK_next(tokens).t.value == 12 );
+  TOK_consume(tokens);
+  TOK_consume(tokens);
+  test_assert( TOK_next(tokens).t.value == 34 );
+  TOK_consume(tokens);
+  test_assert( TOK_next_type(tokens) == TOK_END );
+  CL_free(tokens);
+  tokens = TOK_tokenize_span("x==1", 2, errmsg, sizeof(errmsg));
+  test_assert( tokens && TOK_next_type(tokens) == TOK_SYMBOL );
+  TOK_consume(tokens);
+  test_assert( TOK_next_type(tokens) == TOK_EQUAL );
+  CL_free(tokens);
+  tokens = NULL;
+
+  // each line sees the assignments of the lines before it, over more
+  // lines than a chunk holds
+  fprintf(in, "# a comment\n"
+          "x = 1\n"
+          "\n"
+          "   \t\n"
+          "cmd anything (\n"
+          "1 +\n"
+          "y * 2\n"
+          "  # an indented comment\n"
+          "x * 10\r\n");
+  for (int i = 0; i < repeats; i++)
+    fprintf(in, "x = x + 1\n");
+  fprintf(in, "x");   // no newline at the end
+  fflush(in);
+
+  // once mapped, and once read through a pipe
+  for (int run = 0; run < 2; run++) {
+    rewind(in);
+    if (run == 1) {
+      snprintf(command, sizeof(command), "cat <&%d", fileno(in));
+      pipe = popen(command, "r");
+      test_assert( pipe != NULL );
+    }
+    b->count = 0;
+    BTConfig config = {.is_command = batch_is_command, .evaluate = batch_evaluate, .cb_data = b};
+    long lines = BT_run(run == 0 ? in : pipe, &config);
+    test_assert( lines == 5 + repeats + 1 );
+    test_assert( b->count == lines );
+
+    test_assert( b->number[0] == 2 && strcmp(b->seen[0], "1") == 0 );
+    test_assert( b->number[1] == 5 && strcmp(b->seen[1], "command cmd anything (") == 0 );
+    test_assert( b->number[2] == 6 && strcmp(b->seen[2], "error Unexpected token (end)") == 0 );
+    test_assert( b->number[3] == 7 && strcmp(b->seen[3], "error Undefined variable: y") == 0 );
+    test_assert( b->number[4] == 9 && strcmp(b->seen[4], "10") == 0 );
+    for (int i = 0; i < repeats; i++)
+      test_assert( b->number[5 + i] == 10 + i && atof(b->seen[5 + i]) == i + 2 );
+    test_assert( b->number[lines - 1] == 10 + repeats );
+    test_assert( atof(b->seen[lines - 1]) == repeats + 1 );
+    if (pipe)
+      pclose(pipe);
+    pipe = NULL;
+  }
+
+  // lines that read and assign a few variables at random, computed at
+  // once where they are independent, give the results of running them
+  // one after another
+  const char *templates[] = {
+    "a = b + 1", "b = a * 0.5 + c", "c = c + 1", "a + b * c", "d = a - c", "c * d",
+    "e = d + 2", "b = 3", "(a = 2) + a", "e", "cmd c = 0", "q + 1", "a / d",
+  };
+  const int num_templates = sizeof(templates) / sizeof(templates[0]);
+  fclose(in);
+  in = tmpfile();
+  test_assert( in != NULL );
+  srand(11);
+  fprintf(in, "a = 1\nb = 2\nc = 3\nd = 4\n");
+  for (int i = 0; i < 3000; i++)
+    fprintf(in, "%s\n", templates[rand() % num_templates]);
+
+  sequential = malloc(3004 * sizeof(*sequential));
+  test_assert( sequential != NULL );
+  for (int threads = 1; threads <= 4; threads += 3) {
+    for (int compute = 0; compute < 2; compute++) {
+      CD_free(b->dict);
+      b->dict = CD_new();
+      b->count = 0;
+      rewind(in);
+      BTConfig config = {.is_command = batch_is_command, .evaluate = batch_evaluate,
+                         .compute = compute ? batch_compute : NULL, .vars = b->dict,
+                         .threads = threads, .cb_data = b};
+      test_assert( BT_run(in, &config) == 3004 );
+      if (threads == 1 && !compute)
+        memcpy(sequential, b->seen, 3004 * sizeof(*sequential));
+      else
+        for (int i = 0; i < 3004; i++)
+          test_assert( strcmp(b->seen[i], sequential[i]) == 0 );
+    }
+  }
+  // an empty file
+  fclose(in);
+  in = tmpfile();
+  test_assert( in != NULL );
+  BTConfig config = {.is_command = batch_is_command, .evaluate = batch_evaluate, .cb_data = b};
+  test_assert( BT_run(in, &config) == 0 );
+
+  ret = 1;
+
+ test_error:
+  CL_free(tokens);
+  free(sequential);
+  if (pipe)
+    pclose(pipe);
+  if (in)
+    fclose(in);
+  if (b)
+    CD_free(b->dict);
+  free(b);
+  return ret;
+}
+
+int test_csv()
+{
+  CDict dict = CD_new();
+  ExprTree tree = NULL;
+  FILE *in = tmpfile(), *out = tmpfile();
+  char errmsg[128] = {0};
+  char line[256], path[32] = "";
+  int ret = 0;
+
+  test_assert( in != NULL && out != NULL );
+
+  // numbers convert as strtod does, and stop where it would
+  const char *numbers[] = {
+    "0", "-0", "1", "+7", "42", "3.25", "-0.1", ".5", "5.", "1e10", "1E-5", "2.5e+3",
+    "0.30000000000000004", "123456789012345678", "1234567890123456789012", "9007199254740993",
+    "1e22", "1e23", "4.9e-324", "1.7976931348623157e308", "1e400", "0x1p3", "inf", "nan",
+    "12abc", "1e", "1e+", "-", ".", "", "abc", "00012.5000", "1.5,2",
+  };
+  for (int i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+    const char *s = numbers[i], *end = s + strlen(s);
+    char *expected_end;
+    double value, expected = strtod(s, &expected_end);
+    const char *after = CS_number(s, end, &value);
+    if (expected_end == s) {
+      test_assert( after == NULL );
+    } else {
+      test_assert( after == expected_end );
+      test_assert( memcmp(&value, &expected, sizeof(value)) == 0 ||
+                   (isnan(value) && isnan(expected)) );
+    }
+  }
+  // and read no further than the end given
+  double value;
+  test_assert( CS_number("12345", "12345" + 3, &value) == "12345" + 3 && value == 123 );
+
+  // columns are found by name, quoted or not, in any order; fields
+  // that are missing, empty or not numbers are NaN
+  CD_store(dict, "k", 10);
+  fputs("name,\"y\",x,notes\r\n"
+        "\"a, b\",2,1,\"said \"\"hi\"\", left\"\r\n"
+        "c,4,3\r\n"
+        "d,,5,\r\n"
+        "e,abc,7,x\r\n"
+        "f,1e3\r\n", in);
+  rewind(in);
+  tree = parse_str("x * y + k");
+  test_assert( CS_evaluate(tree, in, dict, out, errmsg, sizeof(errmsg)) == 5 );
+  const char *expected[] = {"value\n", "12\n", "22\n", "nan\n", "nan\n", "nan\n"};
+  rewind(out);
+  for (int i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    test_assert( fgets(line, sizeof(line), out) != NULL );
+    test_assert( strcmp(line, expected[i]) == 0 );
+  }
+  test_assert( fgets(line, sizeof(line), out) == NULL );
+  ET_free(tree);
+
+  // many blocks, read back exactly; an assignment to a variable not in
+  // the file does not carry over to the next row
+  in = freopen(NULL, "w+", in);
+  out = freopen(NULL, "w+", out);
+  test_assert( in != NULL && out != NULL );
+  fputs("t\n", in);
+  for (int i = 0; i < 3 * CS_BLOCK + 7; i++)
+    fprintf(in, "%.17g\n", i / 7.0);
+  rewind(in);
+  tree = parse_str("(k = k + t) / 3");
+  test_assert( CS_evaluate(tree, in, dict, out, errmsg, sizeof(errmsg)) == 3 * CS_BLOCK + 7 );
+  rewind(out);
+  test_assert( fgets(line, sizeof(line), out) && strcmp(line, "value\n") == 0 );
+  for (int i = 0; i < 3 * CS_BLOCK + 7; i++) {
+    test_assert( fgets(line, sizeof(line), out) != NULL );
+    test_assert( strtod(line, NULL) == (10 + i / 7.0) / 3 );
+  }
+  test_assert( fgets(line, sizeof(line), out) == NULL );
+  ET_free(tree);
+
+  // a blank line is a row, except at the end of the file
+  in = freopen(NULL, "w+", in);
+  out = freopen(NULL, "w+", out);
+  test_assert( in != NULL && out != NULL );
+  fputs("x\n1\n \n\n4\n\n \r\n", in);
+  rewind(in);
+  tree = parse_str("x");
+  test_assert( CS_evaluate(tree, in, dict, out, errmsg, sizeof(errmsg)) == 4 );
+  const char *blank_rows[] = {"value\n", "1\n", "nan\n", "nan\n", "4\n"};
+  rewind(out);
+  for (int i = 0; i < sizeof(blank_rows) / sizeof(blank_rows[0]); i++) {
+    test_assert( fgets(line, sizeof(line), out) != NULL );
+    test_assert( strcmp(line, blank_rows[i]) == 0 );
+  }
+  test_assert( fgets(line, sizeof(line), out) == NULL );
+
+  // the file being read is refused as the output, and left as it was
+  test_assert( CS_evaluate(tree, in, dict, in, errmsg, sizeof(errmsg)) == -1 );
+  test_assert( strcmp(errmsg, "Error: The output is also the input") == 0 );
+  strcpy(path, "/tmp/ew_test_XXXXXX");
+  int fd = mkstemp(path);
+  test_assert( fd >= 0 && write(fd, "x\n1\n", 4) == 4 && close(fd) == 0 );
+  fclose(in);
+  in = fopen(path, "r");
+  test_assert( in != NULL );
+  test_assert( CS_open_output(in, path, errmsg, sizeof(errmsg)) == NULL );
+  snprintf(line, sizeof(line), "Error: %s is also the input", path);
+  test_assert( strcmp(errmsg, line) == 0 );
+  test_assert( CS_evaluate(tree, in, dict, out, errmsg, sizeof(errmsg)) == 1 );
+  ET_free(tree);
+  tree = NULL;
+
+  // errors
+  const struct { const char *text, *expr, *error; } bad[] = {
+    {"", "x", "Error: The CSV file has no header"},
+    {"x,y,\"x\"\n1,2,3\n", "y", "Error: x is given twice"},
+    {"x,y\n1,2\n", "x + q", "Undefined variable: q"},
+    {"x\n1\n", "sum(i, 1, 3, x)", "Error: sum over a range is not supported in compiled expressions"},
+  };
+  for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    in = freopen(NULL, "w+", in);
+    test_assert( in != NULL );
+    fputs(bad[i].text, in);
+    rewind(in);
+    tree = parse_str(bad[i].expr);
+    test_assert( CS_evaluate(tree, in, dict, out, errmsg, sizeof(errmsg)) == -1 );
+    test_assert( strcmp(errmsg, bad[i].error) == 0 );
+    ET_free(tree);
+    tree = NULL;
+  }
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  if (in)
+    fclose(in);
+  if (out)
+    fclose(out);
+  if (*path)
+    unlink(path);
+  CD_free(dict);
+  return ret;
+}
+
+// Write a file of count doubles, little-endian, after a header of
+// header_len bytes, to a new temporary file whose name is copied into
+// path; returns false on failure
+static bool write_column_file(char *path, const char *header, size_t header_len,
+                              const double *values, long count)
+{
+  strcpy(path, "/tmp/ew_test_XXXXXX");
+  int fd = mkstemp(path);
+  FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  if (f == NULL)
+    return false;
+  bool ok = fwrite(header, 1, header_len, f) == header_len &&
+            fwrite(values, sizeof(double), count, f) == (size_t)count;
+  return fclose(f) == 0 && ok;
+}
+
+int test_columns()
+{
+  enum { ROWS = 2 * CF_BLOCK + 5 };
+  CDict dict = CD_new();
+  CFTable t = NULL;
+  ExprTree tree = NULL;
+  FILE *out = tmpfile(), *f = NULL;
+  double *x = malloc(2 * ROWS * sizeof(double)), *y = x + ROWS;
+  char x_path[32] = "", xy_path[32] = "", value_path[32] = "", bad_path[32] = "";
+  char errmsg[128] = {0};
+  char header[CF_ENTRY_BYTES * 2 + 24];
+  int ret = 0;
+
+  test_assert( out != NULL && x != NULL );
+  for (int i = 0; i < ROWS; i++) {
+    x[i] = i * 0.25;
+    y[i] = 1.0 / (i + 1);
+  }
+  CD_store(dict, "k", 3);
+
+  // a raw column of x, and a column file of x (again) and y
+  test_assert( write_column_file(x_path, "", 0, x, ROWS) );
+  const char *names[] = {"x", "y"};
+  f = tmpfile();
+  test_assert( f != NULL && CF_write_header(f, names, 2, ROWS) );
+  test_assert( ftell(f) == sizeof(header) );
+  rewind(f);
+  test_assert( fread(header, 1, sizeof(header), f) == sizeof(header) );
+  fclose(f);
+  f = NULL;
+  test_assert( write_column_file(xy_path, header, sizeof(header), x, 2 * ROWS) );
+
+  // raw output, over several blocks
+  t = CF_new();
+  test_assert( CF_add_file(t, xy_path, errmsg, sizeof(errmsg)) );
+  test_assert( CF_rows(t) == ROWS );
+  tree = parse_str("x * y + k");
+  test_assert( CF_evaluate(tree, t, dict, out, CF_RAW, errmsg, sizeof(errmsg)) == ROWS );
+  test_assert( ftell(out) == ROWS * sizeof(double) );
+  rewind(out);
+  for (int i = 0; i < ROWS; i++) {
+    double value;
+    test_assert( fread(&value, sizeof(value), 1, out) == 1 );
+    test_assert( value == x[i] * y[i] + 3 );
+  }
+  ET_free(tree);
+
+  // an assignment to a column's variable leaves the table as it was;
+  // a column file of the results reads back as a table, here with a
+  // raw column
+  tree = parse_str("(y = y * 2) + y");
+  strcpy(value_path, "/tmp/ew_test_XXXXXX");
+  int fd = mkstemp(value_path);
+  f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  test_assert( f != NULL );
+  test_assert( CF_evaluate(tree, t, dict, f, CF_COLUMNS, errmsg, sizeof(errmsg)) == ROWS );
+  test_assert( fclose(f) == 0 );
+  f = NULL;
+  ET_free(tree);
+  tree = parse_str("y");
+  out = freopen(NULL, "w+b", out);
+  test_assert( out != NULL );
+  test_assert( CF_evaluate(tree, t, dict, out, CF_RAW, errmsg, sizeof(errmsg)) == ROWS );
+  rewind(out);
+  for (int i = 0; i < ROWS; i++) {
+    double value;
+    test_assert( fread(&value, sizeof(value), 1, out) == 1 && value == y[i] );
+  }
+  ET_free(tree);
+  CF_free(t);
+
+  t = CF_new();
+  test_assert( CF_add_file(t, value_path, errmsg, sizeof(errmsg)) );
+  test_assert( CF_add_raw(t, "x", x_path, errmsg, sizeof(errmsg)) );
+  tree = parse_str("value - x");
+  out = freopen(NULL, "w+b", out);
+  test_assert( out != NULL );
+  test_assert( CF_evaluate(tree, t, dict, out, CF_RAW, errmsg, sizeof(errmsg)) == ROWS );
+  rewind(out);
+  for (int i = 0; i < ROWS; i++) {
+    double value;
+    test_assert( fread(&value, sizeof(value), 1, out) == 1 && value == 4 * y[i] - x[i] );
+  }
+  ET_free(tree);
+  tree = NULL;
+  CF_free(t);
+  t = NULL;
+
+  // errors
+  t = CF_new();
+  test_assert( CF_add_raw(t, "x", x_path, errmsg, sizeof(errmsg)) );
+  test_assert( !CF_add_file(t, xy_path, errmsg, sizeof(errmsg)) );
+  snprintf(header, sizeof(header), "Error: x is given twice");
+  test_assert( strcmp(errmsg, header) == 0 );
+  test_assert( CF_rows(t) == ROWS );
+
+  test_assert( write_column_file(bad_path, "", 0, x, 3) );
+  test_assert( !CF_add_raw(t, "z", bad_path, errmsg, sizeof(errmsg)) );
+  snprintf(header, sizeof(header), "Error: %s has 3 rows, not %d", bad_path, ROWS);
+  test_assert( strcmp(errmsg, header) == 0 );
+  test_assert( !CF_add_file(t, bad_path, errmsg, sizeof(errmsg)) );
+  snprintf(header, sizeof(header), "Error: %s is not a column file", bad_path);
+  test_assert( strcmp(errmsg, header) == 0 );
+  unlink(bad_path);
+
+  test_assert( write_column_file(bad_path, "EWCOL001", 7, x, 1) );
+  test_assert( !CF_add_raw(t, "z", bad_path, errmsg, sizeof(errmsg)) );
+  snprintf(header, sizeof(header), "Error: %s is not a whole number of doubles", bad_path);
+  test_assert( strcmp(errmsg, header) == 0 );
+  unlink(bad_path);
+
+  f = tmpfile();
+  test_assert( f != NULL && CF_write_header(f, names + 1, 1, ROWS) );
+  rewind(f);
+  test_assert( fread(header, 1, CF_ENTRY_BYTES + 24, f) == CF_ENTRY_BYTES + 24 );
+  fclose(f);
+  f = NULL;
+  test_assert( write_column_file(bad_path, header, CF_ENTRY_BYTES + 24, y, ROWS - 1) );
+  test_assert( !CF_add_file(t, bad_path, errmsg, sizeof(errmsg)) );
+  snprintf(header, sizeof(header), "Error: %s is truncated", bad_path);
+  test_assert( strcmp(errmsg, header) == 0 );
+  unlink(bad_path);
+  *bad_path = '\0';
+
+  test_assert( !CF_add_raw(t, "z", "/nonexistent/z.bin", errmsg, sizeof(errmsg)) );
+  test_assert( strcmp(errmsg, "Error: Cannot open /nonexistent/z.bin") == 0 );
+
+  tree = parse_str("x + q");
+  test_assert( CF_evaluate(tree, t, dict, stdout, CF_RAW, errmsg, sizeof(errmsg)) == -1 );
+  test_assert( strcmp(errmsg, "Undefined variable: q") == 0 );
+
+  // a mapped file is refused as the output, by any name, and left as
+  // it was; another file is emptied
+  test_assert( CF_open_output(t, x_path, errmsg, sizeof(errmsg)) == NULL );
+  snprintf(header, sizeof(header), "Error: %s is also an input", x_path);
+  test_assert( strcmp(errmsg, header) == 0 );
+  snprintf(header, sizeof(header), "/tmp/.%s", x_path + 4);
+  test_assert( CF_open_output(t, header, errmsg, sizeof(errmsg)) == NULL );
+  f = fopen(x_path, "rb");
+  test_assert( f != NULL && fseek(f, 0, SEEK_END) == 0 && ftell(f) == ROWS * sizeof(double) );
+  fclose(f);
+  f = CF_open_output(t, value_path, errmsg, sizeof(errmsg));
+  test_assert( f != NULL && fseek(f, 0, SEEK_END) == 0 && ftell(f) == 0 );
+
+  ret = 1;
+
+ test_error:
+  ET_free(tree);
+  CF_free(t);
+  if (f)
+    fclose(f);
+  if (out)
+    fclose(out);
+  if (*x_path)
+    unlink(x_path);
+  if (*xy_path)
+    unlink(xy_path);
+  if (*value_path)
+    unlink(value_path);
+  if (*bad_path)
+    unlink(bad_path);
+  free(x);
+  CD_free(dict);
+  return ret;
+}
+
+
+/*
+ * Tests the lines expr_whizz runs as commands, by running it in batch
+ * mode: a line starting with a command's name is an expression, the
+ * name a variable, unless it has the command's shape
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_commands()
+{
+  // each line gives one line of output, starting as given
+  const struct { const char *line; const char *output; } cases[] = {
+    {"solve = 4", "4"},
+    {"solve * 2", "8"},
+    {"solve x 0 10: x - 3", "x = 3  ("},
+    {"solve x 0 1 2: x", "line 4: Usage: solve VAR [LO [HI]]: EXPR"},
+    {"mc = 5", "5"},
+    {"mc + 1", "6"},
+    {"mc - 1 ? 2 : 3", "2"},
+    {"mc 0: 7", "line 8: Usage: mc N: EXPR"},
+    {"csv = 3", "3"},
+    {"csv > 2 ? csv : 0", "3"},
+    {"csv / 3 ? csv : 0", "3"},
+    {"csv /nonexistent.csv: 1", "line 12: Error: Cannot open /nonexistent.csv"},
+    {"columns = 2", "2"},
+    {"columns - 1 > 0 ? columns : 0", "2"},
+    {"columns x=/nonexistent.bin > /dev/null: x",
+     "line 15: Error: Cannot open /nonexistent.bin"},
+  };
+  const int num_cases = sizeof(cases) / sizeof(cases[0]);
+  FILE *in = tmpfile(), *pipe = NULL;
+  char command[64], line[256];
+  int ret = 0;
+
+  test_assert( in != NULL );
+  for (int i = 0; i < num_cases; i++)
+    fprintf(in, "%s\n", cases[i].line);
+  fflush(in);
+  rewind(in);
+
+  snprintf(command, sizeof(command), "./expr_whizz -b <&%d 2>&1", fileno(in));
+  pipe = popen(command, "r");
+  test_assert( pipe != NULL );
+  for (int i = 0; i < num_cases; i++) {
+    test_assert( fgets(line, sizeof(line), pipe) != NULL );
+    test_assert( strncmp(line, cases[i].output, strlen(cases[i].output)) == 0 );
+  }
+  test_assert( fgets(line, sizeof(line), pipe) == NULL );
+
+  ret = 1;
+
+ test_error:
+  if (pipe)
+    pclose(pipe);
+  if (in)
+    fclose(in);
+  return ret;
+}
+
+
 int main()
 {
   int passed = 0;
@@ -513,6 +3300,29 @@ int main()
   num_tests++; passed += test_parse(); 
   num_tests++; passed += test_parse_associativity();
   num_tests++; passed += test_parse_errors(); 
+  num_tests++; passed += test_sheet();
+  num_tests++; passed += test_parse_cache();
+  num_tests++; passed += test_memo();
+  num_tests++; passed += test_prepared();
+  num_tests++; passed += test_tier();
+  num_tests++; passed += test_closure();
+  num_tests++; passed += test_integer();
+  num_tests++; passed += test_batch();
+  num_tests++; passed += test_builtins();
+  num_tests++; passed += test_functions();
+  num_tests++; passed += test_conditionals();
+  num_tests++; passed += test_arrays();
+  num_tests++; passed += test_ranges();
+  num_tests++; passed += test_autodiff();
+  num_tests++; passed += test_derive();
+  num_tests++; passed += test_solve();
+  num_tests++; passed += test_integrate();
+  num_tests++; passed += test_montecarlo();
+  num_tests++; passed += test_tabulate();
+  num_tests++; passed += test_batch_file();
+  num_tests++; passed += test_csv();
+  num_tests++; passed += test_columns();
+  num_tests++; passed += test_commands();
 
   printf("Passed %d/%d test cases\n", passed, num_tests);
   fflush(stdout);
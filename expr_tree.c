@@ -9,11 +9,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 #include "expr_tree.h"
+#include "functions.h"
 #include "cdict.h"
+#include "array_ops.h"
+#include "prepared.h"
+#include "range.h"
 
 #define LEFT 0
 #define RIGHT 1
@@ -21,45 +28,119 @@
 struct _expr_tree_node
 {
     ExprNodeType type;
+    bool pure;       // true if the subtree contains no OP_ASSIGN
+    bool integer;    // VALUE node holding ivalue rather than value
+    bool arrays;     // true if the subtree contains an ARRAY_LITERAL
+    bool unbound;    // true if the subtree contains a USER_CALL not yet bound
+    uint64_t hash;   // structural hash of the subtree
     union
     {
         struct _expr_tree_node *child[2];
+        struct _et_call *call; // For FUNC_CALL, USER_CALL, ARRAY_LITERAL and ranges
         double value;
+        int64_t ivalue;
+        int param;    // For PARAM type
         char *symbol; // For SYMBOL type
+        struct
+        {
+            int level;
+            char *name;
+        } index;      // For RANGE_INDEX type
     } n;
 };
 
+// The function and arguments of a call, the elements of an array
+// literal, or the bounds and body of a range, allocated with the node
+struct _et_call
+{
+    const Builtin *builtin; // FUNC_CALL
+    const UserFunc *user;   // USER_CALL, once bound
+    char *name;             // USER_CALL, or the index of a range
+    int num_args;
+    struct _expr_tree_node *arg[];
+};
+
 /*
- * Convert an ExprNodeType into a printable character
+ * Convert an ExprNodeType into a printable operator
  *
  * Parameters:
  *   ent    The ExprNodeType to convert
  *
- * Returns: A single character representing the ent
+ * Returns: The operator, of one or two characters, representing the ent
  */
-static char ExprNodeType_to_char(ExprNodeType ent)
+static const char *ExprNodeType_to_str(ExprNodeType ent)
 {
     switch (ent)
     {
     case OP_ADD:
-        return '+';
+        return "+";
     case OP_SUB:
-        return '-';
+        return "-";
     case OP_MUL:
-        return '*';
+        return "*";
     case OP_DIV:
-        return '/';
+        return "/";
     case OP_POWER:
-        return '^';
+        return "^";
     case OP_ASSIGN:
-        return '=';
+        return "=";
     case UNARY_NEGATE:
-        return '-';
+        return "-";
+    case FUNC_DEF:
+        return "=";
+    case OP_LT:
+        return "<";
+    case OP_LE:
+        return "<=";
+    case OP_GT:
+        return ">";
+    case OP_GE:
+        return ">=";
+    case OP_EQ:
+        return "==";
+    case OP_NE:
+        return "!=";
+    case OP_AND:
+        return "&&";
+    case OP_OR:
+        return "||";
+    case OP_COND:
+        return "?";
+    case OP_BRANCHES:
+        return ":";
     default:
-        return '?';
+        return "?";
     }
 }
 
+/*
+ * Mix two 64-bit values into one; used to build structural hashes
+ * bottom-up as nodes are created
+ */
+static uint64_t _ET_mix(uint64_t h, uint64_t x)
+{
+    h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static uint64_t _ET_string_hash(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *p = s; *p; p++)
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    return h;
+}
+
+// Does the node hold its children as a call's arguments?
+static bool _ET_has_args(ExprTree tree)
+{
+    return tree->type == FUNC_CALL || tree->type == USER_CALL || tree->type == ARRAY_LITERAL ||
+           tree->type == RANGE_SUM || tree->type == RANGE_PROD;
+}
+
 // Documented in .h file
 ExprTree ET_value(double value)
 {
@@ -67,6 +148,31 @@ ExprTree ET_value(double value)
     assert(new);
     new->type = VALUE;
     new->n.value = value;
+    new->pure = true;
+    new->integer = false;
+    new->arrays = false;
+    new->unbound = false;
+
+    uint64_t bits;
+    if (value == 0)
+        value = 0; // so that -0.0 and 0.0 hash alike
+    memcpy(&bits, &value, sizeof(bits));
+    new->hash = _ET_mix(VALUE, bits);
+    return new;
+}
+
+// Documented in .h file
+ExprTree ET_integer(int64_t value)
+{
+    ExprTree new = (ExprTree)malloc(sizeof(struct _expr_tree_node));
+    assert(new);
+    new->type = VALUE;
+    new->n.ivalue = value;
+    new->pure = true;
+    new->integer = true;
+    new->arrays = false;
+    new->unbound = false;
+    new->hash = _ET_mix(_ET_mix(VALUE, 1), (uint64_t)value);
     return new;
 }
 
@@ -78,8 +184,120 @@ ExprTree ET_node(ExprNodeType op, ExprTree left, ExprTree right)
     new->type = op;
     new->n.child[LEFT] = left;
     new->n.child[RIGHT] = right;
+    new->integer = false;
+    new->pure = (op != OP_ASSIGN) && (op != FUNC_DEF) && (!left || left->pure) &&
+                (!right || right->pure);
+    new->arrays = (left && left->arrays) || (right && right->arrays);
+    new->unbound = (left && left->unbound) || (right && right->unbound);
+    new->hash = _ET_mix(_ET_mix(op, left ? left->hash : 0), right ? right->hash : 0);
+    return new;
+}
+
+/*
+ * Allocate a call node, with room for its arguments, and hash the
+ * arguments into it
+ */
+static ExprTree _ET_new_call(ExprNodeType type, uint64_t hash, ExprTree *args, int num_args)
+{
+    assert(type == ARRAY_LITERAL || num_args <= ET_MAX_ARGS);
+
+    ExprTree new = (ExprTree)malloc(sizeof(struct _expr_tree_node) + sizeof(struct _et_call) +
+                                    num_args * sizeof(ExprTree));
+    assert(new);
+    new->type = type;
+    new->integer = false;
+    new->pure = true;
+    new->arrays = type == ARRAY_LITERAL;
+    new->unbound = false;
+    new->n.call = (struct _et_call *)(new + 1);
+    memset(new->n.call, 0, sizeof(struct _et_call));
+    new->n.call->num_args = num_args;
+
+    for (int i = 0; i < num_args; i++)
+    {
+        new->n.call->arg[i] = args[i];
+        new->pure = new->pure && args[i]->pure;
+        new->arrays = new->arrays || args[i]->arrays;
+        new->unbound = new->unbound || args[i]->unbound;
+        hash = _ET_mix(hash, args[i]->hash);
+    }
+    new->hash = hash;
+    return new;
+}
+
+// Documented in .h file
+ExprTree ET_call(const Builtin *fn, ExprTree *args)
+{
+    assert(fn);
+    ExprTree new = _ET_new_call(FUNC_CALL, _ET_mix(FUNC_CALL, _ET_string_hash(fn->name)),
+                                args, fn->num_args);
+    new->n.call->builtin = fn;
+    return new;
+}
+
+// Documented in .h file
+ExprTree ET_user_call(const char *name, const UserFunc *fn, ExprTree *args, int num_args)
+{
+    // calls bound to different definitions of a function differ
+    uint64_t hash = _ET_mix(_ET_mix(USER_CALL, _ET_string_hash(name)), (uintptr_t)fn);
+    ExprTree new = _ET_new_call(USER_CALL, hash, args, num_args);
+    new->n.call->user = fn;
+    new->n.call->name = strdup(name);
+    assert(new->n.call->name);
+    new->pure = new->pure && (fn == NULL || fn->pure);
+    new->unbound = new->unbound || fn == NULL;
+    return new;
+}
+
+// Documented in .h file
+ExprTree ET_array_literal(ExprTree *elems, int num_elems)
+{
+    return _ET_new_call(ARRAY_LITERAL, _ET_mix(ARRAY_LITERAL, num_elems), elems, num_elems);
+}
+
+// Documented in .h file
+ExprTree ET_range(ExprNodeType type, const char *index, ExprTree lo, ExprTree hi, ExprTree body)
+{
+    assert(type == RANGE_SUM || type == RANGE_PROD);
+    ExprTree args[3] = {lo, hi, body};
+    ExprTree new = _ET_new_call(type, _ET_mix(type, 3), args, 3);
+    new->n.call->name = strdup(index);
+    assert(new->n.call->name);
     return new;
 }
+
+// Documented in .h file
+ExprTree ET_range_index(int level, const char *name)
+{
+    ExprTree new = (ExprTree)malloc(sizeof(struct _expr_tree_node));
+    assert(new);
+    new->type = RANGE_INDEX;
+    new->n.index.level = level;
+    new->n.index.name = strdup(name);
+    assert(new->n.index.name);
+    new->pure = true;
+    new->integer = false;
+    new->arrays = false;
+    new->unbound = false;
+    new->hash = _ET_mix(RANGE_INDEX, level);
+    return new;
+}
+
+// Documented in .h file
+ExprTree ET_param(int index)
+{
+    ExprTree new = (ExprTree)malloc(sizeof(struct _expr_tree_node));
+    assert(new);
+    new->type = PARAM;
+    new->n.param = index;
+    new->pure = true;
+    new->integer = false;
+    new->arrays = false;
+    new->unbound = false;
+    new->hash = _ET_mix(PARAM, index);
+    return new;
+}
+
 // Add SYMBOL node support
 ExprTree ET_symbol(const char *symbol)
 {
@@ -87,6 +305,11 @@ ExprTree ET_symbol(const char *symbol)
     assert(new);
     new->type = SYMBOL;
     new->n.symbol = strdup(symbol); // Allocate memory for the symbol
+    new->pure = true;
+    new->integer = false;
+    new->arrays = false;
+    new->unbound = false;
+    new->hash = _ET_mix(SYMBOL, _ET_string_hash(symbol));
     return new;
 }
 
@@ -96,7 +319,7 @@ void ET_free(ExprTree tree)
     if (tree == NULL)
         return;
 
-    if (tree->type == VALUE)
+    if (tree->type == VALUE || tree->type == PARAM)
     {
         free(tree);
         return;
@@ -109,6 +332,22 @@ void ET_free(ExprTree tree)
         return;
     }
 
+    if (tree->type == RANGE_INDEX)
+    {
+        free(tree->n.index.name);
+        free(tree);
+        return;
+    }
+
+    if (_ET_has_args(tree))
+    {
+        for (int i = 0; i < tree->n.call->num_args; i++)
+            ET_free(tree->n.call->arg[i]);
+        free(tree->n.call->name);
+        free(tree);
+        return;
+    }
+
     if (tree->type != VALUE)
     {
         ET_free(tree->n.child[LEFT]);
@@ -124,60 +363,644 @@ int ET_count(ExprTree tree)
     if (tree == NULL)
         return 0;
 
-    if (tree->type == VALUE || tree->type == SYMBOL)
+    if (tree->type == VALUE || tree->type == SYMBOL || tree->type == PARAM ||
+        tree->type == RANGE_INDEX)
         return 1;
 
+    if (_ET_has_args(tree))
+    {
+        int count = 1;
+        for (int i = 0; i < tree->n.call->num_args; i++)
+            count += ET_count(tree->n.call->arg[i]);
+        return count;
+    }
+
     return 1 + ET_count(tree->n.child[LEFT]) + ET_count(tree->n.child[RIGHT]);
 }
 
+// Documented in .h file
+size_t ET_footprint(ExprTree tree)
+{
+    if (tree == NULL)
+        return 0;
+
+    if (tree->type == VALUE || tree->type == PARAM)
+        return sizeof(struct _expr_tree_node);
+
+    if (tree->type == SYMBOL)
+        return sizeof(struct _expr_tree_node) + strlen(tree->n.symbol) + 1;
+
+    if (tree->type == RANGE_INDEX)
+        return sizeof(struct _expr_tree_node) + strlen(tree->n.index.name) + 1;
+
+    if (_ET_has_args(tree))
+    {
+        struct _et_call *call = tree->n.call;
+        size_t bytes = sizeof(struct _expr_tree_node) + sizeof(struct _et_call) +
+                       call->num_args * sizeof(ExprTree);
+        if (call->name)
+            bytes += strlen(call->name) + 1;
+        for (int i = 0; i < call->num_args; i++)
+            bytes += ET_footprint(call->arg[i]);
+        return bytes;
+    }
+
+    return sizeof(struct _expr_tree_node) + ET_footprint(tree->n.child[LEFT]) +
+           ET_footprint(tree->n.child[RIGHT]);
+}
+
 // Documented in .h file
 int ET_depth(ExprTree tree)
 {
     if (tree == NULL)
         return 0;
-    if (tree->type == VALUE || tree->type == SYMBOL)
+    if (tree->type == VALUE || tree->type == SYMBOL || tree->type == PARAM ||
+        tree->type == RANGE_INDEX)
         return 1;
 
+    if (_ET_has_args(tree))
+    {
+        int max_depth = 0;
+        for (int i = 0; i < tree->n.call->num_args; i++)
+        {
+            int depth = ET_depth(tree->n.call->arg[i]);
+            max_depth = depth > max_depth ? depth : max_depth;
+        }
+        return 1 + max_depth;
+    }
+
     int left_depth = ET_depth(tree->n.child[LEFT]);
     int right_depth = ET_depth(tree->n.child[RIGHT]);
     return 1 + (left_depth > right_depth ? left_depth : right_depth);
 }
 
+/*
+ * Largest magnitude below which every integer is exactly representable
+ * as a double
+ */
+#define ET_EXACT_DOUBLE_INT 9007199254740992.0  // 2^53
+
+static ETNumber _ET_double(double d)
+{
+    return (ETNumber){.is_int = false, .d = d};
+}
+
+static ETNumber _ET_int(int64_t i)
+{
+    return (ETNumber){.is_int = true, .i = i};
+}
+
+static double _ET_to_double(ETNumber num)
+{
+    return num.is_int ? (double)num.i : num.d;
+}
+
+/*
+ * Carry a double from the variable dictionary as an integer if it is
+ * one and converting it loses nothing
+ */
+static ETNumber _ET_from_double(double d)
+{
+    if (d == trunc(d) && fabs(d) <= ET_EXACT_DOUBLE_INT)
+        return _ET_int((int64_t)d);
+    return _ET_double(d);
+}
+
+/*
+ * Raise base to a non-negative integer power by repeated squaring
+ *
+ * Returns: true, with the result in *result, unless it overflows
+ */
+static bool _ET_ipow(int64_t base, int64_t exp, int64_t *result)
+{
+    int64_t acc = 1;
+
+    while (exp > 0)
+    {
+        if ((exp & 1) && __builtin_mul_overflow(acc, base, &acc))
+            return false;
+        exp >>= 1;
+        if (exp > 0 && __builtin_mul_overflow(base, base, &base))
+            return false;
+    }
+
+    *result = acc;
+    return true;
+}
+
 // Documented in .h file
-// Updated ET_evaluate
-double ET_evaluate(ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz)
+ETNumber ET_apply_number(ExprNodeType op, ETNumber left, ETNumber right, char *errmsg, size_t errmsg_sz)
+{
+    int64_t l = left.i, r = right.i, result;
+
+    if (left.is_int && (right.is_int || op == UNARY_NEGATE))
+    {
+        switch (op)
+        {
+        case OP_ADD:
+            if (!__builtin_add_overflow(l, r, &result))
+                return _ET_int(result);
+            break;
+        case OP_SUB:
+            if (!__builtin_sub_overflow(l, r, &result))
+                return _ET_int(result);
+            break;
+        case OP_MUL:
+            if (!__builtin_mul_overflow(l, r, &result))
+                return _ET_int(result);
+            break;
+        case OP_DIV:
+            // exact quotients only; INT64_MIN / -1 overflows
+            if (r != 0 && !(l == INT64_MIN && r == -1) && l % r == 0)
+                return _ET_int(l / r);
+            break;
+        case OP_POWER:
+            if (r >= 0 && _ET_ipow(l, r, &result))
+                return _ET_int(result);
+            if (r < 0 && (l == 1 || l == -1))
+                return _ET_int((r & 1) ? l : 1);
+            break;
+        case UNARY_NEGATE:
+            if (l != INT64_MIN)
+                return _ET_int(-l);
+            break;
+        case OP_LT:
+            return _ET_int(l < r);
+        case OP_LE:
+            return _ET_int(l <= r);
+        case OP_GT:
+            return _ET_int(l > r);
+        case OP_GE:
+            return _ET_int(l >= r);
+        case OP_EQ:
+            return _ET_int(l == r);
+        case OP_NE:
+            return _ET_int(l != r);
+        default:
+            break;
+        }
+    }
+
+    double value = ET_apply(op, _ET_to_double(left), _ET_to_double(right), errmsg, errmsg_sz);
+
+    // truth values are exact
+    if (op >= OP_LT && op <= OP_OR && !isnan(value))
+        return _ET_int((int64_t)value);
+    return _ET_double(value);
+}
+
+static bool _ET_truth(ETNumber num)
+{
+    return num.is_int ? num.i != 0 : num.d != 0;
+}
+
+// NaN has no truth value
+static bool _ET_is_nan(ETNumber num)
+{
+    return !num.is_int && !num.array && isnan(num.d);
+}
+
+// The indexes of the ranges being evaluated, innermost first
+typedef struct _et_index
+{
+    int64_t value;
+    const struct _et_index *outer;
+} ETIndex;
+
+static ETNumber _ET_eval(ExprTree tree, CDict vars, const ETNumber *frame, const ETIndex *ranges,
+                         int depth, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Evaluate an ARRAY_LITERAL, concatenating the elements that are
+ * themselves arrays
+ */
+static ETNumber _ET_eval_array(ExprTree tree, CDict vars, const ETNumber *frame,
+                               const ETIndex *ranges, int depth, char *errmsg, size_t errmsg_sz)
+{
+    struct _et_call *call = tree->n.call;
+    ETNumber *elem = malloc(call->num_args * sizeof(ETNumber) + 1);
+    assert(elem);
+
+    size_t n = 0;
+    for (int i = 0; i < call->num_args; i++)
+    {
+        elem[i] = _ET_eval(call->arg[i], vars, frame, ranges, depth, errmsg, errmsg_sz);
+        n += elem[i].array ? AR_length(elem[i].array) : 1;
+    }
+
+    Array a = AR_new(n);
+    double *data = AR_mutable(&a);
+    for (int i = 0; i < call->num_args; i++)
+    {
+        if (elem[i].array)
+        {
+            size_t len = AR_length(elem[i].array);
+            memcpy(data, AR_data(elem[i].array), len * sizeof(double));
+            data += len;
+            AR_release(elem[i].array);
+        }
+        else
+            *data++ = _ET_to_double(elem[i]);
+    }
+
+    free(elem);
+    return (ETNumber){.is_int = false, .d = NAN, .array = a};
+}
+
+// The name of the index in the body of a range as compiled by
+// _ET_range_batch; not a name the parser accepts
+#define ET_RANGE_SYMBOL "$index"
+
+/*
+ * Copy the body of a range for compiling, replacing its index with
+ * the symbol ET_RANGE_SYMBOL and the arguments and outer indexes it
+ * reads with their values
+ *
+ * Returns: The copy, or NULL if the body holds a nested range or
+ *   reads an argument that is an array
+ */
+static ExprTree _ET_specialize(ExprTree tree, const ETNumber *frame, const ETIndex *ranges)
 {
     if (tree == NULL)
-        return 0;
+        return NULL;
+
+    if (tree->type == PARAM)
+    {
+        ETNumber arg = frame[tree->n.param];
+        if (arg.array)
+            return NULL;
+        return arg.is_int ? ET_integer(arg.i) : ET_value(arg.d);
+    }
+
+    if (tree->type == RANGE_INDEX)
+    {
+        if (tree->n.index.level == 0)
+            return ET_symbol(ET_RANGE_SYMBOL);
+        const ETIndex *range = ranges;
+        for (int level = 1; level < tree->n.index.level; level++)
+            range = range->outer;
+        return ET_integer(range->value);
+    }
+
+    if (tree->type == RANGE_SUM || tree->type == RANGE_PROD || tree->type == ARRAY_LITERAL)
+        return NULL;
+
+    if (tree->type == FUNC_CALL || tree->type == USER_CALL)
+    {
+        struct _et_call *call = tree->n.call;
+        ExprTree args[ET_MAX_ARGS];
+        for (int i = 0; i < call->num_args; i++)
+        {
+            args[i] = _ET_specialize(call->arg[i], frame, ranges);
+            if (args[i] == NULL)
+            {
+                for (int j = 0; j < i; j++)
+                    ET_free(args[j]);
+                return NULL;
+            }
+        }
+        if (tree->type == FUNC_CALL)
+            return ET_call(call->builtin, args);
+        return ET_user_call(call->name, call->user, args, call->num_args);
+    }
+
+    if (tree->type == VALUE || tree->type == SYMBOL)
+        return ET_copy(tree);
+
+    ExprTree left = _ET_specialize(tree->n.child[LEFT], frame, ranges);
+    ExprTree right = _ET_specialize(tree->n.child[RIGHT], frame, ranges);
+    if ((tree->n.child[LEFT] && left == NULL) || (tree->n.child[RIGHT] && right == NULL))
+    {
+        ET_free(left);
+        ET_free(right);
+        return NULL;
+    }
+    return ET_node(tree->type, left, right);
+}
+
+/*
+ * Evaluate a range of n indices from lo with RG_reduce, its body
+ * compiled with the variables it reads bound to their current values
+ *
+ * Returns: true, with the result in *result, unless the body does not
+ *   compile or reads a variable that is undefined or holds an array,
+ *   or its terms are integers that doubles do not hold exactly, which
+ *   the caller must then evaluate itself
+ */
+static bool _ET_range_batch(ExprTree tree, CDict vars, const ETNumber *frame,
+                            const ETIndex *ranges, int64_t lo, uint64_t n, ETNumber *result,
+                            char *errmsg, size_t errmsg_sz)
+{
+    ExprTree body = _ET_specialize(tree->n.call->arg[2], frame, ranges);
+    if (body == NULL)
+        return false;
+
+    char compile_err[128] = "";
+    Prepared p = EW_compile(body, compile_err, sizeof(compile_err));
+    ET_free(body);
+    if (p == NULL)
+        return false;
+
+    int num_vars = EW_num_vars(p);
+    int index_slot = EW_var_slot(p, ET_RANGE_SYMBOL);
+    double *values = malloc(num_vars * sizeof(double) + 1);
+    assert(values);
+    EW_bind_dict(p, values, vars);
+
+    bool bound = true;
+    for (int v = 0; v < num_vars; v++)
+        if (v != index_slot && isnan(values[v]))
+            bound = false;
+
+    if (bound)
+    {
+        RGKind kind;
+        int64_t exact;
+        double d = RG_reduce(p, values, index_slot, lo, n, tree->type == RANGE_PROD, &kind,
+                             &exact, errmsg, errmsg_sz);
+        *result = kind == RG_EXACT ? _ET_int(exact) : _ET_from_double(d);
+        bound = kind != RG_WIDE;
+    }
+
+    free(values);
+    EW_free(p);
+    return bound;
+}
+
+/*
+ * Evaluate a bound of a range, which must be an integer
+ *
+ * Returns: true, with the bound in *bound, unless it is not one
+ */
+static bool _ET_range_bound(ExprTree tree, ETNumber num, int64_t *bound, char *errmsg,
+                            size_t errmsg_sz)
+{
+    if (num.is_int)
+    {
+        *bound = num.i;
+        return true;
+    }
+    if (num.array == NULL && num.d == trunc(num.d) && fabs(num.d) < 0x1p63)
+    {
+        *bound = (int64_t)num.d;
+        return true;
+    }
+
+    // a NaN bound has had its error reported already
+    if (num.array || !isnan(num.d))
+        snprintf(errmsg, errmsg_sz, "Error: Bounds of %s must be integers", ET_call_name(tree));
+    AR_release(num.array);
+    return false;
+}
+
+/*
+ * Evaluate a RANGE_SUM or RANGE_PROD. Terms are combined exactly as
+ * integers until one is not an integer or the result overflows, then
+ * as a compensated sum, or a product, of doubles; a term that is an
+ * array makes the result one too.
+ */
+static ETNumber _ET_eval_range(ExprTree tree, CDict vars, const ETNumber *frame,
+                               const ETIndex *ranges, int depth, char *errmsg, size_t errmsg_sz)
+{
+    struct _et_call *call = tree->n.call;
+    bool product = tree->type == RANGE_PROD;
+    int64_t lo, hi;
+
+    if (!_ET_range_bound(tree, _ET_eval(call->arg[0], vars, frame, ranges, depth, errmsg,
+                                        errmsg_sz), &lo, errmsg, errmsg_sz) ||
+        !_ET_range_bound(tree, _ET_eval(call->arg[1], vars, frame, ranges, depth, errmsg,
+                                        errmsg_sz), &hi, errmsg, errmsg_sz))
+        return _ET_double(NAN);
+
+    if (hi < lo)
+        return _ET_int(product ? 1 : 0);
+
+    uint64_t n = (uint64_t)hi - (uint64_t)lo + 1;
+    ETNumber batch;
+    if (n >= RG_BATCH_MIN && call->arg[2]->pure &&
+        _ET_range_batch(tree, vars, frame, ranges, lo, n, &batch, errmsg, errmsg_sz))
+        return batch;
+
+    ETIndex index = {.value = lo, .outer = ranges};
+    ETNumber acc = _ET_int(product ? 1 : 0);
+    double comp = 0; // the compensation of a double sum, as in range.c
+
+    for (;; index.value++)
+    {
+        ETNumber term = _ET_eval(call->arg[2], vars, frame, &index, depth, errmsg, errmsg_sz);
+        int64_t exact;
+
+        if (acc.array || term.array)
+        {
+            if (!acc.array && comp != 0)
+                acc = _ET_double(acc.d - comp);
+            acc = AO_apply(product ? OP_MUL : OP_ADD, acc, term, errmsg, errmsg_sz);
+        }
+        else if (acc.is_int && term.is_int &&
+                 !(product ? __builtin_mul_overflow(acc.i, term.i, &exact)
+                           : __builtin_add_overflow(acc.i, term.i, &exact)))
+            acc.i = exact;
+        else if (product)
+            acc = _ET_double(_ET_to_double(acc) * _ET_to_double(term));
+        else
+        {
+            // Neumaier's compensated sum
+            double sum = _ET_to_double(acc), x = _ET_to_double(term), t = sum + x;
+            comp -= fabs(sum) >= fabs(x) ? (sum - t) + x : (x - t) + sum;
+            acc = _ET_double(t);
+        }
+
+        if (index.value == hi)
+            break;
+    }
+
+    if (!acc.array && !acc.is_int && comp != 0 && isfinite(acc.d))
+        acc.d -= comp;
+    return acc;
+}
+
+/*
+ * ET_evaluate_number, within the body of a user-defined function
+ * whose arguments are frame, and of the ranges whose indexes are
+ * ranges, at call depth depth
+ */
+static ETNumber _ET_eval(ExprTree tree, CDict vars, const ETNumber *frame, const ETIndex *ranges,
+                         int depth, char *errmsg, size_t errmsg_sz)
+{
+    if (tree == NULL)
+        return _ET_int(0);
 
     if (tree->type == VALUE)
-        return tree->n.value;
+        return ET_get_number(tree);
 
     if (tree->type == SYMBOL)
     {
         CDictValueType val = CD_retrieve(vars, tree->n.symbol);
         if (isnan(val))
         {
+            // the variable may hold an array instead
+            Array a = CD_retrieve_array(vars, tree->n.symbol);
+            if (a)
+                return (ETNumber){.is_int = false, .d = NAN, .array = AR_retain(a)};
             snprintf(errmsg, errmsg_sz, "Undefined variable: %s", tree->n.symbol);
-            return NAN;
+            return _ET_double(NAN);
         }
-        return val;
+        return _ET_from_double(val);
+    }
+
+    if (tree->type == PARAM)
+    {
+        assert(frame);
+        ETNumber arg = frame[tree->n.param];
+        AR_retain(arg.array);
+        return arg;
+    }
+
+    if (tree->type == RANGE_INDEX)
+    {
+        const ETIndex *range = ranges;
+        for (int level = 0; level < tree->n.index.level; level++)
+            range = range->outer;
+        assert(range);
+        return _ET_int(range->value);
     }
 
+    if (tree->type == ARRAY_LITERAL)
+        return _ET_eval_array(tree, vars, frame, ranges, depth, errmsg, errmsg_sz);
+
+    if (tree->type == RANGE_SUM || tree->type == RANGE_PROD)
+        return _ET_eval_range(tree, vars, frame, ranges, depth, errmsg, errmsg_sz);
+
+    if (tree->type == FUNC_CALL)
+    {
+        const Builtin *fn = tree->n.call->builtin;
+        ETNumber args[BI_MAX_ARGS];
+        bool arrays = false;
+        for (int i = 0; i < fn->num_args; i++)
+        {
+            args[i] = _ET_eval(tree->n.call->arg[i], vars, frame, ranges, depth, errmsg, errmsg_sz);
+            arrays = arrays || args[i].array;
+        }
+        if (arrays)
+            return AO_call(fn, args, errmsg, errmsg_sz);
+
+        double values[BI_MAX_ARGS];
+        for (int i = 0; i < fn->num_args; i++)
+            values[i] = _ET_to_double(args[i]);
+        return _ET_double(fn->scalar(values));
+    }
+
+    if (tree->type == USER_CALL)
+    {
+        struct _et_call *call = tree->n.call;
+        if (call->user == NULL)
+        {
+            snprintf(errmsg, errmsg_sz, "Unknown function: %s", call->name);
+            return _ET_double(NAN);
+        }
+        if (depth == ET_MAX_CALL_DEPTH)
+        {
+            snprintf(errmsg, errmsg_sz, "Error: Recursion too deep in %s", call->name);
+            return _ET_double(NAN);
+        }
+
+        ETNumber args[ET_MAX_ARGS];
+        for (int i = 0; i < call->num_args; i++)
+            args[i] = _ET_eval(call->arg[i], vars, frame, ranges, depth, errmsg, errmsg_sz);
+        ETNumber result = _ET_eval(call->user->body, vars, args, NULL, depth + 1, errmsg,
+                                   errmsg_sz);
+        for (int i = 0; i < call->num_args; i++)
+            AR_release(args[i].array);
+        return result;
+    }
+
+    if (tree->type == FUNC_DEF)
+    {
+        snprintf(errmsg, errmsg_sz, "Error: Function definition within an expression");
+        return _ET_double(NAN);
+    }
+
+    // Only the operand or branch that decides the result is evaluated,
+    // unless the condition is an array, which needs both
+    if (tree->type == OP_AND || tree->type == OP_OR || tree->type == OP_COND)
+    {
+        ETNumber cond = _ET_eval(tree->n.child[LEFT], vars, frame, ranges, depth, errmsg, errmsg_sz);
+        ExprTree right = tree->n.child[RIGHT];
+
+        if (cond.array && tree->type == OP_COND)
+        {
+            ETNumber a = _ET_eval(right->n.child[LEFT], vars, frame, ranges, depth, errmsg, errmsg_sz);
+            ETNumber b = _ET_eval(right->n.child[RIGHT], vars, frame, ranges, depth, errmsg, errmsg_sz);
+            return AO_select(cond, a, b, errmsg, errmsg_sz);
+        }
+        if (cond.array)
+            return AO_apply(tree->type, cond,
+                            _ET_eval(right, vars, frame, ranges, depth, errmsg, errmsg_sz),
+                            errmsg, errmsg_sz);
+
+        if (_ET_is_nan(cond))
+            return cond;
+        bool truth = _ET_truth(cond);
+        if (tree->type == OP_COND)
+            return _ET_eval(right->n.child[truth ? LEFT : RIGHT], vars, frame, ranges, depth,
+                            errmsg, errmsg_sz);
+        if (truth == (tree->type == OP_OR))
+            return _ET_int(truth);
+
+        ETNumber right_val = _ET_eval(right, vars, frame, ranges, depth, errmsg, errmsg_sz);
+        if (right_val.array)
+            return AO_apply(OP_NE, right_val, _ET_int(0), errmsg, errmsg_sz);
+        if (_ET_is_nan(right_val))
+            return right_val;
+        return _ET_int(_ET_truth(right_val));
+    }
 
-    // TODO: Before going to the left first handle the OP_ASSIGN type
     if (tree->type == OP_ASSIGN)
     {
         // Directly store the evaluated right-hand value in the left-hand symbol
-        double value = ET_evaluate(tree->n.child[RIGHT], vars, errmsg, errmsg_sz);
-        CD_store(vars, tree->n.child[LEFT]->n.symbol, value);
+        ETNumber value = _ET_eval(tree->n.child[RIGHT], vars, frame, ranges, depth, errmsg, errmsg_sz);
+        if (value.array)
+            CD_store_array(vars, tree->n.child[LEFT]->n.symbol, value.array);
+        else
+            CD_store(vars, tree->n.child[LEFT]->n.symbol, _ET_to_double(value));
         return value; // Return the assigned value
     }
 
-    double left_val = ET_evaluate(tree->n.child[LEFT], vars, errmsg, errmsg_sz);
-    double right_val = ET_evaluate(tree->n.child[RIGHT], vars, errmsg, errmsg_sz);
+    ETNumber left_val = _ET_eval(tree->n.child[LEFT], vars, frame, ranges, depth, errmsg, errmsg_sz);
+    ETNumber right_val = _ET_eval(tree->n.child[RIGHT], vars, frame, ranges, depth, errmsg, errmsg_sz);
+
+    if (left_val.array || right_val.array)
+        return AO_apply(tree->type, left_val, right_val, errmsg, errmsg_sz);
+    return ET_apply_number(tree->type, left_val, right_val, errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+ETNumber ET_evaluate_number(ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz)
+{
+    return _ET_eval(tree, vars, NULL, NULL, 0, errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+double ET_evaluate(ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz)
+{
+    ETNumber result = ET_evaluate_number(tree, vars, errmsg, errmsg_sz);
+    if (result.array)
+    {
+        AR_release(result.array);
+        snprintf(errmsg, errmsg_sz, "Error: Array value where a number is expected");
+        return NAN;
+    }
+    return _ET_to_double(result);
+}
+
+// Documented in .h file
+double ET_apply(ExprNodeType op, double left_val, double right_val, char *errmsg, size_t errmsg_sz)
+{
+    // NaN has no truth value, and is not ordered
+    if (op >= OP_LT && op <= OP_NE && (isnan(left_val) || isnan(right_val)))
+        return NAN;
 
-    switch (tree->type)
+    switch (op)
     {
     case OP_ADD:
         return left_val + right_val;
@@ -196,15 +1019,24 @@ double ET_evaluate(ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz)
         return pow(left_val, right_val);
     case UNARY_NEGATE:
         return -left_val;
-    case OP_ASSIGN:
-        if (tree->n.child[LEFT]->type != SYMBOL)
-        {
-            snprintf(errmsg, errmsg_sz, "Error: Left side of '=' must be a variable");
-            return NAN;
-        }
-        CD_store(vars, tree->n.child[LEFT]->n.symbol, right_val);
-
-        return right_val;
+    case OP_LT:
+        return left_val < right_val;
+    case OP_LE:
+        return left_val <= right_val;
+    case OP_GT:
+        return left_val > right_val;
+    case OP_GE:
+        return left_val >= right_val;
+    case OP_EQ:
+        return left_val == right_val;
+    case OP_NE:
+        return left_val != right_val;
+    case OP_AND:
+    case OP_OR:
+        // as evaluated lazily: the right operand counts only if needed
+        if (isnan(left_val) || (left_val != 0) == (op == OP_OR))
+            return isnan(left_val) ? NAN : left_val != 0;
+        return isnan(right_val) ? NAN : right_val != 0;
     default:
         snprintf(errmsg, errmsg_sz, "Error: Invalid operator");
         return NAN;
@@ -222,7 +1054,10 @@ size_t ET_tree2string(ExprTree tree, char *buf, size_t buf_sz)
     // Handle VALUE nodes
     if (tree->type == VALUE)
     {
-        len = snprintf(buf, buf_sz, "%g", tree->n.value);
+        if (tree->integer)
+            len = snprintf(buf, buf_sz, "%" PRId64, tree->n.ivalue);
+        else
+            len = snprintf(buf, buf_sz, "%g", tree->n.value);
         return len;
     }
 
@@ -233,6 +1068,53 @@ size_t ET_tree2string(ExprTree tree, char *buf, size_t buf_sz)
         return len;
     }
 
+    // Parameters print as $1, $2, ...
+    if (tree->type == PARAM)
+    {
+        len = snprintf(buf, buf_sz, "$%d", tree->n.param + 1);
+        return len;
+    }
+
+    if (tree->type == RANGE_INDEX)
+    {
+        len = snprintf(buf, buf_sz, "%s", tree->n.index.name);
+        return len;
+    }
+
+    // Calls print as name(arg,arg), array literals as [elem,elem],
+    // ranges as sum(index,lo,hi,body)
+    if (_ET_has_args(tree))
+    {
+        struct _et_call *call = tree->n.call;
+        bool array = tree->type == ARRAY_LITERAL;
+        len = snprintf(buf, buf_sz, "%s%s", array ? "" : ET_call_name(tree), array ? "[" : "(");
+        if ((tree->type == RANGE_SUM || tree->type == RANGE_PROD) && len < buf_sz)
+            len += snprintf(buf + len, buf_sz - len, "%s,", call->name);
+
+        for (int i = 0; i < call->num_args && len < buf_sz; i++)
+        {
+            if (i > 0)
+                len += snprintf(buf + len, buf_sz - len, ",");
+            if (len < buf_sz)
+                len += ET_tree2string(call->arg[i], buf + len, buf_sz - len);
+        }
+
+        if (len < buf_sz)
+            len += snprintf(buf + len, buf_sz - len, "%s", array ? "]" : ")");
+
+        // Check if the buffer overflowed
+        if (len >= buf_sz)
+        {
+            if (buf_sz >= 2)
+            {
+                buf[buf_sz - 2] = '$'; // indication of truncation
+                buf[buf_sz - 1] = '\0';
+            }
+            return buf_sz - 1;
+        }
+        return len;
+    }
+
     // Handle UNARY NEGATE type specifically
     if (tree->type == UNARY_NEGATE)
     {
@@ -241,7 +1123,7 @@ size_t ET_tree2string(ExprTree tree, char *buf, size_t buf_sz)
         buf[len++] = '(';
         if (len < buf_sz - 1)
         {
-            buf[len++] = ExprNodeType_to_char(UNARY_NEGATE);
+            buf[len++] = '-';
         }
 
         size_t child_len = ET_tree2string(tree->n.child[LEFT], buf + len, buf_sz - len);
@@ -265,27 +1147,289 @@ size_t ET_tree2string(ExprTree tree, char *buf, size_t buf_sz)
         return len;
     }
 
-    // For operators (binary expressions)
-    char op = ExprNodeType_to_char(tree->type);
+    // For operators (binary expressions). The branches of a
+    // conditional share its parentheses: (c?a:b)
+    const char *op = ExprNodeType_to_str(tree->type);
+    bool parens = tree->type != OP_BRANCHES;
 
     if (buf_sz < 3) return 0; // need space for at least one operator and parens
 
-    buf[len++] = '(';
+    if (parens)
+        buf[len++] = '(';
 
     // Handle the left child
     size_t left_len = ET_tree2string(tree->n.child[LEFT], buf + len, buf_sz - len);
     len += left_len;
-    if (len >= buf_sz) return len; // prevent buffer overrun
+    if (len + strlen(op) >= buf_sz) return len; // prevent buffer overrun
 
-    buf[len++] = op;
+    for (; *op; op++)
+        buf[len++] = *op;
 
     // Handle the right child
     size_t right_len = ET_tree2string(tree->n.child[RIGHT], buf + len, buf_sz - len);
     len += right_len;
-    if (len >= buf_sz) return len; // prevent buffer overrun
+    if (len + 1 >= buf_sz) return len; // prevent buffer overrun
 
-    buf[len++] = ')';
+    if (parens)
+        buf[len++] = ')';
     buf[len] = '\0';
 
     return len;
 }
+
+// Documented in .h file
+ExprNodeType ET_type(ExprTree tree)
+{
+    assert(tree);
+    return tree->type;
+}
+
+// Documented in .h file
+ExprTree ET_child(ExprTree tree, int which)
+{
+    assert(tree);
+    assert(tree->type != VALUE && tree->type != SYMBOL && tree->type != PARAM &&
+           tree->type != RANGE_INDEX);
+    assert(!_ET_has_args(tree));
+    assert(which == LEFT || which == RIGHT);
+    return tree->n.child[which];
+}
+
+// Documented in .h file
+const Builtin *ET_call_function(ExprTree tree)
+{
+    assert(tree && tree->type == FUNC_CALL);
+    return tree->n.call->builtin;
+}
+
+// Documented in .h file
+const UserFunc *ET_user_function(ExprTree tree)
+{
+    assert(tree && tree->type == USER_CALL);
+    return tree->n.call->user;
+}
+
+// Documented in .h file
+const char *ET_call_name(ExprTree tree)
+{
+    assert(tree && (tree->type == FUNC_CALL || tree->type == USER_CALL ||
+                    tree->type == RANGE_SUM || tree->type == RANGE_PROD));
+    if (tree->type == RANGE_SUM || tree->type == RANGE_PROD)
+        return tree->type == RANGE_SUM ? "sum" : "prod";
+    return tree->type == FUNC_CALL ? tree->n.call->builtin->name : tree->n.call->name;
+}
+
+// Documented in .h file
+int ET_num_args(ExprTree tree)
+{
+    assert(tree && _ET_has_args(tree));
+    return tree->n.call->num_args;
+}
+
+// Documented in .h file
+ExprTree ET_arg(ExprTree tree, int which)
+{
+    assert(tree && _ET_has_args(tree));
+    assert(which >= 0 && which < tree->n.call->num_args);
+    return tree->n.call->arg[which];
+}
+
+// Documented in .h file
+int ET_param_index(ExprTree tree)
+{
+    assert(tree && tree->type == PARAM);
+    return tree->n.param;
+}
+
+// Documented in .h file
+int ET_index_level(ExprTree tree)
+{
+    assert(tree && tree->type == RANGE_INDEX);
+    return tree->n.index.level;
+}
+
+// Documented in .h file
+const char *ET_index_name(ExprTree tree)
+{
+    assert(tree && (tree->type == RANGE_INDEX || tree->type == RANGE_SUM ||
+                    tree->type == RANGE_PROD));
+    return tree->type == RANGE_INDEX ? tree->n.index.name : tree->n.call->name;
+}
+
+// Documented in .h file
+const char *ET_symbol_name(ExprTree tree)
+{
+    assert(tree && tree->type == SYMBOL);
+    return tree->n.symbol;
+}
+
+/*
+ * Copy a tree that lies within depth ranges of the root of the copy.
+ * SYMBOL nodes named bind (if not NULL) become references to the
+ * range around the root, references to that range are named rename
+ * (if not NULL), and references to ranges around it have their level
+ * raised by shift.
+ */
+static ExprTree _ET_copy(ExprTree tree, const char *bind, const char *rename, int shift,
+                         int depth)
+{
+    if (tree == NULL)
+        return NULL;
+
+    if (tree->type == VALUE)
+        return tree->integer ? ET_integer(tree->n.ivalue) : ET_value(tree->n.value);
+
+    if (tree->type == SYMBOL)
+    {
+        if (bind && strcmp(tree->n.symbol, bind) == 0)
+            return ET_range_index(depth, bind);
+        return ET_symbol(tree->n.symbol);
+    }
+
+    if (tree->type == PARAM)
+        return ET_param(tree->n.param);
+
+    if (tree->type == RANGE_INDEX)
+    {
+        int level = tree->n.index.level;
+        const char *name = rename && level == depth ? rename : tree->n.index.name;
+        return ET_range_index(level >= depth ? level + shift : level, name);
+    }
+
+    if (tree->type == ARRAY_LITERAL)
+    {
+        struct _et_call *call = tree->n.call;
+        ExprTree *elems = malloc(call->num_args * sizeof(ExprTree) + 1);
+        assert(elems);
+        for (int i = 0; i < call->num_args; i++)
+            elems[i] = _ET_copy(call->arg[i], bind, rename, shift, depth);
+        ExprTree copy = ET_array_literal(elems, call->num_args);
+        free(elems);
+        return copy;
+    }
+
+    if (tree->type == RANGE_SUM || tree->type == RANGE_PROD)
+    {
+        // a nested range of the same index name hides the one bound
+        struct _et_call *call = tree->n.call;
+        const char *inner = bind && strcmp(call->name, bind) == 0 ? NULL : bind;
+        return ET_range(tree->type, call->name,
+                        _ET_copy(call->arg[0], bind, rename, shift, depth),
+                        _ET_copy(call->arg[1], bind, rename, shift, depth),
+                        _ET_copy(call->arg[2], inner, rename, shift, depth + 1));
+    }
+
+    if (tree->type == FUNC_CALL || tree->type == USER_CALL)
+    {
+        struct _et_call *call = tree->n.call;
+        ExprTree args[ET_MAX_ARGS];
+        for (int i = 0; i < call->num_args; i++)
+            args[i] = _ET_copy(call->arg[i], bind, rename, shift, depth);
+        if (tree->type == FUNC_CALL)
+            return ET_call(call->builtin, args);
+        return ET_user_call(call->name, call->user, args, call->num_args);
+    }
+
+    return ET_node(tree->type, _ET_copy(tree->n.child[LEFT], bind, rename, shift, depth),
+                   _ET_copy(tree->n.child[RIGHT], bind, rename, shift, depth));
+}
+
+// Documented in .h file
+ExprTree ET_copy(ExprTree tree)
+{
+    return _ET_copy(tree, NULL, NULL, 0, 0);
+}
+
+// Documented in .h file
+ExprTree ET_bind_index(ExprTree tree, const char *index)
+{
+    return _ET_copy(tree, index, NULL, 0, 0);
+}
+
+// Documented in .h file
+ExprTree ET_rename_index(ExprTree tree, const char *index)
+{
+    assert(tree && (tree->type == RANGE_SUM || tree->type == RANGE_PROD));
+    struct _et_call *call = tree->n.call;
+    return ET_range(tree->type, index, ET_copy(call->arg[0]), ET_copy(call->arg[1]),
+                    _ET_copy(call->arg[2], NULL, index, 0, 0));
+}
+
+// Documented in .h file
+ExprTree ET_shift_indexes(ExprTree tree, int shift)
+{
+    return _ET_copy(tree, NULL, NULL, shift, 0);
+}
+
+// Documented in .h file
+void ET_foreach_symbol(ExprTree tree, ET_symbol_callback callback, void *cb_data)
+{
+    // a definition reads and assigns nothing until it is called
+    if (tree == NULL || tree->type == VALUE || tree->type == PARAM || tree->type == FUNC_DEF ||
+        tree->type == RANGE_INDEX)
+        return;
+
+    if (tree->type == SYMBOL)
+    {
+        callback(tree->n.symbol, false, cb_data);
+        return;
+    }
+
+    if (_ET_has_args(tree))
+    {
+        struct _et_call *call = tree->n.call;
+        for (int i = 0; i < call->num_args; i++)
+            ET_foreach_symbol(call->arg[i], callback, cb_data);
+        if (call->user)
+            for (int i = 0; i < call->user->num_symbols; i++)
+                callback(call->user->symbol[i], call->user->assigned[i], cb_data);
+        return;
+    }
+
+    if (tree->type == OP_ASSIGN && tree->n.child[LEFT]->type == SYMBOL)
+        callback(tree->n.child[LEFT]->n.symbol, true, cb_data);
+    else
+        ET_foreach_symbol(tree->n.child[LEFT], callback, cb_data);
+
+    ET_foreach_symbol(tree->n.child[RIGHT], callback, cb_data);
+}
+
+// Documented in .h file
+double ET_get_value(ExprTree tree)
+{
+    assert(tree && tree->type == VALUE);
+    return tree->integer ? (double)tree->n.ivalue : tree->n.value;
+}
+
+// Documented in .h file
+ETNumber ET_get_number(ExprTree tree)
+{
+    assert(tree && tree->type == VALUE);
+    if (tree->integer)
+        return _ET_int(tree->n.ivalue);
+    return _ET_double(tree->n.value);
+}
+
+// Documented in .h file
+uint64_t ET_hash(ExprTree tree)
+{
+    return tree ? tree->hash : 0;
+}
+
+// Documented in .h file
+bool ET_is_pure(ExprTree tree)
+{
+    return tree == NULL || tree->pure;
+}
+
+// Documented in .h file
+bool ET_has_array_literal(ExprTree tree)
+{
+    return tree != NULL && tree->arrays;
+}
+
+// Documented in .h file
+bool ET_has_unbound_call(ExprTree tree)
+{
+    return tree != NULL && tree->unbound;
+}
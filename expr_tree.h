@@ -12,11 +12,23 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include "cdict.h"  
+#include "builtins.h"
 
 
 typedef struct _expr_tree_node * ExprTree;
 
+// A user-defined function, as stored by a FuncTable (see functions.h)
+typedef struct _user_func UserFunc;
+
+// The most arguments a call may have
+#define ET_MAX_ARGS 8
+
+// The deepest that calls of user-defined functions may nest during
+// evaluation; deeper recursion is reported as an error
+#define ET_MAX_CALL_DEPTH 1000
+
 typedef enum {
   VALUE,
   SYMBOL,
@@ -26,10 +38,45 @@ typedef enum {
   OP_SUB,
   OP_MUL,
   OP_DIV,
-  OP_POWER
+  OP_POWER,
+  OP_LT,          // the comparisons give 1 if true and 0 if false
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_EQ,
+  OP_NE,
+  OP_AND,         // && and ||: the right operand only if needed
+  OP_OR,
+  OP_COND,        // cond ? a : b; left is cond, right an OP_BRANCHES
+  OP_BRANCHES,    // the a : b of an OP_COND, of which only one is run
+  FUNC_CALL,      // call of a builtin
+  USER_CALL,      // call of a user-defined function
+  PARAM,          // a parameter, within the body of a user-defined function
+  FUNC_DEF,       // name(params) = body; left is a USER_CALL, right the body
+  ARRAY_LITERAL,  // [a, b, ...]; its elements are held as a call's arguments
+  RANGE_SUM,      // sum(i, a, b, body); a, b and body are held as a call's arguments
+  RANGE_PROD,     // prod(i, a, b, body), likewise
+  RANGE_INDEX     // the index of an enclosing RANGE_SUM or RANGE_PROD
 } ExprNodeType;
 
 
+/*
+ * A number as computed by ET_evaluate_number. While every operation
+ * leading up to it has had an exact integer result, the number is
+ * carried as a 64-bit integer in i; otherwise it is the double d.
+ *
+ * An array value is instead held in array, with is_int false and d
+ * NaN. The ETNumber owns one reference to it, which whoever receives
+ * the ETNumber must AR_release.
+ */
+typedef struct {
+  bool is_int;
+  int64_t i;      // valid if is_int
+  double d;       // valid if !is_int
+  Array array;    // if not NULL, the value is this array
+} ETNumber;
+
+
 /*
  * Create a value node on the tree. A value node is always a leaf.
  *
@@ -45,6 +92,19 @@ typedef enum {
 ExprTree ET_value(double value);
 
 
+/*
+ * Create a value node holding an exact integer, as written by an
+ * integer literal. ET_evaluate_number computes with it on its integer
+ * path; everywhere else it behaves as ET_value((double)value).
+ *
+ * Parameters:
+ *   value    The value for the leaf node
+ * 
+ * Returns: The new tree, which will consist of a single leaf node
+ */
+ExprTree ET_integer(int64_t value);
+
+
 /*
  * Create an interior node on tree. An interior node always represents
  * an arithmetic operation.
@@ -63,6 +123,147 @@ ExprTree ET_value(double value);
 ExprTree ET_node(ExprNodeType op, ExprTree left, ExprTree right);
 
 
+/*
+ * Create a call of a builtin function
+ *
+ * Parameters:
+ *   fn       The function
+ *   args     Its arguments, fn->num_args of them; the trees become
+ *            part of the new tree, but the array itself is copied
+ *
+ * Returns: The new tree, a FUNC_CALL node whose children are the
+ *   arguments
+ *
+ * It is the responsibility of the caller to call ET_free on a tree
+ * that contains this node
+ */
+ExprTree ET_call(const Builtin *fn, ExprTree *args);
+
+
+/*
+ * Create a call of a user-defined function. As made by the parser,
+ * the call names the function without being bound to one; FT_inline
+ * binds the calls it does not inline away.
+ *
+ * Parameters:
+ *   name      The function name
+ *   fn        The function, or NULL if the call is not yet bound
+ *   args      Its arguments; the trees become part of the new tree,
+ *             but the array itself is copied
+ *   num_args  The number of arguments, at most ET_MAX_ARGS
+ *
+ * Returns: The new tree, a USER_CALL node whose children are the
+ *   arguments
+ */
+ExprTree ET_user_call(const char *name, const UserFunc *fn, ExprTree *args, int num_args);
+
+
+/*
+ * Create an array literal, [a, b, ...]. Its elements may themselves
+ * be arrays, which are concatenated into the result.
+ *
+ * Parameters:
+ *   elems     The elements; the trees become part of the new tree, but
+ *             the array itself is copied
+ *   num_elems The number of elements, which is not limited
+ *
+ * Returns: The new tree, an ARRAY_LITERAL node whose children are the
+ *   elements. The evaluators other than ET_evaluate_number reject it.
+ */
+ExprTree ET_array_literal(ExprTree *elems, int num_elems);
+
+
+/*
+ * Create a summation or product over a range of integers, as in
+ *
+ *   sum(i, 1, n, i ^ 2)
+ *
+ * The bounds are evaluated once, outside the range; the index is
+ * bound within the body only, where it must already have been turned
+ * into RANGE_INDEX nodes by ET_bind_index.
+ *
+ * Parameters:
+ *   type     RANGE_SUM or RANGE_PROD
+ *   index    The name of the index, kept for printing
+ *   lo       The first index
+ *   hi       The last index
+ *   body     The term for each index; the trees become part of the
+ *            new tree
+ *
+ * Returns: The new tree, whose arguments (see ET_arg) are lo, hi and
+ *   body. The evaluators other than ET_evaluate_number reject it.
+ */
+ExprTree ET_range(ExprNodeType type, const char *index, ExprTree lo, ExprTree hi, ExprTree body);
+
+
+/*
+ * Create a reference to the index of an enclosing range
+ *
+ * Parameters:
+ *   level    Which range: 0 for the innermost enclosing range body,
+ *            1 for the one around that, and so on
+ *   name     The name of the index, kept for printing
+ *
+ * Returns: The new tree, a RANGE_INDEX leaf
+ */
+ExprTree ET_range_index(int level, const char *name);
+
+
+/*
+ * Make a copy of a tree to be the body of a range, in which the
+ * SYMBOL nodes named index become RANGE_INDEX nodes of the new range.
+ * Symbols of that name within the body of a nested range refer to the
+ * new range too, unless the nested range has the same index name.
+ *
+ * Parameters:
+ *   tree     The body
+ *   index    The name of the index
+ *
+ * Returns: The copy. The caller still owns tree.
+ */
+ExprTree ET_bind_index(ExprTree tree, const char *index);
+
+
+/*
+ * Make a copy of a range with its index given a new name, both in the
+ * range and in the references to it within its body, so that it prints
+ * apart from another index of the old name
+ *
+ * Parameters:
+ *   tree     The range
+ *   index    The new name of its index
+ *
+ * Returns: The copy. The caller still owns tree.
+ */
+ExprTree ET_rename_index(ExprTree tree, const char *index);
+
+
+/*
+ * Make a copy of a tree to be placed within shift more ranges than it
+ * was, raising the level of each RANGE_INDEX that refers to a range
+ * around the tree so that it still refers to the same one
+ *
+ * Parameters:
+ *   tree     The tree; may be NULL
+ *   shift    The number of ranges
+ *
+ * Returns: The copy. The caller still owns tree.
+ */
+ExprTree ET_shift_indexes(ExprTree tree, int shift);
+
+
+/*
+ * Create a parameter node, which stands for an argument of the
+ * function whose body contains it
+ *
+ * Parameters:
+ *   index    The parameter number, from 0
+ *
+ * Returns: The new tree, a PARAM leaf
+ */
+ExprTree ET_param(int index);
+
+
 /*
  * Destroy an ExprTree, calling free() on all malloc'd memory
  *
@@ -86,6 +287,18 @@ void ET_free(ExprTree tree);
 int ET_count(ExprTree tree);
 
 
+/*
+ * Return the number of bytes of heap memory used by the tree,
+ * including symbol names.
+ *
+ * Parameters:
+ *   tree     The tree 
+ * 
+ * Returns: The memory footprint in bytes
+ */
+size_t ET_footprint(ExprTree tree);
+
+
 /*
  * Return the maximum depth for the tree. A tree that contains just a
  * single leaf node has a depth of 1.
@@ -104,7 +317,8 @@ int ET_depth(ExprTree tree);
  * Parameters:
  *   tree     The tree to compute
  * 
- * Returns: The computed value
+ * Returns: The computed value. A result that is an array is reported
+ *   as an error, since it cannot be returned as a double.
  */
 
 // expr_tree.h
@@ -113,6 +327,115 @@ int ET_depth(ExprTree tree);
 double ET_evaluate(ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz);
 
 
+/*
+ * Does the tree contain an ARRAY_LITERAL? Computed when nodes are
+ * built, so this call is O(1).
+ *
+ * Parameters:
+ *   tree     The tree; may be NULL
+ *
+ * Returns: true if the tree holds an array literal
+ */
+bool ET_has_array_literal(ExprTree tree);
+
+
+/*
+ * Does the tree call a user-defined function that it is not bound to,
+ * as a parsed tree is until FT_inline? ET_foreach_symbol cannot report
+ * what such a call reads and assigns. Computed when nodes are built, so
+ * this call is O(1).
+ *
+ * Parameters:
+ *   tree     The tree; may be NULL
+ *
+ * Returns: true if the tree holds an unbound USER_CALL
+ */
+bool ET_has_unbound_call(ExprTree tree);
+
+
+/*
+ * Evaluate an ExprTree, keeping integer results exact. Integer
+ * literals, and variables holding integral values no larger than
+ * 2^53 in magnitude, are carried as int64; + - * ^ and exact division
+ * on integers are computed with overflow-checked integer arithmetic.
+ * A result becomes a double only when an operation overflows or has
+ * no exact integer result, so integer-only formulas never call into
+ * libm. ET_evaluate is this function with the result converted to
+ * double.
+ *
+ * Values assigned to variables are stored in vars as doubles.
+ *
+ * A condition is true if it is nonzero. NaN, the value of an error or
+ * of an undefined variable, has no truth value: a comparison with NaN,
+ * an OP_AND or OP_OR with a NaN operand it needs, and an OP_COND with a
+ * NaN condition all give NaN. OP_AND, OP_OR and OP_COND evaluate
+ * lazily: a branch not taken is not evaluated, so its assignments,
+ * errors and calls do not happen.
+ *
+ * A bound USER_CALL evaluates its arguments into a frame on the C
+ * stack and then the function body, whose PARAM nodes read the frame;
+ * no memory is allocated. Calls nested more than ET_MAX_CALL_DEPTH
+ * deep, unbound calls and FUNC_DEF nodes are errors.
+ *
+ * A RANGE_SUM or RANGE_PROD evaluates its bounds, which must be
+ * integers, and then its body for each index from the first to the
+ * last; an empty range has sum 0 and product 1. Integer terms are
+ * summed or multiplied exactly while the result fits in an int64, and
+ * otherwise the sum is compensated (see range.h). A pure body over
+ * RG_BATCH_MIN or more indices is compiled and run by RG_reduce
+ * instead, falling back to this evaluator if it does not compile,
+ * reads a variable that is undefined or holds an array, or has integer
+ * terms too large for a double to hold exactly. Its integer terms are
+ * still combined exactly.
+ *
+ * Values may be arrays, made by array literals or read from variables
+ * holding them. Every operator then works element by element (see
+ * array_ops.h), a number being applied to each element; a conditional
+ * or logical operator whose condition is an array evaluates both of
+ * its operands and selects element by element. Assigning an array
+ * stores a reference to it, not a copy. The result may be an array,
+ * which it is up to the caller to AR_release.
+ *
+ * Parameters:
+ *   tree       The tree to compute
+ *   vars       The variables, which may be modified by assignments
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value. If an error is encountered, copies an
+ *   error message into errmsg and returns a NaN double.
+ */
+ETNumber ET_evaluate_number(ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Apply an arithmetic operator to already-computed operands. This is
+ * the arithmetic used by ET_evaluate, exposed so that other
+ * evaluators compute exactly the same results.
+ *
+ * Parameters:
+ *   op         The operator; one of OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+ *              OP_POWER, UNARY_NEGATE (which ignores right_val), a
+ *              comparison, OP_AND or OP_OR (which here take both
+ *              operands as already computed)
+ *   left_val   The left operand
+ *   right_val  The right operand
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The result, or NaN with an error message on error
+ */
+double ET_apply(ExprNodeType op, double left_val, double right_val, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * As ET_apply, but on ETNumbers: integer operands stay on the integer
+ * path where the result is exact and fits, as described for
+ * ET_evaluate_number
+ */
+ETNumber ET_apply_number(ExprNodeType op, ETNumber left, ETNumber right, char *errmsg, size_t errmsg_sz);
+
+
 /*
 * Evaluate an ExprTree and return the resulting value
 *
@@ -131,4 +454,219 @@ size_t ET_tree2string(ExprTree tree, char *buf, size_t buf_sz);
 ExprTree ET_symbol(const char *symbol);
 
 
+/*
+ * Return the type of the root node of a tree
+ *
+ * Parameters:
+ *   tree     The tree
+ * 
+ * Returns: The ExprNodeType of the root node
+ */
+ExprNodeType ET_type(ExprTree tree);
+
+
+/*
+ * Return one of the children of an interior node
+ *
+ * Parameters:
+ *   tree     The tree; must be an interior node other than a call,
+ *            array literal or range
+ *   which    0 for the left child, 1 for the right child
+ * 
+ * Returns: The requested child, which may be NULL (for instance the
+ *   right child of a UNARY_NEGATE node)
+ */
+ExprTree ET_child(ExprTree tree, int which);
+
+
+/*
+ * Return the function called by a FUNC_CALL node
+ *
+ * Parameters:
+ *   tree     The tree; must be a FUNC_CALL node
+ * 
+ * Returns: The builtin
+ */
+const Builtin *ET_call_function(ExprTree tree);
+
+
+/*
+ * Return the function called by a USER_CALL node
+ *
+ * Parameters:
+ *   tree     The tree; must be a USER_CALL node
+ * 
+ * Returns: The function, or NULL if the call is not bound
+ */
+const UserFunc *ET_user_function(ExprTree tree);
+
+
+/*
+ * Return the name of the function called by a FUNC_CALL or USER_CALL
+ * node, or "sum" or "prod" for a range
+ *
+ * Parameters:
+ *   tree     The tree; must be a call or range
+ * 
+ * Returns: The name, which remains owned by the tree or the builtin
+ */
+const char *ET_call_name(ExprTree tree);
+
+
+/*
+ * Return the number of arguments of a FUNC_CALL or USER_CALL node, the
+ * number of elements of an ARRAY_LITERAL, or 3 for a range
+ *
+ * Parameters:
+ *   tree     The tree; must be a call, array literal or range
+ * 
+ * Returns: The number of arguments
+ */
+int ET_num_args(ExprTree tree);
+
+
+/*
+ * Return one argument of a FUNC_CALL or USER_CALL node, one element
+ * of an ARRAY_LITERAL, or the first index, last index or body of a
+ * range
+ *
+ * Parameters:
+ *   tree     The tree; must be a call, array literal or range
+ *   which    The argument number, from 0 to ET_num_args - 1
+ * 
+ * Returns: The argument, which remains owned by the tree
+ */
+ExprTree ET_arg(ExprTree tree, int which);
+
+
+/*
+ * Return the parameter number of a PARAM node
+ *
+ * Parameters:
+ *   tree     The tree; must be a PARAM node
+ * 
+ * Returns: The parameter number, from 0
+ */
+int ET_param_index(ExprTree tree);
+
+
+/*
+ * Return the level of a RANGE_INDEX node (see ET_range_index)
+ *
+ * Parameters:
+ *   tree     The tree; must be a RANGE_INDEX node
+ * 
+ * Returns: The level, from 0
+ */
+int ET_index_level(ExprTree tree);
+
+
+/*
+ * Return the index name of a range or RANGE_INDEX node
+ *
+ * Parameters:
+ *   tree     The tree; must be a RANGE_SUM, RANGE_PROD or RANGE_INDEX
+ * 
+ * Returns: The name, which remains owned by the tree
+ */
+const char *ET_index_name(ExprTree tree);
+
+
+/*
+ * Return the name held by a SYMBOL node
+ *
+ * Parameters:
+ *   tree     The tree; must be a SYMBOL node
+ * 
+ * Returns: The symbol name, which remains owned by the tree
+ */
+const char *ET_symbol_name(ExprTree tree);
+
+
+/*
+ * Make a deep copy of a tree
+ *
+ * Parameters:
+ *   tree     The tree to copy; may be NULL
+ * 
+ * Returns: A new tree, structurally identical to the argument. It is
+ *   the responsibility of the caller to call ET_free on the copy.
+ */
+ExprTree ET_copy(ExprTree tree);
+
+
+typedef void (*ET_symbol_callback)(const char *symbol, bool assigned, void *cb_data);
+
+/*
+ * Walk the tree, calling the user-specified callback for every
+ * SYMBOL node. Each call to callback will be of the form
+ *
+ *   callback( <symbol name>, <assigned>, <cb_data> )
+ *
+ * where assigned is true if the symbol is the target of an OP_ASSIGN
+ * (i.e., it is written rather than read). A symbol appearing several
+ * times results in several calls. A bound USER_CALL reports the
+ * variables that the function reads and assigns, as well as those in
+ * its arguments.
+ *
+ * Parameters:
+ *   tree       The tree
+ *   callback   The function to call
+ *   cb_data    Caller data to pass to the function
+ * 
+ * Returns: None
+ */
+void ET_foreach_symbol(ExprTree tree, ET_symbol_callback callback, void *cb_data);
+
+
+/*
+ * Return the value held by a VALUE node
+ *
+ * Parameters:
+ *   tree     The tree; must be a VALUE node
+ * 
+ * Returns: The value
+ */
+double ET_get_value(ExprTree tree);
+
+
+/*
+ * Return the value held by a VALUE node as an ETNumber, which is an
+ * integer if the node was made by ET_integer
+ *
+ * Parameters:
+ *   tree     The tree; must be a VALUE node
+ * 
+ * Returns: The value
+ */
+ETNumber ET_get_number(ExprTree tree);
+
+
+/*
+ * Return the structural hash of a tree. Two trees with the same shape,
+ * operators, values and symbol names have the same hash, wherever
+ * they appear; the names of range indexes do not count. The hash is
+ * computed when nodes are built, so this call is O(1).
+ *
+ * Parameters:
+ *   tree     The tree; may be NULL
+ * 
+ * Returns: The 64-bit structural hash
+ */
+uint64_t ET_hash(ExprTree tree);
+
+
+/*
+ * Is the tree free of side effects, i.e., does it contain no
+ * OP_ASSIGN or FUNC_DEF, and call no function whose body does?
+ * Computed when nodes are built, so this call is O(1).
+ *
+ * Parameters:
+ *   tree     The tree; may be NULL
+ * 
+ * Returns: true if evaluating the tree cannot modify any variable
+ */
+bool ET_is_pure(ExprTree tree);
+
+
 #endif /* _EXPR_TREE_H_ */
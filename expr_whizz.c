@@ -11,6 +11,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <time.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -19,16 +23,1047 @@
 #include "tokenize.h"
 #include "expr_tree.h"
 #include "parse.h"
+#include "sheet.h"
+#include "parse_cache.h"
+#include "memo.h"
+#include "functions.h"
+#include "solve.h"
+#include "quad.h"
+#include "montecarlo.h"
+#include "grid.h"
+#include "batch.h"
+#include "csv.h"
+#include "colfile.h"
+
+#define DEFAULT_CACHE_BYTES (1024 * 1024)
+
+// The output buffer in batch mode
+#define BATCH_OUTPUT_BYTES (1024 * 1024)
+
+// Longer arrays print only their first and last elements
+#define PRINT_ARRAY_MAX 10
+
+/*
+ * Print a usage message for the program
+ *
+ * Parameters:
+ *   progname   The name the program was invoked as
+ *
+ * Returns: None
+ */
+static void usage(const char *progname)
+{
+  fprintf(stderr, "Usage: %s [-r] [-m bytes] [-M entries] [-b [file] | -c file expr]\n", progname);
+  fprintf(stderr, "  -r        reactive mode: assignments are remembered as formulas and\n"
+          "            recomputed when the variables they read change\n");
+  fprintf(stderr, "  -m bytes  memory cap for the parsed-expression cache (default %d)\n",
+          DEFAULT_CACHE_BYTES);
+  fprintf(stderr, "  -M entries  remember up to this many subtree results, reusing them\n"
+          "            while the variables they read are unchanged\n");
+  fprintf(stderr, "  -b [file] batch mode: evaluate the lines of file (or of stdin),\n"
+          "            printing one result per expression\n");
+  fprintf(stderr, "  -c file expr  evaluate expr on every row of the CSV file, whose\n"
+          "            header names its columns, writing the results to stdout\n");
+}
+
+/*
+ * Print an array result as [a, b, ...]
+ *
+ * Parameters:
+ *   a          The array
+ *
+ * Returns: None
+ */
+static void print_array(Array a)
+{
+  size_t n = AR_length(a);
+  const double *data = AR_data(a);
+
+  printf("[");
+  for (size_t i = 0; i < n; i++) {
+    if (n > PRINT_ARRAY_MAX && i == PRINT_ARRAY_MAX / 2) {
+      printf(", ...");
+      i = n - PRINT_ARRAY_MAX / 2;
+    }
+    printf("%s%g", i > 0 ? ", " : "", data[i]);
+  }
+  printf("]");
+  if (n > PRINT_ARRAY_MAX)
+    printf(" (%zu elements)", n);
+  printf("\n");
+}
+
+// The state that lines are evaluated against
+typedef struct
+{
+  CDict dict;
+  Sheet sheet;       // NULL unless in reactive mode
+  MemoCache memo;    // NULL unless memoizing
+  FuncTable funcs;
+  ParseCache cache;
+  MOModel model;
+  long line;         // the line being run in batch mode, or 0
+} Session;
+
+/*
+ * Report an error of a line, an expression's or a command's, to
+ * stderr: in batch mode with its line number, and after the results
+ * of the lines before it. A message, such as one from a library, that
+ * does not start with "Error" or "Usage" is given the "Error: " prefix.
+ *
+ * Parameters:
+ *   s          The session
+ *   errmsg     The message, without a newline
+ *
+ * Returns: None
+ */
+static void report_error(const Session *s, const char *errmsg)
+{
+  if (s->line > 0) {
+    fflush(stdout);
+    fprintf(stderr, "line %ld: ", s->line);
+  }
+  bool prefixed = strncmp(errmsg, "Error", 5) == 0 || strncmp(errmsg, "Usage", 5) == 0;
+  fprintf(stderr, "%s%s\n", prefixed ? "" : "Error: ", errmsg);
+}
+
+/*
+ * Run the command "solve VAR [LO [HI]]: EXPR", which finds a value of
+ * VAR at which EXPR is 0, between LO and HI, or starting from LO, or
+ * from VAR's current value (0 if it has none). The expression is
+ * compiled once and solved in-process (see solve.h); the root is
+ * printed with the iteration count and time per iteration, and stored
+ * in VAR, through the sheet in reactive mode so that the formulas that
+ * read VAR are recomputed.
+ *
+ * Parameters:
+ *   args       The command, after "solve"
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void solve_command(const char *args, Session *s)
+{
+  char errmsg[128] = "";
+  char var[64];
+  double lo, hi;
+  int n = 0;
+
+  const char *colon = strchr(args, ':');
+  int fields = colon ? sscanf(args, " %63[A-Za-z_0-9] %n", var, &n) : 0;
+  if (fields != 1 || !(isalpha((unsigned char)var[0]) || var[0] == '_')) {
+    report_error(s, "Usage: solve VAR [LO [HI]]: EXPR");
+    return;
+  }
+
+  // at most two bounds, and nothing after them
+  char bounds[128];
+  int used = -1;
+  snprintf(bounds, sizeof(bounds), "%.*s", (int)(colon - args - n), args + n);
+  int num_bounds = sscanf(bounds, " %lf %n%lf %n", &lo, &used, &hi, &used);
+  if (num_bounds == 0 || (num_bounds > 0 && bounds[used] != '\0')) {
+    report_error(s, "Usage: solve VAR [LO [HI]]: EXPR");
+    return;
+  }
+  if (num_bounds == 1)
+    hi = lo;
+  else if (num_bounds == EOF)
+    lo = hi = isnan(CD_retrieve(s->dict, var)) ? 0 : CD_retrieve(s->dict, var);
+
+  ExprTree tree = PC_parse(s->cache, colon + 1, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, *errmsg ? errmsg : "Error: Nothing to solve");
+    return;
+  }
+  tree = FT_inline(s->funcs, tree, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, errmsg);
+    return;
+  }
+
+  Solver solver = SV_new(tree, var, s->dict, errmsg, sizeof(errmsg));
+  ET_free(tree);
+  if (solver == NULL) {
+    report_error(s, errmsg);
+    return;
+  }
+
+  int iterations;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  double root = SV_solve(solver, lo, hi, &iterations, errmsg, sizeof(errmsg));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  SV_free(solver);
+
+  if (*errmsg != '\0') {
+    report_error(s, errmsg);
+    return;
+  }
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  if (iterations > 0)
+    printf("%s = %.15g  (%d iterations, %.0f ns per iteration)\n", var, root, iterations,
+           ns / iterations);
+  else
+    printf("%s = %.15g  (0 iterations)\n", var, root);
+
+  if (s->sheet == NULL) {
+    CD_store(s->dict, var, root);
+    return;
+  }
+  ExprTree assign = ET_node(OP_ASSIGN, ET_symbol(var), ET_value(root));
+  SH_evaluate(s->sheet, assign, errmsg, sizeof(errmsg));
+  ET_free(assign);
+  if (*errmsg != '\0')
+    report_error(s, errmsg);
+}
+
+/*
+ * Evaluate an argument of a command, itself an expression, such as a
+ * bound of integrate
+ *
+ * Parameters:
+ *   what       What the argument is, for the error if it is missing
+ *
+ * Returns: The value, or NaN with an error message in errmsg
+ */
+static double eval_arg(const char *text, const char *what, Session *s, char *errmsg,
+                       size_t errmsg_sz)
+{
+  ExprTree tree = PC_parse(s->cache, text, errmsg, errmsg_sz);
+  if (tree == NULL) {
+    if (*errmsg == '\0')
+      snprintf(errmsg, errmsg_sz, "Error: Missing %s", what);
+    return NAN;
+  }
+  tree = FT_inline(s->funcs, tree, errmsg, errmsg_sz);
+  if (tree == NULL)
+    return NAN;
+  double value = ET_evaluate(tree, s->dict, errmsg, errmsg_sz);
+  ET_free(tree);
+  return value;
+}
+
+/*
+ * Run the command "integrate(EXPR, VAR, A, B)", which integrates EXPR
+ * over VAR from A to B by adaptive quadrature (see quad.h), printing
+ * the integral with its estimated error and the work done
+ *
+ * Parameters:
+ *   input      The command
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void integrate_command(const char *input, Session *s)
+{
+  char errmsg[128] = "";
+  char text[1024], var[64];
+
+  // the last three commas outside parentheses end the expression and
+  // separate the variable and the bounds
+  const char *open = strchr(input, '('), *close = strrchr(input, ')');
+  const char *comma[3] = {NULL};
+  int depth = 0;
+  for (const char *c = open + 1; close && c < close; c++) {
+    depth += (*c == '(' || *c == '[') - (*c == ')' || *c == ']');
+    if (*c == ',' && depth == 0) {
+      comma[0] = comma[1];
+      comma[1] = comma[2];
+      comma[2] = c;
+    }
+  }
+  if (close == NULL || close[strspn(close + 1, " \t") + 1] != '\0' || comma[0] == NULL ||
+      sscanf(comma[0] + 1, " %63[A-Za-z_0-9] ,", var) != 1 ||
+      !(isalpha((unsigned char)var[0]) || var[0] == '_')) {
+    report_error(s, "Usage: integrate(EXPR, VAR, A, B)");
+    return;
+  }
+
+  snprintf(text, sizeof(text), "%.*s", (int)(comma[2] - comma[1] - 1), comma[1] + 1);
+  double a = eval_arg(text, "bound of integrate", s, errmsg, sizeof(errmsg));
+  snprintf(text, sizeof(text), "%.*s", (int)(close - comma[2] - 1), comma[2] + 1);
+  double b = *errmsg ? NAN
+                     : eval_arg(text, "bound of integrate", s, errmsg, sizeof(errmsg));
+  if (*errmsg != '\0') {
+    report_error(s, errmsg);
+    return;
+  }
+
+  snprintf(text, sizeof(text), "%.*s", (int)(comma[0] - open - 1), open + 1);
+  ExprTree tree = PC_parse(s->cache, text, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, *errmsg ? errmsg : "Error: Nothing to integrate");
+    return;
+  }
+  tree = FT_inline(s->funcs, tree, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, errmsg);
+    return;
+  }
+
+  QDStats stats;
+  double result = QD_integrate(tree, var, s->dict, a, b, &stats, errmsg, sizeof(errmsg));
+  ET_free(tree);
+  if (*errmsg != '\0') {
+    report_error(s, errmsg);
+    return;
+  }
+  printf("%s  ==> %.15g  (error %.2g; %ld evaluations over %d intervals, %d thread%s)\n",
+         input, result, stats.error, stats.evaluations, stats.intervals, stats.threads,
+         stats.threads == 1 ? "" : "s");
+}
+
+/*
+ * Run the command "VAR ~ DIST(PARAMS)", which binds VAR to a
+ * distribution for Monte Carlo runs (see montecarlo.h)
+ *
+ * Parameters:
+ *   input      The command
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void distribution_command(const char *input, Session *s)
+{
+  char errmsg[128] = "";
+  char text[1024], var[64], dist[32];
+  double params[4];
+  int num_params = 0, n = 0;
+
+  const char *close = strrchr(input, ')');
+  if (sscanf(input, " %63[A-Za-z_0-9] ~ %31[a-z] (%n", var, dist, &n) != 2 || n == 0 ||
+      close == NULL || close[strspn(close + 1, " \t") + 1] != '\0' ||
+      !(isalpha((unsigned char)var[0]) || var[0] == '_')) {
+    report_error(s, "Usage: VAR ~ DIST(PARAMS), where DIST is uniform, normal, lognormal "
+                 "or exponential");
+    return;
+  }
+
+  // the parameters are separated by commas outside parentheses
+  const char *start = input + n;
+  int depth = 0;
+  for (const char *c = start; c <= close && *errmsg == '\0'; c++) {
+    depth += (*c == '(' || *c == '[') - (*c == ')' || *c == ']');
+    if ((*c == ',' && depth == 0) || c == close) {
+      if (num_params == sizeof(params) / sizeof(params[0])) {
+        snprintf(errmsg, sizeof(errmsg), "Error: Too many parameters for %s", dist);
+        break;
+      }
+      snprintf(text, sizeof(text), "%.*s", (int)(c - start), start);
+      params[num_params++] = eval_arg(text, "parameter of distribution", s, errmsg,
+                                      sizeof(errmsg));
+      start = c + 1;
+    }
+  }
+  const char *tilde = strchr(input, '~');
+  if (*errmsg == '\0' && MO_bind(s->model, var, dist, params, num_params, errmsg, sizeof(errmsg)))
+    printf("%s ~ %s\n", var, tilde + 1 + strspn(tilde + 1, " "));
+  else
+    report_error(s, errmsg);
+}
+
+/*
+ * Run the command "mc N: EXPR", which evaluates EXPR over N samples of
+ * the random variables, printing its mean, spread and quantiles
+ *
+ * Parameters:
+ *   args       The command, after "mc"
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void mc_command(const char *args, Session *s)
+{
+  char errmsg[128] = "";
+  double samples;
+  int n = 0;
+
+  const char *colon = strchr(args, ':');
+  if (colon == NULL || sscanf(args, " %lf %n", &samples, &n) != 1 || args + n != colon ||
+      samples < 1 || samples > 1e15 || samples != floor(samples)) {
+    report_error(s, "Usage: mc N: EXPR");
+    return;
+  }
+
+  ExprTree tree = PC_parse(s->cache, colon + 1, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, *errmsg ? errmsg : "Error: Nothing to evaluate");
+    return;
+  }
+  tree = FT_inline(s->funcs, tree, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, errmsg);
+    return;
+  }
+
+  MOStats stats;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  MO_run(s->model, tree, s->dict, (long)samples, &stats, errmsg, sizeof(errmsg));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ET_free(tree);
+  if (*errmsg != '\0') {
+    report_error(s, errmsg);
+    return;
+  }
+
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  printf("%s  ==> mean %.10g (std error %.2g), std dev %.10g\n", colon + 1 + strspn(colon + 1, " "),
+         stats.mean, stats.std_error, stats.std_dev);
+  printf("  min %.6g  5%% %.6g  25%% %.6g  median %.6g  75%% %.6g  95%% %.6g  max %.6g\n",
+         stats.min, stats.p5, stats.p25, stats.median, stats.p75, stats.p95, stats.max);
+  printf("  (%ld samples, %ld undefined; %.1f ns per sample, %d thread%s)\n", stats.samples,
+         stats.undefined, ns / stats.samples, stats.threads, stats.threads == 1 ? "" : "s");
+}
+
+/*
+ * Evaluate EXPR on the rows of a CSV file (see csv.h), writing the
+ * column of results to stdout, or to a file with a summary on stdout
+ *
+ * Parameters:
+ *   in_path    The CSV file, or "-" for stdin
+ *   out_path   The file to write, or NULL for stdout
+ *   expr       The expression
+ *   s          The session
+ *
+ * Returns: true if every row was evaluated and written
+ */
+static bool csv_evaluate(const char *in_path, const char *out_path, const char *expr,
+                         Session *s)
+{
+  char errmsg[128] = "";
+
+  ExprTree tree = PC_parse(s->cache, expr, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, *errmsg ? errmsg : "Error: Nothing to evaluate");
+    return false;
+  }
+  tree = FT_inline(s->funcs, tree, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, errmsg);
+    return false;
+  }
+
+  FILE *in = stdin, *out = stdout;
+  if (strcmp(in_path, "-") != 0 && (in = fopen(in_path, "r")) == NULL) {
+    snprintf(errmsg, sizeof(errmsg), "Error: Cannot open %s", in_path);
+    report_error(s, errmsg);
+    ET_free(tree);
+    return false;
+  }
+  if (out_path != NULL && (out = CS_open_output(in, out_path, errmsg, sizeof(errmsg))) == NULL) {
+    report_error(s, errmsg);
+    if (in != stdin)
+      fclose(in);
+    ET_free(tree);
+    return false;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long rows = CS_evaluate(tree, in, s->dict, out, errmsg, sizeof(errmsg));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ET_free(tree);
+  if (in != stdin)
+    fclose(in);
+  if (out != stdout && fclose(out) != 0 && rows >= 0) {
+    snprintf(errmsg, sizeof(errmsg), "Error: Could not write %s", out_path);
+    rows = -1;
+  }
+  if (out == stdout)
+    fflush(stdout);
+  if (rows < 0) {
+    report_error(s, errmsg);
+    return false;
+  }
+
+  if (out_path != NULL) {
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("Wrote %ld values to %s (%.1f ns per row)\n", rows, out_path, rows ? ns / rows : 0);
+  }
+  return true;
+}
+
+/*
+ * Run the command "csv FILE [> OUT]: EXPR", which evaluates EXPR on
+ * every row of the CSV file FILE, whose header names the variables in
+ * its columns, writing the column of results to stdout or OUT
+ *
+ * Parameters:
+ *   args       The command, after "csv"
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void csv_command(const char *args, Session *s)
+{
+  char head[600], in_path[256], out_path[256] = "";
+  int n = 0, m = 0;
+
+  // the files are named before the first colon
+  const char *colon = strchr(args, ':');
+  bool ok = colon != NULL && (size_t)(colon - args) < sizeof(head);
+  if (ok) {
+    memcpy(head, args, colon - args);
+    head[colon - args] = '\0';
+    ok = sscanf(head, " %255[^> \t] %n", in_path, &n) == 1;
+  }
+  if (ok && head[n] == '>') {
+    ok = sscanf(head + n + 1, " %255s %n", out_path, &m) == 1;
+    n += 1 + m;
+  }
+  if (!ok || head[n] != '\0') {
+    report_error(s, "Usage: csv FILE [> OUT]: EXPR");
+    return;
+  }
+
+  csv_evaluate(in_path, *out_path ? out_path : NULL, colon + 1, s);
+}
+
+/*
+ * Run the command "columns IN [IN ...] > OUT: EXPR", which evaluates EXPR
+ * on every row of binary columns (see colfile.h), writing the results
+ * to OUT: raw, to a file ending in ".bin", or else as a column file.
+ * Each IN is NAME=FILE, a raw column file holding the values of NAME,
+ * or a column file, whose columns are named within it.
+ *
+ * Parameters:
+ *   args       The command, after "columns"
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void columns_command(const char *args, Session *s)
+{
+  char errmsg[400] = "";   // with room for a file's name
+  char head[1024], out_path[256] = "";
+  int n = 0;
+
+  // the files are named before the first colon, the output after a '>'
+  const char *colon = strchr(args, ':');
+  char *arrow = NULL;
+  if (colon != NULL && (size_t)(colon - args) < sizeof(head)) {
+    memcpy(head, args, colon - args);
+    head[colon - args] = '\0';
+    arrow = strchr(head, '>');
+  }
+  if (arrow != NULL) {
+    *arrow = '\0';
+    sscanf(arrow + 1, " %255s %n", out_path, &n);
+  }
+  if (arrow == NULL || *out_path == '\0' || arrow[1 + n] != '\0' ||
+      head[strspn(head, " \t")] == '\0') {
+    report_error(s, "Usage: columns NAME=FILE|FILE [...] > OUT: EXPR");
+    return;
+  }
+
+  CFTable table = CF_new();
+  bool ok = true;
+  for (char *in = strtok(head, " \t"); ok && in != NULL; in = strtok(NULL, " \t")) {
+    char *eq = strchr(in, '=');
+    if (eq != NULL) {
+      *eq = '\0';
+      ok = CF_add_raw(table, in, eq + 1, errmsg, sizeof(errmsg));
+    } else {
+      ok = CF_add_file(table, in, errmsg, sizeof(errmsg));
+    }
+  }
+  if (!ok) {
+    report_error(s, errmsg);
+    CF_free(table);
+    return;
+  }
+
+  ExprTree tree = PC_parse(s->cache, colon + 1, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, *errmsg ? errmsg : "Error: Nothing to evaluate");
+    CF_free(table);
+    return;
+  }
+  tree = FT_inline(s->funcs, tree, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, errmsg);
+    CF_free(table);
+    return;
+  }
+
+  size_t len = strlen(out_path);
+  CFFormat format = len > 4 && strcmp(out_path + len - 4, ".bin") == 0 ? CF_RAW : CF_COLUMNS;
+  FILE *out = CF_open_output(table, out_path, errmsg, sizeof(errmsg));
+  if (out == NULL) {
+    report_error(s, errmsg);
+    ET_free(tree);
+    CF_free(table);
+    return;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long rows = CF_evaluate(tree, table, s->dict, out, format, errmsg, sizeof(errmsg));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ET_free(tree);
+  CF_free(table);
+  bool closed = fclose(out) == 0;
+  if (rows < 0) {
+    report_error(s, errmsg);
+    return;
+  }
+  if (!closed) {
+    snprintf(errmsg, sizeof(errmsg), "Error: Could not write %s", out_path);
+    report_error(s, errmsg);
+    return;
+  }
+
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  printf("Wrote %ld values to %s, %s (%.2f ns per row)\n", rows, out_path,
+         format == CF_RAW ? "raw" : "as a column file", rows ? ns / rows : 0);
+}
+
+/*
+ * Run the command "tabulate(EXPR, VAR, A, B, N [, VAR, A, B, N ...]) [> FILE]",
+ * which evaluates EXPR over a grid of N values of each VAR from A to B
+ * (see grid.h), writing a text table to stdout or FILE, or a binary
+ * one to a FILE ending in ".bin"
+ *
+ * Parameters:
+ *   input      The command
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void tabulate_command(const char *input, Session *s)
+{
+  char errmsg[400] = "";   // with room for a file's name
+  char text[1024], var[GR_MAX_AXES][64], file[256] = "";
+  GRAxis axes[GR_MAX_AXES];
+
+  // the commas outside parentheses separate the arguments, up to the
+  // parenthesis that closes the first
+  const char *open = strchr(input, '('), *close = NULL;
+  const char *arg[4 * GR_MAX_AXES + 2];
+  int num_args = 0, depth = 0;
+  arg[num_args++] = open + 1;
+  for (const char *c = open + 1; *c != '\0' && close == NULL; c++) {
+    depth += (*c == '(' || *c == '[') - (*c == ')' || *c == ']');
+    if (depth < 0)
+      close = c;
+    else if (*c == ',' && depth == 0 && num_args <= 4 * GR_MAX_AXES)
+      arg[num_args++] = c + 1;
+  }
+  int n = 0;
+  if (close != NULL)
+    sscanf(close + 1, " >%n %255s %n", &n, file, &n);
+  if (close == NULL || close[1 + n + strspn(close + 1 + n, " \t")] != '\0' ||
+      num_args < 5 || (num_args - 1) % 4 != 0) {
+    report_error(s, "Usage: tabulate(EXPR, VAR, A, B, N [, VAR, A, B, N [, ...]]) [> FILE]");
+    return;
+  }
+  arg[num_args] = close + 1;
+
+  int num_axes = (num_args - 1) / 4;
+  for (int a = 0; a < num_axes && *errmsg == '\0'; a++) {
+    const char *const *spec = arg + 1 + 4 * a;
+    if (sscanf(spec[0], " %63[A-Za-z_0-9] ,", var[a]) != 1 ||
+        !(isalpha((unsigned char)var[a][0]) || var[a][0] == '_')) {
+      report_error(s, "Usage: tabulate(EXPR, VAR, A, B, N [, VAR, A, B, N [, ...]]) [> FILE]");
+      return;
+    }
+    double bound[3];
+    for (int i = 0; i < 3 && *errmsg == '\0'; i++) {
+      snprintf(text, sizeof(text), "%.*s", (int)(spec[i + 2] - spec[i + 1] - 1), spec[i + 1]);
+      bound[i] = eval_arg(text, "range of tabulate", s, errmsg, sizeof(errmsg));
+    }
+    if (*errmsg == '\0' && !(bound[2] >= 1 && bound[2] <= 1e15 && bound[2] == floor(bound[2])))
+      snprintf(errmsg, sizeof(errmsg), "Error: Number of values of %.63s must be a whole number",
+               var[a]);
+    axes[a] = (GRAxis){var[a], bound[0], bound[1], (long)bound[2]};
+  }
+  if (*errmsg != '\0') {
+    report_error(s, errmsg);
+    return;
+  }
+
+  snprintf(text, sizeof(text), "%.*s", (int)(arg[1] - arg[0] - 1), arg[0]);
+  ExprTree tree = PC_parse(s->cache, text, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, *errmsg ? errmsg : "Error: Nothing to tabulate");
+    return;
+  }
+  tree = FT_inline(s->funcs, tree, errmsg, sizeof(errmsg));
+  if (tree == NULL) {
+    report_error(s, errmsg);
+    return;
+  }
+
+  size_t len = strlen(file);
+  GRFormat format = len > 4 && strcmp(file + len - 4, ".bin") == 0 ? GR_BINARY : GR_TEXT;
+  FILE *out = *file ? fopen(file, format == GR_BINARY ? "wb" : "w") : stdout;
+  if (out == NULL) {
+    snprintf(errmsg, sizeof(errmsg), "Error: Cannot open %s", file);
+    report_error(s, errmsg);
+    ET_free(tree);
+    return;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long points = GR_tabulate(tree, axes, num_axes, s->dict, out, format, errmsg, sizeof(errmsg));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ET_free(tree);
+  if (out != stdout && fclose(out) != 0 && points >= 0) {
+    snprintf(errmsg, sizeof(errmsg), "Error: Could not write the table");
+    points = -1;
+  }
+  if (points < 0) {
+    report_error(s, errmsg);
+    return;
+  }
+  if (out != stdout) {
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("Wrote %ld %s values to %s  (%.1f ns per value)\n", points,
+           format == GR_BINARY ? "binary" : "text", file, ns / points);
+  }
+}
+
+/*
+ * Does the input start with a command's name and then a space?
+ *
+ * Parameters:
+ *   input      The input
+ *   name       The command's name
+ *
+ * Returns: The text after the name, or NULL if it does not
+ */
+static const char *command_args(const char *input, const char *name)
+{
+  size_t len = strlen(name);
+  if (strncmp(input, name, len) != 0 || !isspace((unsigned char)input[len]))
+    return NULL;
+  return input + len;
+}
+
+// Is the input a solve command, "solve VAR [LO [HI]]: EXPR"? Anything
+// else starting with solve is an expression, solve being a variable
+static bool is_solve(const char *input)
+{
+  const char *args = command_args(input, "solve");
+  if (args == NULL)
+    return false;
+  args += strspn(args, " \t");
+  return (isalpha((unsigned char)*args) || *args == '_') && strchr(args, ':') != NULL;
+}
+
+// Is the input an mc command, "mc N: EXPR"?
+static bool is_mc(const char *input)
+{
+  const char *args = command_args(input, "mc");
+  double count;
+  int n = 0;
+  return args && sscanf(args, " %lf %n", &count, &n) == 1 && args[n] == ':';
+}
+
+// Skip any spaces and then a word, of characters not in stop. Returns
+// the text after the word, or NULL if there is none
+static const char *skip_word(const char *text, const char *stop)
+{
+  text += strspn(text, " \t");
+  size_t len = strcspn(text, stop);
+  return len > 0 ? text + len : NULL;
+}
+
+// Is the input a csv command, "csv FILE [> OUT]: EXPR", with nothing
+// else before the colon?
+static bool is_csv(const char *input)
+{
+  const char *p = command_args(input, "csv");
+  if (p)
+    p = skip_word(p, " \t>:");
+  if (p && p[strspn(p, " \t")] == '>')
+    p = skip_word(p + strspn(p, " \t") + 1, " \t:");
+  return p && p[strspn(p, " \t")] == ':';
+}
+
+// Is the input a columns command, "columns NAME=FILE|FILE [...] > OUT:
+// EXPR", with nothing else before the colon?
+static bool is_columns(const char *input)
+{
+  const char *p = command_args(input, "columns");
+  int words = 0;
+  for (const char *word; p && (word = skip_word(p, " \t>:")); words++)
+    p = word;
+  if (words == 0 || p[strspn(p, " \t")] != '>')
+    return false;
+  p = skip_word(p + strspn(p, " \t") + 1, " \t:");
+  return p && p[strspn(p, " \t")] == ':';
+}
+
+/*
+ * Is the input one of the commands, which are run from their text
+ * rather than parsed as an expression? A command's name on its own is
+ * a variable; only a line of the command's shape runs it.
+ *
+ * Parameters:
+ *   input      The input
+ *
+ * Returns: true if it is a command
+ */
+static bool is_command(const char *input)
+{
+  int tilde = 0;
+  return is_solve(input) ||
+         (strncmp(input, "integrate", 9) == 0 && input[9 + strspn(input + 9, " ")] == '(') ||
+         (strncmp(input, "tabulate", 8) == 0 && input[8 + strspn(input + 8, " ")] == '(') ||
+         is_mc(input) ||
+         is_csv(input) ||
+         is_columns(input) ||
+         (sscanf(input, " %*[A-Za-z_0-9] ~%n", &tilde) == 0 && tilde > 0);
+}
+
+// Is a line in batch mode a command? It is not terminated, so its
+// text up to the first colon, where a command's shape ends, is copied
+static bool is_batch_command(const char *text, size_t len)
+{
+  char input[1100];  // more than a command's longest head
+  const char *colon = memchr(text, ':', len);
+  if (colon)
+    len = colon - text + 1;
+  if (len >= sizeof(input))
+    len = sizeof(input) - 1;
+  memcpy(input, text, len);
+  input[len] = '\0';
+  return is_command(input);
+}
+
+/*
+ * Run a command
+ *
+ * Parameters:
+ *   input      The command, for which is_command is true
+ *   s          The session
+ *
+ * Returns: None
+ */
+static void run_command(const char *input, Session *s)
+{
+  if (is_solve(input))
+    solve_command(input + 5, s);
+  else if (strncmp(input, "integrate", 9) == 0)
+    integrate_command(input, s);
+  else if (strncmp(input, "tabulate", 8) == 0)
+    tabulate_command(input, s);
+  else if (is_mc(input))
+    mc_command(input + 2, s);
+  else if (is_csv(input))
+    csv_command(input + 3, s);
+  else if (is_columns(input))
+    columns_command(input + 7, s);
+  else
+    distribution_command(input, s);
+}
+
+/*
+ * Define the function, or evaluate the expression, parsed from a line
+ *
+ * Parameters:
+ *   s          The session
+ *   tree       The parsed line; it is not modified, and the caller
+ *              retains ownership of it
+ *   result     Return space for the value of an expression; the
+ *              caller must AR_release its array
+ *   defined    Return space for the function defined, or NULL if the
+ *              line is an expression
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, false with an error message in errmsg
+ */
+static bool evaluate_tree(Session *s, ExprTree tree, ETNumber *result,
+                          const UserFunc **defined, char *errmsg, size_t errmsg_sz)
+{
+  *result = (ETNumber){.is_int = false};
+  *defined = NULL;
+  if (ET_type(tree) == FUNC_DEF) {
+    *defined = FT_define(s->funcs, tree, errmsg, errmsg_sz);
+    return *defined != NULL;
+  }
+
+  // Calls are inlined into a private copy; the parsed tree is left
+  // as it is, since the functions it calls may be redefined
+  tree = FT_inline(s->funcs, tree, errmsg, errmsg_sz);
+  if (tree == NULL)
+    return false;
+
+  if (s->sheet)
+    *result = SH_evaluate_number(s->sheet, tree, errmsg, errmsg_sz);
+  else if (s->memo)
+    *result = MC_evaluate_number(s->memo, tree, s->dict, errmsg, errmsg_sz);
+  else
+    *result = ET_evaluate_number(tree, s->dict, errmsg, errmsg_sz);
+  ET_free(tree);
+  if (*errmsg != '\0') {
+    AR_release(result->array);
+    result->array = NULL;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Compute a line in batch mode, perhaps on another thread; see batch.h
+ *
+ * Parameters:
+ *   line       The line, which holds no definition or call of a
+ *              user-defined function
+ *   vars       The variables to evaluate it against
+ *   cb_data    The session (not used)
+ *
+ * Returns: None
+ */
+static void batch_compute(BTLine *line, CDict vars, void *cb_data)
+{
+  line->result = ET_evaluate_number(line->tree, vars, line->errmsg, sizeof(line->errmsg));
+}
+
+/*
+ * Report one line in batch mode, first evaluating it if it was not
+ * computed, printing its result alone, and its error, if any, with its
+ * line number to stderr
+ *
+ * Parameters:
+ *   line       The line, parsed (see batch.h)
+ *   cb_data    The session
+ *
+ * Returns: None
+ */
+static void batch_line(const BTLine *line, void *cb_data)
+{
+  Session *s = cb_data;
+  char errmsg[128] = "";
+  ETNumber result = line->result;
+  const UserFunc *defined = NULL;
+
+  s->line = line->number;
+  if (line->command) {
+    run_command(line->command, s);
+    return;
+  }
+  if (line->tree == NULL) {
+    report_error(s, line->errmsg);
+    return;
+  }
+
+  bool ok;
+  if (line->computed) {
+    ok = line->errmsg[0] == '\0';
+    strcpy(errmsg, line->errmsg);
+  } else {
+    ok = evaluate_tree(s, line->tree, &result, &defined, errmsg, sizeof(errmsg));
+  }
+
+  if (!ok)
+    report_error(s, errmsg);
+  else if (result.array)
+    print_array(result.array);
+  else if (result.is_int)
+    printf("%" PRId64 "\n", result.i);
+  else if (!defined)
+    printf("%.17g\n", result.d);
+  if (!line->computed)
+    AR_release(result.array);
+}
 
 int main(int argc, char *argv[])
 {
   char *input = NULL;
-  CList tokens = NULL;
   ExprTree tree = NULL;
   char errmsg[128];
   bool time_to_quit = false;
+  bool batch = false;
+  const char *csv_path = NULL;
   char expr_buf[1024];
-  CDict dict = CD_new();
+  size_t cache_bytes = DEFAULT_CACHE_BYTES;
+  Session s = {.dict = CD_new(), .funcs = FT_new(), .model = MO_new(0)};
+  int opt;
+
+  while ((opt = getopt(argc, argv, "rm:M:bc:")) != -1) {
+    switch (opt) {
+    case 'r':
+      if (!s.sheet)
+        s.sheet = SH_new(s.dict);
+      break;
+    case 'm':
+      cache_bytes = strtoul(optarg, NULL, 0);
+      break;
+    case 'M':
+      MC_free(s.memo);
+      s.memo = MC_new(strtoul(optarg, NULL, 0));
+      break;
+    case 'b':
+      batch = true;
+      break;
+    case 'c':
+      csv_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      MO_free(s.model);
+      MC_free(s.memo);
+      SH_free(s.sheet);
+      FT_free(s.funcs);
+      CD_free(s.dict);
+      return 1;
+    }
+  }
+
+  if (csv_path != NULL && optind != argc - 1) {
+    usage(argv[0]);
+    time_to_quit = true;
+  }
+
+  s.cache = PC_new(cache_bytes);
+
+  if (csv_path != NULL) {
+    if (!time_to_quit) {
+      setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BYTES);
+      time_to_quit = !csv_evaluate(csv_path, NULL, argv[optind], &s);
+    }
+    PC_free(s.cache);
+    MO_free(s.model);
+    MC_free(s.memo);
+    SH_free(s.sheet);
+    FT_free(s.funcs);
+    CD_free(s.dict);
+    return time_to_quit ? 1 : 0;
+  }
+
+  if (batch) {
+    // No prompts, banner or echoed expressions: one result per line,
+    // written through a large buffer
+    FILE *in = stdin;
+    const char *path = optind < argc ? argv[optind] : "-";
+    if (strcmp(path, "-") != 0 && (in = fopen(path, "r")) == NULL) {
+      perror(path);
+      time_to_quit = true;
+    } else {
+      setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BYTES);
+      // lines are computed at once only when evaluating them has no
+      // effect beyond the variables they assign
+      BTConfig config = {.is_command = is_batch_command, .evaluate = batch_line,
+                         .compute = s.sheet || s.memo ? NULL : batch_compute,
+                         .vars = s.dict, .cb_data = &s};
+      BT_run(in, &config);
+      if (in != stdin)
+        fclose(in);
+      fflush(stdout);
+    }
+    PC_free(s.cache);
+    MO_free(s.model);
+    MC_free(s.memo);
+    SH_free(s.sheet);
+    FT_free(s.funcs);
+    CD_free(s.dict);
+    return time_to_quit ? 1 : 0;
+  }
 
   printf("Welcome to ExpressionWhizz!\n");
 
@@ -46,44 +1081,51 @@ int main(int argc, char *argv[])
 
     add_history(input);
 
-    tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
-
-    if (tokens == NULL) {
-      fprintf(stderr, "%s\n", errmsg);
+    if (is_command(input)) {
+      run_command(input, &s);
       goto loop_end;
     }
 
-    if (CL_length(tokens) == 0)
-      goto loop_end;
-      
-    // uncomment for more debug info
-    TOK_print(tokens);
-
-    tree = Parse(tokens, errmsg, sizeof(errmsg));
+    // The tree is owned by the cache; a repeated expression skips
+    // tokenizing and parsing altogether
+    tree = PC_parse(s.cache, input, errmsg, sizeof(errmsg));
 
     if (tree == NULL) {
-      fprintf(stderr, "%s\n", errmsg);
+      if (*errmsg != '\0')
+        fprintf(stderr, "%s\n", errmsg);
       goto loop_end;
     }
 
     ET_tree2string(tree, expr_buf, sizeof(expr_buf));
-    
-    double result = ET_evaluate(tree, dict, errmsg, sizeof(errmsg));
-    if (*errmsg != '\0') { // Error handling
+
+    // Integer results are printed exactly, however large
+    ETNumber result;
+    const UserFunc *defined;
+    if (!evaluate_tree(&s, tree, &result, &defined, errmsg, sizeof(errmsg))) {
       fprintf(stderr, "Error: %s\n", errmsg);
+    } else if (defined) {
+      printf("Defined %s\n", defined->name);
+    } else if (result.array) {
+      printf("%s  ==> ", expr_buf);
+      print_array(result.array);
+    } else if (result.is_int) {
+      printf("%s  ==> %" PRId64 "\n", expr_buf, result.i);
     } else {
-      printf("%s  ==> %g\n", expr_buf, result);
+      printf("%s  ==> %g\n", expr_buf, result.d);
     }
+    AR_release(result.array);
 
   loop_end:
     free(input);
     input = NULL;
-    CL_free(tokens);
-    tokens = NULL;
-    ET_free(tree);
     tree = NULL;
   }
   
-  //TODO: Free the dictionary
+  PC_free(s.cache);
+  MO_free(s.model);
+  MC_free(s.memo);
+  SH_free(s.sheet);
+  FT_free(s.funcs);
+  CD_free(s.dict);
   return 0;
 }
@@ -0,0 +1,322 @@
+/*
+ * fastmath.h
+ *
+ * Relaxed-accuracy replacements for pow() and the exp() and log() it
+ * is built from. They are polynomial approximations with no table
+ * lookups, no calls and no data-dependent branches on the common path,
+ * so that a loop applying them to an array can be vectorized by the
+ * compiler. They are defined here, inline, for that reason.
+ *
+ * Error bounds, measured by ew_bench against libm over the ranges it
+ * reports, with ulp(r) the spacing of doubles at the correct result r:
+ *
+ *   FM_log(x)         x > 0, finite:             at most 2 ulp
+ *   FM_exp(t)         |t| < 708:                 at most 1 ulp
+ *   FM_pow(x, y)      y in {0, 1, 2, -1, 0.5}:   exact (correctly rounded)
+ *                     y in {3, 4, -2}:           at most 2 ulp
+ *                     otherwise:                 at most 2 + 3 |y ln x| ulp
+ *
+ * The last bound grows with |y ln x| because the rounding error of
+ * y * ln(x) is magnified by exp(); results near the overflow limit can
+ * be off by a couple of thousand ulp, a relative error of about 2e-13.
+ * Subnormal results are rounded coarsely. Special values (x <= 0, infinities, NaNs) are
+ * handed to libm pow(), and give exactly its results.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _FASTMATH_H_
+#define _FASTMATH_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#define FM_LN2_HI 6.93147180369123816490e-01   // ln 2, top 32 bits
+#define FM_LN2_LO 1.90821492927058770002e-10   // ln 2 - FM_LN2_HI
+#define FM_INV_LN2 1.44269504088896338700e+00
+#define FM_SQRT2 1.41421356237309514547e+00
+#define FM_ROUND_MAGIC 6755399441055744.0      // 1.5 * 2^52
+
+// Always inlined, so that each caller gets a copy compiled for its own
+// instruction set (see FM_CLONES)
+#ifdef __GNUC__
+#define FM_INLINE static inline __attribute__((always_inline))
+#else
+#define FM_INLINE static inline
+#endif
+
+// For the loops that apply these functions to arrays: on x86-64 they
+// are also compiled for AVX2 and FMA, which doubles the rows per
+// instruction, and the best version for the running CPU is chosen at
+// load time
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define FM_CLONES __attribute__((target_clones("arch=x86-64-v3", "default")))
+#else
+#define FM_CLONES
+#endif
+
+FM_INLINE uint64_t _FM_bits(double d)
+{
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+FM_INLINE double _FM_double(uint64_t u)
+{
+  double d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+/*
+ * Is x in the domain of FM_log, i.e., positive, normal and finite?
+ * Like FM_POW_ORDINARY below, this is a macro so that it vectorizes.
+ */
+#define FM_LOG_ORDINARY(x) \
+  (((x) >= 2.2250738585072014e-308) & ((x) <= 1.7976931348623157e308))
+
+/*
+ * Natural log of a positive, finite, normal x
+ *
+ * x is split as m * 2^e with m in [sqrt(1/2), sqrt(2)), and
+ * log(m) = 2 atanh(s), s = (m-1)/(m+1), from its odd series in s.
+ * With |s| < 0.172 the series through s^21 is accurate to 2^-60.
+ */
+FM_INLINE double FM_log(double x)
+{
+  // the exponent field, converted to double by placing it in the
+  // mantissa of 2^52 (integer<->double conversions do not vectorize)
+  uint64_t bits = _FM_bits(x);
+  double e = _FM_double((bits >> 52) | 0x4330000000000000ULL) - (4503599627370496.0 + 1023);
+  double m = _FM_double((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+
+  bool high = m > FM_SQRT2;
+  m = high ? m * 0.5 : m;
+  e = high ? e + 1 : e;
+
+  double s = (m - 1) / (m + 1);
+  double z = s * s;
+  double p = 1.0 / 21;
+  p = p * z + 1.0 / 19;
+  p = p * z + 1.0 / 17;
+  p = p * z + 1.0 / 15;
+  p = p * z + 1.0 / 13;
+  p = p * z + 1.0 / 11;
+  p = p * z + 1.0 / 9;
+  p = p * z + 1.0 / 7;
+  p = p * z + 1.0 / 5;
+  p = p * z + 1.0 / 3;
+
+  // 2s + 2s*z*p, adding the small terms first
+  double log_m = 2 * s + 2 * s * z * p;
+  return e * FM_LN2_HI + (e * FM_LN2_LO + log_m);
+}
+
+/*
+ * e^t for finite t. Arguments beyond the double range give infinity
+ * or zero.
+ *
+ * t = k ln2 + r with |r| <= ln2/2; e^r comes from its Taylor series
+ * through r^13, and 2^k is built directly in the exponent bits, as
+ * two factors so that k may reach subnormal range.
+ */
+FM_INLINE double FM_exp(double t)
+{
+  t = t > 710 ? 710 : t;
+  t = t < -746 ? -746 : t;
+
+  // adding FM_ROUND_MAGIC rounds to an integer k, which can then be
+  // read from the low bits as well as by subtracting it back
+  double kd = t * FM_INV_LN2 + FM_ROUND_MAGIC;
+  double k = kd - FM_ROUND_MAGIC;
+  double r = (t - k * FM_LN2_HI) - k * FM_LN2_LO;
+
+  double p = 1.0 / 6227020800;   // 1/13!
+  p = p * r + 1.0 / 479001600;
+  p = p * r + 1.0 / 39916800;
+  p = p * r + 1.0 / 3628800;
+  p = p * r + 1.0 / 362880;
+  p = p * r + 1.0 / 40320;
+  p = p * r + 1.0 / 5040;
+  p = p * r + 1.0 / 720;
+  p = p * r + 1.0 / 120;
+  p = p * r + 1.0 / 24;
+  p = p * r + 1.0 / 6;
+  p = p * r + 0.5;
+  p = p * r * r + r;
+  p = p + 1;
+
+  // k1 = floor(k/2) and k2 = k - k1, each biased by 1023, in unsigned
+  // arithmetic only
+  uint64_t ki = _FM_bits(kd) - _FM_bits(FM_ROUND_MAGIC);
+  uint64_t k1 = ((ki + 2048) >> 1) - 1024 + 1023;
+  uint64_t k2 = ki - k1 + 2 * 1023;
+  return p * _FM_double(k1 << 52) * _FM_double(k2 << 52);
+}
+
+/*
+ * Does FM_pow_core give a usable answer for these operands, i.e., is
+ * x positive, normal and finite, and y finite? If not, FM_pow hands
+ * them to libm. This is a macro, written with & rather than &&,
+ * because the vectorizer handles it inline but not as a function
+ * returning bool.
+ */
+#define FM_POW_ORDINARY(x, y) \
+  (FM_LOG_ORDINARY(x) & (fabs(y) <= 1.7976931348623157e308))
+
+/*
+ * x^y for operands that pass FM_POW_ORDINARY. Small
+ * integer exponents and square roots are computed directly; the
+ * rest as e^(y ln x).
+ */
+FM_INLINE double FM_pow_core(double x, double y)
+{
+  // every candidate is computed, so that choosing one is a select
+  // rather than a branch
+  double general = FM_exp(y * FM_log(x));
+  double x2 = x * x;
+  double x3 = x2 * x;
+  double x4 = x2 * x2;
+  double inv = 1 / x;
+  double inv2 = 1 / x2;
+  double root = sqrt(x);
+
+  double r = general;
+  r = (y == 0.5) ? root : r;
+  r = (y == -2) ? inv2 : r;
+  r = (y == -1) ? inv : r;
+  r = (y == 4) ? x4 : r;
+  r = (y == 3) ? x3 : r;
+  r = (y == 2) ? x2 : r;
+  r = (y == 1) ? x : r;
+  r = (y == 0) ? 1 : r;
+  return r;
+}
+
+/*
+ * Relaxed-accuracy pow(), with the error bounds given above
+ */
+FM_INLINE double FM_pow(double x, double y)
+{
+  if (!FM_POW_ORDINARY(x, y))
+    return pow(x, y);
+  return FM_pow_core(x, y);
+}
+
+/*
+ * Single-precision versions, for EW_execute_batch_f32. They follow
+ * the double versions with shorter polynomials and float bit layouts,
+ * and their bounds are in float ulps:
+ *
+ *   FM_logf(x)        x > 0, finite:             at most 2 ulp
+ *   FM_expf(t)        |t| < 87:                  at most 2 ulp
+ *   FM_powf(x, y)     y in {0, 1, 2, -1, 0.5}:   exact (correctly rounded)
+ *                     y in {3, 4, -2}:           at most 2 ulp
+ *                     otherwise:                 at most 2 + 3 |y ln x| ulp
+ */
+
+#define FM_LN2_HI_F 6.93145751953125e-01f      // ln 2, top 12 bits
+#define FM_LN2_LO_F 1.42860676533018704e-06f   // ln 2 - FM_LN2_HI_F
+#define FM_ROUND_MAGIC_F 12582912.0f            // 1.5 * 2^23
+
+FM_INLINE uint32_t _FM_bitsf(float f)
+{
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+FM_INLINE float _FM_float(uint32_t u)
+{
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+FM_INLINE float FM_logf(float x)
+{
+  uint32_t bits = _FM_bitsf(x);
+  float e = _FM_float((bits >> 23) | 0x4b000000U) - (8388608.0f + 127);
+  float m = _FM_float((bits & 0x007fffffU) | 0x3f800000U);
+
+  bool high = m > (float)FM_SQRT2;
+  m = high ? m * 0.5f : m;
+  e = high ? e + 1 : e;
+
+  // |s| < 0.172, so the series through s^11 is accurate to 2^-28
+  float s = (m - 1) / (m + 1);
+  float z = s * s;
+  float p = 1.0f / 11;
+  p = p * z + 1.0f / 9;
+  p = p * z + 1.0f / 7;
+  p = p * z + 1.0f / 5;
+  p = p * z + 1.0f / 3;
+
+  float log_m = 2 * s + 2 * s * z * p;
+  return e * FM_LN2_HI_F + (e * FM_LN2_LO_F + log_m);
+}
+
+FM_INLINE float FM_expf(float t)
+{
+  t = t > 89 ? 89 : t;
+  t = t < -104 ? -104 : t;
+
+  float kd = t * (float)FM_INV_LN2 + FM_ROUND_MAGIC_F;
+  float k = kd - FM_ROUND_MAGIC_F;
+  float r = (t - k * FM_LN2_HI_F) - k * FM_LN2_LO_F;
+
+  // |r| <= ln2/2, so the series through r^7 is accurate to 2^-28
+  float p = 1.0f / 5040;
+  p = p * r + 1.0f / 720;
+  p = p * r + 1.0f / 120;
+  p = p * r + 1.0f / 24;
+  p = p * r + 1.0f / 6;
+  p = p * r + 0.5f;
+  p = p * r * r + r;
+  p = p + 1;
+
+  uint32_t ki = _FM_bitsf(kd) - _FM_bitsf(FM_ROUND_MAGIC_F);
+  uint32_t k1 = ((ki + 256) >> 1) - 128 + 127;
+  uint32_t k2 = ki - k1 + 2 * 127;
+  return p * _FM_float(k1 << 23) * _FM_float(k2 << 23);
+}
+
+#define FM_LOGF_ORDINARY(x) \
+  (((x) >= 1.17549435e-38f) & ((x) <= 3.40282347e+38f))
+
+#define FM_POWF_ORDINARY(x, y) \
+  (FM_LOGF_ORDINARY(x) & (fabsf(y) <= 3.40282347e+38f))
+
+FM_INLINE float FM_powf_core(float x, float y)
+{
+  float general = FM_expf(y * FM_logf(x));
+  float x2 = x * x;
+  float x3 = x2 * x;
+  float x4 = x2 * x2;
+  float inv = 1 / x;
+  float inv2 = 1 / x2;
+  float root = sqrtf(x);
+
+  float r = general;
+  r = (y == 0.5f) ? root : r;
+  r = (y == -2) ? inv2 : r;
+  r = (y == -1) ? inv : r;
+  r = (y == 4) ? x4 : r;
+  r = (y == 3) ? x3 : r;
+  r = (y == 2) ? x2 : r;
+  r = (y == 1) ? x : r;
+  r = (y == 0) ? 1 : r;
+  return r;
+}
+
+FM_INLINE float FM_powf(float x, float y)
+{
+  if (!FM_POWF_ORDINARY(x, y))
+    return powf(x, y);
+  return FM_powf_core(x, y);
+}
+
+#endif /* _FASTMATH_H_ */
@@ -0,0 +1,453 @@
+/*
+ * functions.c
+ *
+ * User-defined functions: definition, lookup and inlining
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "functions.h"
+
+// Every definition ever made, in order; the current definition of a
+// name is the last one with that name
+struct _func_table
+{
+  UserFunc **def;
+  int num_defs;
+  int cap;
+};
+
+// State for resolving the calls in one tree
+typedef struct
+{
+  FuncTable ft;
+  UserFunc *self;            // the function being defined, if any
+  char **param;              // ...and the names of its parameters
+  char *errmsg;
+  size_t errmsg_sz;
+  bool failed;
+} FTResolver;
+
+static void _FT_free_func(UserFunc *fn)
+{
+  free(fn->name);
+  ET_free(fn->body);
+  for (int i = 0; i < fn->num_symbols; i++)
+    free(fn->symbol[i]);
+  free(fn->symbol);
+  free(fn->assigned);
+  free(fn);
+}
+
+// Documented in .h file
+FuncTable FT_new(void)
+{
+  FuncTable ft = calloc(1, sizeof(struct _func_table));
+  assert(ft);
+  return ft;
+}
+
+// Documented in .h file
+void FT_free(FuncTable ft)
+{
+  if (!ft)
+    return;
+
+  for (int i = 0; i < ft->num_defs; i++)
+    _FT_free_func(ft->def[i]);
+  free(ft->def);
+  free(ft);
+}
+
+// Documented in .h file
+const UserFunc *FT_lookup(FuncTable ft, const char *name)
+{
+  assert(ft);
+  assert(name);
+
+  for (int i = ft->num_defs - 1; i >= 0; i--)
+    if (strcmp(ft->def[i]->name, name) == 0)
+      return ft->def[i];
+
+  return NULL;
+}
+
+/*
+ * Return a copy of tree, which lies within depth ranges of the body,
+ * with PARAM(i) replaced by a copy of args[i]. The arguments
+ * themselves are not descended into, since their PARAM nodes, if any,
+ * belong to the calling function; the indexes they use are shifted
+ * past the ranges they are placed in.
+ */
+static ExprTree _FT_substitute(ExprTree tree, ExprTree *args, int depth)
+{
+  if (tree == NULL)
+    return NULL;
+
+  switch (ET_type(tree))
+  {
+  case PARAM:
+    return ET_shift_indexes(args[ET_param_index(tree)], depth);
+
+  case VALUE:
+  case SYMBOL:
+  case RANGE_INDEX:
+    return ET_copy(tree);
+
+  case ARRAY_LITERAL:
+  {
+    ExprTree *sub = malloc(ET_num_args(tree) * sizeof(ExprTree) + 1);
+    assert(sub);
+    for (int i = 0; i < ET_num_args(tree); i++)
+      sub[i] = _FT_substitute(ET_arg(tree, i), args, depth);
+    ExprTree array = ET_array_literal(sub, ET_num_args(tree));
+    free(sub);
+    return array;
+  }
+
+  case RANGE_SUM:
+  case RANGE_PROD:
+    return ET_range(ET_type(tree), ET_index_name(tree),
+                    _FT_substitute(ET_arg(tree, 0), args, depth),
+                    _FT_substitute(ET_arg(tree, 1), args, depth),
+                    _FT_substitute(ET_arg(tree, 2), args, depth + 1));
+
+  case FUNC_CALL:
+  case USER_CALL:
+  {
+    ExprTree sub[ET_MAX_ARGS];
+    for (int i = 0; i < ET_num_args(tree); i++)
+      sub[i] = _FT_substitute(ET_arg(tree, i), args, depth);
+    if (ET_type(tree) == FUNC_CALL)
+      return ET_call(ET_call_function(tree), sub);
+    return ET_user_call(ET_call_name(tree), ET_user_function(tree), sub, ET_num_args(tree));
+  }
+
+  default:
+    return ET_node(ET_type(tree), _FT_substitute(ET_child(tree, 0), args, depth),
+                   _FT_substitute(ET_child(tree, 1), args, depth));
+  }
+}
+
+static void _FT_free_args(ExprTree *args, int num_args)
+{
+  for (int i = 0; i < num_args; i++)
+    ET_free(args[i]);
+}
+
+static ExprTree _FT_resolve(FTResolver *r, ExprTree tree);
+
+/*
+ * Resolve a USER_CALL whose arguments have already been resolved into
+ * args, taking ownership of them
+ */
+static ExprTree _FT_resolve_call(FTResolver *r, ExprTree tree, ExprTree *args)
+{
+  const char *name = ET_call_name(tree);
+  int num_args = ET_num_args(tree);
+  const UserFunc *fn = ET_user_function(tree);
+
+  if (fn == NULL && r->self && strcmp(name, r->self->name) == 0)
+  {
+    fn = r->self;
+    r->self->recursive = true;
+  }
+  else if (fn == NULL)
+    fn = FT_lookup(r->ft, name);
+
+  if (fn == NULL)
+  {
+    snprintf(r->errmsg, r->errmsg_sz, "Unknown function: %s", name);
+    r->failed = true;
+    _FT_free_args(args, num_args);
+    return NULL;
+  }
+
+  if (num_args != fn->num_params)
+  {
+    snprintf(r->errmsg, r->errmsg_sz, "Function %s takes %d argument%s",
+             name, fn->num_params, fn->num_params == 1 ? "" : "s");
+    r->failed = true;
+    _FT_free_args(args, num_args);
+    return NULL;
+  }
+
+  // Substituting an argument that assigns a variable would repeat or
+  // drop the assignment, so such calls stay calls
+  bool inline_ok = fn != r->self && !fn->recursive;
+  for (int i = 0; i < num_args; i++)
+    inline_ok = inline_ok && ET_is_pure(args[i]);
+
+  if (!inline_ok)
+    return ET_user_call(name, fn, args, num_args);
+
+  ExprTree body = _FT_substitute(fn->body, args, 0);
+  _FT_free_args(args, num_args);
+  return body;
+}
+
+/*
+ * Return a copy of tree with its calls inlined or bound, and, within
+ * a definition, its parameters turned into PARAM nodes. On error,
+ * r->failed is set and the result is to be discarded.
+ */
+static ExprTree _FT_resolve(FTResolver *r, ExprTree tree)
+{
+  if (tree == NULL || r->failed)
+    return NULL;
+
+  switch (ET_type(tree))
+  {
+  case VALUE:
+  case PARAM:
+  case RANGE_INDEX:
+    return ET_copy(tree);
+
+  case SYMBOL:
+    if (r->self)
+      for (int i = 0; i < r->self->num_params; i++)
+        if (strcmp(r->param[i], ET_symbol_name(tree)) == 0)
+          return ET_param(i);
+    return ET_copy(tree);
+
+  case FUNC_DEF:
+    snprintf(r->errmsg, r->errmsg_sz, "Error: Function definition within an expression");
+    r->failed = true;
+    return NULL;
+
+  case OP_ASSIGN:
+  {
+    ExprTree target = ET_child(tree, 0);
+    if (r->self && ET_type(target) == SYMBOL)
+      for (int i = 0; i < r->self->num_params; i++)
+        if (strcmp(r->param[i], ET_symbol_name(target)) == 0)
+        {
+          snprintf(r->errmsg, r->errmsg_sz, "Cannot assign to parameter %s of %s",
+                   r->param[i], r->self->name);
+          r->failed = true;
+          return NULL;
+        }
+
+    ExprTree value = _FT_resolve(r, ET_child(tree, 1));
+    if (r->failed)
+      return NULL;
+    return ET_node(OP_ASSIGN, ET_copy(target), value);
+  }
+
+  case ARRAY_LITERAL:
+  {
+    int num_elems = ET_num_args(tree);
+    ExprTree *elems = malloc(num_elems * sizeof(ExprTree) + 1);
+    assert(elems);
+    for (int i = 0; i < num_elems; i++)
+    {
+      elems[i] = _FT_resolve(r, ET_arg(tree, i));
+      if (r->failed)
+      {
+        _FT_free_args(elems, i);
+        free(elems);
+        return NULL;
+      }
+    }
+    ExprTree array = ET_array_literal(elems, num_elems);
+    free(elems);
+    return array;
+  }
+
+  case RANGE_SUM:
+  case RANGE_PROD:
+  case FUNC_CALL:
+  case USER_CALL:
+  {
+    ExprTree args[ET_MAX_ARGS];
+    int num_args = ET_num_args(tree);
+    for (int i = 0; i < num_args; i++)
+    {
+      args[i] = _FT_resolve(r, ET_arg(tree, i));
+      if (r->failed)
+      {
+        _FT_free_args(args, i);
+        return NULL;
+      }
+    }
+
+    if (ET_type(tree) == RANGE_SUM || ET_type(tree) == RANGE_PROD)
+      return ET_range(ET_type(tree), ET_index_name(tree), args[0], args[1], args[2]);
+    if (ET_type(tree) == FUNC_CALL)
+      return ET_call(ET_call_function(tree), args);
+    return _FT_resolve_call(r, tree, args);
+  }
+
+  default:
+  {
+    ExprTree left = _FT_resolve(r, ET_child(tree, 0));
+    ExprTree right = _FT_resolve(r, ET_child(tree, 1));
+    if (r->failed)
+    {
+      ET_free(left);
+      ET_free(right);
+      return NULL;
+    }
+    return ET_node(ET_type(tree), left, right);
+  }
+  }
+}
+
+/*
+ * Is the body of self free of assignments? Its calls to itself do
+ * not count against it.
+ */
+static bool _FT_is_pure(ExprTree tree, const UserFunc *self)
+{
+  if (tree == NULL)
+    return true;
+
+  switch (ET_type(tree))
+  {
+  case VALUE:
+  case SYMBOL:
+  case PARAM:
+  case RANGE_INDEX:
+    return true;
+
+  case OP_ASSIGN:
+    return false;
+
+  case FUNC_CALL:
+  case USER_CALL:
+  case ARRAY_LITERAL:
+  case RANGE_SUM:
+  case RANGE_PROD:
+    if (ET_type(tree) == USER_CALL && ET_user_function(tree) != self &&
+        !ET_user_function(tree)->pure)
+      return false;
+    for (int i = 0; i < ET_num_args(tree); i++)
+      if (!_FT_is_pure(ET_arg(tree, i), self))
+        return false;
+    return true;
+
+  default:
+    return _FT_is_pure(ET_child(tree, 0), self) && _FT_is_pure(ET_child(tree, 1), self);
+  }
+}
+
+static void _FT_record_symbol(const char *symbol, bool assigned, void *cb_data)
+{
+  UserFunc *fn = cb_data;
+
+  for (int i = 0; i < fn->num_symbols; i++)
+    if (strcmp(fn->symbol[i], symbol) == 0)
+    {
+      fn->assigned[i] = fn->assigned[i] || assigned;
+      return;
+    }
+
+  fn->symbol = realloc(fn->symbol, (fn->num_symbols + 1) * sizeof(char *));
+  fn->assigned = realloc(fn->assigned, (fn->num_symbols + 1) * sizeof(bool));
+  assert(fn->symbol && fn->assigned);
+  fn->symbol[fn->num_symbols] = strdup(symbol);
+  assert(fn->symbol[fn->num_symbols]);
+  fn->assigned[fn->num_symbols] = assigned;
+  fn->num_symbols++;
+}
+
+// Documented in .h file
+const UserFunc *FT_define(FuncTable ft, ExprTree def, char *errmsg, size_t errmsg_sz)
+{
+  assert(ft);
+  assert(def && ET_type(def) == FUNC_DEF);
+
+  ExprTree pattern = ET_child(def, 0);
+  assert(ET_type(pattern) == USER_CALL);
+
+  UserFunc *fn = calloc(1, sizeof(UserFunc));
+  assert(fn);
+  fn->name = strdup(ET_call_name(pattern));
+  assert(fn->name);
+  fn->num_params = ET_num_args(pattern);
+
+  char *param[ET_MAX_ARGS];
+  for (int i = 0; i < fn->num_params; i++)
+  {
+    assert(ET_type(ET_arg(pattern, i)) == SYMBOL);
+    param[i] = (char *)ET_symbol_name(ET_arg(pattern, i));
+  }
+
+  // fn is not yet pure, so that calls to itself are bound, not inlined
+  FTResolver r = {ft, fn, param, errmsg, errmsg_sz, false};
+  fn->body = _FT_resolve(&r, ET_child(def, 1));
+  if (r.failed)
+  {
+    _FT_free_func(fn);
+    return NULL;
+  }
+
+  fn->pure = _FT_is_pure(fn->body, fn);
+  ET_foreach_symbol(fn->body, _FT_record_symbol, fn);
+
+  if (ft->num_defs == ft->cap)
+  {
+    ft->cap = ft->cap ? ft->cap * 2 : 8;
+    ft->def = realloc(ft->def, ft->cap * sizeof(UserFunc *));
+    assert(ft->def);
+  }
+  ft->def[ft->num_defs++] = fn;
+
+  return fn;
+}
+
+// Documented in .h file
+ExprTree FT_inline(FuncTable ft, ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  assert(ft);
+
+  FTResolver r = {ft, NULL, NULL, errmsg, errmsg_sz, false};
+  ExprTree result = _FT_resolve(&r, tree);
+  return r.failed ? NULL : result;
+}
+
+static void _FT_collect_called(ExprTree tree, const UserFunc ***funcs, int *num_funcs)
+{
+  if (tree == NULL || ET_type(tree) == VALUE || ET_type(tree) == SYMBOL ||
+      ET_type(tree) == PARAM || ET_type(tree) == RANGE_INDEX)
+    return;
+
+  if (ET_type(tree) != FUNC_CALL && ET_type(tree) != USER_CALL &&
+      ET_type(tree) != ARRAY_LITERAL && ET_type(tree) != RANGE_SUM &&
+      ET_type(tree) != RANGE_PROD)
+  {
+    _FT_collect_called(ET_child(tree, 0), funcs, num_funcs);
+    _FT_collect_called(ET_child(tree, 1), funcs, num_funcs);
+    return;
+  }
+
+  for (int i = 0; i < ET_num_args(tree); i++)
+    _FT_collect_called(ET_arg(tree, i), funcs, num_funcs);
+
+  const UserFunc *fn = ET_type(tree) == USER_CALL ? ET_user_function(tree) : NULL;
+  if (fn == NULL)
+    return;
+
+  for (int i = 0; i < *num_funcs; i++)
+    if ((*funcs)[i] == fn)
+      return;
+
+  *funcs = realloc(*funcs, (*num_funcs + 1) * sizeof(UserFunc *));
+  assert(*funcs);
+  (*funcs)[(*num_funcs)++] = fn;
+  _FT_collect_called(fn->body, funcs, num_funcs);
+}
+
+// Documented in .h file
+const UserFunc **FT_called(ExprTree tree, int *num_funcs)
+{
+  const UserFunc **funcs = NULL;
+  *num_funcs = 0;
+  _FT_collect_called(tree, &funcs, num_funcs);
+  return funcs;
+}
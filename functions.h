@@ -0,0 +1,140 @@
+/*
+ * functions.h
+ *
+ * User-defined functions. A definition such as
+ *
+ *   f(x, y) = a * x + y ^ 2
+ *
+ * is parsed into a FUNC_DEF tree and stored in a FuncTable as a
+ * parameterized ExprTree: its parameters become PARAM nodes, and the
+ * other symbols in it remain global variables.
+ *
+ * Before an expression is compiled or evaluated, FT_inline replaces
+ * each call with a copy of the function body, the arguments
+ * substituted for the parameters, so that constant folding and common
+ * subexpression caching see through the call. A call that cannot be
+ * inlined -- to a recursive function, or with an argument that
+ * assigns a variable -- is instead bound to the function and
+ * evaluated as a real call.
+ *
+ * Calls in a body are resolved when the function is defined, so
+ * redefining a function affects only what is defined or inlined after
+ * it. A function calling itself is recursive; since the functions it
+ * calls must already be defined, recursion through several functions
+ * cannot occur.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _FUNCTIONS_H_
+#define _FUNCTIONS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "expr_tree.h"
+
+struct _user_func
+{
+  char *name;
+  int num_params;
+  ExprTree body;            // parameters appear as PARAM nodes
+  bool recursive;           // does the body call the function itself?
+  bool pure;                // is the body free of assignments?
+
+  // The global variables the body reads and assigns, including through
+  // the functions it calls, as reported by ET_foreach_symbol
+  char **symbol;
+  bool *assigned;
+  int num_symbols;
+};
+
+typedef struct _func_table *FuncTable;
+
+
+/*
+ * Create a new, empty function table
+ *
+ * Parameters: None
+ *
+ * Returns: The new table. It is up to the caller to call FT_free.
+ */
+FuncTable FT_new(void);
+
+
+/*
+ * Free a function table and every function defined in it. Trees
+ * holding calls bound to its functions must not be used afterwards.
+ *
+ * Parameters:
+ *   ft       The table; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void FT_free(FuncTable ft);
+
+
+/*
+ * Define a function, or redefine one. A function it replaces stays
+ * allocated until FT_free, so that calls already bound to it remain
+ * valid.
+ *
+ * Parameters:
+ *   ft         The table
+ *   def        A FUNC_DEF tree, as returned by Parse; it is not
+ *              modified, and the caller retains ownership of it
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The new function, or NULL (with an error message copied
+ *   into errmsg) if the body calls a function that is not defined or
+ *   passes the wrong number of arguments
+ */
+const UserFunc *FT_define(FuncTable ft, ExprTree def, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Find a function by name
+ *
+ * Parameters:
+ *   ft       The table
+ *   name     The function name
+ *
+ * Returns: Its current definition, or NULL if there is none
+ */
+const UserFunc *FT_lookup(FuncTable ft, const char *name);
+
+
+/*
+ * Return a copy of a tree with every call of a user-defined function
+ * inlined or bound, as described above
+ *
+ * Parameters:
+ *   ft         The table
+ *   tree       The tree; it is not modified
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The new tree, which it is up to the caller to ET_free, or
+ *   NULL (with an error message copied into errmsg) if the tree calls
+ *   a function that is not defined, passes the wrong number of
+ *   arguments, or contains a FUNC_DEF
+ */
+ExprTree FT_inline(FuncTable ft, ExprTree tree, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * List the distinct functions that a tree calls through bound
+ * USER_CALL nodes, directly or from within the bodies of the
+ * functions it calls
+ *
+ * Parameters:
+ *   tree       The tree
+ *   num_funcs  Return space for the number of functions
+ *
+ * Returns: A malloc'd array of the functions, which it is up to the
+ *   caller to free; NULL if there are none
+ */
+const UserFunc **FT_called(ExprTree tree, int *num_funcs);
+
+
+#endif /* _FUNCTIONS_H_ */
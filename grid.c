@@ -0,0 +1,239 @@
+/*
+ * grid.c
+ *
+ * Tabulation of compiled expressions over grids, a tile at a time
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "grid.h"
+#include "prepared.h"
+
+// The most points a grid has
+#define GR_MAX_POINTS 1e15
+
+// The longest number written by "%.17g", with its separator
+#define GR_NUMBER_LEN 26
+
+typedef struct
+{
+  const char *var;
+  bool assigned;
+} GRAssigned;
+
+static void _GR_assigned(const char *symbol, bool assigned, void *cb_data)
+{
+  GRAssigned *a = cb_data;
+  if (assigned && strcmp(symbol, a->var) == 0)
+    a->assigned = true;
+}
+
+// The value of an axis at index i, with its ends exact
+static inline double _GR_coord(const GRAxis *ax, long i)
+{
+  if (ax->n == 1)
+    return ax->lo;
+  return i == ax->n - 1 ? ax->hi : ax->lo + (ax->hi - ax->lo) * i / (ax->n - 1);
+}
+
+/*
+ * Fill in the coordinates of the next rows points, and advance to the
+ * point after them. The last axis runs through its values fastest,
+ * while each other axis holds one value over a run of them.
+ *
+ * Parameters:
+ *   axes, num_axes  The axes
+ *   index           The index along each axis of the first point,
+ *                   advanced past the last
+ *   rows            The number of points
+ *   tile            Return space for each axis's coordinates
+ *
+ * Returns: None
+ */
+static void _GR_fill(const GRAxis *axes, int num_axes, long *index, int rows,
+                     double *const *tile)
+{
+  int last = num_axes - 1;
+  for (int r = 0; r < rows;)
+  {
+    long left = axes[last].n - index[last];
+    int run = left < rows - r ? (int)left : rows - r;
+    for (int i = 0; i < run; i++)
+      tile[last][r + i] = _GR_coord(&axes[last], index[last] + i);
+    for (int a = 0; a < last; a++)
+    {
+      double value = _GR_coord(&axes[a], index[a]);
+      for (int i = r; i < r + run; i++)
+        tile[a][i] = value;
+    }
+    r += run;
+
+    index[last] += run;
+    for (int a = last; a > 0 && index[a] == axes[a].n; a--)
+    {
+      index[a] = 0;
+      index[a - 1]++;
+    }
+  }
+}
+
+// The text of each axis's coordinate at the last point written, which
+// the axes other than the last keep over whole runs of points
+typedef struct
+{
+  double value[GR_MAX_AXES];
+  char text[GR_MAX_AXES][GR_NUMBER_LEN + 1];
+  int len[GR_MAX_AXES];
+} GRText;
+
+// Write one tile of a table; returns false if writing fails
+static bool _GR_write(FILE *out, GRFormat format, int num_axes, double *const *tile,
+                      const double *results, int rows, GRText *prev, char *text)
+{
+  if (format == GR_BINARY)
+    return fwrite(results, sizeof(double), rows, out) == (size_t)rows;
+
+  // the tile is formatted into one buffer, and written at once; NaN is
+  // written without the sign some printfs give it
+  char *end = text;
+  for (int i = 0; i < rows; i++)
+  {
+    for (int a = 0; a < num_axes; a++)
+    {
+      if (tile[a][i] != prev->value[a] || prev->len[a] == 0)
+      {
+        prev->value[a] = tile[a][i];
+        prev->len[a] = sprintf(prev->text[a], "%.17g ", tile[a][i]);
+      }
+      memcpy(end, prev->text[a], prev->len[a]);
+      end += prev->len[a];
+    }
+    end += isnan(results[i]) ? sprintf(end, "nan\n") : sprintf(end, "%.17g\n", results[i]);
+  }
+  return fwrite(text, 1, end - text, out) == (size_t)(end - text);
+}
+
+// Documented in .h file
+long GR_tabulate(ExprTree tree, const GRAxis *axes, int num_axes, CDict vars, FILE *out,
+                 GRFormat format, char *errmsg, size_t errmsg_sz)
+{
+  if (num_axes < 1 || num_axes > GR_MAX_AXES)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: A grid has 1 to %d variables", GR_MAX_AXES);
+    return -1;
+  }
+  double points = 1;
+  for (int a = 0; a < num_axes; a++)
+  {
+    if (axes[a].n < 1 || !isfinite(axes[a].lo) || !isfinite(axes[a].hi))
+    {
+      snprintf(errmsg, errmsg_sz, "Error: Invalid range for %s", axes[a].var);
+      return -1;
+    }
+    for (int b = 0; b < a; b++)
+      if (strcmp(axes[a].var, axes[b].var) == 0)
+      {
+        snprintf(errmsg, errmsg_sz, "Error: %s is given twice", axes[a].var);
+        return -1;
+      }
+    points *= axes[a].n;
+  }
+  if (points > GR_MAX_POINTS)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Grid is too large");
+    return -1;
+  }
+
+  Prepared p = EW_compile(tree, errmsg, errmsg_sz);
+  if (p == NULL)
+    return -1;
+
+  // a variable that is neither an axis nor set, nor assigned before it
+  // is read, would make every point an error
+  int num_vars = EW_num_vars(p);
+  int axis_of[num_vars + 1];
+  double *values = malloc((num_vars + 1) * sizeof(double));
+  assert(values);
+  EW_bind_dict(p, values, vars);
+  for (int v = 0; v < num_vars; v++)
+  {
+    axis_of[v] = -1;
+    for (int a = 0; a < num_axes; a++)
+      if (strcmp(EW_var_name(p, v), axes[a].var) == 0)
+        axis_of[v] = a;
+    GRAssigned assigned = {EW_var_name(p, v), false};
+    ET_foreach_symbol(tree, _GR_assigned, &assigned);
+    if (axis_of[v] < 0 && isnan(values[v]) && !assigned.assigned)
+    {
+      snprintf(errmsg, errmsg_sz, "Undefined variable: %s", EW_var_name(p, v));
+      free(values);
+      EW_free(p);
+      return -1;
+    }
+  }
+
+  double *tile[GR_MAX_AXES];
+  for (int a = 0; a < num_axes; a++)
+  {
+    tile[a] = malloc(GR_TILE * sizeof(double));
+    assert(tile[a]);
+  }
+
+  double *data = malloc(((size_t)num_vars + 1) * GR_TILE * sizeof(double));
+  char *text = format == GR_TEXT ? malloc((size_t)GR_TILE * (num_axes + 1) * GR_NUMBER_LEN + 1)
+                                 : NULL;
+  assert(data && (text || format != GR_TEXT));
+  double *columns[num_vars + 1];
+  for (int v = 0; v < num_vars; v++)
+    columns[v] = data + (size_t)v * GR_TILE;
+  double *results = data + (size_t)num_vars * GR_TILE;
+
+  bool ok = true;
+  if (format == GR_TEXT)
+  {
+    ok = fputs("#", out) >= 0;
+    for (int a = 0; a < num_axes; a++)
+      ok = ok && fprintf(out, " %s", axes[a].var) >= 0;
+    ok = ok && fputs(" value\n", out) >= 0;
+  }
+
+  long total = (long)points, index[GR_MAX_AXES] = {0};
+  GRText prev = {.len = {0}};
+  for (long first = 0; ok && first < total; first += GR_TILE)
+  {
+    int rows = total - first < GR_TILE ? (int)(total - first) : GR_TILE;
+    _GR_fill(axes, num_axes, index, rows, tile);
+
+    // the other variables are filled in again, as the expression may
+    // assign them
+    for (int v = 0; v < num_vars; v++)
+    {
+      if (axis_of[v] >= 0)
+        memcpy(columns[v], tile[axis_of[v]], rows * sizeof(double));
+      else
+        for (int i = 0; i < rows; i++)
+          columns[v][i] = values[v];
+    }
+
+    char ignored[128] = "";
+    EW_execute_batch(p, columns, rows, results, 0, ignored, sizeof(ignored));
+    ok = _GR_write(out, format, num_axes, tile, results, rows, &prev, text);
+  }
+  ok = ok && fflush(out) == 0;
+  if (!ok)
+    snprintf(errmsg, errmsg_sz, "Error: Could not write the table");
+
+  for (int a = 0; a < num_axes; a++)
+    free(tile[a]);
+  free(text);
+  free(data);
+  free(values);
+  EW_free(p);
+  return ok ? total : -1;
+}
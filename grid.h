@@ -0,0 +1,75 @@
+/*
+ * grid.h
+ *
+ * Tabulation of an expression over a grid of values of one to three
+ * variables, for lookup tables.
+ *
+ * The grid is never held in memory. The points are visited in tiles of
+ * GR_TILE, whose coordinates are computed as the tile is reached; a
+ * tile is evaluated with one call of EW_execute_batch and written out
+ * at once, so memory use depends on the tile size, not on the number
+ * of points.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _GRID_H_
+#define _GRID_H_
+
+#include <stdio.h>
+
+#include "cdict.h"
+#include "expr_tree.h"
+
+// The most variables a grid has
+#define GR_MAX_AXES 3
+
+// The points evaluated and written at once
+#define GR_TILE 1024
+
+typedef enum
+{
+  GR_TEXT,    // a line per point: its coordinates and the value
+  GR_BINARY   // the values alone, as doubles in the machine's byte order
+} GRFormat;
+
+// One variable of a grid: n values evenly spaced from lo to hi
+typedef struct
+{
+  const char *var;
+  double lo, hi;
+  long n;
+} GRAxis;
+
+
+/*
+ * Evaluate an expression at every point of a grid, and write the values
+ * out in order, the last axis varying fastest
+ *
+ * A text table starts with a line naming the columns, after a '#', and
+ * prints the numbers with enough digits to be read back exactly. A
+ * binary one holds the values alone; the grid's shape is up to the
+ * reader. A point at which the expression has an error is written as
+ * NaN.
+ *
+ * Parameters:
+ *   tree       The expression, with calls inlined (see FT_inline); it is
+ *              not modified, and the caller retains ownership of it
+ *   axes       The axes, of distinct variables, each with n >= 1 (with
+ *              n == 1, the variable is lo)
+ *   num_axes   The number of axes, 1 to GR_MAX_AXES
+ *   vars       The values of the other variables
+ *   out        Where to write the table
+ *   format     GR_TEXT or GR_BINARY
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The number of points written, or -1 with an error message
+ *   copied into errmsg if the axes are invalid, the expression cannot
+ *   be compiled or reads a variable with no value, or writing fails
+ */
+long GR_tabulate(ExprTree tree, const GRAxis *axes, int num_axes, CDict vars, FILE *out,
+                 GRFormat format, char *errmsg, size_t errmsg_sz);
+
+
+#endif /* _GRID_H_ */
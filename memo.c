@@ -0,0 +1,339 @@
+/*
+ * memo.c
+ *
+ * Memoization of pure subtree results, keyed by structural hash and
+ * validated against the versions of the variables each subtree read.
+ * The table is direct-mapped: a new entry simply replaces whatever
+ * occupied its slot.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "memo.h"
+#include "array_ops.h"
+
+struct _memo_entry
+{
+  bool used;
+  uint64_t hash;
+  ETNumber value;            // never an array
+  unsigned long clock;       // dictionary clock when last validated
+  int num_vars;
+  char **names;              // variables read by the subtree
+  unsigned long *versions;   // ...and their versions when computed
+};
+
+struct _memo_cache
+{
+  struct _memo_entry *entry;
+  unsigned int mask;
+  CDict vars;                // the dictionary the versions refer to
+  MCStats stats;
+};
+
+static void _MC_clear_entry(struct _memo_entry *e)
+{
+  for (int i = 0; i < e->num_vars; i++)
+    free(e->names[i]);
+  free(e->names);
+  free(e->versions);
+  e->names = NULL;
+  e->versions = NULL;
+  e->num_vars = 0;
+  e->used = false;
+}
+
+/*
+ * Is this subtree worth caching? Leaves are cheaper to evaluate than
+ * to look up, as are most operators applied directly to leaves; the
+ * exceptions are OP_POWER, which calls pow(), and function calls.
+ * (A call to an impure user-defined function is not pure.)
+ */
+static bool _MC_worth_caching(ExprTree tree)
+{
+  ExprNodeType type = ET_type(tree);
+
+  if (type == VALUE || type == SYMBOL || type == ARRAY_LITERAL || !ET_is_pure(tree))
+    return false;
+
+  if (type == OP_POWER || type == FUNC_CALL || type == USER_CALL || type == RANGE_SUM ||
+      type == RANGE_PROD)
+    return true;
+
+  for (int i = 0; i < 2; i++)
+  {
+    ExprTree child = ET_child(tree, i);
+    if (child && ET_type(child) != VALUE && ET_type(child) != SYMBOL)
+      return true;
+  }
+
+  return false;
+}
+
+static void _MC_record_var(const char *symbol, bool assigned, void *cb_data)
+{
+  struct _memo_entry *e = cb_data;
+
+  for (int i = 0; i < e->num_vars; i++)
+    if (strcmp(e->names[i], symbol) == 0)
+      return;
+
+  e->names = realloc(e->names, (e->num_vars + 1) * sizeof(char *));
+  assert(e->names);
+  e->names[e->num_vars] = strdup(symbol);
+  assert(e->names[e->num_vars]);
+  e->num_vars++;
+}
+
+/*
+ * Look for a valid cached result for tree
+ *
+ * Returns: true, with the result in *value, on a hit
+ */
+static bool _MC_lookup(MemoCache memo, ExprTree tree, ETNumber *value)
+{
+  uint64_t hash = ET_hash(tree);
+  struct _memo_entry *e = &memo->entry[hash & memo->mask];
+
+  if (!e->used || e->hash != hash)
+    return false;
+
+  unsigned long clock = CD_clock(memo->vars);
+  if (e->clock != clock)
+  {
+    for (int i = 0; i < e->num_vars; i++)
+      if (CD_version(memo->vars, e->names[i]) != e->versions[i])
+        return false;
+    e->clock = clock;
+  }
+
+  *value = e->value;
+  return true;
+}
+
+static void _MC_insert(MemoCache memo, ExprTree tree, ETNumber value)
+{
+  uint64_t hash = ET_hash(tree);
+  struct _memo_entry *e = &memo->entry[hash & memo->mask];
+
+  if (e->used)
+  {
+    if (e->hash != hash)
+      memo->stats.evictions++;
+    _MC_clear_entry(e);
+    memo->stats.entries--;
+  }
+
+  ET_foreach_symbol(tree, _MC_record_var, e);
+  e->versions = malloc((e->num_vars + 1) * sizeof(unsigned long));
+  assert(e->versions);
+  for (int i = 0; i < e->num_vars; i++)
+    e->versions[i] = CD_version(memo->vars, e->names[i]);
+
+  e->used = true;
+  e->hash = hash;
+  e->value = value;
+  e->clock = CD_clock(memo->vars);
+  memo->stats.entries++;
+}
+
+static ETNumber _MC_int(int64_t i)
+{
+  return (ETNumber){.is_int = true, .i = i};
+}
+
+static double _MC_to_double(ETNumber num)
+{
+  return num.is_int ? (double)num.i : num.d;
+}
+
+// Is a number, not an array, NaN?
+static bool _MC_is_nan(ETNumber num)
+{
+  return !num.is_int && !num.array && isnan(num.d);
+}
+
+// As _ET_eval in expr_tree.c, keeping integers exact and arrays whole
+static ETNumber _MC_eval(MemoCache memo, ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  if (tree == NULL)
+    return _MC_int(0);
+
+  ExprNodeType type = ET_type(tree);
+
+  // Leaves and array literals are left to ET_evaluate_number
+  if (type == VALUE || type == SYMBOL || type == ARRAY_LITERAL)
+    return ET_evaluate_number(tree, memo->vars, errmsg, errmsg_sz);
+
+  if (type == OP_ASSIGN)
+  {
+    ETNumber value = _MC_eval(memo, ET_child(tree, 1), errmsg, errmsg_sz);
+    const char *name = ET_symbol_name(ET_child(tree, 0));
+    if (value.array)
+      CD_store_array(memo->vars, name, value.array);
+    else
+      CD_store(memo->vars, name, _MC_to_double(value));
+    return value;
+  }
+
+  bool cacheable = _MC_worth_caching(tree);
+  ETNumber value;
+
+  if (cacheable)
+  {
+    if (_MC_lookup(memo, tree, &value))
+    {
+      memo->stats.hits++;
+      return value;
+    }
+    memo->stats.misses++;
+  }
+
+  // a result computed with an error, even one that does not show in
+  // it, is not cached; nor is one computed after an earlier error, as
+  // a new one could not be told apart
+  bool clean = errmsg[0] == '\0';
+
+  if (type == FUNC_CALL && (ET_call_function(tree)->reduce || ET_has_array_literal(tree)))
+    value = ET_evaluate_number(tree, memo->vars, errmsg, errmsg_sz);
+  else if (type == FUNC_CALL)
+  {
+    const Builtin *fn = ET_call_function(tree);
+    ETNumber args[BI_MAX_ARGS];
+    bool arrays = false;
+    for (int i = 0; i < fn->num_args; i++)
+    {
+      args[i] = _MC_eval(memo, ET_arg(tree, i), errmsg, errmsg_sz);
+      arrays = arrays || args[i].array;
+    }
+    if (arrays)
+      value = AO_call(fn, args, errmsg, errmsg_sz);
+    else
+    {
+      double values[BI_MAX_ARGS];
+      for (int i = 0; i < fn->num_args; i++)
+        values[i] = _MC_to_double(args[i]);
+      value = (ETNumber){.is_int = false, .d = fn->scalar(values)};
+    }
+  }
+  else if (type == USER_CALL || type == RANGE_SUM || type == RANGE_PROD)
+    value = ET_evaluate_number(tree, memo->vars, errmsg, errmsg_sz);
+  else if (type == OP_COND || type == OP_AND || type == OP_OR)
+  {
+    // only the operand or branch that decides the result, unless the
+    // condition is an array
+    ETNumber cond = _MC_eval(memo, ET_child(tree, 0), errmsg, errmsg_sz);
+    ExprTree right = ET_child(tree, 1);
+    if (cond.array && type == OP_COND)
+    {
+      ETNumber a = _MC_eval(memo, ET_child(right, 0), errmsg, errmsg_sz);
+      ETNumber b = _MC_eval(memo, ET_child(right, 1), errmsg, errmsg_sz);
+      value = AO_select(cond, a, b, errmsg, errmsg_sz);
+    }
+    else if (cond.array)
+      value = AO_apply(type, cond, _MC_eval(memo, right, errmsg, errmsg_sz), errmsg, errmsg_sz);
+    else if (_MC_is_nan(cond))
+      value = cond;
+    else
+    {
+      bool truth = cond.is_int ? cond.i != 0 : cond.d != 0;
+      if (type == OP_COND)
+        value = _MC_eval(memo, ET_child(right, truth ? 0 : 1), errmsg, errmsg_sz);
+      else if (truth == (type == OP_OR))
+        value = _MC_int(truth);
+      else
+      {
+        value = _MC_eval(memo, right, errmsg, errmsg_sz);
+        if (value.array)
+          value = AO_apply(OP_NE, value, _MC_int(0), errmsg, errmsg_sz);
+        else if (!_MC_is_nan(value))
+          value = _MC_int(_MC_to_double(value) != 0);
+      }
+    }
+  }
+  else
+  {
+    ETNumber left_val = _MC_eval(memo, ET_child(tree, 0), errmsg, errmsg_sz);
+    ETNumber right_val = _MC_eval(memo, ET_child(tree, 1), errmsg, errmsg_sz);
+    if (left_val.array || right_val.array)
+      value = AO_apply(type, left_val, right_val, errmsg, errmsg_sz);
+    else
+      value = ET_apply_number(type, left_val, right_val, errmsg, errmsg_sz);
+  }
+
+  if (cacheable && clean && errmsg[0] == '\0' && !value.array && !_MC_is_nan(value))
+    _MC_insert(memo, tree, value);
+
+  return value;
+}
+
+// Documented in .h file
+MemoCache MC_new(unsigned int max_entries)
+{
+  MemoCache memo = malloc(sizeof(struct _memo_cache));
+  assert(memo);
+
+  unsigned int size = 1;
+  while (size < max_entries)
+    size *= 2;
+
+  memo->entry = calloc(size, sizeof(struct _memo_entry));
+  assert(memo->entry);
+  memo->mask = size - 1;
+  memo->vars = NULL;
+  memset(&memo->stats, 0, sizeof(memo->stats));
+
+  return memo;
+}
+
+// Documented in .h file
+void MC_free(MemoCache memo)
+{
+  if (!memo)
+    return;
+
+  for (unsigned int i = 0; i <= memo->mask; i++)
+    _MC_clear_entry(&memo->entry[i]);
+
+  free(memo->entry);
+  free(memo);
+}
+
+// Documented in .h file
+ETNumber MC_evaluate_number(MemoCache memo, ExprTree tree, CDict vars, char *errmsg,
+                            size_t errmsg_sz)
+{
+  assert(memo);
+  assert(vars);
+  assert(memo->vars == NULL || memo->vars == vars);
+
+  memo->vars = vars;
+  return _MC_eval(memo, tree, errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+double MC_evaluate(MemoCache memo, ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz)
+{
+  ETNumber result = MC_evaluate_number(memo, tree, vars, errmsg, errmsg_sz);
+  if (result.array)
+  {
+    AR_release(result.array);
+    snprintf(errmsg, errmsg_sz, "Error: Array value where a number is expected");
+    return NAN;
+  }
+  return _MC_to_double(result);
+}
+
+// Documented in .h file
+void MC_stats(MemoCache memo, MCStats *stats)
+{
+  assert(memo);
+  assert(stats);
+  *stats = memo->stats;
+}
@@ -0,0 +1,112 @@
+/*
+ * memo.h
+ *
+ * Memoization of subtree results. Each pure subtree (one containing
+ * no OP_ASSIGN) that is evaluated has its result remembered, keyed by
+ * the subtree's structural hash and the versions of the variables it
+ * read. Re-evaluating an identical subtree -- in the same expression
+ * or a different one -- is a cache hit as long as none of those
+ * variables has been stored to since.
+ *
+ * Entries are identified by their 64-bit structural hash alone; two
+ * different subtrees would have to collide in all 64 bits for a wrong
+ * result to be returned.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _MEMO_H_
+#define _MEMO_H_
+
+#include <stddef.h>
+#include "cdict.h"
+#include "expr_tree.h"
+
+typedef struct _memo_cache *MemoCache;
+
+typedef struct {
+  unsigned long hits;       // subtrees answered from the cache
+  unsigned long misses;     // subtrees that had to be computed
+  unsigned long evictions;  // entries overwritten by a different subtree
+  unsigned int entries;     // entries currently held
+} MCStats;
+
+
+/*
+ * Create a new, empty memo cache. A memo cache records variable
+ * versions from one dictionary, and must always be used with the same
+ * CDict.
+ *
+ * Parameters:
+ *   max_entries  The maximum number of subtree results to hold; it is
+ *                rounded up to a power of two
+ *
+ * Returns: The new MemoCache. It is up to the caller to call MC_free.
+ */
+MemoCache MC_new(unsigned int max_entries);
+
+
+/*
+ * Destroy a memo cache
+ *
+ * Parameters:
+ *   memo     The cache; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void MC_free(MemoCache memo);
+
+
+/*
+ * Evaluate an ExprTree, exactly as ET_evaluate would, but answering
+ * pure subtrees from the memo cache where possible. Results that
+ * produce an error are not cached.
+ *
+ * Parameters:
+ *   memo       The memo cache
+ *   tree       The tree to compute
+ *   vars       A dictionary containing the variables known so far, which
+ *              may be modified by this function
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value on success. If an error is encountered,
+ *   copies an error message into errmsg and returns NaN.
+ */
+double MC_evaluate(MemoCache memo, ExprTree tree, CDict vars, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Evaluate an ExprTree, exactly as ET_evaluate_number would, but
+ * answering pure subtrees from the memo cache where possible, so that
+ * integer results stay exact and arrays are kept. Results that are
+ * arrays or produce an error are not cached.
+ *
+ * Parameters:
+ *   memo       The memo cache
+ *   tree       The tree to compute
+ *   vars       A dictionary containing the variables known so far, which
+ *              may be modified by this function
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value, whose array, if any, it is up to the
+ *   caller to AR_release. If an error is encountered, copies an error
+ *   message into errmsg and returns a NaN double.
+ */
+ETNumber MC_evaluate_number(MemoCache memo, ExprTree tree, CDict vars, char *errmsg,
+                            size_t errmsg_sz);
+
+
+/*
+ * Retrieve the hit/miss/eviction counters
+ *
+ * Parameters:
+ *   memo     The cache
+ *   stats    Return space for the statistics
+ *
+ * Returns: None
+ */
+void MC_stats(MemoCache memo, MCStats *stats);
+
+#endif /* _MEMO_H_ */
@@ -0,0 +1,611 @@
+/*
+ * montecarlo.c
+ *
+ * Monte Carlo evaluation of compiled expressions over counter-based
+ * random samples, with streaming statistics
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "montecarlo.h"
+#include "prepared.h"
+#include "fastmath.h"
+
+// The lanes of the sums over a batch, which are independent so that
+// the loops are vectorized
+#define MO_LANES 8
+
+// The Philox4x32 multipliers and Weyl key increments
+#define MO_PHILOX_M0 0xD2511F53ull
+#define MO_PHILOX_M1 0xCD9E8D57ull
+#define MO_PHILOX_W0 0x9E3779B9ull
+#define MO_PHILOX_W1 0xBB67AE85ull
+
+#define MO_TWO_PI 6.28318530717958647692
+
+typedef enum
+{
+  MO_UNIFORM,
+  MO_NORMAL,
+  MO_LOGNORMAL,
+  MO_EXPONENTIAL
+} MOKind;
+
+static const struct
+{
+  const char *name;
+  MOKind kind;
+  int num_params;
+} MO_DISTRIBUTIONS[] = {
+  {"uniform", MO_UNIFORM, 2},
+  {"normal", MO_NORMAL, 2},
+  {"lognormal", MO_LOGNORMAL, 2},
+  {"exponential", MO_EXPONENTIAL, 1},
+};
+
+typedef struct
+{
+  char *var;
+  MOKind kind;
+  double param[2];
+} MOBinding;
+
+struct _mo_model
+{
+  uint32_t key[2];
+  uint32_t runs;        // the runs made, which number their samples
+  MOBinding *binding;   // the binding's index numbers its samples too
+  int num_bindings, cap_bindings;
+};
+
+// Counts of the values in buckets of equal relative width, over a
+// window of buckets that grows to cover the values seen
+typedef struct
+{
+  long *count;
+  size_t lo, len;   // count[i] is of bucket lo + i
+} MOSketch;
+
+typedef struct
+{
+  long count;       // the values with a value, i.e. not NaN
+  long undefined;
+  double mean, m2;  // and the sum of squared deviations from the mean
+  double min, max;
+  MOSketch sketch;
+} MOAccum;
+
+typedef struct _mo_job MOJob;
+
+typedef struct
+{
+  MOJob *job;
+  pthread_t thread;
+  bool started;
+  double *data;     // the batch columns, then the results
+  MOAccum acc;
+  char errmsg[128];
+} MOWorker;
+
+struct _mo_job
+{
+  MOModel m;
+  Prepared p;
+  int num_vars;
+  int *binding;     // of each slot, or -1 for a variable in vars
+  long n;
+  long num_blocks;
+  long next_block;  // accessed atomically
+  uint32_t run;
+};
+
+// Documented in .h file
+MOModel MO_new(uint64_t seed)
+{
+  MOModel m = malloc(sizeof(struct _mo_model));
+  assert(m);
+  m->key[0] = (uint32_t)seed;
+  m->key[1] = (uint32_t)(seed >> 32);
+  m->runs = 0;
+  m->binding = NULL;
+  m->num_bindings = m->cap_bindings = 0;
+  return m;
+}
+
+// Documented in .h file
+void MO_free(MOModel m)
+{
+  if (!m)
+    return;
+
+  for (int i = 0; i < m->num_bindings; i++)
+    free(m->binding[i].var);
+  free(m->binding);
+  free(m);
+}
+
+// Documented in .h file
+bool MO_bind(MOModel m, const char *var, const char *dist, const double *params,
+             int num_params, char *errmsg, size_t errmsg_sz)
+{
+  int d = 0, num_dists = sizeof(MO_DISTRIBUTIONS) / sizeof(MO_DISTRIBUTIONS[0]);
+  while (d < num_dists && strcmp(MO_DISTRIBUTIONS[d].name, dist) != 0)
+    d++;
+  if (d == num_dists)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Unknown distribution %s", dist);
+    return false;
+  }
+  if (num_params != MO_DISTRIBUTIONS[d].num_params)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: %s takes %d parameter%s", dist,
+             MO_DISTRIBUTIONS[d].num_params, MO_DISTRIBUTIONS[d].num_params == 1 ? "" : "s");
+    return false;
+  }
+
+  MOKind kind = MO_DISTRIBUTIONS[d].kind;
+  bool valid = isfinite(params[0]) && (num_params < 2 || isfinite(params[1]));
+  if (kind == MO_UNIFORM)
+    valid = valid && params[0] < params[1];
+  else if (kind == MO_EXPONENTIAL)
+    valid = valid && params[0] > 0;
+  else
+    valid = valid && params[1] >= 0;
+  if (!valid)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Invalid parameters for %s", dist);
+    return false;
+  }
+
+  int i = 0;
+  while (i < m->num_bindings && strcmp(m->binding[i].var, var) != 0)
+    i++;
+  if (i == m->num_bindings)
+  {
+    if (m->num_bindings == m->cap_bindings)
+    {
+      m->cap_bindings = m->cap_bindings ? 2 * m->cap_bindings : 8;
+      m->binding = realloc(m->binding, m->cap_bindings * sizeof(MOBinding));
+      assert(m->binding);
+    }
+    m->binding[i].var = strdup(var);
+    m->num_bindings++;
+  }
+  m->binding[i].kind = kind;
+  m->binding[i].param[0] = params[0];
+  m->binding[i].param[1] = num_params > 1 ? params[1] : 0;
+  return true;
+}
+
+// Ten rounds of Philox4x32 on one counter. Its words are held in 64
+// bits, so that a vectorized loop keeps them in the lanes that the
+// 32 x 32 -> 64-bit multiplies use, with no shuffling.
+static inline __attribute__((always_inline)) void
+_MO_philox(uint64_t *c0, uint64_t *c1, uint64_t *c2, uint64_t *c3, uint64_t k0, uint64_t k1)
+{
+  for (int r = 0; r < 10; r++)
+  {
+    uint64_t p0 = MO_PHILOX_M0 * *c0, p1 = MO_PHILOX_M1 * *c2;
+    *c0 = (p1 >> 32) ^ *c1 ^ k0;
+    *c1 = p1 & 0xffffffff;
+    *c2 = (p0 >> 32) ^ *c3 ^ k1;
+    *c3 = p0 & 0xffffffff;
+    k0 = (k0 + MO_PHILOX_W0) & 0xffffffff;
+    k1 = (k1 + MO_PHILOX_W1) & 0xffffffff;
+  }
+}
+
+// Documented in .h file
+void MO_philox(uint32_t counter[4], const uint32_t key[2])
+{
+  uint64_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  _MO_philox(&c0, &c1, &c2, &c3, key[0], key[1]);
+  counter[0] = (uint32_t)c0;
+  counter[1] = (uint32_t)c1;
+  counter[2] = (uint32_t)c2;
+  counter[3] = (uint32_t)c3;
+}
+
+// A double in [1, 2) from the top 52 of 64 random bits; integer to
+// double conversions do not vectorize, so the bits are placed in the
+// mantissa instead
+static inline __attribute__((always_inline)) double _MO_one_two(uint64_t hi, uint64_t lo)
+{
+  return _FM_double((((hi << 32) | lo) >> 12) | 0x3ff0000000000000ULL);
+}
+
+// sin and cos of 2 pi t, for |t| <= 1/2: t is reduced by quarter
+// turns to |r| <= pi/4, where the Taylor series through r^17 are
+// accurate to 2^-53
+static inline __attribute__((always_inline)) void _MO_sincos_turn(double t, double *s,
+                                                                  double *c)
+{
+  double qd = 4 * t + FM_ROUND_MAGIC;
+  double q = qd - FM_ROUND_MAGIC;
+  uint64_t quadrant = _FM_bits(qd) & 3;
+  double r = MO_TWO_PI * (t - 0.25 * q), z = r * r;
+
+  double ps = -1.0 / 355687428096000;   // -1/17!
+  ps = ps * z + 1.0 / 1307674368000;
+  ps = ps * z - 1.0 / 6227020800;
+  ps = ps * z + 1.0 / 39916800;
+  ps = ps * z - 1.0 / 362880;
+  ps = ps * z + 1.0 / 5040;
+  ps = ps * z - 1.0 / 120;
+  ps = ps * z + 1.0 / 6;
+  double sin_r = r - r * z * ps;
+
+  double pc = 1.0 / 20922789888000;     // 1/16!
+  pc = pc * z - 1.0 / 87178291200;
+  pc = pc * z + 1.0 / 479001600;
+  pc = pc * z - 1.0 / 3628800;
+  pc = pc * z + 1.0 / 40320;
+  pc = pc * z - 1.0 / 720;
+  pc = pc * z + 1.0 / 24;
+  pc = pc * z - 0.5;
+  double cos_r = 1 + z * pc;
+
+  // turned by quadrant quarter turns
+  double s1 = (quadrant & 1) ? cos_r : sin_r, c1 = (quadrant & 1) ? sin_r : cos_r;
+  *s = (quadrant & 2) ? -s1 : s1;
+  *c = ((quadrant + 1) & 2) ? -c1 : c1;
+}
+
+/*
+ * Fill a batch with samples of a binding
+ *
+ * Parameters:
+ *   b          The binding
+ *   stream     Its index, which with the run and the first pair of
+ *              samples makes up the counters
+ *   key        The model's key
+ *   run        The run
+ *   pair       The number of the first pair of samples in the run
+ *   out        Return space for MO_BATCH samples
+ *
+ * Returns: None
+ */
+FM_CLONES static void _MO_generate(const MOBinding *b, uint32_t stream, const uint32_t key[2],
+                                   uint32_t run, uint64_t pair, double *restrict out)
+{
+  // each counter gives two uniforms in [1, 2), for the samples j and
+  // j + MO_BATCH / 2 of the batch, which make up its pair j
+  const int half = MO_BATCH / 2;
+  for (int j = 0; j < half; j++)
+  {
+    uint64_t c0 = (pair + j) & 0xffffffff, c1 = (pair + j) >> 32, c2 = stream, c3 = run;
+    _MO_philox(&c0, &c1, &c2, &c3, key[0], key[1]);
+    out[j] = _MO_one_two(c0, c1);
+    out[j + half] = _MO_one_two(c2, c3);
+  }
+
+  double p0 = b->param[0], p1 = b->param[1];
+  switch (b->kind)
+  {
+  case MO_UNIFORM:
+    for (int i = 0; i < MO_BATCH; i++)
+      out[i] = p0 + (p1 - p0) * (out[i] - 1);
+    break;
+
+  case MO_EXPONENTIAL:
+    // 2 - u is in (0, 1], so its log is finite
+    for (int i = 0; i < MO_BATCH; i++)
+      out[i] = -FM_log(2 - out[i]) / p0;
+    break;
+
+  case MO_NORMAL:
+  case MO_LOGNORMAL:
+    // the Box-Muller transform turns each pair into two normals
+    for (int j = 0; j < half; j++)
+    {
+      double radius = sqrt(-2 * FM_log(2 - out[j])), s, c;
+      _MO_sincos_turn(out[j + half] - 1.5, &s, &c);
+      out[j] = p0 + p1 * radius * c;
+      out[j + half] = p0 + p1 * radius * s;
+    }
+    if (b->kind == MO_LOGNORMAL)
+      for (int i = 0; i < MO_BATCH; i++)
+        out[i] = FM_exp(out[i]);
+    break;
+  }
+}
+
+// The bucket of a double that is not NaN: its bits, flipped so that
+// they order as unsigned integers as the doubles do, and cut to the
+// exponent and the top MO_SKETCH_BITS of the mantissa
+static inline __attribute__((always_inline)) size_t _MO_bucket(double x)
+{
+  uint64_t bits = _FM_bits(x);
+  bits ^= -(bits >> 63) | 0x8000000000000000ULL;
+  return (size_t)(bits >> (52 - MO_SKETCH_BITS));
+}
+
+// The middle value of a bucket, except that the buckets either side of
+// zero, of -0 and +0 and denormals too small to tell apart from them,
+// are exactly 0
+static double _MO_bucket_value(size_t bucket)
+{
+  const size_t zero = (size_t)(0x8000000000000000ULL >> (52 - MO_SKETCH_BITS));
+  if (bucket == zero || bucket == zero - 1)
+    return 0;
+  uint64_t bits = ((uint64_t)bucket << (52 - MO_SKETCH_BITS)) | (1ULL << (51 - MO_SKETCH_BITS));
+  bits = (bits >> 63) ? bits ^ 0x8000000000000000ULL : ~bits;
+  return _FM_double(bits);
+}
+
+// Grow the window of a sketch to cover the buckets lo to hi, and by
+// half as much again, so that a spreading tail grows it rarely
+static void _MO_sketch_cover(MOSketch *s, size_t lo, size_t hi)
+{
+  if (s->len > 0 && lo >= s->lo && hi < s->lo + s->len)
+    return;
+
+  size_t new_lo = s->len > 0 && s->lo < lo ? s->lo : lo;
+  size_t new_hi = s->len > 0 && s->lo + s->len - 1 > hi ? s->lo + s->len - 1 : hi;
+  size_t pad = (new_hi - new_lo + 1) / 2;
+  if (s->len > 0 && lo < s->lo)
+    new_lo = new_lo > pad ? new_lo - pad : 0;
+  if (s->len > 0 && hi >= s->lo + s->len)
+    new_hi += pad;
+
+  long *count = calloc(new_hi - new_lo + 1, sizeof(long));
+  assert(count);
+  if (s->len > 0)
+    memcpy(count + (s->lo - new_lo), s->count, s->len * sizeof(long));
+  free(s->count);
+  s->count = count;
+  s->lo = new_lo;
+  s->len = new_hi - new_lo + 1;
+}
+
+// Fold m values, none of them NaN, into an accumulator
+FM_CLONES static void _MO_accumulate(MOAccum *acc, const double *restrict x, int m)
+{
+  double sum[MO_LANES] = {0}, sq[MO_LANES] = {0};
+  double lo[MO_LANES], hi[MO_LANES];
+  for (int j = 0; j < MO_LANES; j++)
+  {
+    lo[j] = acc->min;
+    hi[j] = acc->max;
+  }
+
+  int i = 0;
+  for (; i + MO_LANES <= m; i += MO_LANES)
+    for (int j = 0; j < MO_LANES; j++)
+    {
+      sum[j] += x[i + j];
+      lo[j] = x[i + j] < lo[j] ? x[i + j] : lo[j];
+      hi[j] = x[i + j] > hi[j] ? x[i + j] : hi[j];
+    }
+  for (int j = 0; i + j < m; j++)
+  {
+    sum[j] += x[i + j];
+    lo[j] = x[i + j] < lo[j] ? x[i + j] : lo[j];
+    hi[j] = x[i + j] > hi[j] ? x[i + j] : hi[j];
+  }
+  double mean = 0;
+  for (int j = 0; j < MO_LANES; j++)
+  {
+    mean += sum[j];
+    acc->min = lo[j] < acc->min ? lo[j] : acc->min;
+    acc->max = hi[j] > acc->max ? hi[j] : acc->max;
+  }
+  mean /= m;
+
+  // the squared deviations from the batch's own mean, which are then
+  // combined with those so far as in Chan et al.'s parallel algorithm
+  for (i = 0; i + MO_LANES <= m; i += MO_LANES)
+    for (int j = 0; j < MO_LANES; j++)
+      sq[j] += (x[i + j] - mean) * (x[i + j] - mean);
+  for (int j = 0; i + j < m; j++)
+    sq[j] += (x[i + j] - mean) * (x[i + j] - mean);
+  double m2 = 0;
+  for (int j = 0; j < MO_LANES; j++)
+    m2 += sq[j];
+
+  double delta = mean - acc->mean, total = (double)acc->count + m;
+  acc->mean += delta * m / total;
+  acc->m2 += m2 + delta * delta * ((double)acc->count * m / total);
+  acc->count += m;
+
+  size_t bucket[MO_BATCH], first = SIZE_MAX, last = 0;
+  for (i = 0; i < m; i++)
+  {
+    bucket[i] = _MO_bucket(x[i]);
+    first = bucket[i] < first ? bucket[i] : first;
+    last = bucket[i] > last ? bucket[i] : last;
+  }
+  _MO_sketch_cover(&acc->sketch, first, last);
+  for (i = 0; i < m; i++)
+    acc->sketch.count[bucket[i] - acc->sketch.lo]++;
+}
+
+// Fold one accumulator into another
+static void _MO_merge(MOAccum *into, const MOAccum *from)
+{
+  into->undefined += from->undefined;
+  if (from->count == 0)
+    return;
+
+  double delta = from->mean - into->mean, total = (double)into->count + from->count;
+  into->mean += delta * from->count / total;
+  into->m2 += from->m2 + delta * delta * ((double)into->count * from->count / total);
+  into->count += from->count;
+  into->min = fmin(into->min, from->min);
+  into->max = fmax(into->max, from->max);
+
+  const MOSketch *s = &from->sketch;
+  _MO_sketch_cover(&into->sketch, s->lo, s->lo + s->len - 1);
+  for (size_t i = 0; i < s->len; i++)
+    into->sketch.count[s->lo + i - into->sketch.lo] += s->count[i];
+}
+
+// Take blocks of samples until none are left: generate the random
+// variables' columns, evaluate, and fold the defined results in
+static void *_MO_worker(void *arg)
+{
+  MOWorker *w = arg;
+  MOJob *job = w->job;
+  double *columns[job->num_vars + 1];
+  for (int v = 0; v < job->num_vars; v++)
+    columns[v] = w->data + (size_t)v * MO_BATCH;
+  double *results = w->data + (size_t)job->num_vars * MO_BATCH;
+  double defined[MO_BATCH];
+
+  for (;;)
+  {
+    long block = __atomic_fetch_add(&job->next_block, 1, __ATOMIC_RELAXED);
+    if (block >= job->num_blocks)
+      break;
+
+    long first = block * MO_BATCH;
+    int rows = job->n - first < MO_BATCH ? (int)(job->n - first) : MO_BATCH;
+    for (int v = 0; v < job->num_vars; v++)
+      if (job->binding[v] >= 0)
+        _MO_generate(&job->m->binding[job->binding[v]], (uint32_t)job->binding[v], job->m->key,
+                     job->run, (uint64_t)first / 2, columns[v]);
+
+    char errmsg[128] = "";
+    EW_execute_batch(job->p, columns, rows, results, 0, errmsg, sizeof(errmsg));
+    if (errmsg[0] != '\0' && w->errmsg[0] == '\0')
+      snprintf(w->errmsg, sizeof(w->errmsg), "%s", errmsg);
+
+    int m = 0;
+    for (int i = 0; i < rows; i++)
+    {
+      defined[m] = results[i];
+      m += !isnan(results[i]);
+    }
+    w->acc.undefined += rows - m;
+    if (m > 0)
+      _MO_accumulate(&w->acc, defined, m);
+  }
+  return NULL;
+}
+
+// The value of each of num_p quantiles p, in ascending order, from a
+// sketch of count values between min and max
+static void _MO_quantiles(const MOSketch *s, long count, double min, double max,
+                          const double *p, double **quantile, int num_p)
+{
+  long seen = 0;
+  size_t i = 0;
+  for (int q = 0; q < num_p; q++)
+  {
+    // the value of rank ceil(p * count), counting from 1
+    long rank = (long)ceil(p[q] * count);
+    rank = rank < 1 ? 1 : rank;
+    while (seen + s->count[i] < rank)
+      seen += s->count[i++];
+    double value = _MO_bucket_value(s->lo + i);
+    *quantile[q] = value < min ? min : value > max ? max : value;
+  }
+}
+
+// Documented in .h file
+double MO_run(MOModel m, ExprTree tree, CDict vars, long n, MOStats *stats, char *errmsg,
+              size_t errmsg_sz)
+{
+  *stats = (MOStats){.mean = NAN, .std_dev = NAN, .std_error = NAN, .min = NAN, .max = NAN,
+                     .p5 = NAN, .p25 = NAN, .median = NAN, .p75 = NAN, .p95 = NAN};
+  errmsg[0] = '\0';
+  if (n < 1)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Number of samples must be at least 1");
+    return NAN;
+  }
+
+  Prepared p = EW_compile(tree, errmsg, errmsg_sz);
+  if (p == NULL)
+    return NAN;
+
+  MOJob job = {.m = m,
+               .p = p,
+               .num_vars = EW_num_vars(p),
+               .n = n,
+               .num_blocks = (n + MO_BATCH - 1) / MO_BATCH,
+               .run = m->runs++};
+  double *values = malloc((job.num_vars + 1) * sizeof(double));
+  job.binding = malloc((job.num_vars + 1) * sizeof(int));
+  assert(values && job.binding);
+  EW_bind_dict(p, values, vars);
+  for (int v = 0; v < job.num_vars; v++)
+  {
+    job.binding[v] = m->num_bindings - 1;
+    while (job.binding[v] >= 0 && strcmp(m->binding[job.binding[v]].var, EW_var_name(p, v)) != 0)
+      job.binding[v]--;
+  }
+
+  static long cpus = 0;
+  if (cpus == 0)
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int num_workers = cpus < 1 ? 1 : cpus > MO_MAX_THREADS ? MO_MAX_THREADS : (int)cpus;
+  if (num_workers > job.num_blocks)
+    num_workers = (int)job.num_blocks;
+
+  // the variables that are not random are filled in once
+  MOWorker worker[MO_MAX_THREADS];
+  for (int t = 0; t < num_workers; t++)
+  {
+    MOWorker *w = &worker[t];
+    *w = (MOWorker){.job = &job, .acc = {.min = INFINITY, .max = -INFINITY}};
+    w->data = malloc(((size_t)job.num_vars + 1) * MO_BATCH * sizeof(double));
+    assert(w->data);
+    for (int v = 0; v < job.num_vars; v++)
+      for (int i = 0; i < MO_BATCH; i++)
+        w->data[(size_t)v * MO_BATCH + i] = values[v];
+  }
+  for (int t = 1; t < num_workers; t++)
+    worker[t].started = pthread_create(&worker[t].thread, NULL, _MO_worker, &worker[t]) == 0;
+  _MO_worker(&worker[0]);
+
+  // merged in the same order whatever the threads did
+  MOAccum *acc = &worker[0].acc;
+  stats->threads = 1;
+  for (int t = 1; t < num_workers; t++)
+  {
+    if (worker[t].started)
+    {
+      pthread_join(worker[t].thread, NULL);
+      stats->threads++;
+    }
+    _MO_merge(acc, &worker[t].acc);
+  }
+  for (int t = 0; errmsg[0] == '\0' && t < num_workers; t++)
+    if (acc->count == 0)
+      snprintf(errmsg, errmsg_sz, "%s", worker[t].errmsg);
+
+  stats->samples = n;
+  stats->undefined = acc->undefined;
+  if (acc->count > 0)
+  {
+    stats->mean = acc->mean;
+    stats->std_dev = acc->count > 1 ? sqrt(acc->m2 / (acc->count - 1)) : 0;
+    stats->std_error = stats->std_dev / sqrt((double)acc->count);
+    stats->min = acc->min;
+    stats->max = acc->max;
+    const double p[] = {0.05, 0.25, 0.5, 0.75, 0.95};
+    double *quantile[] = {&stats->p5, &stats->p25, &stats->median, &stats->p75, &stats->p95};
+    _MO_quantiles(&acc->sketch, acc->count, acc->min, acc->max, p, quantile, 5);
+  }
+  else if (errmsg[0] == '\0')
+    snprintf(errmsg, errmsg_sz, "Error: Expression is not a number at any sample");
+
+  for (int t = 0; t < num_workers; t++)
+  {
+    free(worker[t].acc.sketch.count);
+    free(worker[t].data);
+  }
+  free(job.binding);
+  free(values);
+  EW_free(p);
+  return stats->mean;
+}
@@ -0,0 +1,149 @@
+/*
+ * montecarlo.h
+ *
+ * Monte Carlo evaluation: variables are bound to distributions, and an
+ * expression is evaluated over many samples of them, for its mean,
+ * spread and quantiles.
+ *
+ * Samples come from Philox4x32-10, a counter-based generator: the
+ * random bits of a sample are a keyed hash of its number, so any thread
+ * can produce any block of samples without sharing state, and the
+ * samples do not depend on the number of threads. Each thread fills
+ * MO_BATCH samples of every variable at a time, in loops the compiler
+ * can vectorize, evaluates the expression on them with one call of
+ * EW_execute_batch, and folds the results into its own running mean,
+ * variance and quantile sketch. The samples themselves are never kept.
+ *
+ * A typical use:
+ *
+ *   MOModel m = MO_new(0);
+ *   double params[2] = {0, 1};
+ *   MO_bind(m, "x", "normal", params, 2, errmsg, sizeof(errmsg));
+ *   MOStats stats;
+ *   MO_run(m, tree, dict, 1000000, &stats, errmsg, sizeof(errmsg));
+ *   MO_free(m);
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _MONTECARLO_H_
+#define _MONTECARLO_H_
+
+#include <stdint.h>
+
+#include "cdict.h"
+#include "expr_tree.h"
+
+// The samples a thread generates and evaluates at once
+#define MO_BATCH 1024
+
+// The most threads a run uses
+#define MO_MAX_THREADS 8
+
+// The quantile sketch keeps 2^MO_SKETCH_BITS buckets per power of 2,
+// so quantiles are accurate to a relative 2^-(MO_SKETCH_BITS + 1)
+#define MO_SKETCH_BITS 7
+
+typedef struct _mo_model *MOModel;
+
+typedef struct
+{
+  long samples;     // the samples evaluated
+  long undefined;   // those for which the expression had no value
+  double mean;      // over the samples with a value
+  double std_dev;
+  double std_error; // of the mean
+  double min, max;
+  double p5, p25, median, p75, p95;   // quantiles, from the sketch
+  int threads;      // the number of threads that took part
+} MOStats;
+
+
+/*
+ * Create a model, in which no variable is yet random
+ *
+ * Parameters:
+ *   seed       The key of the generator; the same seed gives the same
+ *              samples, run for run
+ *
+ * Returns: The model. It is up to the caller to call MO_free.
+ */
+MOModel MO_new(uint64_t seed);
+
+
+/*
+ * Destroy a model
+ *
+ * Parameters:
+ *   m          The model, or NULL
+ *
+ * Returns: None
+ */
+void MO_free(MOModel m);
+
+
+/*
+ * Bind a variable to a distribution, replacing any it had. The
+ * distributions and their parameters are
+ *
+ *   uniform(a, b)          a < b
+ *   normal(mean, sd)       sd >= 0
+ *   lognormal(mu, sigma)   sigma >= 0; the log is normal(mu, sigma)
+ *   exponential(rate)      rate > 0
+ *
+ * Parameters:
+ *   m           The model
+ *   var         The variable
+ *   dist        The name of the distribution
+ *   params      Its parameters
+ *   num_params  The number of them
+ *   errmsg      Return space for an error message, filled in in case of error
+ *   errmsg_sz   The size of errmsg
+ *
+ * Returns: true on success; false, with an error message copied into
+ *   errmsg, if the distribution is unknown or its parameters are wrong
+ */
+bool MO_bind(MOModel m, const char *var, const char *dist, const double *params,
+             int num_params, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Evaluate an expression over samples of the random variables
+ *
+ * The variables not bound to a distribution take their values in vars.
+ * A sample at which the expression has an error, or is NaN, counts as
+ * undefined and is left out of the statistics. Each run draws new
+ * samples.
+ *
+ * Parameters:
+ *   m          The model
+ *   tree       The expression, with calls inlined (see FT_inline); it is
+ *              not modified, and the caller retains ownership of it
+ *   vars       The values of the other variables
+ *   n          The number of samples
+ *   stats      Return space for the statistics
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The mean. If the expression cannot be compiled, n is less
+ *   than 1, or every sample is undefined, copies an error message (that
+ *   of one of the samples, in the last case) into errmsg and returns NaN.
+ */
+double MO_run(MOModel m, ExprTree tree, CDict vars, long n, MOStats *stats, char *errmsg,
+              size_t errmsg_sz);
+
+
+/*
+ * The Philox4x32-10 generator of Salmon et al.: replace a counter with
+ * 128 random bits, as a function of it and a key
+ *
+ * Parameters:
+ *   counter    The counter, replaced by the random bits
+ *   key        The key
+ *
+ * Returns: None
+ */
+void MO_philox(uint32_t counter[4], const uint32_t key[2]);
+
+
+#endif /* _MONTECARLO_H_ */
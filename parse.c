@@ -8,6 +8,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 
 #include "parse.h"
 #include "tokenize.h"
@@ -27,11 +30,20 @@
  *   encountered, copies an error message into errmsg and returns
  *   NULL.
  */
+static ExprTree conditional(CList tokens, char *errmsg, size_t errmsg_sz);
+static ExprTree logical_or(CList tokens, char *errmsg, size_t errmsg_sz);
+static ExprTree logical_and(CList tokens, char *errmsg, size_t errmsg_sz);
+static ExprTree equality(CList tokens, char *errmsg, size_t errmsg_sz);
+static ExprTree relational(CList tokens, char *errmsg, size_t errmsg_sz);
 static ExprTree additive(CList tokens, char *errmsg, size_t errmsg_sz);
 static ExprTree multiplicative(CList tokens, char *errmsg, size_t errmsg_sz);
 static ExprTree exponential(CList tokens, char *errmsg, size_t errmsg_sz);
 static ExprTree primary(CList tokens, char *errmsg, size_t errmsg_sz);
 static ExprTree assignment(CList tokens, char *errmsg, size_t errmsg_sz);
+static ExprTree call(CList tokens, char *errmsg, size_t errmsg_sz);
+static ExprTree array_literal(CList tokens, char *errmsg, size_t errmsg_sz);
+static ExprTree range(const char *name, ExprTree *args, char *errmsg, size_t errmsg_sz);
+static ExprTree definition(CList tokens, ExprTree call, char *errmsg, size_t errmsg_sz);
 
 static ExprTree assignment(CList tokens, char *errmsg, size_t errmsg_sz)
 {
@@ -52,8 +64,105 @@ static ExprTree assignment(CList tokens, char *errmsg, size_t errmsg_sz)
     }
   }
 
-  // If no assignment detected, fall back to the next rule (additive)
-  return additive(tokens, errmsg, errmsg_sz);
+  // If no assignment detected, fall back to the next rule (conditional)
+  return conditional(tokens, errmsg, errmsg_sz);
+}
+
+/*
+ * cond ? a : b, which groups to the right, as in C
+ */
+static ExprTree conditional(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+  ExprTree cond = logical_or(tokens, errmsg, errmsg_sz);
+  if (cond == NULL || TOK_next_type(tokens) != TOK_QUESTION)
+    return cond;
+
+  TOK_consume(tokens); // Consume '?'
+  ExprTree then = assignment(tokens, errmsg, errmsg_sz);
+  if (then == NULL)
+  {
+    ET_free(cond);
+    return NULL;
+  }
+
+  if (TOK_next_type(tokens) != TOK_COLON)
+  {
+    snprintf(errmsg, errmsg_sz, "Unexpected token %s", TT_to_str(TOK_next_type(tokens)));
+    ET_free(cond);
+    ET_free(then);
+    return NULL;
+  }
+  TOK_consume(tokens); // Consume ':'
+
+  ExprTree otherwise = conditional(tokens, errmsg, errmsg_sz);
+  if (otherwise == NULL)
+  {
+    ET_free(cond);
+    ET_free(then);
+    return NULL;
+  }
+
+  return ET_node(OP_COND, cond, ET_node(OP_BRANCHES, then, otherwise));
+}
+
+/*
+ * A left-associative sequence of operands of rule operand, separated
+ * by any of the tokens in ops, each of which builds the node type at
+ * the same index of types
+ */
+static ExprTree binary_sequence(CList tokens, ExprTree (*operand)(CList, char *, size_t),
+                                const TokenType *ops, const ExprNodeType *types, int num_ops,
+                                char *errmsg, size_t errmsg_sz)
+{
+  ExprTree ret = operand(tokens, errmsg, errmsg_sz);
+
+  while (ret != NULL)
+  {
+    int which = 0;
+    while (which < num_ops && TOK_next_type(tokens) != ops[which])
+      which++;
+    if (which == num_ops)
+      break;
+
+    TOK_consume(tokens); // Consume the operator
+    ExprTree right = operand(tokens, errmsg, errmsg_sz);
+    if (right == NULL)
+    {
+      ET_free(ret);
+      return NULL;
+    }
+    ret = ET_node(types[which], ret, right);
+  }
+
+  return ret;
+}
+
+static ExprTree logical_or(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+  static const TokenType ops[] = {TOK_OR};
+  static const ExprNodeType types[] = {OP_OR};
+  return binary_sequence(tokens, logical_and, ops, types, 1, errmsg, errmsg_sz);
+}
+
+static ExprTree logical_and(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+  static const TokenType ops[] = {TOK_AND};
+  static const ExprNodeType types[] = {OP_AND};
+  return binary_sequence(tokens, equality, ops, types, 1, errmsg, errmsg_sz);
+}
+
+static ExprTree equality(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+  static const TokenType ops[] = {TOK_EQUAL_EQUAL, TOK_NOT_EQUAL};
+  static const ExprNodeType types[] = {OP_EQ, OP_NE};
+  return binary_sequence(tokens, relational, ops, types, 2, errmsg, errmsg_sz);
+}
+
+static ExprTree relational(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+  static const TokenType ops[] = {TOK_LESS, TOK_LESS_EQUAL, TOK_GREATER, TOK_GREATER_EQUAL};
+  static const ExprNodeType types[] = {OP_LT, OP_LE, OP_GT, OP_GE};
+  return binary_sequence(tokens, additive, ops, types, 4, errmsg, errmsg_sz);
 }
 
 static ExprTree additive(CList tokens, char *errmsg, size_t errmsg_sz)
@@ -142,9 +251,18 @@ static ExprTree primary(CList tokens, char *errmsg, size_t errmsg_sz)
 
   if (TOK_next_type(tokens) == TOK_VALUE)
   {
-    ret = ET_value(TOK_next(tokens).t.value);
+    Token value = TOK_next(tokens);
+    ret = value.integer ? ET_integer(value.ivalue) : ET_value(value.t.value);
     TOK_consume(tokens);
   }
+  else if (TOK_next_type(tokens) == TOK_SYMBOL && TOK_next_next_type(tokens) == TOK_OPEN_PAREN)
+  {
+    ret = call(tokens, errmsg, errmsg_sz);
+  }
+  else if (TOK_next_type(tokens) == TOK_OPEN_BRACKET)
+  {
+    ret = array_literal(tokens, errmsg, errmsg_sz);
+  }
   else if (TOK_next_type(tokens) == TOK_SYMBOL)
   {
     Token symbol = TOK_next(tokens);
@@ -186,6 +304,218 @@ static ExprTree primary(CList tokens, char *errmsg, size_t errmsg_sz)
   return ret;
 }
 
+/*
+ * A function call, name(arg, ...). A builtin is resolved here, so
+ * that a wrong number of arguments to it is a parse error; any other
+ * name is left for FT_inline to resolve against the user-defined
+ * functions. sum and prod of four arguments are ranges instead.
+ */
+static ExprTree call(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+  Token name = TOK_next(tokens);
+  TOK_consume(tokens); // Consume the name
+  TOK_consume(tokens); // Consume '('
+
+  const Builtin *fn = BI_lookup(name.t.symbol, -1);
+  ExprTree args[ET_MAX_ARGS];
+  int num_args = 0;
+
+  while (TOK_next_type(tokens) != TOK_CLOSE_PAREN || num_args > 0)
+  {
+    if (num_args > 0)
+      TOK_consume(tokens); // Consume ','
+
+    if (num_args == ET_MAX_ARGS)
+    {
+      snprintf(errmsg, errmsg_sz, "Too many arguments to %s", name.t.symbol);
+      goto error;
+    }
+
+    args[num_args] = assignment(tokens, errmsg, errmsg_sz);
+    if (args[num_args] == NULL)
+      goto error;
+    num_args++;
+
+    if (TOK_next_type(tokens) != TOK_COMMA)
+      break;
+  }
+
+  if (TOK_next_type(tokens) != TOK_CLOSE_PAREN)
+  {
+    snprintf(errmsg, errmsg_sz, "Unexpected token %s", TT_to_str(TOK_next_type(tokens)));
+    goto error;
+  }
+  if (num_args == 4 &&
+      (strcmp(name.t.symbol, "sum") == 0 || strcmp(name.t.symbol, "prod") == 0))
+  {
+    TOK_consume(tokens); // Consume ')'
+    return range(name.t.symbol, args, errmsg, errmsg_sz);
+  }
+  if (fn && BI_lookup(fn->name, num_args) == NULL)
+  {
+    // list the numbers of arguments it does take, such as "1 or 2"
+    int len = snprintf(errmsg, errmsg_sz, "Function %s takes", fn->name);
+    int last = -1;
+    for (int n = 0; n <= BI_MAX_ARGS; n++)
+      if (BI_lookup(fn->name, n))
+      {
+        if (len >= 0 && len < errmsg_sz)
+          len += snprintf(errmsg + len, errmsg_sz - len, "%s %d", last >= 0 ? " or" : "", n);
+        last = n;
+      }
+    if (len >= 0 && len < errmsg_sz)
+      snprintf(errmsg + len, errmsg_sz - len, " argument%s", last == 1 ? "" : "s");
+    goto error;
+  }
+  if (fn)
+    fn = BI_lookup(fn->name, num_args);
+
+  TOK_consume(tokens); // Consume ')'
+  if (fn)
+    return ET_call(fn, args);
+  return ET_user_call(name.t.symbol, NULL, args, num_args);
+
+ error:
+  while (num_args > 0)
+    ET_free(args[--num_args]);
+  return NULL;
+}
+
+// The search by range for an assignment to its index
+struct index_search
+{
+  const char *index;
+  bool assigned;
+};
+
+static void find_assignment(const char *symbol, bool assigned, void *cb_data)
+{
+  struct index_search *search = cb_data;
+  if (assigned && strcmp(symbol, search->index) == 0)
+    search->assigned = true;
+}
+
+/*
+ * A range, sum(index, lo, hi, body) or prod(...), once call has
+ * parsed its four arguments; takes ownership of them. The index is
+ * bound in the body only, and may not be assigned there.
+ */
+static ExprTree range(const char *name, ExprTree *args, char *errmsg, size_t errmsg_sz)
+{
+  ExprTree ret = NULL;
+
+  if (ET_type(args[0]) != SYMBOL)
+    snprintf(errmsg, errmsg_sz, "Index of %s must be a variable name", name);
+  else
+  {
+    const char *index = ET_symbol_name(args[0]);
+    struct index_search search = {index, false};
+    ET_foreach_symbol(args[3], find_assignment, &search);
+
+    if (search.assigned)
+      snprintf(errmsg, errmsg_sz, "Cannot assign to index %s of %s", index, name);
+    else
+      ret = ET_range(strcmp(name, "sum") == 0 ? RANGE_SUM : RANGE_PROD, index, args[1],
+                     args[2], ET_bind_index(args[3], index));
+  }
+
+  ET_free(args[0]);
+  ET_free(args[3]);
+  if (ret == NULL)
+  {
+    ET_free(args[1]);
+    ET_free(args[2]);
+  }
+  return ret;
+}
+
+/*
+ * An array literal, [elem, ...]; it may be empty
+ */
+static ExprTree array_literal(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+  TOK_consume(tokens); // Consume '['
+
+  ExprTree *elems = NULL;
+  int num_elems = 0, cap = 0;
+
+  while (TOK_next_type(tokens) != TOK_CLOSE_BRACKET || num_elems > 0)
+  {
+    if (num_elems > 0)
+      TOK_consume(tokens); // Consume ','
+
+    if (num_elems == cap)
+    {
+      cap = cap ? cap * 2 : 8;
+      elems = realloc(elems, cap * sizeof(ExprTree));
+      assert(elems);
+    }
+
+    elems[num_elems] = assignment(tokens, errmsg, errmsg_sz);
+    if (elems[num_elems] == NULL)
+      goto error;
+    num_elems++;
+
+    if (TOK_next_type(tokens) != TOK_COMMA)
+      break;
+  }
+
+  if (TOK_next_type(tokens) != TOK_CLOSE_BRACKET)
+  {
+    snprintf(errmsg, errmsg_sz, "Unexpected token %s", TT_to_str(TOK_next_type(tokens)));
+    goto error;
+  }
+
+  TOK_consume(tokens); // Consume ']'
+  ExprTree ret = ET_array_literal(elems, num_elems);
+  free(elems);
+  return ret;
+
+ error:
+  while (num_elems > 0)
+    ET_free(elems[--num_elems]);
+  free(elems);
+  return NULL;
+}
+
+/*
+ * The rest of a function definition, name(param, ...) = body, once
+ * its left side has been parsed as call; takes ownership of call
+ */
+static ExprTree definition(CList tokens, ExprTree call, char *errmsg, size_t errmsg_sz)
+{
+  if (ET_type(call) == FUNC_CALL || ET_type(call) == RANGE_SUM || ET_type(call) == RANGE_PROD)
+  {
+    snprintf(errmsg, errmsg_sz, "Cannot redefine builtin function %s", ET_call_name(call));
+    ET_free(call);
+    return NULL;
+  }
+
+  for (int i = 0; i < ET_num_args(call); i++)
+  {
+    bool distinct = ET_type(ET_arg(call, i)) == SYMBOL;
+    for (int j = 0; distinct && j < i; j++)
+      distinct = strcmp(ET_symbol_name(ET_arg(call, i)), ET_symbol_name(ET_arg(call, j))) != 0;
+
+    if (!distinct)
+    {
+      snprintf(errmsg, errmsg_sz, "Parameters of %s must be distinct variable names",
+               ET_call_name(call));
+      ET_free(call);
+      return NULL;
+    }
+  }
+
+  TOK_consume(tokens); // Consume '='
+  ExprTree body = assignment(tokens, errmsg, errmsg_sz);
+  if (body == NULL)
+  {
+    ET_free(call);
+    return NULL;
+  }
+  return ET_node(FUNC_DEF, call, body);
+}
+
 ExprTree Parse(CList tokens, char *errmsg, size_t errmsg_sz)
 {
   ExprTree tree = assignment(tokens, errmsg, errmsg_sz);
@@ -195,8 +525,14 @@ ExprTree Parse(CList tokens, char *errmsg, size_t errmsg_sz)
     return NULL; // Error already set in errmsg
   }
 
-  // Debugging: print the next token after parsing the expression
-  printf("Next token after parsing: %s\n", TT_to_str(TOK_next_type(tokens)));
+  // name(param, ...) = body defines a function
+  if (TOK_next_type(tokens) == TOK_EQUAL &&
+      (ET_type(tree) == USER_CALL || ET_type(tree) == FUNC_CALL))
+  {
+    tree = definition(tokens, tree, errmsg, errmsg_sz);
+    if (tree == NULL)
+      return NULL;
+  }
 
   // Ensure we have reached the end of input
   if (TOK_next_type(tokens) != TOK_END)
@@ -16,7 +16,9 @@
 /*
  * Parses a list of tokens into an ExprTree, which is the abstract
  * syntax tree for the ExpressionWhizz grammar.  See the assignment
- * writeup for the BNF.
+ * writeup for the BNF. A line of the form name(param, ...) = body
+ * parses to a FUNC_DEF tree, for FT_define; calls to functions other
+ * than the builtins parse to unbound USER_CALL nodes, for FT_inline.
  *
  * Parameters:
  *   tokens     List of tokens remaining to be parsed
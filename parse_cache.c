@@ -0,0 +1,288 @@
+/*
+ * parse_cache.c
+ *
+ * An LRU cache of parsed ExprTrees, keyed by a hash of the
+ * normalized input text. Entries live in a chained hash table for
+ * lookup and on a doubly-linked list ordered by recency of use.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "parse_cache.h"
+#include "tokenize.h"
+#include "parse.h"
+
+#define DEFAULT_NUM_BUCKETS 64
+#define MAX_LOAD_FACTOR 0.75
+
+struct _pc_entry
+{
+  uint64_t hash;
+  char *key;                     // normalized input
+  ExprTree tree;
+  size_t bytes;                  // memory charged for this entry
+  struct _pc_entry *chain;       // next entry in the same bucket
+  struct _pc_entry *prev;        // more recently used
+  struct _pc_entry *next;        // less recently used
+};
+
+struct _parse_cache
+{
+  struct _pc_entry **bucket;
+  unsigned int num_buckets;
+  struct _pc_entry *mru;         // head of the LRU list
+  struct _pc_entry *lru;         // tail of the LRU list
+  ExprTree uncached;             // last result too large to cache
+  PCStats stats;
+};
+
+/*
+ * 64-bit FNV-1a hash of a string
+ */
+static uint64_t _PC_hash(const char *str)
+{
+  uint64_t x = 14695981039346656037ULL;
+
+  for (const unsigned char *p = (const unsigned char *)str; *p; p++)
+  {
+    x ^= *p;
+    x *= 1099511628211ULL;
+  }
+
+  return x;
+}
+
+/*
+ * Copy input into a new string with leading and trailing whitespace
+ * removed and interior runs of whitespace collapsed to one space
+ */
+static char *_PC_normalize(const char *input)
+{
+  char *out = malloc(strlen(input) + 1);
+  assert(out);
+
+  size_t len = 0;
+  bool pending_space = false;
+
+  for (const char *p = input; *p; p++)
+  {
+    if (isspace((unsigned char)*p))
+    {
+      pending_space = (len > 0);
+      continue;
+    }
+    if (pending_space)
+      out[len++] = ' ';
+    pending_space = false;
+    out[len++] = *p;
+  }
+
+  out[len] = '\0';
+  return out;
+}
+
+static void _PC_unlink_lru(ParseCache cache, struct _pc_entry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    cache->mru = e->next;
+
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    cache->lru = e->prev;
+
+  e->prev = e->next = NULL;
+}
+
+static void _PC_push_mru(ParseCache cache, struct _pc_entry *e)
+{
+  e->prev = NULL;
+  e->next = cache->mru;
+  if (cache->mru)
+    cache->mru->prev = e;
+  cache->mru = e;
+  if (!cache->lru)
+    cache->lru = e;
+}
+
+static void _PC_grow(ParseCache cache)
+{
+  unsigned int new_num = cache->num_buckets * 2;
+  struct _pc_entry **new_bucket = calloc(new_num, sizeof(struct _pc_entry *));
+  if (!new_bucket)
+    return; // Allocation failed, keep the longer chains
+
+  for (unsigned int i = 0; i < cache->num_buckets; i++)
+  {
+    struct _pc_entry *e = cache->bucket[i];
+    while (e)
+    {
+      struct _pc_entry *next = e->chain;
+      unsigned int b = e->hash % new_num;
+      e->chain = new_bucket[b];
+      new_bucket[b] = e;
+      e = next;
+    }
+  }
+
+  free(cache->bucket);
+  cache->bucket = new_bucket;
+  cache->num_buckets = new_num;
+}
+
+/*
+ * Discard the least recently used entry
+ */
+static void _PC_evict(ParseCache cache)
+{
+  struct _pc_entry *e = cache->lru;
+  assert(e);
+
+  struct _pc_entry **pp = &cache->bucket[e->hash % cache->num_buckets];
+  while (*pp != e)
+    pp = &(*pp)->chain;
+  *pp = e->chain;
+
+  _PC_unlink_lru(cache, e);
+  cache->stats.bytes -= e->bytes;
+  cache->stats.entries--;
+  cache->stats.evictions++;
+
+  ET_free(e->tree);
+  free(e->key);
+  free(e);
+}
+
+// Documented in .h file
+ParseCache PC_new(size_t max_bytes)
+{
+  ParseCache cache = malloc(sizeof(struct _parse_cache));
+  assert(cache);
+
+  cache->num_buckets = DEFAULT_NUM_BUCKETS;
+  cache->bucket = calloc(DEFAULT_NUM_BUCKETS, sizeof(struct _pc_entry *));
+  assert(cache->bucket);
+  cache->mru = cache->lru = NULL;
+  cache->uncached = NULL;
+  memset(&cache->stats, 0, sizeof(cache->stats));
+  cache->stats.max_bytes = max_bytes;
+
+  return cache;
+}
+
+// Documented in .h file
+void PC_free(ParseCache cache)
+{
+  if (!cache)
+    return;
+
+  struct _pc_entry *e = cache->mru;
+  while (e)
+  {
+    struct _pc_entry *next = e->next;
+    ET_free(e->tree);
+    free(e->key);
+    free(e);
+    e = next;
+  }
+
+  ET_free(cache->uncached);
+  free(cache->bucket);
+  free(cache);
+}
+
+// Documented in .h file
+ExprTree PC_parse(ParseCache cache, const char *input, char *errmsg, size_t errmsg_sz)
+{
+  assert(cache);
+  assert(input);
+
+  ET_free(cache->uncached);
+  cache->uncached = NULL;
+
+  char *key = _PC_normalize(input);
+  if (*key == '\0')
+  {
+    free(key);
+    return NULL;
+  }
+
+  uint64_t hash = _PC_hash(key);
+  unsigned int b = hash % cache->num_buckets;
+
+  for (struct _pc_entry *e = cache->bucket[b]; e; e = e->chain)
+  {
+    if (e->hash == hash && strcmp(e->key, key) == 0)
+    {
+      cache->stats.hits++;
+      _PC_unlink_lru(cache, e);
+      _PC_push_mru(cache, e);
+      free(key);
+      return e->tree;
+    }
+  }
+
+  cache->stats.misses++;
+
+  CList tokens = TOK_tokenize_input(key, errmsg, errmsg_sz);
+  if (tokens == NULL)
+  {
+    free(key);
+    return NULL;
+  }
+
+  ExprTree tree = Parse(tokens, errmsg, errmsg_sz);
+  CL_free(tokens);
+  if (tree == NULL)
+  {
+    free(key);
+    return NULL;
+  }
+
+  size_t bytes = sizeof(struct _pc_entry) + strlen(key) + 1 + ET_footprint(tree);
+  if (bytes > cache->stats.max_bytes)
+  {
+    free(key);
+    cache->uncached = tree;
+    return tree;
+  }
+
+  while (cache->stats.bytes + bytes > cache->stats.max_bytes)
+    _PC_evict(cache);
+
+  struct _pc_entry *e = malloc(sizeof(struct _pc_entry));
+  assert(e);
+  e->hash = hash;
+  e->key = key;
+  e->tree = tree;
+  e->bytes = bytes;
+
+  if (cache->stats.entries + 1 > MAX_LOAD_FACTOR * cache->num_buckets)
+    _PC_grow(cache);
+
+  b = hash % cache->num_buckets;
+  e->chain = cache->bucket[b];
+  cache->bucket[b] = e;
+  _PC_push_mru(cache, e);
+  cache->stats.entries++;
+  cache->stats.bytes += bytes;
+
+  return tree;
+}
+
+// Documented in .h file
+void PC_stats(ParseCache cache, PCStats *stats)
+{
+  assert(cache);
+  assert(stats);
+  *stats = cache->stats;
+}
@@ -0,0 +1,86 @@
+/*
+ * parse_cache.h
+ *
+ * An LRU cache of parsed ExprTrees, keyed by the normalized input
+ * text. A repeated expression skips tokenizing and parsing and goes
+ * straight to evaluation.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _PARSE_CACHE_H_
+#define _PARSE_CACHE_H_
+
+#include <stddef.h>
+#include "expr_tree.h"
+
+typedef struct _parse_cache *ParseCache;
+
+typedef struct {
+  unsigned long hits;       // lookups answered from the cache
+  unsigned long misses;     // lookups that had to tokenize and parse
+  unsigned long evictions;  // entries discarded to stay under the cap
+  unsigned int entries;     // entries currently cached
+  size_t bytes;             // memory currently charged to the cache
+  size_t max_bytes;         // the configured cap
+} PCStats;
+
+
+/*
+ * Create a new, empty parse cache
+ *
+ * Parameters:
+ *   max_bytes  Cap on the memory used by cached entries (keys plus
+ *              trees). The least recently used entries are evicted to
+ *              stay under it.
+ *
+ * Returns: The new ParseCache. It is up to the caller to call PC_free.
+ */
+ParseCache PC_new(size_t max_bytes);
+
+
+/*
+ * Destroy a cache and every tree it holds
+ *
+ * Parameters:
+ *   cache    The cache; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void PC_free(ParseCache cache);
+
+
+/*
+ * Return the parsed tree for input, tokenizing and parsing it only if
+ * it is not already cached. Inputs are normalized before lookup by
+ * trimming leading and trailing whitespace and collapsing interior
+ * runs of whitespace to a single space, so "1+2" and " 1+2 " share an
+ * entry. Inputs that fail to tokenize or parse are not cached.
+ *
+ * Parameters:
+ *   cache      The cache
+ *   input      The input as entered by the user
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The parsed tree on success, which remains owned by the
+ *   cache and is valid until the next call to PC_parse or PC_free;
+ *   the caller must not modify or free it. Returns NULL for an empty
+ *   input (errmsg untouched), or on a tokenize/parse error (with an
+ *   error message copied into errmsg).
+ */
+ExprTree PC_parse(ParseCache cache, const char *input, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Retrieve the hit/miss/eviction counters and current usage
+ *
+ * Parameters:
+ *   cache    The cache
+ *   stats    Return space for the statistics
+ *
+ * Returns: None
+ */
+void PC_stats(ParseCache cache, PCStats *stats);
+
+#endif /* _PARSE_CACHE_H_ */
@@ -0,0 +1,814 @@
+/*
+ * prepared.c
+ *
+ * Prepared expressions: an ExprTree compiled into a flat postfix
+ * program for a small stack machine, with every variable resolved to
+ * a slot in the caller's value array.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "prepared.h"
+#include "functions.h"
+#include "fastmath.h"
+#include "tokenize.h"
+#include "parse.h"
+
+typedef enum
+{
+  INS_CONST,      // push value
+  INS_LOAD,       // push values[slot]
+  INS_STORE,      // values[slot] = top of stack (left on the stack)
+  INS_ADD,
+  INS_SUB,
+  INS_MUL,
+  INS_DIV,
+  INS_POWER,
+  INS_NEGATE,
+  INS_CALL,       // replace the top fn->num_args entries with fn of them
+  INS_PARAM,      // push argument slot of the current call
+  INS_UCALL,      // replace the top num_params entries with the result
+                  // of running function slot on them
+  INS_LT,         // the comparisons, replacing the top two entries
+  INS_LE,         // with 1 or 0, or NaN if either is NaN
+  INS_GT,
+  INS_GE,
+  INS_EQ,
+  INS_NE,
+  INS_JUMP_FALSE, // pop; continue at instruction slot if it was 0;
+                  // a NaN is kept as the result of the conditional
+  INS_JUMP,       // continue at instruction slot
+  INS_TRUTH,      // replace the top with 1 if nonzero, else 0; NaN stays
+  INS_AND,        // the eager forms of && and ||, for batches, with the
+                  // results of the lazy ones
+  INS_OR,
+  INS_SELECT,     // replace the top three c, a, b with c ? a : b, or NaN
+                  // if c is NaN
+  INS_ROWS        // push the result of island slot, run row by row;
+                  // value is nonzero if the island assigns variables
+} InsType;
+
+typedef struct
+{
+  InsType op;
+  int slot;
+  double value;
+  const Builtin *fn;
+} Instruction;
+
+typedef struct
+{
+  Instruction *code;
+  int code_len;
+  int max_stack;
+} Program;
+
+/*
+ * The expression is the main program. Each user-defined function that
+ * it calls without inlining, directly or not, is compiled once into a
+ * program of its own, which finds its arguments on its caller's stack.
+ *
+ * Conditionals in main jump, so that only one branch runs. The batch
+ * executor runs batch instead, the same expression compiled with both
+ * branches computed and then blended by INS_SELECT, which has no
+ * branches at all. A conditional whose branches cannot safely be
+ * computed for rows that do not take them -- because they assign,
+ * call a user-defined function, divide by anything but a nonzero
+ * constant, or read a variable its condition does not -- becomes an
+ * island: a jumping program of its own, which the batch executor runs
+ * a row at a time.
+ */
+struct _prepared
+{
+  Program main;
+  Program batch;
+  Program *func;
+  const UserFunc **user;     // the function each of func runs
+  int num_funcs;
+  Program *island;
+  int num_islands;
+  int num_vars;
+  char **var_name;
+};
+
+// Compilation state, discarded once the Prepared is built
+struct _compiler
+{
+  struct _prepared *p;
+  Program *prog;             // the program being emitted
+  bool eager;                // compiling batch: select, don't jump
+  int code_cap;
+  int depth;
+};
+
+static void _EW_emit(struct _compiler *c, InsType op, int slot, double value)
+{
+  Program *prog = c->prog;
+
+  if (prog->code_len == c->code_cap)
+  {
+    c->code_cap = c->code_cap ? c->code_cap * 2 : 16;
+    prog->code = realloc(prog->code, c->code_cap * sizeof(Instruction));
+    assert(prog->code);
+  }
+
+  prog->code[prog->code_len++] = (Instruction){op, slot, value, NULL};
+
+  if (op == INS_CONST || op == INS_LOAD || op == INS_PARAM || op == INS_ROWS)
+    c->depth++;
+  else if (op == INS_SELECT)
+    c->depth -= 2;
+  else if (op != INS_STORE && op != INS_NEGATE && op != INS_CALL && op != INS_UCALL &&
+           op != INS_JUMP && op != INS_TRUTH)
+    c->depth--;
+
+  if (c->depth > prog->max_stack)
+    prog->max_stack = c->depth;
+}
+
+static void _EW_emit_call(struct _compiler *c, const Builtin *fn)
+{
+  _EW_emit(c, INS_CALL, 0, 0);
+  c->prog->code[c->prog->code_len - 1].fn = fn;
+  c->depth -= fn->num_args - 1;
+}
+
+static void _EW_emit_ucall(struct _compiler *c, int func, int num_args)
+{
+  _EW_emit(c, INS_UCALL, func, 0);
+  c->depth -= num_args - 1;
+
+  // a call without arguments pushes its result
+  if (c->depth > c->prog->max_stack)
+    c->prog->max_stack = c->depth;
+}
+
+/*
+ * Return the slot for name; every name was given a slot up front by
+ * EW_tree_vars
+ */
+static int _EW_slot(struct _compiler *c, const char *name)
+{
+  int slot = EW_var_slot(c->p, name);
+  assert(slot >= 0);
+  return slot;
+}
+
+/*
+ * Append name to names unless it is already present
+ */
+static void _EW_add_var(char ***names, int *num_vars, const char *name)
+{
+  for (int i = 0; i < *num_vars; i++)
+    if (strcmp((*names)[i], name) == 0)
+      return;
+
+  *names = realloc(*names, (*num_vars + 1) * sizeof(char *));
+  assert(*names);
+  (*names)[*num_vars] = strdup(name);
+  assert((*names)[*num_vars]);
+  (*num_vars)++;
+}
+
+static void _EW_collect_vars(ExprTree tree, char ***names, int *num_vars)
+{
+  if (tree == NULL || ET_type(tree) == VALUE || ET_type(tree) == PARAM ||
+      ET_type(tree) == RANGE_INDEX)
+    return;
+
+  if (ET_type(tree) == SYMBOL)
+    _EW_add_var(names, num_vars, ET_symbol_name(tree));
+  else if (ET_type(tree) == OP_ASSIGN)
+  {
+    _EW_collect_vars(ET_child(tree, 1), names, num_vars);
+    if (ET_type(ET_child(tree, 0)) == SYMBOL)
+      _EW_add_var(names, num_vars, ET_symbol_name(ET_child(tree, 0)));
+  }
+  else if (ET_type(tree) == FUNC_CALL || ET_type(tree) == USER_CALL ||
+           ET_type(tree) == ARRAY_LITERAL || ET_type(tree) == RANGE_SUM ||
+           ET_type(tree) == RANGE_PROD)
+  {
+    for (int i = 0; i < ET_num_args(tree); i++)
+      _EW_collect_vars(ET_arg(tree, i), names, num_vars);
+
+    // the called function's globals, which its program addresses by slot
+    const UserFunc *fn = ET_type(tree) == USER_CALL ? ET_user_function(tree) : NULL;
+    for (int i = 0; fn && i < fn->num_symbols; i++)
+      _EW_add_var(names, num_vars, fn->symbol[i]);
+  }
+  else
+  {
+    _EW_collect_vars(ET_child(tree, 0), names, num_vars);
+    _EW_collect_vars(ET_child(tree, 1), names, num_vars);
+  }
+}
+
+// Documented in .h file
+char **EW_tree_vars(ExprTree tree, int *num_vars)
+{
+  char **names = NULL;
+  *num_vars = 0;
+  _EW_collect_vars(tree, &names, num_vars);
+  return names;
+}
+
+static bool _EW_compile(struct _compiler *c, ExprTree tree, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Does tree read the variable name for every row, not only in the
+ * branch or operand of a conditional or logical operator?
+ */
+static bool _EW_always_reads(ExprTree tree, const char *name)
+{
+  if (tree == NULL)
+    return false;
+
+  switch (ET_type(tree))
+  {
+  case SYMBOL:
+    return strcmp(ET_symbol_name(tree), name) == 0;
+
+  case VALUE:
+  case PARAM:
+  case RANGE_INDEX:
+  case RANGE_SUM:
+  case RANGE_PROD:
+    return false;
+
+  case OP_COND:
+  case OP_AND:
+  case OP_OR:
+    return _EW_always_reads(ET_child(tree, 0), name);
+
+  case FUNC_CALL:
+  case USER_CALL:
+    for (int i = 0; i < ET_num_args(tree); i++)
+      if (_EW_always_reads(ET_arg(tree, i), name))
+        return true;
+    return false;
+
+  case OP_ASSIGN:
+    return _EW_always_reads(ET_child(tree, 1), name);
+
+  default:
+    return _EW_always_reads(ET_child(tree, 0), name) ||
+           _EW_always_reads(ET_child(tree, 1), name);
+  }
+}
+
+/*
+ * Can tree be computed for a row whose value of it will be discarded,
+ * that of the conditional or logical operator whose condition is cond?
+ * It must have no side effects, and report no errors that the row
+ * would not otherwise report. A variable may be undefined in some
+ * rows, so it may be read only if cond reads it too, reporting it
+ * for those rows, whose results are NaN.
+ */
+static bool _EW_select_safe(ExprTree tree, ExprTree cond)
+{
+  if (tree == NULL)
+    return true;
+
+  switch (ET_type(tree))
+  {
+  case VALUE:
+    return true;
+
+  case SYMBOL:
+    return _EW_always_reads(cond, ET_symbol_name(tree));
+
+  case OP_ASSIGN:
+  case USER_CALL:
+  case ARRAY_LITERAL:
+  case RANGE_SUM:
+  case RANGE_PROD:
+  case RANGE_INDEX:
+    return false;
+
+  case OP_DIV:
+    return ET_type(ET_child(tree, 1)) == VALUE && ET_get_value(ET_child(tree, 1)) != 0 &&
+           _EW_select_safe(ET_child(tree, 0), cond);
+
+  case FUNC_CALL:
+    for (int i = 0; i < ET_num_args(tree); i++)
+      if (!_EW_select_safe(ET_arg(tree, i), cond))
+        return false;
+    return true;
+
+  default:
+    return _EW_select_safe(ET_child(tree, 0), cond) && _EW_select_safe(ET_child(tree, 1), cond);
+  }
+}
+
+/*
+ * Point the jump at index from at the next instruction to be emitted
+ */
+static void _EW_patch(struct _compiler *c, int from)
+{
+  c->prog->code[from].slot = c->prog->code_len;
+}
+
+/*
+ * Emit code for an OP_COND, OP_AND or OP_OR that runs only the branch
+ * or operand needed
+ */
+static bool _EW_compile_lazy(struct _compiler *c, ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  ExprNodeType type = ET_type(tree);
+  ExprTree right = ET_child(tree, 1);
+
+  if (!_EW_compile(c, ET_child(tree, 0), errmsg, errmsg_sz))
+    return false;
+  int if_false = c->prog->code_len;
+  _EW_emit(c, INS_JUMP_FALSE, 0, 0);
+  int depth = c->depth;
+
+  // the code for the true case first
+  if (type == OP_OR)
+    _EW_emit(c, INS_CONST, 0, 1);
+  else if (!_EW_compile(c, type == OP_COND ? ET_child(right, 0) : right, errmsg, errmsg_sz))
+    return false;
+  if (type == OP_AND)
+    _EW_emit(c, INS_TRUTH, 0, 0);
+  int to_end = c->prog->code_len;
+  _EW_emit(c, INS_JUMP, 0, 0);
+
+  _EW_patch(c, if_false);
+  c->depth = depth;
+  if (type == OP_AND)
+    _EW_emit(c, INS_CONST, 0, 0);
+  else if (!_EW_compile(c, type == OP_COND ? ET_child(right, 1) : right, errmsg, errmsg_sz))
+    return false;
+  if (type == OP_OR)
+    _EW_emit(c, INS_TRUTH, 0, 0);
+  _EW_patch(c, to_end);
+
+  return true;
+}
+
+/*
+ * Emit batch code for an OP_COND, OP_AND or OP_OR: branch-free if
+ * its branches are safe to compute for every row, and as an island
+ * otherwise
+ */
+static bool _EW_compile_select(struct _compiler *c, ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  ExprNodeType type = ET_type(tree);
+  ExprTree right = ET_child(tree, 1);
+
+  if (_EW_select_safe(right, ET_child(tree, 0)))
+  {
+    if (!_EW_compile(c, ET_child(tree, 0), errmsg, errmsg_sz))
+      return false;
+    if (type == OP_COND)
+    {
+      if (!_EW_compile(c, ET_child(right, 0), errmsg, errmsg_sz) ||
+          !_EW_compile(c, ET_child(right, 1), errmsg, errmsg_sz))
+        return false;
+      _EW_emit(c, INS_SELECT, 0, 0);
+    }
+    else
+    {
+      if (!_EW_compile(c, right, errmsg, errmsg_sz))
+        return false;
+      _EW_emit(c, type == OP_AND ? INS_AND : INS_OR, 0, 0);
+    }
+    return true;
+  }
+
+  struct _prepared *p = c->p;
+  p->island = realloc(p->island, (p->num_islands + 1) * sizeof(Program));
+  assert(p->island);
+  p->island[p->num_islands] = (Program){NULL, 0, 0};
+
+  struct _compiler island = {.p = p, .prog = &p->island[p->num_islands]};
+  if (!_EW_compile_lazy(&island, tree, errmsg, errmsg_sz))
+  {
+    free(island.prog->code);
+    return false;
+  }
+
+  _EW_emit(c, INS_ROWS, p->num_islands++, ET_is_pure(tree) ? 0 : 1);
+  return true;
+}
+
+/*
+ * Emit code for tree, leaving its value on top of the stack
+ *
+ * Returns: true on success, false (with errmsg filled in) on error
+ */
+static bool _EW_compile(struct _compiler *c, ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  if (tree == NULL)
+  {
+    _EW_emit(c, INS_CONST, 0, 0);
+    return true;
+  }
+
+  ExprNodeType type = ET_type(tree);
+
+  switch (type)
+  {
+  case VALUE:
+    _EW_emit(c, INS_CONST, 0, ET_get_value(tree));
+    return true;
+
+  case SYMBOL:
+    _EW_emit(c, INS_LOAD, _EW_slot(c, ET_symbol_name(tree)), 0);
+    return true;
+
+  case OP_ASSIGN:
+    if (ET_type(ET_child(tree, 0)) != SYMBOL)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: Left side of '=' must be a variable");
+      return false;
+    }
+    if (!_EW_compile(c, ET_child(tree, 1), errmsg, errmsg_sz))
+      return false;
+    _EW_emit(c, INS_STORE, _EW_slot(c, ET_symbol_name(ET_child(tree, 0))), 0);
+    return true;
+
+  case UNARY_NEGATE:
+    if (!_EW_compile(c, ET_child(tree, 0), errmsg, errmsg_sz))
+      return false;
+    _EW_emit(c, INS_NEGATE, 0, 0);
+    return true;
+
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_POWER:
+    if (!_EW_compile(c, ET_child(tree, 0), errmsg, errmsg_sz) ||
+        !_EW_compile(c, ET_child(tree, 1), errmsg, errmsg_sz))
+      return false;
+    _EW_emit(c, type == OP_ADD ? INS_ADD :
+                type == OP_SUB ? INS_SUB :
+                type == OP_MUL ? INS_MUL :
+                type == OP_DIV ? INS_DIV : INS_POWER, 0, 0);
+    return true;
+
+  case FUNC_CALL:
+    for (int i = 0; i < ET_num_args(tree); i++)
+      if (!_EW_compile(c, ET_arg(tree, i), errmsg, errmsg_sz))
+        return false;
+    _EW_emit_call(c, ET_call_function(tree));
+    return true;
+
+  case PARAM:
+    _EW_emit(c, INS_PARAM, ET_param_index(tree), 0);
+    return true;
+
+  case OP_LT:
+  case OP_LE:
+  case OP_GT:
+  case OP_GE:
+  case OP_EQ:
+  case OP_NE:
+    if (!_EW_compile(c, ET_child(tree, 0), errmsg, errmsg_sz) ||
+        !_EW_compile(c, ET_child(tree, 1), errmsg, errmsg_sz))
+      return false;
+    _EW_emit(c, INS_LT + (type - OP_LT), 0, 0);
+    return true;
+
+  case OP_AND:
+  case OP_OR:
+  case OP_COND:
+    if (c->eager)
+      return _EW_compile_select(c, tree, errmsg, errmsg_sz);
+    return _EW_compile_lazy(c, tree, errmsg, errmsg_sz);
+
+  case USER_CALL:
+  {
+    const UserFunc *fn = ET_user_function(tree);
+    if (fn == NULL)
+    {
+      snprintf(errmsg, errmsg_sz, "Unknown function: %s", ET_call_name(tree));
+      return false;
+    }
+
+    int func = 0;
+    while (c->p->user[func] != fn)
+      func++;
+
+    for (int i = 0; i < ET_num_args(tree); i++)
+      if (!_EW_compile(c, ET_arg(tree, i), errmsg, errmsg_sz))
+        return false;
+    _EW_emit_ucall(c, func, ET_num_args(tree));
+    return true;
+  }
+
+  case ARRAY_LITERAL:
+    snprintf(errmsg, errmsg_sz, "Error: Arrays are not supported in compiled expressions");
+    return false;
+
+  case RANGE_SUM:
+  case RANGE_PROD:
+  case RANGE_INDEX:
+    snprintf(errmsg, errmsg_sz, "Error: %s over a range is not supported in compiled expressions",
+             type == RANGE_PROD ? "prod" : "sum");
+    return false;
+
+  default:
+    snprintf(errmsg, errmsg_sz, "Error: Invalid operator");
+    return false;
+  }
+}
+
+// Documented in .h file
+Prepared EW_compile(ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  struct _prepared *p = calloc(1, sizeof(struct _prepared));
+  assert(p);
+
+  p->var_name = EW_tree_vars(tree, &p->num_vars);
+  p->user = FT_called(tree, &p->num_funcs);
+  p->func = calloc(p->num_funcs + 1, sizeof(Program));
+  assert(p->func);
+
+  // the functions, then main, then batch
+  for (int f = 0; f <= p->num_funcs + 1; f++)
+  {
+    struct _compiler c = {.p = p};
+    c.prog = (f < p->num_funcs) ? &p->func[f] : (f == p->num_funcs) ? &p->main : &p->batch;
+    c.eager = (f > p->num_funcs);
+
+    if (!_EW_compile(&c, (f < p->num_funcs) ? p->user[f]->body : tree, errmsg, errmsg_sz))
+    {
+      EW_free(p);
+      return NULL;
+    }
+  }
+
+  return p;
+}
+
+// Documented in .h file
+Prepared EW_prepare(const char *text, char *errmsg, size_t errmsg_sz)
+{
+  assert(text);
+
+  CList tokens = TOK_tokenize_input(text, errmsg, errmsg_sz);
+  if (tokens == NULL)
+    return NULL;
+
+  ExprTree tree = Parse(tokens, errmsg, errmsg_sz);
+  CL_free(tokens);
+  if (tree == NULL)
+    return NULL;
+
+  Prepared p = EW_compile(tree, errmsg, errmsg_sz);
+  ET_free(tree);
+  return p;
+}
+
+// Documented in .h file
+void EW_free(Prepared p)
+{
+  if (!p)
+    return;
+
+  for (int i = 0; i < p->num_vars; i++)
+    free(p->var_name[i]);
+  free(p->var_name);
+  for (int f = 0; f < p->num_funcs; f++)
+    free(p->func[f].code);
+  free(p->func);
+  free(p->user);
+  for (int i = 0; i < p->num_islands; i++)
+    free(p->island[i].code);
+  free(p->island);
+  free(p->main.code);
+  free(p->batch.code);
+  free(p);
+}
+
+// Documented in .h file
+int EW_num_vars(Prepared p)
+{
+  assert(p);
+  return p->num_vars;
+}
+
+// Documented in .h file
+const char *EW_var_name(Prepared p, int slot)
+{
+  assert(p);
+  assert(slot >= 0 && slot < p->num_vars);
+  return p->var_name[slot];
+}
+
+// Documented in .h file
+int EW_var_slot(Prepared p, const char *name)
+{
+  assert(p);
+  assert(name);
+
+  for (int i = 0; i < p->num_vars; i++)
+    if (strcmp(p->var_name[i], name) == 0)
+      return i;
+
+  return -1;
+}
+
+// Documented in .h file
+void EW_bind(Prepared p, double *values, int slot, double value)
+{
+  assert(p);
+  assert(slot >= 0 && slot < p->num_vars);
+  values[slot] = value;
+}
+
+// Documented in .h file
+bool EW_bind_name(Prepared p, double *values, const char *name, double value)
+{
+  int slot = EW_var_slot(p, name);
+  if (slot < 0)
+    return false;
+
+  values[slot] = value;
+  return true;
+}
+
+// Documented in .h file
+void EW_bind_dict(Prepared p, double *values, CDict dict)
+{
+  assert(p);
+  assert(dict);
+
+  for (int i = 0; i < p->num_vars; i++)
+    values[i] = CD_retrieve(dict, p->var_name[i]);
+}
+
+// Is either operand NaN, which has no truth value?
+static inline bool _EW_unordered(double a, double b)
+{
+  return isnan(a) || isnan(b);
+}
+
+/*
+ * Run one program of p. Within a function, frame points to its
+ * arguments on the caller's stack, and depth is the call depth.
+ */
+static double _EW_run(Prepared p, const Program *prog, double *values, const double *frame,
+                      int depth, char *errmsg, size_t errmsg_sz)
+{
+  double stack[prog->max_stack > 0 ? prog->max_stack : 1];
+  int sp = -1;
+
+  for (const Instruction *ins = prog->code, *end = prog->code + prog->code_len; ins < end; ins++)
+  {
+    switch (ins->op)
+    {
+    case INS_CONST:
+      stack[++sp] = ins->value;
+      break;
+    case INS_LOAD:
+      stack[++sp] = values[ins->slot];
+      if (isnan(stack[sp]))
+        snprintf(errmsg, errmsg_sz, "Undefined variable: %s", p->var_name[ins->slot]);
+      break;
+    case INS_STORE:
+      values[ins->slot] = stack[sp];
+      break;
+    case INS_ADD:
+      sp--;
+      stack[sp] = stack[sp] + stack[sp + 1];
+      break;
+    case INS_SUB:
+      sp--;
+      stack[sp] = stack[sp] - stack[sp + 1];
+      break;
+    case INS_MUL:
+      sp--;
+      stack[sp] = stack[sp] * stack[sp + 1];
+      break;
+    case INS_DIV:
+      sp--;
+      if (stack[sp + 1] == 0)
+      {
+        snprintf(errmsg, errmsg_sz, "Error: Division by zero");
+        stack[sp] = NAN;
+      }
+      else
+        stack[sp] = stack[sp] / stack[sp + 1];
+      break;
+    case INS_POWER:
+      sp--;
+      stack[sp] = pow(stack[sp], stack[sp + 1]);
+      break;
+    case INS_NEGATE:
+      stack[sp] = -stack[sp];
+      break;
+    case INS_CALL:
+      sp -= ins->fn->num_args - 1;
+      stack[sp] = ins->fn->scalar(&stack[sp]);
+      break;
+    case INS_PARAM:
+      stack[++sp] = frame[ins->slot];
+      break;
+    case INS_UCALL:
+      sp -= p->user[ins->slot]->num_params - 1;
+      if (depth == ET_MAX_CALL_DEPTH)
+      {
+        snprintf(errmsg, errmsg_sz, "Error: Recursion too deep in %s", p->user[ins->slot]->name);
+        stack[sp] = NAN;
+      }
+      else
+        stack[sp] = _EW_run(p, &p->func[ins->slot], values, &stack[sp], depth + 1,
+                            errmsg, errmsg_sz);
+      break;
+    case INS_LT:
+      sp--;
+      stack[sp] = _EW_unordered(stack[sp], stack[sp + 1]) ? NAN : stack[sp] < stack[sp + 1];
+      break;
+    case INS_LE:
+      sp--;
+      stack[sp] = _EW_unordered(stack[sp], stack[sp + 1]) ? NAN : stack[sp] <= stack[sp + 1];
+      break;
+    case INS_GT:
+      sp--;
+      stack[sp] = _EW_unordered(stack[sp], stack[sp + 1]) ? NAN : stack[sp] > stack[sp + 1];
+      break;
+    case INS_GE:
+      sp--;
+      stack[sp] = _EW_unordered(stack[sp], stack[sp + 1]) ? NAN : stack[sp] >= stack[sp + 1];
+      break;
+    case INS_EQ:
+      sp--;
+      stack[sp] = _EW_unordered(stack[sp], stack[sp + 1]) ? NAN : stack[sp] == stack[sp + 1];
+      break;
+    case INS_NE:
+      sp--;
+      stack[sp] = _EW_unordered(stack[sp], stack[sp + 1]) ? NAN : stack[sp] != stack[sp + 1];
+      break;
+    case INS_JUMP_FALSE:
+      // a NaN condition is the result, and neither branch is run: the
+      // instruction before the false branch jumps past it
+      if (isnan(stack[sp]))
+        ins = prog->code + prog->code[ins->slot - 1].slot - 1;
+      else if (stack[sp--] == 0)
+        ins = prog->code + ins->slot - 1;
+      break;
+    case INS_JUMP:
+      ins = prog->code + ins->slot - 1;
+      break;
+    case INS_TRUTH:
+      stack[sp] = isnan(stack[sp]) ? NAN : stack[sp] != 0;
+      break;
+    case INS_AND:
+    case INS_OR:
+    case INS_SELECT:
+    case INS_ROWS:
+      // only in batch programs
+      assert(false);
+      break;
+    }
+  }
+
+  return stack[sp];
+}
+
+// Documented in .h file
+double EW_execute(Prepared p, double *values, char *errmsg, size_t errmsg_sz)
+{
+  assert(p);
+  return _EW_run(p, &p->main, values, NULL, 0, errmsg, errmsg_sz);
+}
+
+// Rows per block in the batch executors; one block of the operand
+// stack stays in L1 for typical expressions
+#define EW_BATCH_BLOCK 256
+
+// The batch executor, instantiated once for double and once for float
+#define EW_REAL double
+#define EW_NAME(name) name##_d
+#define EW_BATCH_FN EW_execute_batch
+#define EW_POW pow
+#define EW_SQRT sqrt
+#define EW_FM_LOG FM_log
+#define EW_FM_EXP FM_exp
+#define EW_FM_POW FM_pow
+#define EW_FM_POW_CORE FM_pow_core
+#define EW_FM_POW_ORDINARY FM_POW_ORDINARY
+#define EW_BI_BATCH batch
+#include "prepared_batch.inc"
+
+#define EW_REAL float
+#define EW_NAME(name) name##_f
+#define EW_BATCH_FN EW_execute_batch_f32
+#define EW_POW powf
+#define EW_SQRT sqrtf
+#define EW_FM_LOG FM_logf
+#define EW_FM_EXP FM_expf
+#define EW_FM_POW FM_powf
+#define EW_FM_POW_CORE FM_powf_core
+#define EW_FM_POW_ORDINARY FM_POWF_ORDINARY
+#define EW_BI_BATCH batch_f32
+#include "prepared_batch.inc"
@@ -0,0 +1,231 @@
+/*
+ * prepared.h
+ *
+ * Prepared expressions: compile an expression once, then execute it
+ * many times against a caller-provided array of variable values. This
+ * is the analogue of an SQL prepared statement. Execution does no
+ * hashing and no allocation; variables are addressed by slot number,
+ * which is fixed when the expression is prepared.
+ *
+ * A typical use:
+ *
+ *   Prepared p = EW_prepare("a * x + b", errmsg, sizeof(errmsg));
+ *   double values[EW_num_vars(p)];
+ *   EW_bind_name(p, values, "a", 2);
+ *   ...
+ *   double result = EW_execute(p, values, errmsg, sizeof(errmsg));
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _PREPARED_H_
+#define _PREPARED_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "cdict.h"
+#include "expr_tree.h"
+
+typedef struct _prepared *Prepared;
+
+
+/*
+ * Tokenize, parse and compile an expression
+ *
+ * Parameters:
+ *   text       The expression
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The compiled expression, or NULL (with an error message
+ *   copied into errmsg) on error. It is up to the caller to call
+ *   EW_free.
+ */
+Prepared EW_prepare(const char *text, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Compile an already-parsed tree
+ *
+ * Parameters:
+ *   tree       The tree; it is not modified, and the caller retains
+ *              ownership of it
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The compiled expression, or NULL (with an error message
+ *   copied into errmsg) on error. It is up to the caller to call
+ *   EW_free.
+ */
+Prepared EW_compile(ExprTree tree, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Return the variables of a tree in slot order, i.e., the order in
+ * which EW_compile numbers them: left to right, with the target of an
+ * assignment after its right-hand side. Other backends that execute
+ * against the same value array use this to agree on slot numbers.
+ *
+ * Parameters:
+ *   tree       The tree
+ *   num_vars   Return space for the number of variables
+ *
+ * Returns: A malloc'd array of *num_vars malloc'd names. It is up to
+ *   the caller to free each name and the array.
+ */
+char **EW_tree_vars(ExprTree tree, int *num_vars);
+
+
+/*
+ * Destroy a prepared expression
+ *
+ * Parameters:
+ *   p        The prepared expression; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void EW_free(Prepared p);
+
+
+/*
+ * Return the number of variables (read or assigned) in the
+ * expression. A values array passed to EW_execute must have at least
+ * this many elements.
+ *
+ * Parameters:
+ *   p        The prepared expression
+ *
+ * Returns: The number of variable slots
+ */
+int EW_num_vars(Prepared p);
+
+
+/*
+ * Return the name of the variable in a given slot
+ *
+ * Parameters:
+ *   p        The prepared expression
+ *   slot     The slot, in the range [0, EW_num_vars(p)-1]
+ *
+ * Returns: The variable name, owned by p
+ */
+const char *EW_var_name(Prepared p, int slot);
+
+
+/*
+ * Find the slot for a named variable
+ *
+ * Parameters:
+ *   p        The prepared expression
+ *   name     The variable name
+ *
+ * Returns: The slot, or -1 if the expression has no such variable
+ */
+int EW_var_slot(Prepared p, const char *name);
+
+
+/*
+ * Bind a value to a slot. Equivalent to values[slot] = value, with a
+ * range check.
+ *
+ * Parameters:
+ *   p        The prepared expression
+ *   values   The caller's value array
+ *   slot     The slot
+ *   value    The value
+ *
+ * Returns: None
+ */
+void EW_bind(Prepared p, double *values, int slot, double value);
+
+
+/*
+ * Bind a value to a named variable
+ *
+ * Parameters:
+ *   p        The prepared expression
+ *   values   The caller's value array
+ *   name     The variable name
+ *   value    The value
+ *
+ * Returns: true if the expression has a variable of that name
+ */
+bool EW_bind_name(Prepared p, double *values, const char *name, double value);
+
+
+/*
+ * Bind every slot from a dictionary. Slots whose variable is not in
+ * dict are set to NaN, i.e., undefined.
+ *
+ * Parameters:
+ *   p        The prepared expression
+ *   values   The caller's value array
+ *   dict     The dictionary to read
+ *
+ * Returns: None
+ */
+void EW_bind_dict(Prepared p, double *values, CDict dict);
+
+
+/*
+ * Execute a prepared expression. Assignments in the expression write
+ * their value back into the corresponding slot of values. Results are
+ * identical to those of ET_evaluate on the same tree, except that
+ * ET_evaluate keeps integer intermediates exact beyond 2^53, where
+ * this double-only machine rounds.
+ *
+ * Parameters:
+ *   p          The prepared expression
+ *   values     The value array, indexed by slot; NaN means undefined
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value on success. If an error is encountered,
+ *   copies an error message into errmsg and returns NaN.
+ */
+double EW_execute(Prepared p, double *values, char *errmsg, size_t errmsg_sz);
+
+
+// Flags for EW_execute_batch
+#define EW_RELAXED_MATH 0x1   // '^' uses FM_pow (see fastmath.h), not pow()
+
+
+/*
+ * Execute a prepared expression over many rows of values at once.
+ * Each instruction is applied to a block of rows in a tight loop that
+ * the compiler can vectorize, rather than to one row at a time.
+ *
+ * Parameters:
+ *   p          The prepared expression
+ *   columns    An array of EW_num_vars(p) pointers, one per slot, each
+ *              to n values; NaN means undefined in that row. Columns
+ *              of assigned variables are written back, row by row.
+ *   n          The number of rows
+ *   results    Return space for n results
+ *   flags      0, or EW_RELAXED_MATH
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: None. Each result is what EW_execute would return for that
+ *   row (to within the bounds in fastmath.h, with EW_RELAXED_MATH).
+ *   Rows with an error have NaN results, and the error message of one
+ *   of them is copied into errmsg.
+ */
+void EW_execute_batch(Prepared p, double **columns, size_t n, double *results,
+                      int flags, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * As EW_execute_batch, but in single precision: columns and results
+ * are float, and all arithmetic is done in float, which processes
+ * twice as many rows per vector instruction. Constants in the
+ * expression are rounded to float. Results differ from those of
+ * EW_execute_batch by float rounding; ew_bench reports by how much
+ * for a set of expressions.
+ *
+ * Parameters and return: as for EW_execute_batch
+ */
+void EW_execute_batch_f32(Prepared p, float **columns, size_t n, float *results,
+                          int flags, char *errmsg, size_t errmsg_sz);
+
+#endif /* _PREPARED_H_ */
@@ -0,0 +1,493 @@
+/*
+ * quad.c
+ *
+ * Adaptive Gauss-Kronrod quadrature of compiled expressions, with the
+ * intervals spread over work-stealing threads
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "quad.h"
+#include "prepared.h"
+
+// The nodes of the 21-point Kronrod rule
+#define QD_NODES 21
+
+// The fewest intervals waiting with the first thread for which the
+// others are started
+#define QD_PARALLEL_MIN 4
+
+// The 21-point Kronrod rule on [-1, 1]: its nodes in ascending order,
+// and their weights; the 10-point Gauss rule is embedded in it, using
+// every other node but the center with the weights QD_WG (0 elsewhere)
+static const double QD_X[QD_NODES] = {
+  -0.995657163025808080735527280689003, -0.973906528517171720077964012084452,
+  -0.930157491355708226001207180059508, -0.865063366688984510732096688423493,
+  -0.780817726586416897063717578345042, -0.679409568299024406234327365114874,
+  -0.562757134668604683339000099272694, -0.433395394129247190799265943165784,
+  -0.294392862701460198131126603103866, -0.148874338981631210884826001129720,
+  0, 0.148874338981631210884826001129720,
+  0.294392862701460198131126603103866, 0.433395394129247190799265943165784,
+  0.562757134668604683339000099272694, 0.679409568299024406234327365114874,
+  0.780817726586416897063717578345042, 0.865063366688984510732096688423493,
+  0.930157491355708226001207180059508, 0.973906528517171720077964012084452,
+  0.995657163025808080735527280689003,
+};
+static const double QD_WK[QD_NODES] = {
+  0.011694638867371874278064396062192, 0.032558162307964727478818972459390,
+  0.054755896574351996031381300244580, 0.075039674810919952767043140916190,
+  0.093125454583697605535065465083366, 0.109387158802297641899210590325805,
+  0.123491976262065851077208034640302, 0.134709217311473325928054001771707,
+  0.142775938577060080797094273138717, 0.147739104901338491374841515972068,
+  0.149445554002916905664936468389821, 0.147739104901338491374841515972068,
+  0.142775938577060080797094273138717, 0.134709217311473325928054001771707,
+  0.123491976262065851077208034640302, 0.109387158802297641899210590325805,
+  0.093125454583697605535065465083366, 0.075039674810919952767043140916190,
+  0.054755896574351996031381300244580, 0.032558162307964727478818972459390,
+  0.011694638867371874278064396062192,
+};
+static const double QD_WG[QD_NODES] = {
+  0, 0.066671344308688137593568809893332,
+  0, 0.149451349150580593145776339657697,
+  0, 0.219086362515982043995534934228163,
+  0, 0.269266719309996355091226921569469,
+  0, 0.295524224714752870173892994651338,
+  0, 0.295524224714752870173892994651338,
+  0, 0.269266719309996355091226921569469,
+  0, 0.219086362515982043995534934228163,
+  0, 0.149451349150580593145776339657697,
+  0, 0.066671344308688137593568809893332,
+  0,
+};
+
+typedef struct
+{
+  double a, b;
+  int depth;
+} QDInterval;
+
+// An accepted interval
+typedef struct
+{
+  double a;
+  double value;
+  double error;
+} QDPiece;
+
+// The intervals waiting with a thread: it takes from the tail, and
+// others steal from the head
+typedef struct
+{
+  pthread_mutex_t lock;
+  QDInterval *item;   // item[head .. tail-1]
+  size_t head, tail, cap;
+} QDDeque;
+
+typedef struct _qd_job QDJob;
+
+typedef struct
+{
+  QDJob *job;
+  int id;
+  pthread_t thread;
+  QDDeque deque;
+  QDPiece *piece;
+  size_t num_pieces, cap_pieces;
+  long evaluations;
+  double *data;       // the batch columns, then the results
+  char errmsg[128];
+} QDWorker;
+
+struct _qd_job
+{
+  Prepared p;
+  const char *var;
+  const double *values;
+  int num_vars;
+  int slot;            // the variable's slot, or -1
+  double tol_density;  // the error allowed per unit width
+  int num_workers;     // the workers taking part, the first of max_workers
+  int max_workers;
+  QDWorker *worker;
+  bool started[QD_MAX_THREADS];
+  long pending;        // intervals not yet accepted; accessed atomically
+  int failed;          // accessed atomically
+};
+
+static void _QD_push(QDDeque *dq, double a, double b, int depth)
+{
+  pthread_mutex_lock(&dq->lock);
+  if (dq->tail == dq->cap)
+  {
+    if (dq->head > 0)
+    {
+      memmove(dq->item, dq->item + dq->head, (dq->tail - dq->head) * sizeof(QDInterval));
+      dq->tail -= dq->head;
+      dq->head = 0;
+    }
+    else
+    {
+      dq->cap = dq->cap ? 2 * dq->cap : 64;
+      dq->item = realloc(dq->item, dq->cap * sizeof(QDInterval));
+      assert(dq->item);
+    }
+  }
+  dq->item[dq->tail++] = (QDInterval){a, b, depth};
+  pthread_mutex_unlock(&dq->lock);
+}
+
+// Take up to max intervals from the tail, or, if steal, up to half of
+// them (at least one) from the head
+static int _QD_take(QDDeque *dq, QDInterval *batch, int max, bool steal)
+{
+  pthread_mutex_lock(&dq->lock);
+  size_t avail = dq->tail - dq->head;
+  size_t m = steal ? (avail + 1) / 2 : avail;
+  if (m > (size_t)max)
+    m = max;
+  if (steal)
+  {
+    memcpy(batch, dq->item + dq->head, m * sizeof(QDInterval));
+    dq->head += m;
+  }
+  else
+  {
+    dq->tail -= m;
+    memcpy(batch, dq->item + dq->tail, m * sizeof(QDInterval));
+  }
+  if (dq->head == dq->tail)
+    dq->head = dq->tail = 0;
+  pthread_mutex_unlock(&dq->lock);
+  return (int)m;
+}
+
+/*
+ * Evaluate the Kronrod and Gauss rules on m intervals, with one batch
+ * execution of the integrand over all of their nodes
+ *
+ * Parameters:
+ *   job, w     The job, and the worker doing it
+ *   batch      The intervals
+ *   m          Their number, at most QD_BATCH
+ *   value      Return space for each interval's integral
+ *   error      Return space for each interval's error estimate
+ *   limited    Return space for whether each error is rounding error,
+ *              which halving the interval would not reduce
+ *
+ * Returns: true on success; false, with an error message in the
+ *   worker's errmsg, if the integrand fails at a node
+ */
+static bool _QD_evaluate(QDJob *job, QDWorker *w, const QDInterval *batch, int m,
+                         double *value, double *error, bool *limited)
+{
+  double *columns[job->num_vars + 1];
+  for (int v = 0; v < job->num_vars; v++)
+    columns[v] = w->data + (size_t)v * QD_BATCH * QD_NODES;
+  double *results = w->data + (size_t)job->num_vars * QD_BATCH * QD_NODES;
+
+  if (job->slot >= 0)
+  {
+    double *x = columns[job->slot];
+    for (int k = 0; k < m; k++)
+    {
+      double center = 0.5 * (batch[k].a + batch[k].b), hw = 0.5 * (batch[k].b - batch[k].a);
+      for (int i = 0; i < QD_NODES; i++)
+        x[k * QD_NODES + i] = center + hw * QD_X[i];
+    }
+  }
+
+  int n = m * QD_NODES;
+  EW_execute_batch(job->p, columns, n, results, 0, w->errmsg, sizeof(w->errmsg));
+  w->evaluations += n;
+  if (w->errmsg[0] != '\0')
+    return false;
+
+  // the sums run across the intervals, node by node, so that they are
+  // independent and can be vectorized
+  double kronrod[QD_BATCH] = {0}, gauss[QD_BATCH] = {0}, abs_k[QD_BATCH] = {0};
+  double asc[QD_BATCH] = {0};
+  for (int i = 0; i < QD_NODES; i++)
+    for (int k = 0; k < m; k++)
+    {
+      double f = results[k * QD_NODES + i];
+      kronrod[k] += QD_WK[i] * f;
+      gauss[k] += QD_WG[i] * f;
+      abs_k[k] += QD_WK[i] * fabs(f);
+    }
+  for (int i = 0; i < QD_NODES; i++)
+    for (int k = 0; k < m; k++)
+      asc[k] += QD_WK[i] * fabs(results[k * QD_NODES + i] - 0.5 * kronrod[k]);
+
+  for (int k = 0; k < m; k++)
+  {
+    if (!isfinite(abs_k[k]))
+    {
+      int i = 0;
+      while (isfinite(results[k * QD_NODES + i]))
+        i++;
+      double x = job->slot >= 0 ? columns[job->slot][k * QD_NODES + i] : batch[k].a;
+      snprintf(w->errmsg, sizeof(w->errmsg),
+               "Error: Integrand is not a finite number at %s = %g", job->var, x);
+      return false;
+    }
+
+    // the error estimate of QUADPACK's qk21, which scales |K - G| by
+    // how smooth the integrand is
+    double hw = 0.5 * (batch[k].b - batch[k].a);
+    double smooth = asc[k] * hw, err = fabs((kronrod[k] - gauss[k]) * hw);
+    if (smooth != 0 && err != 0)
+      err = smooth * fmin(1, (200 * err / smooth) * sqrt(200 * err / smooth));
+    double rounding = 50 * DBL_EPSILON * abs_k[k] * hw;
+    limited[k] = rounding >= err;
+    if (abs_k[k] * hw > DBL_MIN / (50 * DBL_EPSILON))
+      err = fmax(rounding, err);
+
+    value[k] = kronrod[k] * hw;
+    error[k] = err;
+  }
+  return true;
+}
+
+// Accept each interval whose error is within its share of the
+// tolerance, or is rounding error, and halve the others onto the
+// worker's deque
+static void _QD_refine(QDJob *job, QDWorker *w, const QDInterval *batch, int m,
+                       const double *value, const double *error, const bool *limited)
+{
+  long split = 0;
+  for (int k = 0; k < m; k++)
+  {
+    const QDInterval *in = &batch[k];
+    if (error[k] <= job->tol_density * (in->b - in->a) || limited[k] ||
+        in->depth >= QD_MAX_DEPTH)
+    {
+      if (w->num_pieces == w->cap_pieces)
+      {
+        w->cap_pieces = w->cap_pieces ? 2 * w->cap_pieces : 64;
+        w->piece = realloc(w->piece, w->cap_pieces * sizeof(QDPiece));
+        assert(w->piece);
+      }
+      w->piece[w->num_pieces++] = (QDPiece){in->a, value[k], error[k]};
+    }
+    else
+    {
+      double mid = 0.5 * (in->a + in->b);
+      _QD_push(&w->deque, in->a, mid, in->depth + 1);
+      _QD_push(&w->deque, mid, in->b, in->depth + 1);
+      split++;
+    }
+  }
+
+  // the new intervals are counted before the finished ones are taken
+  // off, so that the count is 0 only when all the work is done
+  __atomic_add_fetch(&job->pending, 2 * split, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch(&job->pending, m, __ATOMIC_SEQ_CST);
+}
+
+static void *_QD_worker(void *arg);
+
+// Start the other workers' threads; a thread that cannot be started
+// leaves its share to the others
+static void _QD_start(QDJob *job)
+{
+  job->num_workers = job->max_workers;
+  for (int t = 1; t < job->num_workers; t++)
+    job->started[t] = pthread_create(&job->worker[t].thread, NULL, _QD_worker,
+                                     &job->worker[t]) == 0;
+}
+
+// Take intervals from this worker's deque, or steal them from the
+// others', until every interval is accepted. The first worker, run by
+// the calling thread, starts the others once it has enough intervals
+// waiting to share.
+static void *_QD_worker(void *arg)
+{
+  QDWorker *w = arg;
+  QDJob *job = w->job;
+  QDInterval batch[QD_BATCH];
+  double value[QD_BATCH], error[QD_BATCH];
+  bool limited[QD_BATCH];
+
+  while (__atomic_load_n(&job->pending, __ATOMIC_SEQ_CST) > 0 &&
+         !__atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+  {
+    if (w->id == 0 && job->num_workers < job->max_workers &&
+        w->deque.tail - w->deque.head >= QD_PARALLEL_MIN)
+      _QD_start(job);
+
+    int m = _QD_take(&w->deque, batch, QD_BATCH, false);
+    for (int i = 1; m == 0 && i < job->num_workers; i++)
+      m = _QD_take(&job->worker[(w->id + i) % job->num_workers].deque, batch, QD_BATCH, true);
+    if (m == 0)
+    {
+      sched_yield();
+      continue;
+    }
+
+    if (!_QD_evaluate(job, w, batch, m, value, error, limited))
+    {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    _QD_refine(job, w, batch, m, value, error, limited);
+  }
+  return NULL;
+}
+
+static int _QD_compare_pieces(const void *x, const void *y)
+{
+  double a = ((const QDPiece *)x)->a, b = ((const QDPiece *)y)->a;
+  return (a > b) - (a < b);
+}
+
+static void _QD_depends(const char *symbol, bool assigned, void *cb_data)
+{
+  const char **var = cb_data;
+  if (*var && strcmp(symbol, *var) == 0)
+    *var = NULL;
+}
+
+// Documented in .h file
+double QD_integrate(ExprTree tree, const char *var, CDict vars, double a, double b,
+                    QDStats *stats, char *errmsg, size_t errmsg_sz)
+{
+  QDStats ignored;
+  if (stats == NULL)
+    stats = &ignored;
+  *stats = (QDStats){0};
+
+  if (!isfinite(a) || !isfinite(b))
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Bounds of integrate must be finite");
+    return NAN;
+  }
+  if (a == b)
+    return 0;
+  double sign = 1;
+  if (b < a)
+  {
+    double t = a;
+    a = b;
+    b = t;
+    sign = -1;
+  }
+
+  Prepared p = EW_compile(tree, errmsg, errmsg_sz);
+  if (p == NULL)
+    return NAN;
+
+  // the other variables' values, repeated down their columns; one that
+  // is unknown fails at the first batch
+  const char *missing = var;
+  ET_foreach_symbol(tree, _QD_depends, &missing);
+  QDJob job = {.p = p,
+               .var = var,
+               .num_vars = EW_num_vars(p),
+               .slot = missing ? -1 : EW_var_slot(p, var)};
+  double *values = malloc((job.num_vars + 1) * sizeof(double));
+  assert(values);
+  EW_bind_dict(p, values, vars);
+  job.values = values;
+
+  // asked once, as asking costs more than integrating a smooth function
+  static long cpus = 0;
+  if (cpus == 0)
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  job.max_workers = cpus < 1 ? 1 : cpus > QD_MAX_THREADS ? QD_MAX_THREADS : (int)cpus;
+  QDWorker worker[QD_MAX_THREADS];
+  job.worker = worker;
+  for (int t = 0; t < job.max_workers; t++)
+  {
+    QDWorker *w = &worker[t];
+    *w = (QDWorker){.job = &job, .id = t};
+    pthread_mutex_init(&w->deque.lock, NULL);
+    w->data = malloc(((size_t)job.num_vars + 1) * QD_BATCH * QD_NODES * sizeof(double));
+    assert(w->data);
+    for (int v = 0; v < job.num_vars; v++)
+      for (int i = 0; i < QD_BATCH * QD_NODES; i++)
+        w->data[(size_t)v * QD_BATCH * QD_NODES + i] = values[v];
+  }
+
+  // the first batch splits [a, b] evenly, and its total sets the
+  // tolerance
+  QDInterval batch[QD_BATCH];
+  double value[QD_BATCH], error[QD_BATCH], first = 0;
+  bool limited[QD_BATCH];
+  for (int k = 0; k < QD_BATCH; k++)
+    batch[k] = (QDInterval){a + (b - a) * k / QD_BATCH,
+                            k == QD_BATCH - 1 ? b : a + (b - a) * (k + 1) / QD_BATCH, 0};
+  job.pending = QD_BATCH;
+  job.num_workers = 1;
+  if (_QD_evaluate(&job, &worker[0], batch, QD_BATCH, value, error, limited))
+  {
+    for (int k = 0; k < QD_BATCH; k++)
+      first += value[k];
+    job.tol_density = fmax(QD_REL_TOL * fabs(first), QD_ABS_TOL) / (b - a);
+    _QD_refine(&job, &worker[0], batch, QD_BATCH, value, error, limited);
+    _QD_worker(&worker[0]);
+  }
+  else
+    job.failed = 1;
+
+  // the pieces in order of position, so the sum is the same for any
+  // number of threads
+  size_t num_pieces = 0;
+  for (int t = 0; t < job.num_workers; t++)
+  {
+    if (job.started[t])
+      pthread_join(worker[t].thread, NULL);
+    if (worker[t].errmsg[0] != '\0')
+      snprintf(errmsg, errmsg_sz, "%s", worker[t].errmsg);
+    num_pieces += worker[t].num_pieces;
+    stats->evaluations += worker[t].evaluations;
+    stats->threads += job.started[t] || t == 0;
+  }
+  QDPiece *piece = malloc((num_pieces + 1) * sizeof(QDPiece));
+  assert(piece);
+  num_pieces = 0;
+  for (int t = 0; t < job.num_workers; t++)
+  {
+    memcpy(piece + num_pieces, worker[t].piece, worker[t].num_pieces * sizeof(QDPiece));
+    num_pieces += worker[t].num_pieces;
+  }
+  qsort(piece, num_pieces, sizeof(QDPiece), _QD_compare_pieces);
+
+  // a compensated sum (Neumaier's)
+  double sum = 0, comp = 0;
+  for (size_t i = 0; i < num_pieces; i++)
+  {
+    double x = piece[i].value, t = sum + x;
+    comp += fabs(sum) >= fabs(x) ? (sum - t) + x : (x - t) + sum;
+    sum = t;
+    stats->error += piece[i].error;
+  }
+  stats->intervals = (int)num_pieces;
+
+  free(piece);
+  for (int t = 0; t < job.max_workers; t++)
+  {
+    pthread_mutex_destroy(&worker[t].deque.lock);
+    free(worker[t].deque.item);
+    free(worker[t].piece);
+    free(worker[t].data);
+  }
+  free(values);
+  EW_free(p);
+
+  if (job.failed)
+  {
+    *stats = (QDStats){.error = NAN};
+    return NAN;
+  }
+  return sign * (sum + comp);
+}
@@ -0,0 +1,75 @@
+/*
+ * quad.h
+ *
+ * Numerical integration of an expression over one variable, by
+ * adaptive Gauss-Kronrod quadrature.
+ *
+ * The integrand is compiled once (see prepared.h). Each interval is
+ * estimated with the 21-point Kronrod rule, and its error from the
+ * difference with the embedded 10-point Gauss rule. An interval whose
+ * error is more than its share of the tolerance, in proportion to its
+ * width, is halved, so that intervals are refined independently of one
+ * another. The intervals waiting to be refined are spread over threads,
+ * each of which keeps its own deque of them and steals from the others
+ * when it runs out. A thread takes up to QD_BATCH intervals at a time,
+ * and evaluates all of their nodes in one call of EW_execute_batch.
+ *
+ * The accepted intervals are summed in order, so the result does not
+ * depend on the number of threads.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _QUAD_H_
+#define _QUAD_H_
+
+#include "cdict.h"
+#include "expr_tree.h"
+
+// The intervals a thread evaluates at once, QD_BATCH * 21 nodes
+#define QD_BATCH 16
+
+// The most threads an integration uses
+#define QD_MAX_THREADS 8
+
+// The tolerance: the larger of QD_REL_TOL times the integral and QD_ABS_TOL
+#define QD_REL_TOL 1e-10
+#define QD_ABS_TOL 1e-13
+
+// The most times an interval is halved; one this narrow is accepted
+// whatever its error
+#define QD_MAX_DEPTH 40
+
+typedef struct
+{
+  double error;      // the estimated absolute error of the integral
+  long evaluations;  // the number of times the integrand was evaluated
+  int intervals;     // the number of intervals it was split into
+  int threads;       // the number of threads that took part
+} QDStats;
+
+
+/*
+ * Integrate an expression over one variable
+ *
+ * Parameters:
+ *   tree       The integrand, with calls inlined (see FT_inline); it is
+ *              not modified, and the caller retains ownership of it
+ *   var        The variable of integration
+ *   vars       The values of the other variables
+ *   a, b       The bounds, which must be finite; b may be below a
+ *   stats      Return space for the error estimate and work done, or NULL
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The integral. If the integrand cannot be compiled, or has an
+ *   error or a value that is not finite at one of the nodes, copies an
+ *   error message into errmsg and returns NaN. If the tolerance is not
+ *   met within QD_MAX_DEPTH halvings, as near a singularity, the
+ *   integral is returned with the error estimate in stats.
+ */
+double QD_integrate(ExprTree tree, const char *var, CDict vars, double a, double b,
+                    QDStats *stats, char *errmsg, size_t errmsg_sz);
+
+
+#endif /* _QUAD_H_ */
@@ -0,0 +1,298 @@
+/*
+ * range.c
+ *
+ * The compiled, vectorized and threaded loop of sum() and prod()
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "range.h"
+#include "fastmath.h"
+
+// The indices a thread takes at a time
+#define RG_CHUNK (1 << 14)
+
+// The indices run through the batch evaluator at once
+#define RG_BLOCK 1024
+
+// The independent running sums or products of a chunk
+#define RG_LANES 8
+
+// The largest magnitude below which every integer is a double
+#define RG_EXACT_MAX 9007199254740992.0  // 2^53
+
+// A compensated sum: the true value is sum - comp; while kind is
+// RG_EXACT, it is exact too
+typedef struct
+{
+  double sum;
+  double comp;
+  RGKind kind;
+  int64_t exact;
+} RGPartial;
+
+// A loop, shared by the threads running it
+typedef struct
+{
+  Prepared p;
+  const double *values;
+  int num_vars;
+  int index_slot;
+  int64_t lo;
+  uint64_t n;
+  bool product;
+  size_t num_chunks;
+  size_t next_chunk; // accessed atomically
+  RGPartial *partial; // one per chunk
+} RGLoop;
+
+typedef struct
+{
+  RGLoop *loop;
+  pthread_t thread;
+  char errmsg[128];
+} RGWorker;
+
+/*
+ * Add x into a compensated sum (Neumaier's variant of Kahan's, which
+ * also holds when x is larger than the sum)
+ */
+static void _RG_add_one(RGPartial *acc, double x)
+{
+  double t = acc->sum + x;
+  if (fabs(acc->sum) >= fabs(x))
+    acc->comp -= (acc->sum - t) + x;
+  else
+    acc->comp -= (x - t) + acc->sum;
+  acc->sum = t;
+}
+
+// The value of a compensated sum; an infinite or NaN sum is left alone
+static double _RG_value(RGPartial acc)
+{
+  return isfinite(acc.sum) ? acc.sum - acc.comp : acc.sum;
+}
+
+/*
+ * Add m terms into the lanes' Kahan sums, term i going to lane
+ * i % RG_LANES. The lanes are independent, so the loop is vectorized.
+ */
+FM_CLONES static void _RG_add(double *restrict sum, double *restrict comp,
+                              const double *restrict x, int m)
+{
+  int i = 0;
+  for (; i + RG_LANES <= m; i += RG_LANES)
+    for (int j = 0; j < RG_LANES; j++)
+    {
+      double y = x[i + j] - comp[j];
+      double t = sum[j] + y;
+      comp[j] = (t - sum[j]) - y;
+      sum[j] = t;
+    }
+  for (int j = 0; i < m; i++, j++)
+  {
+    double y = x[i] - comp[j];
+    double t = sum[j] + y;
+    comp[j] = (t - sum[j]) - y;
+    sum[j] = t;
+  }
+}
+
+// Multiply m terms into the lanes' products
+FM_CLONES static void _RG_multiply(double *restrict prod, const double *restrict x, int m)
+{
+  int i = 0;
+  for (; i + RG_LANES <= m; i += RG_LANES)
+    for (int j = 0; j < RG_LANES; j++)
+      prod[j] *= x[i + j];
+  for (int j = 0; i < m; i++, j++)
+    prod[j] *= x[i];
+}
+
+/*
+ * Combine an exact integer into an exact sum or product, which
+ * becomes RG_WIDE if the result overflows
+ */
+static void _RG_combine_exact(RGPartial *acc, int64_t x, bool product)
+{
+  if (product ? __builtin_mul_overflow(acc->exact, x, &acc->exact)
+              : __builtin_add_overflow(acc->exact, x, &acc->exact))
+    acc->kind = RG_WIDE;
+}
+
+/*
+ * Combine m terms exactly into acc, while they are integers; a term
+ * that is not one makes it RG_DOUBLE, after which the rest are skipped
+ */
+static void _RG_exact(RGPartial *acc, const double *x, int m, bool product)
+{
+  for (int i = 0; i < m && acc->kind != RG_DOUBLE; i++)
+  {
+    if (!isfinite(x[i]) || x[i] != trunc(x[i]))
+      acc->kind = RG_DOUBLE;
+    else if (fabs(x[i]) > RG_EXACT_MAX)
+      acc->kind = RG_WIDE;
+    else if (acc->kind == RG_EXACT)
+      _RG_combine_exact(acc, (int64_t)x[i], product);
+  }
+}
+
+/*
+ * Run one chunk of the loop
+ *
+ * Parameters:
+ *   loop       The loop
+ *   chunk      The chunk number
+ *   columns    The batch evaluator's columns, of RG_BLOCK rows, holding
+ *              the values of the variables
+ *   results    Space for RG_BLOCK results
+ *   errmsg     As for RG_reduce
+ *
+ * Returns: The chunk's sum, or its product with a zero comp, and its
+ *   exact sum or product
+ */
+static RGPartial _RG_chunk(RGLoop *loop, size_t chunk, double **columns, double *results,
+                           char *errmsg, size_t errmsg_sz)
+{
+  double lane[RG_LANES], comp[RG_LANES] = {0};
+  for (int j = 0; j < RG_LANES; j++)
+    lane[j] = loop->product ? 1 : 0;
+
+  uint64_t start = (uint64_t)chunk * RG_CHUNK;
+  uint64_t end = loop->n - start < RG_CHUNK ? loop->n : start + RG_CHUNK;
+  double *index = loop->index_slot >= 0 ? columns[loop->index_slot] : NULL;
+  RGPartial acc = {loop->product ? 1 : 0, 0, RG_EXACT, loop->product ? 1 : 0};
+
+  for (uint64_t base = start; base < end; base += RG_BLOCK)
+  {
+    int m = end - base < RG_BLOCK ? (int)(end - base) : RG_BLOCK;
+    if (index)
+      for (int k = 0; k < m; k++)
+        index[k] = (double)(loop->lo + (int64_t)(base + k));
+
+    EW_execute_batch(loop->p, columns, m, results, 0, errmsg, errmsg_sz);
+    if (loop->product)
+      _RG_multiply(lane, results, m);
+    else
+      _RG_add(lane, comp, results, m);
+    _RG_exact(&acc, results, m, loop->product);
+  }
+
+  for (int j = 0; j < RG_LANES; j++)
+  {
+    if (loop->product)
+      acc.sum *= lane[j];
+    else
+    {
+      _RG_add_one(&acc, lane[j]);
+      _RG_add_one(&acc, -comp[j]);
+    }
+  }
+  return acc;
+}
+
+// Take chunks of the loop until there are none left
+static void *_RG_worker(void *arg)
+{
+  RGWorker *worker = arg;
+  RGLoop *loop = worker->loop;
+
+  // a column of RG_BLOCK rows for each slot, filled with its value
+  double *columns[loop->num_vars + 1];
+  double *data = malloc(((size_t)loop->num_vars + 1) * RG_BLOCK * sizeof(double));
+  assert(data);
+  for (int v = 0; v < loop->num_vars; v++)
+  {
+    columns[v] = data + (size_t)v * RG_BLOCK;
+    if (v != loop->index_slot)
+      for (int k = 0; k < RG_BLOCK; k++)
+        columns[v][k] = loop->values[v];
+  }
+  double *results = data + (size_t)loop->num_vars * RG_BLOCK;
+
+  size_t chunk;
+  while ((chunk = __atomic_fetch_add(&loop->next_chunk, 1, __ATOMIC_RELAXED)) < loop->num_chunks)
+    loop->partial[chunk] = _RG_chunk(loop, chunk, columns, results, worker->errmsg,
+                                     sizeof(worker->errmsg));
+
+  free(data);
+  return NULL;
+}
+
+// Documented in .h file
+double RG_reduce(Prepared p, const double *values, int index_slot, int64_t lo, uint64_t n,
+                 bool product, RGKind *kind, int64_t *exact, char *errmsg, size_t errmsg_sz)
+{
+  RGLoop loop = {.p = p,
+                 .values = values,
+                 .num_vars = EW_num_vars(p),
+                 .index_slot = index_slot,
+                 .lo = lo,
+                 .n = n,
+                 .product = product,
+                 .num_chunks = (n + RG_CHUNK - 1) / RG_CHUNK};
+  loop.partial = malloc(loop.num_chunks * sizeof(RGPartial) + 1);
+  assert(loop.partial);
+
+  int num_threads = 1;
+  if (n >= RG_PARALLEL_MIN)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = cpus < 1 ? 1 : cpus > RG_MAX_THREADS ? RG_MAX_THREADS : (int)cpus;
+    if ((size_t)num_threads > loop.num_chunks)
+      num_threads = (int)loop.num_chunks;
+  }
+
+  // this thread is worker 0; a thread that cannot be started leaves
+  // its share to the others
+  RGWorker worker[RG_MAX_THREADS];
+  bool started[RG_MAX_THREADS] = {false};
+  for (int t = 0; t < num_threads; t++)
+  {
+    worker[t].loop = &loop;
+    worker[t].errmsg[0] = '\0';
+    if (t > 0)
+      started[t] = pthread_create(&worker[t].thread, NULL, _RG_worker, &worker[t]) == 0;
+  }
+  _RG_worker(&worker[0]);
+
+  for (int t = 0; t < num_threads; t++)
+  {
+    if (started[t])
+      pthread_join(worker[t].thread, NULL);
+    if (worker[t].errmsg[0] != '\0')
+      snprintf(errmsg, errmsg_sz, "%s", worker[t].errmsg);
+  }
+
+  // the chunks in order, so the result is the same for any number of
+  // threads
+  RGPartial acc = {product ? 1 : 0, 0, RG_EXACT, product ? 1 : 0};
+  for (size_t c = 0; c < loop.num_chunks; c++)
+  {
+    RGPartial *part = &loop.partial[c];
+    if (product)
+      acc.sum *= part->sum;
+    else
+    {
+      _RG_add_one(&acc, part->sum);
+      _RG_add_one(&acc, -part->comp);
+    }
+
+    if (part->kind > acc.kind)
+      acc.kind = part->kind;
+    if (acc.kind == RG_EXACT)
+      _RG_combine_exact(&acc, part->exact, product);
+  }
+
+  free(loop.partial);
+  *kind = acc.kind;
+  *exact = acc.exact;
+  return _RG_value(acc);
+}
@@ -0,0 +1,76 @@
+/*
+ * range.h
+ *
+ * The loop behind sum(i, a, b, expr) and prod(i, a, b, expr) over
+ * large ranges, used by ET_evaluate_number when the body is pure and
+ * compiles (see prepared.h).
+ *
+ * The range is split into chunks of RG_CHUNK indices, which threads
+ * take in turn. Each chunk runs the compiled body over blocks of
+ * indices with EW_execute_batch, and adds the block's terms into
+ * RG_LANES Kahan-compensated running sums, a loop the compiler can
+ * vectorize; products are multiplied the same way, uncompensated. The
+ * chunks' results are then combined in order, so the result does not
+ * depend on the number of threads. While every term is an integer,
+ * the terms are also combined exactly as int64s, so that an integer
+ * result is exact.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _RANGE_H_
+#define _RANGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "prepared.h"
+
+// The fewest indices for which the compiled loop is worth preparing
+#define RG_BATCH_MIN 256
+
+// The fewest indices for which the loop is split among threads
+#define RG_PARALLEL_MIN (1 << 17)
+
+// The most threads the loop uses
+#define RG_MAX_THREADS 8
+
+// How the terms of a loop were combined
+typedef enum
+{
+  RG_EXACT,   // every term is an integer within 2^53, and the result
+              // fits in an int64
+  RG_WIDE,    // every term is an integer, but one is beyond 2^53 or
+              // the result overflows an int64
+  RG_DOUBLE   // a term is not an integer
+} RGKind;
+
+
+/*
+ * Sum, or multiply, the results of a prepared body over a range of
+ * indices
+ *
+ * Parameters:
+ *   p           The prepared body, which must assign nothing
+ *   values      The value of each of its slots, other than the index
+ *   index_slot  The slot of the index, or -1 if the body does not read it
+ *   lo          The first index
+ *   n           The number of indices, lo to lo + n - 1
+ *   product     true to multiply the terms, false to sum them
+ *   kind        Return space for how the terms were combined
+ *   exact       Return space for the result as an int64, set if *kind is
+ *               RG_EXACT
+ *   errmsg      Return space for an error message, filled in in case of error
+ *   errmsg_sz   The size of errmsg
+ *
+ * Returns: The sum or product. If a term has an error, its error
+ *   message is copied into errmsg and the term is NaN. The terms are
+ *   computed in doubles, so when *kind is RG_WIDE an integer term or
+ *   the result may have been rounded, and the caller should combine
+ *   the terms exactly itself.
+ */
+double RG_reduce(Prepared p, const double *values, int index_slot, int64_t lo, uint64_t n,
+                 bool product, RGKind *kind, int64_t *exact, char *errmsg, size_t errmsg_sz);
+
+
+#endif /* _RANGE_H_ */
@@ -0,0 +1,387 @@
+/*
+ * sheet.c
+ *
+ * Spreadsheet-style reactive evaluation built on CDict and ExprTree
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "sheet.h"
+
+#define DEFAULT_SHEET_CAPACITY 8
+
+/*
+ * One cell per variable that has a formula or that some formula
+ * reads. deps are the cells read by formula; dependents are the cells
+ * whose formulas read this one.
+ */
+struct _cell
+{
+  char *name;
+  ExprTree formula;          // NULL if this is a plain value
+  int *deps;
+  int num_deps;
+  int *dependents;
+  int num_dependents;
+  int cap_dependents;
+  bool dirty;
+  unsigned int visit;        // stamp used by the cycle check
+};
+
+struct _sheet
+{
+  CDict vars;                // values, owned by the caller
+  CDict index;               // name -> position in cell[]
+  struct _cell *cell;
+  int num_cells;
+  int capacity;
+  unsigned int num_dirty;
+  unsigned long num_recomputed;
+  unsigned int stamp;
+};
+
+/*
+ * Find the cell for name, optionally creating it
+ *
+ * Parameters:
+ *   sheet    The sheet
+ *   name     The variable name
+ *   create   If true, a missing cell is created
+ *
+ * Returns: The index of the cell, or -1 if it does not exist and
+ *   create is false
+ */
+static int _SH_cell(Sheet sheet, const char *name, bool create)
+{
+  double pos = CD_retrieve(sheet->index, name);
+  if (!isnan(pos))
+    return (int)pos;
+
+  if (!create)
+    return -1;
+
+  if (sheet->num_cells == sheet->capacity)
+  {
+    sheet->capacity *= 2;
+    sheet->cell = realloc(sheet->cell, sheet->capacity * sizeof(struct _cell));
+    assert(sheet->cell);
+  }
+
+  int idx = sheet->num_cells++;
+  struct _cell *c = &sheet->cell[idx];
+  memset(c, 0, sizeof(*c));
+  c->name = strdup(name);
+  assert(c->name);
+  CD_store(sheet->index, name, idx);
+  return idx;
+}
+
+/*
+ * Mark every formula that transitively depends on cell idx as dirty.
+ * A dirty cell's dependents are always dirty already, so the walk
+ * stops as soon as it reaches one.
+ */
+static void _SH_mark_dependents(Sheet sheet, int idx)
+{
+  struct _cell *c = &sheet->cell[idx];
+
+  for (int i = 0; i < c->num_dependents; i++)
+  {
+    struct _cell *d = &sheet->cell[c->dependents[i]];
+    if (d->dirty)
+      continue;
+    d->dirty = true;
+    sheet->num_dirty++;
+    _SH_mark_dependents(sheet, c->dependents[i]);
+  }
+}
+
+/*
+ * Returns true if target can be reached from cell idx by following
+ * formula dependencies
+ */
+static bool _SH_reaches(Sheet sheet, int idx, int target)
+{
+  if (idx == target)
+    return true;
+
+  struct _cell *c = &sheet->cell[idx];
+  if (c->visit == sheet->stamp)
+    return false;
+  c->visit = sheet->stamp;
+
+  for (int i = 0; i < c->num_deps; i++)
+    if (_SH_reaches(sheet, c->deps[i], target))
+      return true;
+
+  return false;
+}
+
+/*
+ * Bring cell idx up to date, recomputing its dependencies first so
+ * that formulas are evaluated in topological order
+ */
+static void _SH_refresh(Sheet sheet, int idx, char *errmsg, size_t errmsg_sz)
+{
+  struct _cell *c = &sheet->cell[idx];
+  if (!c->dirty)
+    return;
+
+  for (int i = 0; i < c->num_deps; i++)
+    _SH_refresh(sheet, c->deps[i], errmsg, errmsg_sz);
+
+  ETNumber value = ET_evaluate_number(c->formula, sheet->vars, errmsg, errmsg_sz);
+  if (value.array)
+    CD_store_array(sheet->vars, c->name, value.array);
+  else
+    CD_store(sheet->vars, c->name, value.is_int ? (double)value.i : value.d);
+  AR_release(value.array);
+  c->dirty = false;
+  sheet->num_dirty--;
+  sheet->num_recomputed++;
+}
+
+/*
+ * Remove cell idx from the dependents list of each of its deps, and
+ * forget its formula
+ */
+static void _SH_unlink(Sheet sheet, int idx)
+{
+  struct _cell *c = &sheet->cell[idx];
+
+  for (int i = 0; i < c->num_deps; i++)
+  {
+    struct _cell *d = &sheet->cell[c->deps[i]];
+    for (int j = 0; j < d->num_dependents; j++)
+    {
+      if (d->dependents[j] == idx)
+      {
+        d->dependents[j] = d->dependents[--d->num_dependents];
+        break;
+      }
+    }
+  }
+
+  free(c->deps);
+  c->deps = NULL;
+  c->num_deps = 0;
+  ET_free(c->formula);
+  c->formula = NULL;
+  if (c->dirty)
+  {
+    c->dirty = false;
+    sheet->num_dirty--;
+  }
+}
+
+// Accumulates the names read by a formula, and notes any assignment
+struct _scan
+{
+  Sheet sheet;
+  int *deps;
+  int num_deps;
+  int cap_deps;
+  bool has_assign;
+  char *errmsg;
+  size_t errmsg_sz;
+};
+
+static void _SH_collect_dep(const char *symbol, bool assigned, void *cb_data)
+{
+  struct _scan *scan = cb_data;
+
+  if (assigned)
+  {
+    scan->has_assign = true;
+    return;
+  }
+
+  int idx = _SH_cell(scan->sheet, symbol, true);
+  for (int i = 0; i < scan->num_deps; i++)
+    if (scan->deps[i] == idx)
+      return;
+
+  if (scan->num_deps == scan->cap_deps)
+  {
+    scan->cap_deps = scan->cap_deps ? scan->cap_deps * 2 : 4;
+    scan->deps = realloc(scan->deps, scan->cap_deps * sizeof(int));
+    assert(scan->deps);
+  }
+  scan->deps[scan->num_deps++] = idx;
+}
+
+static void _SH_refresh_read(const char *symbol, bool assigned, void *cb_data)
+{
+  struct _scan *scan = cb_data;
+  if (assigned)
+    return;
+
+  int idx = _SH_cell(scan->sheet, symbol, false);
+  if (idx >= 0)
+    _SH_refresh(scan->sheet, idx, scan->errmsg, scan->errmsg_sz);
+}
+
+static void _SH_overwritten(const char *symbol, bool assigned, void *cb_data)
+{
+  struct _scan *scan = cb_data;
+  if (!assigned)
+    return;
+
+  int idx = _SH_cell(scan->sheet, symbol, false);
+  if (idx >= 0)
+  {
+    _SH_unlink(scan->sheet, idx);
+    _SH_mark_dependents(scan->sheet, idx);
+  }
+}
+
+// Documented in .h file
+Sheet SH_new(CDict vars)
+{
+  assert(vars);
+
+  Sheet sheet = malloc(sizeof(struct _sheet));
+  assert(sheet);
+
+  sheet->vars = vars;
+  sheet->index = CD_new();
+  sheet->num_cells = 0;
+  sheet->capacity = DEFAULT_SHEET_CAPACITY;
+  sheet->cell = malloc(DEFAULT_SHEET_CAPACITY * sizeof(struct _cell));
+  assert(sheet->cell);
+  sheet->num_dirty = 0;
+  sheet->num_recomputed = 0;
+  sheet->stamp = 0;
+
+  return sheet;
+}
+
+// Documented in .h file
+void SH_free(Sheet sheet)
+{
+  if (!sheet)
+    return;
+
+  for (int i = 0; i < sheet->num_cells; i++)
+  {
+    free(sheet->cell[i].name);
+    ET_free(sheet->cell[i].formula);
+    free(sheet->cell[i].deps);
+    free(sheet->cell[i].dependents);
+  }
+
+  free(sheet->cell);
+  CD_free(sheet->index);
+  free(sheet);
+}
+
+// Documented in .h file
+ETNumber SH_evaluate_number(Sheet sheet, ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  assert(sheet);
+  assert(tree);
+
+  struct _scan scan = {.sheet = sheet, .errmsg = errmsg, .errmsg_sz = errmsg_sz};
+
+  // Make sure everything this tree reads is current
+  ET_foreach_symbol(tree, _SH_refresh_read, &scan);
+
+  if (ET_type(tree) != OP_ASSIGN || ET_type(ET_child(tree, 0)) != SYMBOL)
+  {
+    ETNumber value = ET_evaluate_number(tree, sheet->vars, errmsg, errmsg_sz);
+    ET_foreach_symbol(tree, _SH_overwritten, &scan);
+    return value;
+  }
+
+  const char *name = ET_symbol_name(ET_child(tree, 0));
+  ExprTree rhs = ET_child(tree, 1);
+
+  ET_foreach_symbol(rhs, _SH_collect_dep, &scan);
+  int target = _SH_cell(sheet, name, true);
+
+  bool self_ref = false;
+  for (int i = 0; i < scan.num_deps; i++)
+    if (scan.deps[i] == target)
+      self_ref = true;
+
+  if (!self_ref && !scan.has_assign)
+  {
+    sheet->stamp++;
+    for (int i = 0; i < scan.num_deps; i++)
+    {
+      if (_SH_reaches(sheet, scan.deps[i], target))
+      {
+        snprintf(errmsg, errmsg_sz, "Circular dependency: %s depends on itself", name);
+        free(scan.deps);
+        return (ETNumber){.is_int = false, .d = NAN};
+      }
+    }
+  }
+
+  ETNumber value = ET_evaluate_number(tree, sheet->vars, errmsg, errmsg_sz);
+
+  // inner assignments in the right-hand side become plain values
+  if (scan.has_assign)
+    ET_foreach_symbol(rhs, _SH_overwritten, &scan);
+
+  _SH_unlink(sheet, target);
+
+  if (!self_ref && !scan.has_assign && scan.num_deps > 0)
+  {
+    struct _cell *c = &sheet->cell[target];
+    c->formula = ET_copy(rhs);
+    c->deps = scan.deps;
+    c->num_deps = scan.num_deps;
+    scan.deps = NULL;
+
+    for (int i = 0; i < c->num_deps; i++)
+    {
+      struct _cell *d = &sheet->cell[c->deps[i]];
+      if (d->num_dependents == d->cap_dependents)
+      {
+        d->cap_dependents = d->cap_dependents ? d->cap_dependents * 2 : 4;
+        d->dependents = realloc(d->dependents, d->cap_dependents * sizeof(int));
+        assert(d->dependents);
+      }
+      d->dependents[d->num_dependents++] = target;
+    }
+  }
+
+  free(scan.deps);
+  _SH_mark_dependents(sheet, target);
+
+  return value;
+}
+
+// Documented in .h file
+double SH_evaluate(Sheet sheet, ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  ETNumber value = SH_evaluate_number(sheet, tree, errmsg, errmsg_sz);
+  if (value.array)
+  {
+    AR_release(value.array);
+    snprintf(errmsg, errmsg_sz, "Error: Array value where a number is expected");
+    return NAN;
+  }
+  return value.is_int ? (double)value.i : value.d;
+}
+
+// Documented in .h file
+unsigned int SH_num_dirty(Sheet sheet)
+{
+  assert(sheet);
+  return sheet->num_dirty;
+}
+
+// Documented in .h file
+unsigned long SH_num_recomputed(Sheet sheet)
+{
+  assert(sheet);
+  return sheet->num_recomputed;
+}
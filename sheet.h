@@ -0,0 +1,115 @@
+/*
+ * sheet.h
+ *
+ * Spreadsheet-style reactive evaluation. Assignments made through a
+ * Sheet remember their formula and the variables it reads; changing
+ * a variable marks only the formulas that depend on it (directly or
+ * indirectly) as dirty, and dirty formulas are recomputed, in
+ * dependency order, the next time their value is needed.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _SHEET_H_
+#define _SHEET_H_
+
+#include <stddef.h>
+#include "cdict.h"
+#include "expr_tree.h"
+
+typedef struct _sheet *Sheet;
+
+
+/*
+ * Create a new, empty sheet
+ *
+ * Parameters:
+ *   vars     The dictionary holding variable values. The sheet reads
+ *            and writes values in vars but does not take ownership;
+ *            vars must outlive the sheet.
+ *
+ * Returns: The new Sheet. It is up to the caller to call SH_free.
+ */
+Sheet SH_new(CDict vars);
+
+
+/*
+ * Destroy a sheet and all the formulas it has recorded. The
+ * dictionary passed to SH_new is not freed.
+ *
+ * Parameters:
+ *   sheet    The sheet; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void SH_free(Sheet sheet);
+
+
+/*
+ * Evaluate an ExprTree reactively.
+ *
+ * Any dirty formula the tree reads is brought up to date first. If
+ * the tree is of the form "name = expr", the right-hand side is
+ * recorded as the formula for name, along with the variables it
+ * reads; later changes to any of those variables will mark name as
+ * dirty. A right-hand side that reads name itself (e.g. "x = x + 1")
+ * is evaluated once and stored as a plain value. Any other variable
+ * assigned by the tree becomes a plain value, dropping its formula.
+ *
+ * The tree is not modified and remains owned by the caller.
+ *
+ * Parameters:
+ *   sheet      The sheet
+ *   tree       The tree to evaluate
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value on success. On error (including an
+ *   assignment that would create a circular dependency, or a value
+ *   that is an array, which as for ET_evaluate is still assigned),
+ *   copies an error message into errmsg and returns NaN.
+ */
+double SH_evaluate(Sheet sheet, ExprTree tree, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Evaluate an ExprTree reactively, as SH_evaluate does, but with the
+ * results of ET_evaluate_number: integers stay exact, and a formula or
+ * an expression may have an array as its value.
+ *
+ * Parameters:
+ *   sheet      The sheet
+ *   tree       The tree to evaluate
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value, whose array, if any, it is up to the
+ *   caller to AR_release. On error, copies an error message into
+ *   errmsg and returns a NaN double.
+ */
+ETNumber SH_evaluate_number(Sheet sheet, ExprTree tree, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Return the number of formulas currently marked dirty
+ *
+ * Parameters:
+ *   sheet    The sheet
+ *
+ * Returns: The number of formulas awaiting recomputation
+ */
+unsigned int SH_num_dirty(Sheet sheet);
+
+
+/*
+ * Return the number of formula recomputations performed so far
+ *
+ * Parameters:
+ *   sheet    The sheet
+ *
+ * Returns: The count of formulas that have been re-evaluated because
+ *   they were dirty
+ */
+unsigned long SH_num_recomputed(Sheet sheet);
+
+#endif /* _SHEET_H_ */
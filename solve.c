@@ -0,0 +1,274 @@
+/*
+ * solve.c
+ *
+ * Root finding over compiled expressions: Newton's method, kept
+ * within a bracket by secant and bisection steps
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+
+#include "solve.h"
+#include "prepared.h"
+#include "derive.h"
+
+// An expression of the variable: compiled, or walked if it cannot be
+typedef struct
+{
+  ExprTree tree;    // owned; NULL for a derivative that could not be found
+  Prepared p;       // NULL if walked
+  double *values;
+  int slot;         // the variable's slot, or -1 if it does not appear
+} SVFunction;
+
+struct _solver
+{
+  char *var;
+  CDict vars;
+  SVFunction f;
+  SVFunction df;
+};
+
+static void _SV_depends(const char *symbol, bool assigned, void *cb_data)
+{
+  const char **var = cb_data;
+  if (*var && strcmp(symbol, *var) == 0)
+    *var = NULL;
+}
+
+// Take ownership of tree, and compile it if it can be
+static void _SV_function_init(SVFunction *fn, ExprTree tree, const char *var, CDict vars)
+{
+  char errmsg[128];
+
+  fn->tree = tree;
+  fn->p = tree ? EW_compile(tree, errmsg, sizeof(errmsg)) : NULL;
+  fn->values = NULL;
+  fn->slot = -1;
+  if (fn->p)
+  {
+    fn->values = malloc((EW_num_vars(fn->p) + 1) * sizeof(double));
+    assert(fn->values);
+    EW_bind_dict(fn->p, fn->values, vars);
+    fn->slot = EW_var_slot(fn->p, var);
+  }
+}
+
+static void _SV_function_free(SVFunction *fn)
+{
+  ET_free(fn->tree);
+  EW_free(fn->p);
+  free(fn->values);
+}
+
+// The value of fn at var = x
+static double _SV_call(Solver s, SVFunction *fn, double x, char *errmsg, size_t errmsg_sz)
+{
+  if (fn->p)
+  {
+    if (fn->slot >= 0)
+      EW_bind(fn->p, fn->values, fn->slot, x);
+    return EW_execute(fn->p, fn->values, errmsg, errmsg_sz);
+  }
+  CD_store(s->vars, s->var, x);
+  return ET_evaluate(fn->tree, s->vars, errmsg, errmsg_sz);
+}
+
+/*
+ * Evaluate the expression, and its derivative if there is one (NaN
+ * otherwise), at var = x
+ *
+ * Returns: true on success, false with an error message in errmsg if
+ *   the expression cannot be evaluated there
+ */
+static bool _SV_eval(Solver s, double x, double *fx, double *dfx, char *errmsg,
+                     size_t errmsg_sz)
+{
+  *fx = _SV_call(s, &s->f, x, errmsg, errmsg_sz);
+  if (errmsg[0] != '\0')
+    return false;
+
+  // where the derivative fails, as that of sqrt does at 0, the step
+  // is a secant or bisection one
+  char ignored[128] = "";
+  *dfx = s->df.tree ? _SV_call(s, &s->df, x, ignored, sizeof(ignored)) : NAN;
+  if (ignored[0] != '\0')
+    *dfx = NAN;
+  if (isnan(*fx))
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Expression is not a number at %s = %g", s->var, x);
+    return false;
+  }
+  return true;
+}
+
+// The distance from x within which the root is taken to be found
+static double _SV_tolerance(double x)
+{
+  return 2 * DBL_EPSILON * fabs(x) + DBL_EPSILON * DBL_EPSILON;
+}
+
+// Documented in .h file
+Solver SV_new(ExprTree tree, const char *var, CDict vars, char *errmsg, size_t errmsg_sz)
+{
+  if (ET_has_array_literal(tree))
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Arrays cannot be solved for");
+    return NULL;
+  }
+  const char *missing = var;
+  ET_foreach_symbol(tree, _SV_depends, &missing);
+  if (missing)
+  {
+    snprintf(errmsg, errmsg_sz, "Error: Expression does not depend on %s", var);
+    return NULL;
+  }
+
+  Solver s = malloc(sizeof(struct _solver));
+  assert(s);
+  s->var = strdup(var);
+  s->vars = vars;
+
+  // without a derivative, only secant and bisection steps are taken
+  char ignored[128];
+  _SV_function_init(&s->f, ET_copy(tree), var, vars);
+  _SV_function_init(&s->df, ET_derive(tree, var, ignored, sizeof(ignored)), var, vars);
+  return s;
+}
+
+// Documented in .h file
+void SV_free(Solver s)
+{
+  if (!s)
+    return;
+
+  _SV_function_free(&s->f);
+  _SV_function_free(&s->df);
+  free(s->var);
+  free(s);
+}
+
+// Documented in .h file
+double SV_solve(Solver s, double lo, double hi, int *iterations, char *errmsg,
+                size_t errmsg_sz)
+{
+  double a = lo, b = hi, fa, fb, dfa, dfb;
+
+  *iterations = 0;
+  errmsg[0] = '\0';
+  if (!_SV_eval(s, a, &fa, &dfa, errmsg, errmsg_sz))
+    return NAN;
+  if (fa == 0)
+    return a;
+
+  if (lo != hi)
+  {
+    if (!_SV_eval(s, b, &fb, &dfb, errmsg, errmsg_sz))
+      return NAN;
+    if (fb == 0)
+      return b;
+    if (signbit(fa) == signbit(fb))
+    {
+      snprintf(errmsg, errmsg_sz, "Error: Expression does not change sign between %s = %g and %g",
+               s->var, lo, hi);
+      return NAN;
+    }
+  }
+  else
+  {
+    // Newton's method from a, or the secant method from a and a point
+    // beside it, until the iterates straddle a root
+    double prev = a + 1e-4 * (1 + fabs(a)), fprev = NAN, dfprev;
+    if (!s->df.tree && !_SV_eval(s, prev, &fprev, &dfprev, errmsg, errmsg_sz))
+      return NAN;
+
+    for (;;)
+    {
+      double slope = s->df.tree ? dfa : (fa - fprev) / (a - prev);
+      double step = fa / slope;
+      if (slope == 0 || !isfinite(step))
+      {
+        snprintf(errmsg, errmsg_sz, "Error: No root found from %s = %g; give an interval",
+                 s->var, lo);
+        return NAN;
+      }
+      if (++*iterations > SV_MAX_ITERATIONS)
+      {
+        snprintf(errmsg, errmsg_sz, "Error: No root found in %d iterations", SV_MAX_ITERATIONS);
+        return NAN;
+      }
+
+      prev = a;
+      fprev = fa;
+      dfprev = dfa;
+      a -= step;
+      if (!_SV_eval(s, a, &fa, &dfa, errmsg, errmsg_sz))
+        return NAN;
+      if (fa == 0 || fabs(step) <= _SV_tolerance(a))
+        return a;
+      if (signbit(fa) != signbit(fprev))
+        break;
+    }
+    b = prev;
+    fb = fprev;
+    dfb = dfprev;
+  }
+
+  // the root is between a and b, which were width[0] apart one
+  // iteration ago and width[1] two ago
+  double width[2] = {INFINITY, INFINITY};
+  for (;;)
+  {
+    bool a_best = fabs(fa) <= fabs(fb);
+    double x = a_best ? a : b, fx = a_best ? fa : fb, dfx = a_best ? dfa : dfb;
+    double tol = _SV_tolerance(x);
+    if (fabs(b - a) <= 2 * tol)
+      return x;
+    if (++*iterations > SV_MAX_ITERATIONS)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: No root found in %d iterations", SV_MAX_ITERATIONS);
+      return NAN;
+    }
+
+    // Newton's step from the better end, else the secant through both
+    // ends, else, if the bracket is not shrinking fast enough, bisection
+    double left = fmin(a, b), right = fmax(a, b);
+    double c = x - fx / dfx;
+    if (!(c > left && c < right))
+      c = (a * fb - b * fa) / (fb - fa);
+    if (!(c > left && c < right) || right - left > 0.5 * width[1])
+      c = a + (b - a) / 2;
+    width[1] = width[0];
+    width[0] = right - left;
+
+    // a step shorter than the tolerance is lengthened to it, toward the
+    // other end, so that the bracket closes on a root approached from
+    // one side
+    if (fabs(c - x) < tol)
+      c = x + ((a_best ? b - a : a - b) > 0 ? tol : -tol);
+
+    double fc, dfc;
+    if (!_SV_eval(s, c, &fc, &dfc, errmsg, errmsg_sz))
+      return NAN;
+    if (fc == 0)
+      return c;
+    if (signbit(fc) == signbit(fa))
+    {
+      a = c;
+      fa = fc;
+      dfa = dfc;
+    }
+    else
+    {
+      b = c;
+      fb = fc;
+      dfb = dfc;
+    }
+  }
+}
@@ -0,0 +1,93 @@
+/*
+ * solve.h
+ *
+ * Root finding: the value of one variable at which an expression is 0.
+ * The expression and its symbolic derivative (see derive.h) are
+ * compiled once, so that each iteration costs two compiled executions
+ * rather than a parse and a tree walk.
+ *
+ * A typical use:
+ *
+ *   Solver s = SV_new(tree, "x", dict, errmsg, sizeof(errmsg));
+ *   int iterations;
+ *   double root = SV_solve(s, 0, 2, &iterations, errmsg, sizeof(errmsg));
+ *   SV_free(s);
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _SOLVE_H_
+#define _SOLVE_H_
+
+#include "cdict.h"
+#include "expr_tree.h"
+
+// The most iterations SV_solve makes before giving up
+#define SV_MAX_ITERATIONS 200
+
+typedef struct _solver *Solver;
+
+
+/*
+ * Prepare to solve an expression for one variable
+ *
+ * The other variables take their values in vars as they are now. An
+ * expression that cannot be compiled (one holding a sum or prod) is
+ * walked instead, and one that cannot be differentiated (one making a
+ * recursive call) is solved without its derivative.
+ *
+ * Parameters:
+ *   tree       The expression, with calls inlined (see FT_inline); it
+ *              is not modified, and the caller retains ownership of it
+ *   var        The variable to solve for
+ *   vars       The values of the other variables
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The solver, or NULL (with an error message copied into
+ *   errmsg) if the expression holds an array or does not depend on
+ *   var. It is up to the caller to call SV_free.
+ */
+Solver SV_new(ExprTree tree, const char *var, CDict vars, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Destroy a solver
+ *
+ * Parameters:
+ *   s          The solver, or NULL
+ *
+ * Returns: None
+ */
+void SV_free(Solver s);
+
+
+/*
+ * Find a root of the expression
+ *
+ * Given an interval over which the expression changes sign, the root
+ * is kept bracketed: each iteration takes a Newton step, or a secant
+ * step where Newton's would leave the bracket or the derivative is 0,
+ * or bisects where the bracket has not halved in two iterations, as in
+ * Brent's method. Given lo == hi, Newton's method runs from there
+ * until the iterates straddle a root, and then continues bracketed.
+ * Either way it stops when the bracket or step is within a few units
+ * in the last place of the root (or 1e-31 of a root at 0), or the
+ * value is exactly 0.
+ *
+ * Parameters:
+ *   s           The solver
+ *   lo, hi      The interval, or the starting point if they are equal
+ *   iterations  Return space for the number of iterations made
+ *   errmsg      Return space for an error message, filled in in case of error
+ *   errmsg_sz   The size of errmsg
+ *
+ * Returns: The root. If the expression does not change sign over the
+ *   interval, cannot be evaluated, or the iterations run out, copies an
+ *   error message into errmsg and returns NaN.
+ */
+double SV_solve(Solver s, double lo, double hi, int *iterations, char *errmsg,
+                size_t errmsg_sz);
+
+
+#endif /* _SOLVE_H_ */
@@ -0,0 +1,368 @@
+/*
+ * tier.c
+ *
+ * Tiered execution: tree-walk first, then bytecode, then the fastest
+ * backend, driven by execution counters
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "tier.h"
+#include "prepared.h"
+#include "closure.h"
+#include "functions.h"
+
+/*
+ * A compiled backend for one tier. compile returns an opaque handle,
+ * or NULL with errmsg filled in.
+ */
+typedef struct
+{
+  void *(*compile)(ExprTree tree, char *errmsg, size_t errmsg_sz);
+  double (*execute)(void *code, double *values, char *errmsg, size_t errmsg_sz);
+  void (*free)(void *code);
+} TRBackend;
+
+static void *_TR_bytecode_compile(ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  return EW_compile(tree, errmsg, errmsg_sz);
+}
+
+static double _TR_bytecode_execute(void *code, double *values, char *errmsg, size_t errmsg_sz)
+{
+  return EW_execute(code, values, errmsg, errmsg_sz);
+}
+
+static void _TR_bytecode_free(void *code)
+{
+  EW_free(code);
+}
+
+static void *_TR_closure_compile(ExprTree tree, char *errmsg, size_t errmsg_sz)
+{
+  return CC_compile(tree, errmsg, errmsg_sz);
+}
+
+static double _TR_closure_execute(void *code, double *values, char *errmsg, size_t errmsg_sz)
+{
+  return CC_execute(code, values, errmsg, errmsg_sz);
+}
+
+static void _TR_closure_free(void *code)
+{
+  CC_free(code);
+}
+
+// TIER_TREE is interpreted directly; a tier with no compile function
+// is not available and is skipped over
+static const TRBackend backend[TIER_COUNT] = {
+  [TIER_BYTECODE] = {_TR_bytecode_compile, _TR_bytecode_execute, _TR_bytecode_free},
+  [TIER_FAST] = {_TR_closure_compile, _TR_closure_execute, _TR_closure_free},
+};
+
+struct _tiered_expr
+{
+  ExprTree tree;
+  char **var_name;
+  int num_vars;
+  TRPolicy policy;
+
+  void *code[TIER_COUNT];       // published before tier is advanced
+  bool failed[TIER_COUNT];      // accessed atomically; compilation failed
+  int tier;                     // accessed atomically
+  unsigned long executions;     // accessed atomically
+
+  int promoting;                // accessed atomically; 1 while compiling
+  TRTier target;                // tier being compiled
+  pthread_mutex_t worker_lock;
+  pthread_t worker;
+  bool have_worker;
+};
+
+/*
+ * The TIER_TREE interpreter: ET_evaluate, but reading variables from
+ * the slot array. Within the body of a user-defined function, frame
+ * holds its arguments, and depth is the call depth.
+ */
+static double _TR_walk(TieredExpr te, ExprTree tree, double *values, const double *frame,
+                       int depth, char *errmsg, size_t errmsg_sz)
+{
+  if (tree == NULL)
+    return 0;
+
+  switch (ET_type(tree))
+  {
+  case VALUE:
+    return ET_get_value(tree);
+
+  case SYMBOL:
+  {
+    int slot = TR_var_slot(te, ET_symbol_name(tree));
+    if (isnan(values[slot]))
+      snprintf(errmsg, errmsg_sz, "Undefined variable: %s", ET_symbol_name(tree));
+    return values[slot];
+  }
+
+  case OP_ASSIGN:
+  {
+    double value = _TR_walk(te, ET_child(tree, 1), values, frame, depth, errmsg, errmsg_sz);
+    values[TR_var_slot(te, ET_symbol_name(ET_child(tree, 0)))] = value;
+    return value;
+  }
+
+  case FUNC_CALL:
+  {
+    const Builtin *fn = ET_call_function(tree);
+    double args[BI_MAX_ARGS];
+    for (int i = 0; i < fn->num_args; i++)
+      args[i] = _TR_walk(te, ET_arg(tree, i), values, frame, depth, errmsg, errmsg_sz);
+    return fn->scalar(args);
+  }
+
+  case PARAM:
+    return frame[ET_param_index(tree)];
+
+  case ARRAY_LITERAL:
+    snprintf(errmsg, errmsg_sz, "Error: Arrays are not supported in compiled expressions");
+    return NAN;
+
+  case RANGE_SUM:
+  case RANGE_PROD:
+  case RANGE_INDEX:
+    snprintf(errmsg, errmsg_sz, "Error: %s over a range is not supported in compiled expressions",
+             ET_type(tree) == RANGE_PROD ? "prod" : "sum");
+    return NAN;
+
+  case USER_CALL:
+  {
+    const UserFunc *fn = ET_user_function(tree);
+    if (fn == NULL)
+    {
+      snprintf(errmsg, errmsg_sz, "Unknown function: %s", ET_call_name(tree));
+      return NAN;
+    }
+    if (depth == ET_MAX_CALL_DEPTH)
+    {
+      snprintf(errmsg, errmsg_sz, "Error: Recursion too deep in %s", fn->name);
+      return NAN;
+    }
+
+    double args[ET_MAX_ARGS];
+    for (int i = 0; i < fn->num_params; i++)
+      args[i] = _TR_walk(te, ET_arg(tree, i), values, frame, depth, errmsg, errmsg_sz);
+    return _TR_walk(te, fn->body, values, args, depth + 1, errmsg, errmsg_sz);
+  }
+
+  case OP_COND:
+  {
+    ExprTree branches = ET_child(tree, 1);
+    double cond = _TR_walk(te, ET_child(tree, 0), values, frame, depth, errmsg, errmsg_sz);
+    if (isnan(cond))
+      return NAN;
+    return _TR_walk(te, ET_child(branches, cond != 0 ? 0 : 1), values, frame, depth,
+                    errmsg, errmsg_sz);
+  }
+
+  case OP_AND:
+  case OP_OR:
+  {
+    double left = _TR_walk(te, ET_child(tree, 0), values, frame, depth, errmsg, errmsg_sz);
+    if (isnan(left) || (left != 0) == (ET_type(tree) == OP_OR))
+      return isnan(left) ? NAN : left != 0;
+    double right = _TR_walk(te, ET_child(tree, 1), values, frame, depth, errmsg, errmsg_sz);
+    return isnan(right) ? NAN : right != 0;
+  }
+
+  default:
+  {
+    double left_val = _TR_walk(te, ET_child(tree, 0), values, frame, depth, errmsg, errmsg_sz);
+    double right_val = _TR_walk(te, ET_child(tree, 1), values, frame, depth, errmsg, errmsg_sz);
+    return ET_apply(ET_type(tree), left_val, right_val, errmsg, errmsg_sz);
+  }
+  }
+}
+
+/*
+ * Compile te->target and, on success, move execution onto it
+ */
+static void _TR_promote(TieredExpr te)
+{
+  char errmsg[128];
+  TRTier target = te->target;
+
+  void *code = backend[target].compile(te->tree, errmsg, sizeof(errmsg));
+  if (code == NULL)
+    __atomic_store_n(&te->failed[target], true, __ATOMIC_RELAXED);
+  else
+  {
+    te->code[target] = code;
+    __atomic_store_n(&te->tier, target, __ATOMIC_RELEASE);
+  }
+
+  __atomic_store_n(&te->promoting, 0, __ATOMIC_RELEASE);
+}
+
+static void *_TR_worker(void *arg)
+{
+  _TR_promote(arg);
+  return NULL;
+}
+
+/*
+ * Return the next tier above cur that has a backend and has not
+ * failed to compile, or TIER_COUNT if there is none
+ */
+static TRTier _TR_next_tier(TieredExpr te, TRTier cur)
+{
+  for (int t = cur + 1; t < TIER_COUNT; t++)
+    if (backend[t].compile && !__atomic_load_n(&te->failed[t], __ATOMIC_RELAXED))
+      return t;
+  return TIER_COUNT;
+}
+
+// Documented in .h file
+TieredExpr TR_new(ExprTree tree, const TRPolicy *policy)
+{
+  TieredExpr te = calloc(1, sizeof(struct _tiered_expr));
+  assert(te);
+
+  te->tree = ET_copy(tree);
+  te->tier = TIER_TREE;
+  if (policy)
+    te->policy = *policy;
+  else
+    te->policy = (TRPolicy){TR_DEFAULT_BYTECODE_AFTER, TR_DEFAULT_FAST_AFTER, true};
+
+  pthread_mutex_init(&te->worker_lock, NULL);
+  te->var_name = EW_tree_vars(te->tree, &te->num_vars);
+
+  return te;
+}
+
+// Documented in .h file
+void TR_wait(TieredExpr te)
+{
+  assert(te);
+
+  pthread_mutex_lock(&te->worker_lock);
+  if (te->have_worker)
+  {
+    pthread_join(te->worker, NULL);
+    te->have_worker = false;
+  }
+  pthread_mutex_unlock(&te->worker_lock);
+}
+
+// Documented in .h file
+void TR_free(TieredExpr te)
+{
+  if (!te)
+    return;
+
+  TR_wait(te);
+
+  for (int t = 0; t < TIER_COUNT; t++)
+    if (te->code[t])
+      backend[t].free(te->code[t]);
+
+  for (int i = 0; i < te->num_vars; i++)
+    free(te->var_name[i]);
+  free(te->var_name);
+  ET_free(te->tree);
+  pthread_mutex_destroy(&te->worker_lock);
+  free(te);
+}
+
+// Documented in .h file
+int TR_num_vars(TieredExpr te)
+{
+  assert(te);
+  return te->num_vars;
+}
+
+// Documented in .h file
+int TR_var_slot(TieredExpr te, const char *name)
+{
+  assert(te);
+
+  for (int i = 0; i < te->num_vars; i++)
+    if (strcmp(te->var_name[i], name) == 0)
+      return i;
+
+  return -1;
+}
+
+// Documented in .h file
+const char *TR_var_name(TieredExpr te, int slot)
+{
+  assert(te);
+  assert(slot >= 0 && slot < te->num_vars);
+  return te->var_name[slot];
+}
+
+// Documented in .h file
+double TR_execute(TieredExpr te, double *values, char *errmsg, size_t errmsg_sz)
+{
+  assert(te);
+
+  unsigned long n = __atomic_add_fetch(&te->executions, 1, __ATOMIC_RELAXED);
+  TRTier cur = __atomic_load_n(&te->tier, __ATOMIC_ACQUIRE);
+  TRTier next = _TR_next_tier(te, cur);
+
+  if (next < TIER_COUNT &&
+      n >= (next == TIER_BYTECODE ? te->policy.bytecode_after : te->policy.fast_after))
+  {
+    int idle = 0;
+    if (__atomic_compare_exchange_n(&te->promoting, &idle, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      // re-check under the flag: another thread may have just promoted
+      if (__atomic_load_n(&te->tier, __ATOMIC_ACQUIRE) != cur)
+        __atomic_store_n(&te->promoting, 0, __ATOMIC_RELEASE);
+      else
+      {
+        te->target = next;
+        if (te->policy.background)
+        {
+          pthread_mutex_lock(&te->worker_lock);
+          if (te->have_worker)
+            pthread_join(te->worker, NULL);
+          te->have_worker = (pthread_create(&te->worker, NULL, _TR_worker, te) == 0);
+          pthread_mutex_unlock(&te->worker_lock);
+          if (!te->have_worker)
+            _TR_promote(te);
+        }
+        else
+          _TR_promote(te);
+
+        cur = __atomic_load_n(&te->tier, __ATOMIC_ACQUIRE);
+      }
+    }
+  }
+
+  if (cur == TIER_TREE)
+    return _TR_walk(te, te->tree, values, NULL, 0, errmsg, errmsg_sz);
+
+  return backend[cur].execute(te->code[cur], values, errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+TRTier TR_tier(TieredExpr te)
+{
+  assert(te);
+  return __atomic_load_n(&te->tier, __ATOMIC_ACQUIRE);
+}
+
+// Documented in .h file
+unsigned long TR_executions(TieredExpr te)
+{
+  assert(te);
+  return __atomic_load_n(&te->executions, __ATOMIC_RELAXED);
+}
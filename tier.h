@@ -0,0 +1,132 @@
+/*
+ * tier.h
+ *
+ * Tiered execution of expressions. A TieredExpr starts out being
+ * interpreted by walking its tree, which costs nothing up front. Each
+ * execution is counted; once an expression has run often enough it is
+ * compiled to bytecode (see prepared.h), and later to the fastest
+ * available backend. Promotion can happen on a background thread, so
+ * callers keep executing on the current tier while the next one is
+ * being built.
+ *
+ * Values are passed exactly as for EW_execute: an array indexed by
+ * variable slot. Slot numbering is the same at every tier.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _TIER_H_
+#define _TIER_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "expr_tree.h"
+
+typedef struct _tiered_expr *TieredExpr;
+
+typedef enum {
+  TIER_TREE,        // tree-walking interpreter
+  TIER_BYTECODE,    // stack-machine bytecode
+  TIER_FAST,        // fastest available backend
+  TIER_COUNT
+} TRTier;
+
+typedef struct {
+  unsigned long bytecode_after;   // executions before compiling to bytecode
+  unsigned long fast_after;       // executions before compiling to TIER_FAST
+  bool background;                // compile on a background thread
+} TRPolicy;
+
+#define TR_DEFAULT_BYTECODE_AFTER 8
+#define TR_DEFAULT_FAST_AFTER 1000
+
+
+/*
+ * Create a tiered expression
+ *
+ * Parameters:
+ *   tree     The expression; it is copied, and the caller retains
+ *            ownership of it
+ *   policy   The tiering policy, or NULL for the defaults
+ *            (TR_DEFAULT_BYTECODE_AFTER, TR_DEFAULT_FAST_AFTER,
+ *            promotion in the background)
+ *
+ * Returns: The new TieredExpr, initially at TIER_TREE. It is up to the
+ *   caller to call TR_free.
+ */
+TieredExpr TR_new(ExprTree tree, const TRPolicy *policy);
+
+
+/*
+ * Destroy a tiered expression, waiting for any background compilation
+ * to finish
+ *
+ * Parameters:
+ *   te       The tiered expression; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void TR_free(TieredExpr te);
+
+
+/*
+ * Return the number of variable slots, the slot for a name, and the
+ * name for a slot, with the same meanings as the corresponding
+ * functions in prepared.h
+ */
+int TR_num_vars(TieredExpr te);
+int TR_var_slot(TieredExpr te, const char *name);
+const char *TR_var_name(TieredExpr te, int slot);
+
+
+/*
+ * Execute the expression on its current tier, possibly triggering
+ * promotion to the next one. Safe to call from several threads at
+ * once, provided each uses its own values array.
+ *
+ * Parameters:
+ *   te         The tiered expression
+ *   values     The value array, indexed by slot; NaN means undefined
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The computed value on success. If an error is encountered,
+ *   copies an error message into errmsg and returns NaN.
+ */
+double TR_execute(TieredExpr te, double *values, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Return the tier the expression is currently executing on
+ *
+ * Parameters:
+ *   te       The tiered expression
+ *
+ * Returns: The current tier
+ */
+TRTier TR_tier(TieredExpr te);
+
+
+/*
+ * Return the number of times the expression has been executed
+ *
+ * Parameters:
+ *   te       The tiered expression
+ *
+ * Returns: The execution count
+ */
+unsigned long TR_executions(TieredExpr te);
+
+
+/*
+ * Wait for any background promotion in progress to complete. Mostly
+ * useful for tests and benchmarks that want a deterministic tier.
+ *
+ * Parameters:
+ *   te       The tiered expression
+ *
+ * Returns: None
+ */
+void TR_wait(TieredExpr te);
+
+#endif /* _TIER_H_ */
@@ -9,6 +9,9 @@
 #ifndef _TOKEN_H_
 #define _TOKEN_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum {
   TOK_VALUE,
   TOK_SYMBOL,
@@ -20,17 +23,35 @@ typedef enum {
   TOK_POWER,
   TOK_OPEN_PAREN,
   TOK_CLOSE_PAREN,
+  TOK_COMMA,
+  TOK_LESS,
+  TOK_LESS_EQUAL,
+  TOK_GREATER,
+  TOK_GREATER_EQUAL,
+  TOK_EQUAL_EQUAL,
+  TOK_NOT_EQUAL,
+  TOK_AND,
+  TOK_OR,
+  TOK_QUESTION,
+  TOK_COLON,
+  TOK_OPEN_BRACKET,
+  TOK_CLOSE_BRACKET,
   TOK_END
 } TokenType;
 
 #define SYMBOL_MAX_SIZE 31
 
+// The longest numeric literal
+#define NUMBER_MAX_SIZE 127
+
 typedef struct {
   TokenType type;
   union {
     double value;
     char symbol[SYMBOL_MAX_SIZE+1];
   } t;
+  bool integer;       // TOK_VALUE written as an integer literal
+  int64_t ivalue;     // its exact value, if integer
 } Token;
 
 
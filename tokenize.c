@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "clist.h"
 #include "tokenize.h"
@@ -39,6 +40,32 @@ const char *TT_to_str(TokenType tt)
     return "OPEN_PAREN";
   case TOK_CLOSE_PAREN:
     return "CLOSE_PAREN";
+  case TOK_COMMA:
+    return "COMMA";
+  case TOK_OPEN_BRACKET:
+    return "OPEN_BRACKET";
+  case TOK_CLOSE_BRACKET:
+    return "CLOSE_BRACKET";
+  case TOK_LESS:
+    return "LESS";
+  case TOK_LESS_EQUAL:
+    return "LESS_EQUAL";
+  case TOK_GREATER:
+    return "GREATER";
+  case TOK_GREATER_EQUAL:
+    return "GREATER_EQUAL";
+  case TOK_EQUAL_EQUAL:
+    return "EQUAL_EQUAL";
+  case TOK_NOT_EQUAL:
+    return "NOT_EQUAL";
+  case TOK_AND:
+    return "AND";
+  case TOK_OR:
+    return "OR";
+  case TOK_QUESTION:
+    return "QUESTION";
+  case TOK_COLON:
+    return "COLON";
 
   case TOK_SYMBOL:
     return "SYMBOL"; // New case for symbols
@@ -53,11 +80,17 @@ const char *TT_to_str(TokenType tt)
 
 // Documented in .h file
 CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
+{
+  return TOK_tokenize_span(input, strlen(input), errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+CList TOK_tokenize_span(const char *input, size_t len, char *errmsg, size_t errmsg_sz)
 {
   CList tokens = CL_new();
   size_t i = 0;
 
-  while (input[i] != '\0')
+  while (i < len)
   {
     if (isspace(input[i]))
     {
@@ -65,40 +98,70 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
       continue;
     }
 
-    Token token;
+    Token token = {.integer = false};
 
     // Handle numbers (integers and doubles)
     if (isdigit(input[i]) || input[i] == '.')
     {
+      // The input need not be terminated after its last character, so
+      // the number is converted from a terminated copy
+      char number[NUMBER_MAX_SIZE + 1];
+      size_t avail = len - i < NUMBER_MAX_SIZE ? len - i : NUMBER_MAX_SIZE;
+      memcpy(number, &input[i], avail);
+      number[avail] = '\0';
+
       char *endptr;
-      double value = strtod(&input[i], &endptr);
+      double value = strtod(number, &endptr);
 
-      if (endptr == &input[i])
+      if (endptr == number)
       {
         snprintf(errmsg, errmsg_sz, "Position %zu: Illegal numeric value", i + 1);
         CL_free(tokens);
         return NULL;
       }
 
+      size_t length = endptr - number;
+      if (length == NUMBER_MAX_SIZE)
+      {
+        snprintf(errmsg, errmsg_sz, "Position %zu: Number length exceeds maximum of %d characters",
+                 i + 1, NUMBER_MAX_SIZE);
+        CL_free(tokens);
+        return NULL;
+      }
+
+      // A literal of digits alone is an integer, and is kept exactly
+      // unless it is too large for int64
+      if (strspn(number, "0123456789") == length)
+      {
+        errno = 0;
+        long long ivalue = strtoll(number, NULL, 10);
+        if (errno == 0)
+        {
+          token.integer = true;
+          token.ivalue = ivalue;
+        }
+      }
+
       // Check if we've consumed any characters for the number
-      i += (endptr - &input[i]);
+      i += length;
       token.type = TOK_VALUE;
       token.t.value = value;
     }
-    else if ((isalpha(input[i]) || input[i] == '_') && i < 31)
+    else if (isalpha(input[i]) || input[i] == '_')
     {
       // Handle symbols (variable names)
       size_t start = i;
       size_t length = 0;
-      while ((isalnum(input[i]) || input[i] == '_') && length < 31)
+      while (i < len && (isalnum(input[i]) || input[i] == '_'))
       {
         i++;
         length++;
       }
 
-      if (length > 31)
+      if (length > SYMBOL_MAX_SIZE)
       {
-        snprintf(errmsg, errmsg_sz, "Position %zu: Symbol length exceeds maximum of 31 characters", start + 1);
+        snprintf(errmsg, errmsg_sz, "Position %zu: Symbol length exceeds maximum of %d characters",
+                 start + 1, SYMBOL_MAX_SIZE);
         CL_free(tokens);
         return NULL;
       }
@@ -108,13 +171,42 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
       strncpy(token.t.symbol, &input[start], length);
       token.t.symbol[length] = '\0'; // Null-terminate the symbol
     }
-    else if (input[i] == '=')
+    else if (input[i] == '=' && (i + 1 == len || input[i + 1] != '='))
     {
       // Handle assignment operator '='
       token.type = TOK_EQUAL;
       token.t.value = 0; // '=' does not have a numerical value
       i++;
     }
+    else if (i + 1 < len && input[i] != '\0' &&
+             ((strchr("<>=!", input[i]) && input[i + 1] == '=') ||
+              ((input[i] == '&' || input[i] == '|') && input[i + 1] == input[i])))
+    {
+      // Handle the two-character operators <= >= == != && ||
+      switch (input[i])
+      {
+      case '<':
+        token.type = TOK_LESS_EQUAL;
+        break;
+      case '>':
+        token.type = TOK_GREATER_EQUAL;
+        break;
+      case '=':
+        token.type = TOK_EQUAL_EQUAL;
+        break;
+      case '!':
+        token.type = TOK_NOT_EQUAL;
+        break;
+      case '&':
+        token.type = TOK_AND;
+        break;
+      case '|':
+        token.type = TOK_OR;
+        break;
+      }
+      token.t.value = 0;
+      i += 2;
+    }
     else
     {
       // Handle operators and parentheses
@@ -141,6 +233,27 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
       case ')':
         token.type = TOK_CLOSE_PAREN;
         break;
+      case ',':
+        token.type = TOK_COMMA;
+        break;
+      case '[':
+        token.type = TOK_OPEN_BRACKET;
+        break;
+      case ']':
+        token.type = TOK_CLOSE_BRACKET;
+        break;
+      case '<':
+        token.type = TOK_LESS;
+        break;
+      case '>':
+        token.type = TOK_GREATER;
+        break;
+      case '?':
+        token.type = TOK_QUESTION;
+        break;
+      case ':':
+        token.type = TOK_COLON;
+        break;
       // case '=':
       //   token.type = TOK_EQUAL;
       //   break;
@@ -42,6 +42,23 @@ const char *TT_to_str(TokenType tt);
 CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz);
 
 
+/*
+ * Tokenize a span of text, such as a line of a larger buffer, which
+ * need not be terminated: no character past its end is read. Otherwise
+ * as TOK_tokenize_input.
+ *
+ * Parameters:
+ *   input      The first character of the span
+ *   len        The number of characters in the span
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A newly-created CList, which the caller must CL_free, or
+ *   NULL with an error message copied into errmsg
+ */
+CList TOK_tokenize_span(const char *input, size_t len, char *errmsg, size_t errmsg_sz);
+
+
 
 /*
  * Returns the TokenType for the next token. Does not modify the list